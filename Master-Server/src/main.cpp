@@ -1,253 +1,338 @@
-#include <WiFi.h>
-#include <esp_now.h>
-#include <ESPAsyncWebServer.h>
-#include "pageindex.h" // Include the HTML file
-#include <esp_wifi.h>
-
-// Network Credentials
-const char* wifi_network_ssid = "Man2";  // Wi-Fi network SSID
-const char* wifi_network_password = "manman2024"; // Wi-Fi network password
-
-// Access Point Configuration
-const char* soft_ap_ssid = "ESP32_WS";  // AP SSID
-const char* soft_ap_password = "helloesp32WS"; // AP Password
-IPAddress local_ip(192, 168, 1, 1);
-IPAddress gateway(192, 168, 1, 1);
-IPAddress subnet(255, 255, 255, 0);
-
-// ESP-NOW Communication
-uint8_t soundSensorSlaveMAC[] = {0xd8, 0xbc, 0x38, 0xfb, 0xa5, 0x7c}; // sound sensor slave MAC
-uint8_t motionSensorSlaveMAC[] = {0xc0, 0x5d, 0x89, 0xb1, 0x93, 0xa0}; // motion sensor slave MAC
-uint8_t smokeSensorSlaveMAC[] = {0xfc, 0xe8, 0xc0, 0x74, 0x50, 0x14}; // smoke sensor slave MAC
-uint8_t lightSensorSlaveMAC[] = {0xa8, 0x42, 0xe3, 0xc8, 0x36, 0x88}; // light sensor slave MAC
-
-// Create AsyncWebServer object on port 80
-AsyncWebServer server(80);
-
-// Data Structure for ESP-NOW
-typedef struct struct_message {
-  int sensorValue;
-  char sensorStatus[20];
-} struct_message;
-
-typedef struct struct_message_light {
-  int lightLevel;
-  char brightnessPercentage[10];
-} struct_message_light;
-
-struct_message receivedDataSound;  // Data received from sound sensor
-struct_message receivedDataMotion; // Data received from motion sensor
-struct_message receivedDataSmoke;  // Data received from smoke sensor
-struct_message_light receivedDataLight; // Data received from light sensor
-
-// Get Wi-Fi channel for the specified SSID
-int32_t get_wifi_channel(const char* ssid) {
-  int n = WiFi.scanNetworks();
-  for (int i = 0; i < n; ++i) {
-    if (String(ssid) == WiFi.SSID(i)) {
-      return WiFi.channel(i);
-    }
-  }
-  return 0;
-}
-
-// Set Wi-Fi channel for ESP32
-void scan_and_set_wifi_channel() {
-  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
-  int master_channel = get_wifi_channel(wifi_network_ssid);
-
-  if (master_channel == 0) {
-    Serial.println("SSID not found!");
-  } else {
-    Serial.printf("SSID found. Channel: %d\n", master_channel);
-    if (WiFi.channel() != master_channel) {
-      esp_wifi_set_promiscuous(true);
-      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
-      esp_wifi_set_promiscuous(false);
-    }
-  }
-  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
-}
-
-// Initialize ESP-NOW and add peers
-void initESPNow() {
-  if (esp_now_init() != ESP_OK) {
-    Serial.println("Error initializing ESP-NOW");
-    return;
-  }
-
-  // Add Sound Sensor Slave as a peer
-  esp_now_peer_info_t peerInfo;
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, soundSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Sound Sensor Slave");
-  } else {
-    Serial.println("Sound Sensor Slave added successfully");
-  }
-
-  // Add Motion Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, motionSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Motion Sensor Slave");
-  } else {
-    Serial.println("Motion Sensor Slave added successfully");
-  }
-
-  // Add Smoke Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, smokeSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Smoke Sensor Slave");
-  } else {
-    Serial.println("Smoke Sensor Slave added successfully");
-  }
-
-  // Add Light Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, lightSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Light Sensor Slave");
-  } else {
-    Serial.println("Light Sensor Slave added successfully");
-  }
-}
-
-// Handle Received Data
-void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len) {
-  Serial.print("Data received from: ");
-  for (int i = 0; i < 6; i++) {
-    Serial.printf("%02X", mac[i]);
-    if (i < 5) Serial.print(":");
-  }
-  Serial.println();
-
-  // Check the length of the received data
-  if (memcmp(mac, soundSensorSlaveMAC, 6) == 0) {
-    if (len == sizeof(struct_message)) {
-      memcpy(&receivedDataSound, incomingData, sizeof(receivedDataSound));
-
-      // Add the logic for loudness check
-      if (receivedDataSound.sensorValue > 1) {  // Set threshold value for loudness
-        strcpy(receivedDataSound.sensorStatus, "Loud");
-      } else {
-        strcpy(receivedDataSound.sensorStatus, "Normal");
-      }
-
-      Serial.printf("Sound Level: %d, Sound Status: %s\n", receivedDataSound.sensorValue, receivedDataSound.sensorStatus);
-    }
-  } else if (memcmp(mac, motionSensorSlaveMAC, 6) == 0) {
-    if (len == sizeof(struct_message)) {
-      memcpy(&receivedDataMotion, incomingData, sizeof(receivedDataMotion));
-      Serial.printf("Motion Level: %d, Motion Status: %s\n", receivedDataMotion.sensorValue, receivedDataMotion.sensorStatus);
-    }
-  } else if (memcmp(mac, smokeSensorSlaveMAC, 6) == 0) {
-    if (len == sizeof(struct_message)) {
-      memcpy(&receivedDataSmoke, incomingData, sizeof(receivedDataSmoke));
-      Serial.printf("Smoke Level: %d, Smoke Status: %s\n", receivedDataSmoke.sensorValue, receivedDataSmoke.sensorStatus);
-    }
-  } else if (memcmp(mac, lightSensorSlaveMAC, 6) == 0) {
-    if (len == sizeof(struct_message_light)) {
-      memcpy(&receivedDataLight, incomingData, sizeof(receivedDataLight));
-      Serial.printf("Light Level: %d, Brightness Percentage: %s\n", receivedDataLight.lightLevel, receivedDataLight.brightnessPercentage);
-    }
-  } else {
-    Serial.println("Received data length mismatch.");
-  }
-}
-
-
-// Serve the webpage with sensor data
-void serveWebpage(AsyncWebServerRequest *request) {
-  String html = PAGEINDEX;  // HTML page from external file
-
-  html.replace("%STATUS%", String(receivedDataSound.sensorStatus));
-  html.replace("%MOTION%", String(receivedDataMotion.sensorStatus));
-  html.replace("%SMOKE%", String(receivedDataSmoke.sensorStatus));
-  html.replace("%LIGHT%", String(receivedDataLight.brightnessPercentage));
-
-  request->send(200, "text/html", html);
-}
-
-// Serve the light sensor data as JSON
-void serveLightData(AsyncWebServerRequest *request) {
-  String json = "{\"lightLevel\": " + String(receivedDataLight.lightLevel) + ", ";
-  json += "\"brightnessPercentage\": \"" + String(receivedDataLight.brightnessPercentage) + "\"}";
-  request->send(200, "application/json", json);
-}
-
-// Setup Function
-void setup() {
-  Serial.begin(115200);
-
-  // Set Wi-Fi mode to AP+STA
-  WiFi.mode(WIFI_AP_STA);
-  WiFi.setSleep(WIFI_PS_NONE);
-  WiFi.channel(1);  // Set initial channel
-
-  // Configure Access Point
-  WiFi.softAP(soft_ap_ssid, soft_ap_password);
-  delay(1000);
-  WiFi.softAPConfig(local_ip, gateway, subnet);
-  Serial.print("AP IP Address: ");
-  Serial.println(WiFi.softAPIP());
-
-  // Connect to Wi-Fi network (STA)
-  WiFi.begin(wifi_network_ssid, wifi_network_password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println("Connected to Wi-Fi!");
-
-  scan_and_set_wifi_channel();
-  initESPNow();
-
-  // Register the callback for receiving data
-  esp_now_register_recv_cb(OnDataRecv);
-
-  // Serve the webpage with sensor data
-  server.on("/", HTTP_GET, serveWebpage);
-
-  // Serve the light sensor data as JSON
-  server.on("/status/light", HTTP_GET, serveLightData);
-
-  // Serve the sound sensor data
-  server.on("/status/sound", HTTP_GET, [] (AsyncWebServerRequest *request) {
-    String response = String(receivedDataSound.sensorStatus);
-    request->send(200, "text/plain", response);
-  });
-
-  // Serve the motion sensor data
-  server.on("/status/motion", HTTP_GET, [] (AsyncWebServerRequest *request) {
-    String response = String(receivedDataMotion.sensorStatus);
-    request->send(200, "text/plain", response);
-  });
-
-  // Serve the smoke sensor data
-  server.on("/status/smoke", HTTP_GET, [] (AsyncWebServerRequest *request) {
-    String response = String(receivedDataSmoke.sensorStatus);
-    request->send(200, "text/plain", response);
-  });
-
-  // Start the server
-  server.begin();
-}
-
-// Loop Function
-void loop() {
-  // Add any repeated tasks here if needed
-}
+#include <WiFi.h>
+#include <esp_now.h>
+#include <ESPAsyncWebServer.h>
+#include "pageindex.h" // Include the HTML file
+#include <esp_wifi.h>
+#include <BootProfiler.h>
+#include <BinLog.h>
+#include <Preferences.h>
+#include <Pairing.h>
+#include <SensorFrame.h>
+#include <Dispatch.h>
+#include <freertos/FreeRTOS.h>
+
+// Network Credentials
+const char* wifi_network_ssid = "Man2";  // Wi-Fi network SSID
+const char* wifi_network_password = "manman2024"; // Wi-Fi network password
+
+// Access Point Configuration
+const char* soft_ap_ssid = "ESP32_WS";  // AP SSID
+const char* soft_ap_password = "helloesp32WS"; // AP Password
+IPAddress local_ip(192, 168, 1, 1);
+IPAddress gateway(192, 168, 1, 1);
+IPAddress subnet(255, 255, 255, 0);
+
+// ESP-NOW Communication
+// The sensors pair with the Server and address their readings to it, so
+// the Master-Server never sends over ESP-NOW: it learns which
+// sensor is which from the join requests and accepts it hears, and reads
+// the sensors' frames to the Server off the air in promiscuous mode.
+#define MASTER_SENSORS_MAX 16 // Sensors whose frames the Master-Server decodes
+#define ESPNOW_BODY_OFFSET 39 // Start of the ESP-NOW payload in a vendor-specific action frame
+
+// Create AsyncWebServer object on port 80
+AsyncWebServer server(80);
+
+typedef struct heard_sensor {
+  uint8_t mac[6];
+  uint8_t sensorType;
+} heard_sensor;
+
+// Written by the Wi-Fi task, read by loop() and the web handlers under sensorLock
+heard_sensor heardSensors[MASTER_SENSORS_MAX];
+size_t heardCount = 0;
+bool heardChanged = false; // Not yet saved to flash
+sensor_reading latestReadings[SENSOR_LIGHT + 1]; // Last reading of each sensor type
+portMUX_TYPE sensorLock = portMUX_INITIALIZER_UNLOCKED;
+
+// The last reading of a sensor type, copied out from under the Wi-Fi task
+sensor_reading latestReading(uint8_t sensorType) {
+  portENTER_CRITICAL(&sensorLock);
+  sensor_reading reading = latestReadings[sensorType];
+  portEXIT_CRITICAL(&sensorLock);
+  return reading;
+}
+
+// Get Wi-Fi channel for the specified SSID
+int32_t get_wifi_channel(const char* ssid) {
+  int n = WiFi.scanNetworks();
+  for (int i = 0; i < n; ++i) {
+    if (String(ssid) == WiFi.SSID(i)) {
+      return WiFi.channel(i);
+    }
+  }
+  return 0;
+}
+
+// Set Wi-Fi channel for ESP32
+void scan_and_set_wifi_channel() {
+  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
+  int master_channel = get_wifi_channel(wifi_network_ssid);
+
+  if (master_channel == 0) {
+    Serial.println("SSID not found!");
+  } else {
+    Serial.printf("SSID found. Channel: %d\n", master_channel);
+    if (WiFi.channel() != master_channel) {
+      esp_wifi_set_promiscuous(true);
+      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
+      esp_wifi_set_promiscuous(false);
+    }
+  }
+  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
+}
+
+// Remember a sensor's type, from its join request or the Server's accept (Wi-Fi task)
+void learnSensor(const uint8_t *mac, uint8_t sensorType) {
+  if (sensorType < SENSOR_SOUND || sensorType > SENSOR_LIGHT) {
+    return;
+  }
+  portENTER_CRITICAL(&sensorLock);
+  size_t i = 0;
+  while (i < heardCount && memcmp(heardSensors[i].mac, mac, 6) != 0) {
+    i++;
+  }
+  if (i == heardCount && heardCount < MASTER_SENSORS_MAX) {
+    memcpy(heardSensors[i].mac, mac, 6);
+    heardSensors[i].sensorType = SENSOR_UNKNOWN;
+    heardCount++;
+  }
+  if (i < heardCount && heardSensors[i].sensorType != sensorType) {
+    heardSensors[i].sensorType = sensorType;
+    heardChanged = true;
+  }
+  portEXIT_CRITICAL(&sensorLock);
+}
+
+uint8_t heardSensorType(const uint8_t *mac) {
+  uint8_t sensorType = SENSOR_UNKNOWN;
+  portENTER_CRITICAL(&sensorLock);
+  for (size_t i = 0; i < heardCount; i++) {
+    if (memcmp(heardSensors[i].mac, mac, 6) == 0) {
+      sensorType = heardSensors[i].sensorType;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&sensorLock);
+  return sensorType;
+}
+
+// Sensors heard before the last reboot, which do not ask to join again until they reboot
+void loadHeardSensors() {
+  Preferences prefs;
+  prefs.begin("master", true);
+  size_t len = prefs.getBytes("sensors", heardSensors, sizeof(heardSensors));
+  prefs.end();
+  heardCount = len / sizeof(heard_sensor);
+  Serial.printf("Restored %u sensors\n", (unsigned)heardCount);
+}
+
+void saveHeardSensors() {
+  heard_sensor sensors[MASTER_SENSORS_MAX];
+  portENTER_CRITICAL(&sensorLock);
+  bool changed = heardChanged;
+  heardChanged = false;
+  size_t count = heardCount;
+  memcpy(sensors, heardSensors, sizeof(sensors));
+  portEXIT_CRITICAL(&sensorLock);
+
+  if (changed) {
+    Preferences prefs;
+    prefs.begin("master", false);
+    prefs.putBytes("sensors", sensors, count * sizeof(heard_sensor));
+    prefs.end();
+  }
+}
+
+// Handle a frame a sensor sent the Server (Wi-Fi task)
+void handleSensorFrame(const uint8_t *mac, const uint8_t *data, int len) {
+  uint8_t sensorType = heardSensorType(mac);
+  frame_header header;
+  sensor_reading reading;
+  if (sensorType == SENSOR_UNKNOWN || !frameParseHeader(data, len, &header) || !frameIsReading(header.kind)) {
+    return; // Heartbeats, held readings and the sensors' other traffic
+  }
+  BINLOG(FRAME_FROM, binlogMac(mac));
+  if (!dispatchDecode(sensorType, data, len, &reading)) {
+    BINLOG(LENGTH_MISMATCH);
+    return;
+  }
+
+  // Add the logic for loudness check
+  if (sensorType == SENSOR_SOUND && reading.value != 0) {
+    strcpy(reading.status, reading.value > 1 ? "Loud" : "Normal");  // Set threshold value for loudness
+  }
+
+  portENTER_CRITICAL(&sensorLock);
+  latestReadings[sensorType] = reading;
+  portEXIT_CRITICAL(&sensorLock);
+
+  if (sensorType == SENSOR_LIGHT) {
+    BINLOG(LIGHT_READING, reading.value, reading.status);
+  } else {
+    BINLOG(READING, sensorTypeName(sensorType), reading.value, reading.status);
+  }
+}
+
+// Join requests and accepts, which are broadcast or addressed to others (Wi-Fi task)
+void handlePairingFrame(const uint8_t *mac, const uint8_t *data, int len) {
+  pairing_frame frame;
+  if (!pairingParseFrame(data, len, &frame)) {
+    return;
+  }
+  if (frame.kind == PAIRING_JOIN_REQUEST) {
+    learnSensor(mac, frame.sensorType);
+  } else {
+    learnSensor(frame.target, frame.sensorType);
+  }
+}
+
+// Handle Received Data: only broadcasts reach the Master-Server this way
+void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len) {
+  handlePairingFrame(mac, incomingData, len);
+}
+
+// Frames addressed to others. ESP-NOW frames are vendor-specific action
+// frames (subtype 0xd0, category 127); broadcasts come in through OnDataRecv.
+void sniffFrame(void *buf, wifi_promiscuous_pkt_type_t type) {
+  if (type != WIFI_PKT_MGMT) {
+    return;
+  }
+  const wifi_promiscuous_pkt_t *pkt = (const wifi_promiscuous_pkt_t *)buf;
+  const uint8_t *frame = pkt->payload;
+  int sigLen = pkt->rx_ctrl.sig_len;
+  if (sigLen < ESPNOW_BODY_OFFSET || frame[0] != 0xd0 || frame[24] != 127 || frame[32] != 0xdd ||
+      (frame[4] & 0x01)) {
+    return;
+  }
+  int len = frame[33] - 5; // The element length counts the OUI, type and version too
+  if (len <= 0 || ESPNOW_BODY_OFFSET + len > sigLen) {
+    return;
+  }
+  const uint8_t *from = frame + 10;
+  const uint8_t *data = frame + ESPNOW_BODY_OFFSET;
+  if (data[0] == PAIRING_MAGIC) {
+    handlePairingFrame(from, data, len);
+  } else {
+    handleSensorFrame(from, data, len);
+  }
+}
+
+// Initialize ESP-NOW and start listening
+void initESPNow() {
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("Error initializing ESP-NOW");
+    return;
+  }
+
+  wifi_promiscuous_filter_t filter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(sniffFrame);
+  esp_wifi_set_promiscuous(true);
+}
+
+// Serve the webpage with sensor data
+void serveWebpage(AsyncWebServerRequest *request) {
+  String html = PAGEINDEX;  // HTML page from external file
+
+  html.replace("%STATUS%", String(latestReading(SENSOR_SOUND).status));
+  html.replace("%MOTION%", String(latestReading(SENSOR_MOTION).status));
+  html.replace("%SMOKE%", String(latestReading(SENSOR_SMOKE).status));
+  html.replace("%LIGHT%", String(latestReading(SENSOR_LIGHT).status));
+
+  request->send(200, "text/html", html);
+}
+
+// Serve the light sensor data as JSON
+void serveLightData(AsyncWebServerRequest *request) {
+  sensor_reading light = latestReading(SENSOR_LIGHT);
+  String json = "{\"lightLevel\": " + String(light.value) + ", ";
+  json += "\"brightnessPercentage\": \"" + String(light.status) + "\"}";
+  request->send(200, "application/json", json);
+}
+
+// Serve the boot phase timings as JSON
+void serveBootTimings(AsyncWebServerRequest *request) {
+  char json[96 * (BOOT_PROFILER_MAX_PHASES + 1)];
+  bootProfilerFormatJson(json, sizeof(json));
+  request->send(200, "application/json", json);
+}
+
+// Setup Function
+void setup() {
+  Serial.begin(115200);
+  binlogBegin();
+
+  // Set Wi-Fi mode to AP+STA
+  bootPhaseBegin("wifi_mode");
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.setSleep(WIFI_PS_NONE);
+  WiFi.channel(1);  // Set initial channel
+
+  // Configure Access Point
+  bootPhaseBegin("soft_ap");
+  WiFi.softAP(soft_ap_ssid, soft_ap_password);
+  delay(1000);
+  WiFi.softAPConfig(local_ip, gateway, subnet);
+  Serial.print("AP IP Address: ");
+  Serial.println(WiFi.softAPIP());
+
+  // Connect to Wi-Fi network (STA)
+  bootPhaseBegin("sta_connect");
+  WiFi.begin(wifi_network_ssid, wifi_network_password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("Connected to Wi-Fi!");
+
+  bootPhaseBegin("channel_scan");
+  scan_and_set_wifi_channel();
+  bootPhaseBegin("espnow_init");
+  loadHeardSensors();
+  initESPNow();
+
+  // Register the callback for receiving data
+  esp_now_register_recv_cb(OnDataRecv);
+
+  bootPhaseBegin("http_server");
+
+  // Serve the webpage with sensor data
+  server.on("/", HTTP_GET, serveWebpage);
+
+  // Serve the light sensor data as JSON
+  server.on("/status/light", HTTP_GET, serveLightData);
+
+  // Serve the sound sensor data
+  server.on("/status/sound", HTTP_GET, [] (AsyncWebServerRequest *request) {
+    String response = String(latestReading(SENSOR_SOUND).status);
+    request->send(200, "text/plain", response);
+  });
+
+  // Serve the motion sensor data
+  server.on("/status/motion", HTTP_GET, [] (AsyncWebServerRequest *request) {
+    String response = String(latestReading(SENSOR_MOTION).status);
+    request->send(200, "text/plain", response);
+  });
+
+  // Serve the smoke sensor data
+  server.on("/status/smoke", HTTP_GET, [] (AsyncWebServerRequest *request) {
+    String response = String(latestReading(SENSOR_SMOKE).status);
+    request->send(200, "text/plain", response);
+  });
+
+  // Serve the boot phase timings
+  server.on("/boot", HTTP_GET, serveBootTimings);
+
+  // Start the server
+  server.begin();
+  bootPhaseEnd();
+
+  bootProfilerPrint();
+}
+
+// Loop Function
+void loop() {
+  saveHeardSensors();
+  delay(1000);
+}
@@ -0,0 +1,210 @@
+#include "Capture.h"
+
+#include <string.h>
+
+static const uint8_t captureMagic[4] = {'E', 'N', 'C', 'P'};
+static const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t captureEncodeHeader(uint8_t *buf, size_t len, uint64_t startUs)
+{
+  if (len < CAPTURE_HEADER_SIZE)
+  {
+    return 0;
+  }
+  memset(buf, 0, CAPTURE_HEADER_SIZE);
+  memcpy(buf, captureMagic, sizeof(captureMagic));
+  buf[4] = CAPTURE_VERSION;
+  for (size_t i = 0; i < 8; i++)
+  {
+    buf[8 + i] = (uint8_t)(startUs >> (8 * i));
+  }
+  return CAPTURE_HEADER_SIZE;
+}
+
+size_t captureEncodePeer(uint8_t *buf, size_t len, const peer_entry &peer)
+{
+  if (len < 10)
+  {
+    return 0;
+  }
+  buf[0] = CAPTURE_RECORD_PEER;
+  memcpy(buf + 1, peer.mac, 6);
+  buf[7] = peer.sensorType;
+  buf[8] = peer.capabilities;
+  buf[9] = peer.zone;
+  return 10;
+}
+
+size_t captureEncodeFrame(uint8_t *buf, size_t len, uint64_t deltaUs, const uint8_t *mac, int8_t rssi,
+                          const uint8_t *data, size_t dataLen)
+{
+  if (dataLen > CAPTURE_MAX_PAYLOAD || len < CAPTURE_RECORD_MAX)
+  {
+    return 0;
+  }
+
+  size_t pos = 0;
+  buf[pos++] = CAPTURE_RECORD_FRAME;
+  do
+  {
+    uint8_t byte = deltaUs & 0x7f;
+    deltaUs >>= 7;
+    buf[pos++] = byte | (deltaUs ? 0x80 : 0);
+  } while (deltaUs);
+  memcpy(buf + pos, mac, 6);
+  pos += 6;
+  buf[pos++] = (uint8_t)rssi;
+  buf[pos++] = (uint8_t)dataLen;
+  memcpy(buf + pos, data, dataLen);
+  return pos + dataLen;
+}
+
+size_t captureBase64Encode(const uint8_t *in, size_t len, char *out, size_t outLen)
+{
+  size_t needed = (len + 2) / 3 * 4;
+  if (outLen < needed + 1)
+  {
+    return 0;
+  }
+
+  size_t o = 0;
+  for (size_t i = 0; i < len; i += 3)
+  {
+    uint32_t v = (uint32_t)in[i] << 16;
+    if (i + 1 < len)
+    {
+      v |= (uint32_t)in[i + 1] << 8;
+    }
+    if (i + 2 < len)
+    {
+      v |= in[i + 2];
+    }
+    out[o++] = base64Alphabet[(v >> 18) & 0x3f];
+    out[o++] = base64Alphabet[(v >> 12) & 0x3f];
+    out[o++] = i + 1 < len ? base64Alphabet[(v >> 6) & 0x3f] : '=';
+    out[o++] = i + 2 < len ? base64Alphabet[v & 0x3f] : '=';
+  }
+  out[o] = '\0';
+  return o;
+}
+
+static int base64Value(char c)
+{
+  const char *p = c ? strchr(base64Alphabet, c) : nullptr;
+  return p ? (int)(p - base64Alphabet) : -1;
+}
+
+size_t captureBase64Decode(const char *in, size_t len, uint8_t *out, size_t outLen)
+{
+  if (len % 4 != 0)
+  {
+    return 0;
+  }
+
+  size_t o = 0;
+  for (size_t i = 0; i < len; i += 4)
+  {
+    uint32_t v = 0;
+    size_t bytes = 3;
+    for (size_t j = 0; j < 4; j++)
+    {
+      int d = base64Value(in[i + j]);
+      if (in[i + j] == '=' && i + 4 == len && j >= 2)
+      {
+        d = 0;
+        bytes--;
+      }
+      else if (d < 0)
+      {
+        return 0;
+      }
+      v = (v << 6) | (uint32_t)d;
+    }
+    if (o + bytes > outLen)
+    {
+      return 0;
+    }
+    for (size_t j = 0; j < bytes; j++)
+    {
+      out[o++] = (uint8_t)(v >> (16 - 8 * j));
+    }
+  }
+  return o;
+}
+
+CaptureReader::CaptureReader(const uint8_t *data, size_t len)
+    : data(data), len(len), pos(CAPTURE_HEADER_SIZE), start(0), lastUs(0), ok(false), cut(false)
+{
+  if (len < CAPTURE_HEADER_SIZE || memcmp(data, captureMagic, sizeof(captureMagic)) != 0 || data[4] != CAPTURE_VERSION)
+  {
+    return;
+  }
+  for (size_t i = 0; i < 8; i++)
+  {
+    start |= (uint64_t)data[8 + i] << (8 * i);
+  }
+  lastUs = start;
+  ok = true;
+}
+
+bool CaptureReader::next(capture_record *record)
+{
+  if (!ok || pos >= len)
+  {
+    return false;
+  }
+
+  memset(record, 0, sizeof(*record));
+  size_t p = pos;
+  record->kind = data[p++];
+  if (record->kind == CAPTURE_RECORD_PEER)
+  {
+    if (len - p < 9)
+    {
+      cut = true;
+      return false;
+    }
+    memcpy(record->mac, data + p, 6);
+    record->sensorType = data[p + 6];
+    record->capabilities = data[p + 7];
+    record->zone = data[p + 8];
+    pos = p + 9;
+    record->timeUs = lastUs;
+    return true;
+  }
+  if (record->kind != CAPTURE_RECORD_FRAME)
+  {
+    cut = true; // Unknown record; nothing after it can be framed
+    return false;
+  }
+
+  uint64_t deltaUs = 0;
+  for (unsigned shift = 0;; shift += 7)
+  {
+    if (p >= len || shift > 63)
+    {
+      cut = true;
+      return false;
+    }
+    uint8_t byte = data[p++];
+    deltaUs |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      break;
+    }
+  }
+  if (len - p < 8 || len - p - 8 < data[p + 7])
+  {
+    cut = true;
+    return false;
+  }
+  memcpy(record->mac, data + p, 6);
+  record->rssi = (int8_t)data[p + 6];
+  record->len = data[p + 7];
+  record->data = data + p + 8;
+  pos = p + 8 + record->len;
+
+  lastUs += deltaUs;
+  record->timeUs = lastUs;
+  return true;
+}
@@ -0,0 +1,81 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <PeerTable.h>
+
+// Compact binary capture of the ESP-NOW frames the Server receives, for
+// replaying real traffic against the processing pipeline off the board.
+//
+// A capture is a 16-byte header followed by records:
+//   header: "ENCP", version, 3 reserved bytes, start time (uint64 us, LE)
+//   peer:   CAPTURE_RECORD_PEER, mac[6], sensor type, capabilities, zone
+//   frame:  CAPTURE_RECORD_FRAME, time since the previous frame (LEB128
+//           varint, us), mac[6], rssi, payload length, payload
+// Peer records come first and snapshot the peer table when capture starts.
+// Over serial each encoded piece is sent base64-encoded on its own line
+// behind CAPTURE_SERIAL_PREFIX so it survives being mixed with log text.
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_MAX_PAYLOAD 250 // ESP_NOW_MAX_DATA_LEN
+#define CAPTURE_RECORD_MAX (1 + 10 + 6 + 1 + 1 + CAPTURE_MAX_PAYLOAD)
+#define CAPTURE_SERIAL_PREFIX "#CAP "
+
+enum capture_record_kind
+{
+  CAPTURE_RECORD_PEER = 1,
+  CAPTURE_RECORD_FRAME = 2
+};
+
+typedef struct capture_record
+{
+  uint8_t kind;         // capture_record_kind
+  uint64_t timeUs;      // Frames: absolute time (start time plus deltas)
+  uint8_t mac[6];
+  int8_t rssi;          // Frames: 0 when unknown
+  uint8_t sensorType;   // Peers only
+  uint8_t capabilities; // Peers only
+  uint8_t zone;         // Peers only
+  uint8_t len;          // Frames: payload length
+  const uint8_t *data;  // Frames: points into the capture
+} capture_record;
+
+// Encoders return the bytes written, or 0 if buf is too small
+size_t captureEncodeHeader(uint8_t *buf, size_t len, uint64_t startUs);
+size_t captureEncodePeer(uint8_t *buf, size_t len, const peer_entry &peer);
+size_t captureEncodeFrame(uint8_t *buf, size_t len, uint64_t deltaUs, const uint8_t *mac, int8_t rssi,
+                          const uint8_t *data, size_t dataLen);
+
+// Base64 for the serial transport; return the length written, 0 on error.
+// The encoder NUL-terminates its output.
+size_t captureBase64Encode(const uint8_t *in, size_t len, char *out, size_t outLen);
+size_t captureBase64Decode(const char *in, size_t len, uint8_t *out, size_t outLen);
+
+// Walks the records of a complete capture held in memory
+class CaptureReader
+{
+public:
+  CaptureReader(const uint8_t *data, size_t len);
+
+  // False if the header is missing or of another version
+  bool valid() const { return ok; }
+  uint64_t startUs() const { return start; }
+
+  // Next record, or false at the end. truncated() tells a cut-off last
+  // record apart from a clean end.
+  bool next(capture_record *record);
+  bool truncated() const { return cut; }
+
+private:
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  uint64_t start;
+  uint64_t lastUs;
+  bool ok;
+  bool cut;
+};
+
+#endif
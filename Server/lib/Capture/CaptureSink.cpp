@@ -0,0 +1,323 @@
+#ifdef ARDUINO
+
+#include "CaptureSink.h"
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define CAPTURE_FLUSH_BYTES 1024 // Flash writes are batched to this size
+#define CAPTURE_NO_REQUEST 0xff
+#define CAPTURE_TASK_STACK 4096
+#define CAPTURE_TASK_PRIORITY 1 // Just above idle, below the Wi-Fi and radio tasks
+#define CAPTURE_DRAIN_MS 20
+
+// Pieces in the ring: kind, length (uint16 LE), then the bytes
+#define PIECE_HEADER 3
+#define PIECE_START 1 // Sink, capture number
+#define PIECE_DATA 2  // Encoded header, peer or frame record
+#define PIECE_STOP 3  // Records dropped (uint32 LE)
+#define PIECE_CONTROL_ROOM 16 // Kept free of data, so a stop and a start always fit
+
+static_assert((CAPTURE_RING_BYTES & (CAPTURE_RING_BYTES - 1)) == 0, "CAPTURE_RING_BYTES must be a power of two");
+
+// Radio task side
+static uint8_t activeSink = CAPTURE_OFF;
+static volatile uint8_t requestedSink = CAPTURE_NO_REQUEST;
+static uint8_t captureNumber = 0; // Of the current capture, to match the drain task's reports
+static uint32_t droppedRecords = 0;
+static uint64_t lastFrameUs = 0;
+
+// Single producer, single consumer byte ring
+static uint8_t ring[CAPTURE_RING_BYTES];
+static std::atomic<uint32_t> ringHead(0); // Written by the radio task
+static std::atomic<uint32_t> ringTail(0); // Written by the drain task
+
+// Drain task side
+static bool fsMounted = false;
+static File file;
+static uint8_t pending[CAPTURE_FLUSH_BYTES + CAPTURE_RECORD_MAX];
+static size_t pendingLen = 0;
+static uint8_t writingNumber = 0;
+static std::atomic<uint8_t> writingSink(CAPTURE_OFF);
+static std::atomic<uint8_t> endedNumber(0); // Capture the drain task had to stop
+static std::atomic<uint32_t> bytesWritten(0);
+
+// Queue one piece; false, queueing nothing, if the ring has no room for it
+static bool pushPiece(uint8_t kind, const uint8_t *data, size_t len)
+{
+  uint32_t head = ringHead.load(std::memory_order_relaxed);
+  uint32_t room = CAPTURE_RING_BYTES - (head - ringTail.load(std::memory_order_acquire));
+  size_t reserve = kind == PIECE_DATA ? PIECE_CONTROL_ROOM : 0;
+  if (PIECE_HEADER + len + reserve > room)
+  {
+    return false;
+  }
+  uint8_t header[PIECE_HEADER] = {kind, (uint8_t)len, (uint8_t)(len >> 8)};
+  for (size_t i = 0; i < PIECE_HEADER + len; i++)
+  {
+    ring[(head + i) & (CAPTURE_RING_BYTES - 1)] = i < PIECE_HEADER ? header[i] : data[i - PIECE_HEADER];
+  }
+  ringHead.store(head + PIECE_HEADER + len, std::memory_order_release);
+  return true;
+}
+
+// Take the next piece; false when the ring is empty
+static bool popPiece(uint8_t *kind, uint8_t *data, size_t *len)
+{
+  uint32_t tail = ringTail.load(std::memory_order_relaxed);
+  if (ringHead.load(std::memory_order_acquire) == tail)
+  {
+    return false;
+  }
+  uint8_t header[PIECE_HEADER];
+  for (size_t i = 0; i < PIECE_HEADER; i++)
+  {
+    header[i] = ring[(tail + i) & (CAPTURE_RING_BYTES - 1)];
+  }
+  *kind = header[0];
+  *len = header[1] | (size_t)header[2] << 8;
+  for (size_t i = 0; i < *len; i++)
+  {
+    data[i] = ring[(tail + PIECE_HEADER + i) & (CAPTURE_RING_BYTES - 1)];
+  }
+  ringTail.store(tail + PIECE_HEADER + *len, std::memory_order_release);
+  return true;
+}
+
+static void flushFile()
+{
+  if (pendingLen > 0)
+  {
+    file.write(pending, pendingLen);
+    pendingLen = 0;
+  }
+}
+
+static void stop()
+{
+  uint8_t sink = writingSink.load(std::memory_order_relaxed);
+  if (sink == CAPTURE_FLASH)
+  {
+    flushFile();
+    file.close();
+  }
+  if (sink != CAPTURE_OFF)
+  {
+    Serial.printf("Capture stopped after %lu bytes\n", (unsigned long)bytesWritten.load(std::memory_order_relaxed));
+  }
+  writingSink.store(CAPTURE_OFF, std::memory_order_release);
+}
+
+// The sink cannot take more: stop, and have the radio task stop queueing
+static void fail()
+{
+  stop();
+  endedNumber.store(writingNumber, std::memory_order_release);
+}
+
+static void start(uint8_t sink, uint8_t number)
+{
+  stop();
+  writingNumber = number;
+  bytesWritten.store(0, std::memory_order_relaxed);
+  if (sink == CAPTURE_FLASH)
+  {
+    file = fsMounted ? SPIFFS.open(CAPTURE_FILE, "w") : File();
+    if (!file)
+    {
+      Serial.println("Cannot open " CAPTURE_FILE);
+      fail();
+      return;
+    }
+  }
+  writingSink.store(sink, std::memory_order_release);
+  Serial.printf("Capture to %s started\n", captureSinkName(sink));
+}
+
+// Hand one encoded piece of the capture to the sink being written
+static void emit(const uint8_t *piece, size_t len)
+{
+  uint8_t sink = writingSink.load(std::memory_order_relaxed);
+  if (sink == CAPTURE_SERIAL)
+  {
+    // One write per line so log text from other tasks cannot split it
+    char line[sizeof(CAPTURE_SERIAL_PREFIX) + (CAPTURE_RECORD_MAX + 2) / 3 * 4 + 1];
+    size_t prefixLen = sizeof(CAPTURE_SERIAL_PREFIX) - 1;
+    memcpy(line, CAPTURE_SERIAL_PREFIX, prefixLen);
+    size_t n = prefixLen + captureBase64Encode(piece, len, line + prefixLen, sizeof(line) - prefixLen - 1);
+    line[n++] = '\n';
+    Serial.write((const uint8_t *)line, n);
+  }
+  else if (sink == CAPTURE_FLASH)
+  {
+    if (bytesWritten.load(std::memory_order_relaxed) + len > CAPTURE_FLASH_LIMIT)
+    {
+      Serial.println("Capture file full");
+      fail();
+      return;
+    }
+    memcpy(pending + pendingLen, piece, len);
+    pendingLen += len;
+    if (pendingLen >= CAPTURE_FLUSH_BYTES)
+    {
+      flushFile();
+    }
+  }
+  else
+  {
+    return; // Left over from a capture that failed
+  }
+  bytesWritten.fetch_add(len, std::memory_order_relaxed);
+}
+
+static void drainTaskMain(void *)
+{
+  uint8_t piece[CAPTURE_RECORD_MAX];
+  for (;;)
+  {
+    uint8_t kind;
+    size_t len;
+    while (popPiece(&kind, piece, &len))
+    {
+      if (kind == PIECE_START)
+      {
+        start(piece[0], piece[1]);
+      }
+      else if (kind == PIECE_STOP)
+      {
+        uint32_t dropped = piece[0] | (uint32_t)piece[1] << 8 | (uint32_t)piece[2] << 16 | (uint32_t)piece[3] << 24;
+        if (dropped > 0)
+        {
+          Serial.printf("Capture dropped %lu frames while writing fell behind\n", (unsigned long)dropped);
+        }
+        stop();
+      }
+      else
+      {
+        emit(piece, len);
+      }
+    }
+    vTaskDelay(pdMS_TO_TICKS(CAPTURE_DRAIN_MS));
+  }
+}
+
+void captureBegin()
+{
+  fsMounted = SPIFFS.begin(true);
+  if (!fsMounted)
+  {
+    Serial.println("SPIFFS mount failed, flash capture unavailable");
+  }
+  xTaskCreate(drainTaskMain, "capture", CAPTURE_TASK_STACK, NULL, CAPTURE_TASK_PRIORITY, NULL);
+}
+
+void captureRequest(uint8_t sink)
+{
+  requestedSink = sink;
+}
+
+void captureService(const PeerTable &peers, uint64_t nowUs)
+{
+  if (activeSink != CAPTURE_OFF && endedNumber.load(std::memory_order_acquire) == captureNumber)
+  {
+    activeSink = CAPTURE_OFF; // The drain task stopped it
+  }
+
+  uint8_t sink = requestedSink;
+  if (sink == CAPTURE_NO_REQUEST)
+  {
+    return;
+  }
+
+  if (activeSink != CAPTURE_OFF)
+  {
+    uint8_t dropped[4] = {(uint8_t)droppedRecords, (uint8_t)(droppedRecords >> 8), (uint8_t)(droppedRecords >> 16),
+                          (uint8_t)(droppedRecords >> 24)};
+    if (!pushPiece(PIECE_STOP, dropped, sizeof(dropped)))
+    {
+      return; // Tried again on the next call
+    }
+    activeSink = CAPTURE_OFF;
+  }
+  if (sink != CAPTURE_OFF)
+  {
+    // Start once the ring has drained, so the header and peers all fit
+    if (ringHead.load(std::memory_order_relaxed) != ringTail.load(std::memory_order_acquire))
+    {
+      return;
+    }
+    uint8_t number = (uint8_t)(captureNumber + 1);
+    uint8_t control[2] = {sink, number};
+    if (!pushPiece(PIECE_START, control, sizeof(control)))
+    {
+      return;
+    }
+    captureNumber = number;
+    activeSink = sink;
+    droppedRecords = 0;
+    lastFrameUs = nowUs;
+
+    uint8_t piece[CAPTURE_RECORD_MAX];
+    pushPiece(PIECE_DATA, piece, captureEncodeHeader(piece, sizeof(piece), nowUs));
+    for (size_t id = 0; id < peers.count(); id++)
+    {
+      pushPiece(PIECE_DATA, piece, captureEncodePeer(piece, sizeof(piece), peers.at(id)));
+    }
+  }
+  if (requestedSink == sink)
+  {
+    requestedSink = CAPTURE_NO_REQUEST;
+  }
+}
+
+void captureFrame(uint64_t timeUs, const uint8_t *mac, int8_t rssi, const uint8_t *data, int len)
+{
+  if (activeSink == CAPTURE_OFF)
+  {
+    return;
+  }
+
+  uint8_t piece[CAPTURE_RECORD_MAX];
+  size_t n = captureEncodeFrame(piece, sizeof(piece), timeUs - lastFrameUs, mac, rssi, data, len);
+  if (n == 0)
+  {
+    return;
+  }
+  // The next record's delta counts from the last one the capture holds
+  if (pushPiece(PIECE_DATA, piece, n))
+  {
+    lastFrameUs = timeUs;
+  }
+  else
+  {
+    droppedRecords++;
+  }
+}
+
+uint8_t captureActiveSink()
+{
+  return writingSink.load(std::memory_order_acquire);
+}
+
+uint32_t captureBytes()
+{
+  return bytesWritten.load(std::memory_order_relaxed);
+}
+
+const char *captureSinkName(uint8_t sink)
+{
+  switch (sink)
+  {
+  case CAPTURE_SERIAL:
+    return "serial";
+  case CAPTURE_FLASH:
+    return "flash";
+  default:
+    return "off";
+  }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CAPTURE_SINK_H
+#define CAPTURE_SINK_H
+
+#ifdef ARDUINO
+
+#include "Capture.h"
+
+// Server side of frame capture: records every received frame to the
+// serial port or to a file on SPIFFS. The radio task encodes each frame
+// into a ring, and a low-priority task started by captureBegin() drains it
+// to the sink, so serial and flash writes never hold up the radio task. A
+// frame that finds the ring full is dropped and counted. Other tasks only
+// ask for the sink to change.
+
+#define CAPTURE_FILE "/capture.bin"
+#define CAPTURE_FLASH_LIMIT (512 * 1024) // Capture stops when the file reaches this size
+
+#ifndef CAPTURE_RING_BYTES
+#define CAPTURE_RING_BYTES 8192 // Power of two; holds a full peer snapshot and about a second of frames
+#endif
+
+enum capture_sink
+{
+  CAPTURE_OFF,
+  CAPTURE_SERIAL,
+  CAPTURE_FLASH
+};
+
+// Mount SPIFFS for flash captures and start the task writing captures;
+// call once from setup()
+void captureBegin();
+
+// Ask for capture to switch to sink; applied by the next captureService()
+void captureRequest(uint8_t sink);
+
+// Apply a pending request, starting a new capture with a snapshot of peers
+void captureService(const PeerTable &peers, uint64_t nowUs);
+
+// Record a received frame if capture is on
+void captureFrame(uint64_t timeUs, const uint8_t *mac, int8_t rssi, const uint8_t *data, int len);
+
+uint8_t captureActiveSink(); // Sink being written, which lags a request until the ring drains
+uint32_t captureBytes(); // Size of the current or last capture
+
+const char *captureSinkName(uint8_t sink);
+
+#endif
+
+#endif
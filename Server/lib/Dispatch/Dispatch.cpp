@@ -0,0 +1,164 @@
+#include "Dispatch.h"
+
+#include <Pairing.h>
+#include <string.h>
+
+static_assert(sizeof(struct_message_smoke) != sizeof(struct_message_sound) &&
+                  sizeof(struct_message_smoke) != sizeof(struct_message_motion) &&
+                  sizeof(struct_message_smoke) != sizeof(struct_message_light),
+              "dispatchPriority() tells smoke frames apart by their size");
+
+// What the Server sends when there is smoke, from either rule
+static const char shutdownCommand[] = "disable1";
+static const uint32_t shutdownTargets =
+    SENSOR_TYPE_BIT(SENSOR_SOUND) | SENSOR_TYPE_BIT(SENSOR_LIGHT) | SENSOR_TYPE_BIT(SENSOR_MOTION);
+
+static const rule_command smokeAlarm = {shutdownCommand, shutdownTargets, "Smoke detected. Sending Turn Off Command..."};
+static const rule_command smokeBuildup = {shutdownCommand, shutdownTargets,
+                                          "Smoke building up. Sending Turn Off Command..."};
+
+static void copyStatus(sensor_reading *reading, const char *status, size_t len)
+{
+  size_t n = strnlen(status, len);
+  if (n > SENSOR_STATUS_LEN - 1)
+  {
+    n = SENSOR_STATUS_LEN - 1;
+  }
+  memcpy(reading->status, status, n);
+  reading->status[n] = '\0';
+}
+
+bool dispatchDecode(uint8_t sensorType, const uint8_t *data, int len, sensor_reading *reading)
+{
+  memset(reading, 0, sizeof(*reading));
+  reading->sensorType = sensorType;
+
+  frame_header header;
+  if (frameParseHeader(data, len, &header) && !frameIsReading(header.kind))
+  {
+    return false;
+  }
+
+  if (sensorType == SENSOR_SOUND && len == sizeof(struct_message_sound))
+  {
+    struct_message_sound message;
+    memcpy(&message, data, sizeof(message));
+    reading->value = message.soundLevel;
+    if (message.soundLevel == 0)
+    {
+      copyStatus(reading, "DISABLED", sizeof("DISABLED"));
+    }
+    else
+    {
+      copyStatus(reading, message.soundStatus, sizeof(message.soundStatus));
+    }
+    return true;
+  }
+  if (sensorType == SENSOR_MOTION && len == sizeof(struct_message_motion))
+  {
+    struct_message_motion message;
+    memcpy(&message, data, sizeof(message));
+    reading->value = message.motionValue;
+    copyStatus(reading, message.motionStatus, sizeof(message.motionStatus));
+    return true;
+  }
+  if (sensorType == SENSOR_SMOKE && len == sizeof(struct_message_smoke))
+  {
+    struct_message_smoke message;
+    memcpy(&message, data, sizeof(message));
+    reading->value = message.smokePercentage;
+    copyStatus(reading, message.smokeStatus, sizeof(message.smokeStatus));
+    reading->flags = message.blinkLED ? SENSOR_FLAG_BLINK : 0;
+    return true;
+  }
+  if (sensorType == SENSOR_LIGHT && len == sizeof(struct_message_light))
+  {
+    struct_message_light message;
+    memcpy(&message, data, sizeof(message));
+    reading->value = message.lightLevel;
+    copyStatus(reading, message.brightnessPercentage, sizeof(message.brightnessPercentage));
+    return true;
+  }
+  return false;
+}
+
+bool dispatchRule(const sensor_reading *reading, rule_command *command)
+{
+  if (reading->sensorType == SENSOR_MOTION)
+  {
+    if (reading->value == 1)
+    {
+      command->command = "turn on";
+      command->typeMask = SENSOR_TYPE_BIT(SENSOR_SOUND) | SENSOR_TYPE_BIT(SENSOR_LIGHT);
+      command->reason = "Motion detected. Sending Turn On Command...";
+      return true;
+    }
+    if (reading->value == 2)
+    {
+      command->command = "disable";
+      command->typeMask = SENSOR_TYPE_BIT(SENSOR_SOUND) | SENSOR_TYPE_BIT(SENSOR_LIGHT);
+      command->reason = "No motion detected. Sending Turn Off Command...";
+      return true;
+    }
+  }
+  else if (reading->sensorType == SENSOR_SMOKE && reading->value > 100)
+  {
+    *command = smokeAlarm;
+    return true;
+  }
+  return false;
+}
+
+bool dispatchTrendRule(const sensor_reading *reading, const reading_trend *trend, rule_command *command)
+{
+  if (trend->count < DISPATCH_TREND_MIN_READINGS)
+  {
+    return false;
+  }
+  // Below the alarm level, but most of the last minute well above clear air
+  if (reading->sensorType == SENSOR_SMOKE && trend->mean >= DISPATCH_SMOKE_BUILDUP &&
+      trend->p95 >= DISPATCH_SMOKE_BUILDUP)
+  {
+    *command = smokeBuildup;
+    return true;
+  }
+  return false;
+}
+
+uint8_t dispatchPriority(const uint8_t *data, int len)
+{
+  frame_header header;
+  sensor_reading reading;
+  rule_command command;
+  if (len != sizeof(struct_message_smoke) || !frameParseHeader(data, len, &header) || !frameIsReading(header.kind) ||
+      !dispatchDecode(SENSOR_SMOKE, data, len, &reading))
+  {
+    return DISPATCH_PRIORITY_NORMAL;
+  }
+  return dispatchRule(&reading, &command) ? DISPATCH_PRIORITY_ALARM : DISPATCH_PRIORITY_NORMAL;
+}
+
+void dispatchPlanAlarm(const PeerTable &peers, dispatch_alarm_plan *plan)
+{
+  plan->command = smokeAlarm;
+  plan->len = (uint8_t)(strlen(smokeAlarm.command) + 1);
+  plan->count = (uint16_t)dispatchTargets(peers, smokeAlarm.typeMask, plan->targets, PEER_TABLE_MAX);
+}
+
+bool dispatchIsTarget(const peer_entry &peer, uint32_t typeMask)
+{
+  return (typeMask & SENSOR_TYPE_BIT(peer.sensorType)) && (peer.capabilities & SENSOR_CAP_ACCEPTS_COMMANDS);
+}
+
+size_t dispatchTargets(const PeerTable &peers, uint32_t typeMask, uint16_t *ids, size_t maxIds)
+{
+  size_t n = 0;
+  for (size_t id = 0; id < peers.count() && n < maxIds; id++)
+  {
+    if (dispatchIsTarget(peers.at(id), typeMask))
+    {
+      ids[n++] = (uint16_t)id;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,113 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <PeerTable.h>
+#include <SensorFrame.h>
+#include <SensorStore.h>
+
+// Decoding of sensor reading frames and the command rules they trigger.
+// Kept free of Arduino and ESP-NOW calls so the same pipeline runs on the
+// Server and in host tools that replay captured traffic.
+
+// Data Structure for ESP-NOW
+typedef struct struct_message_motion
+{
+  frame_header header;
+  int motionValue;
+  char motionStatus[20];
+} struct_message_motion;
+typedef struct struct_message_sound
+{
+  frame_header header;
+  int soundLevel;
+  char soundStatus[20];
+} struct_message_sound;
+
+typedef struct struct_message_light
+{
+  frame_header header;
+  int lightLevel;
+  char brightnessPercentage[10];
+} struct_message_light;
+
+typedef struct struct_message_smoke
+{
+  frame_header header;
+  int smokePercentage;
+  char smokeStatus[20];
+  bool blinkLED; // Flag to trigger LED blinking
+} struct_message_smoke;
+
+// A reading frame reduced to what the store and the rules need
+typedef struct sensor_reading
+{
+  uint8_t sensorType;
+  int32_t value;
+  char status[SENSOR_STATUS_LEN];
+  uint8_t flags; // SENSOR_FLAG_* bits
+} sensor_reading;
+
+// Command a reading asks the Server to send
+typedef struct rule_command
+{
+  const char *command; // Payload sent to each target
+  uint32_t typeMask;   // SENSOR_TYPE_BIT of the target sensor types
+  const char *reason;  // For the log
+} rule_command;
+
+// Recent statistics of the instance a reading came from, for trend rules
+typedef struct reading_trend
+{
+  uint32_t count; // Readings in the last minute
+  float mean;     // Their mean
+  int32_t p95;    // Over the last 5 to 10 minutes; 0 where no quantiles are kept
+} reading_trend;
+
+#define DISPATCH_TREND_MIN_READINGS 10 // Fewer readings in the minute are not a trend
+#define DISPATCH_SMOKE_BUILDUP 50      // Smoke percent that, held for a minute, counts as smoke building up
+
+// Frame priorities. Alarm frames are smoke readings that fire the smoke
+// rule; the Server handles them ahead of any queued telemetry.
+#define DISPATCH_PRIORITY_NORMAL 0
+#define DISPATCH_PRIORITY_ALARM 1
+
+// The smoke rule's command and targets, worked out before any alarm so an
+// alarm frame only has to send it
+typedef struct dispatch_alarm_plan
+{
+  rule_command command;
+  uint8_t len; // Bytes of command.command sent, with its NUL
+  uint16_t count;
+  uint16_t targets[PEER_TABLE_MAX];
+} dispatch_alarm_plan;
+
+// Decode a frame from a sensor of the given type; false if its size does
+// not match or it is a frame of another kind, e.g. a backlog frame
+bool dispatchDecode(uint8_t sensorType, const uint8_t *data, int len, sensor_reading *reading);
+
+// The command a reading triggers; false if it triggers none
+bool dispatchRule(const sensor_reading *reading, rule_command *command);
+
+// Priority of a received frame from its bytes alone. Smoke frames are the
+// only ones of their size, so this needs no peer table lookup and can run
+// in the Wi-Fi task before the frame is queued; the sender still has to be
+// checked to be a paired smoke sensor.
+uint8_t dispatchPriority(const uint8_t *data, int len);
+
+// Work out the smoke rule's fan-out for the current peer table
+void dispatchPlanAlarm(const PeerTable &peers, dispatch_alarm_plan *plan);
+
+// The command a sustained trend triggers; false if it triggers none. For
+// readings that triggered nothing by themselves.
+bool dispatchTrendRule(const sensor_reading *reading, const reading_trend *trend, rule_command *command);
+
+// Whether a paired sensor receives a command sent to typeMask
+bool dispatchIsTarget(const peer_entry &peer, uint32_t typeMask);
+
+// IDs of the paired sensors a command sent to typeMask goes to, in ID
+// order; returns how many were written to ids
+size_t dispatchTargets(const PeerTable &peers, uint32_t typeMask, uint16_t *ids, size_t maxIds);
+
+#endif
@@ -0,0 +1,394 @@
+#include "Export.h"
+
+#include <Pairing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void exportQueryInit(export_query *query)
+{
+  memset(query, 0, sizeof(*query));
+  query->format = EXPORT_NDJSON;
+  query->toMs = UINT32_MAX;
+  query->sensor = EXPORT_ANY_SENSOR;
+}
+
+// Decimal number filling [start, end); false if it is not one or too large
+static bool parseNumber(const char *start, const char *end, uint32_t max, uint32_t *value)
+{
+  if (start == end || end - start > 10)
+  {
+    return false;
+  }
+  uint64_t n = 0;
+  for (const char *p = start; p < end; p++)
+  {
+    if (*p < '0' || *p > '9')
+    {
+      return false;
+    }
+    n = n * 10 + (uint64_t)(*p - '0');
+  }
+  if (n > max)
+  {
+    return false;
+  }
+  *value = (uint32_t)n;
+  return true;
+}
+
+bool exportParseToken(const char *token, export_query *query)
+{
+  const char *dot = strchr(token, '.');
+  if (dot == nullptr)
+  {
+    return false;
+  }
+  const char *countDot = strchr(dot + 1, '.');
+  const char *msEnd = countDot != nullptr ? countDot : dot + 1 + strlen(dot + 1);
+  uint32_t idValue, ms, count = EXPORT_ALL_AT_MS;
+  if (!parseNumber(token, dot, 0xffff, &idValue) || !parseNumber(dot + 1, msEnd, UINT32_MAX, &ms) ||
+      (countDot != nullptr && !parseNumber(countDot + 1, countDot + 1 + strlen(countDot + 1), 0xfffe, &count)))
+  {
+    return false;
+  }
+  query->resumeId = (uint16_t)idValue;
+  query->resumeMs = ms;
+  query->resumeCount = (uint16_t)count;
+  return true;
+}
+
+size_t exportFormatToken(char *buf, size_t len, uint16_t id, uint32_t ms, uint16_t count)
+{
+  int n = snprintf(buf, len, "%u.%lu.%u", id, (unsigned long)ms, count);
+  return n < 0 ? 0 : (size_t)n < len ? (size_t)n : len - 1;
+}
+
+bool exportParseFormat(const char *name, uint8_t *format)
+{
+  if (strcmp(name, "ndjson") == 0)
+  {
+    *format = EXPORT_NDJSON;
+    return true;
+  }
+  if (strcmp(name, "csv") == 0)
+  {
+    *format = EXPORT_CSV;
+    return true;
+  }
+  return false;
+}
+
+bool exportParseSensor(const char *value, export_query *query)
+{
+  uint32_t id;
+  if (parseNumber(value, value + strlen(value), HISTORY_MAX_SERIES - 1, &id))
+  {
+    query->sensor = (int32_t)id;
+    return true;
+  }
+  static const uint8_t types[] = {SENSOR_SOUND, SENSOR_MOTION, SENSOR_SMOKE, SENSOR_LIGHT};
+  for (uint8_t sensorType : types)
+  {
+    if (strcasecmp(value, sensorTypeName(sensorType)) == 0)
+    {
+      query->sensorType = sensorType;
+      return true;
+    }
+  }
+  return false;
+}
+
+HistoryExport::HistoryExport(const History &history, const PeerTable &peers, const export_query &query)
+    : history(&history), peers(&peers), query(query), id(0), open(false), started(false), finished(false),
+      written(0), lastId(0), lastMs(0), lastCount(0), skip(0), sensorType(0), zone(0), unitLen(0), unitSent(0),
+      reader(history, 0, 0, 0) // Replaced in openSensor()
+{
+  if (query.resume)
+  {
+    id = query.resumeId;
+  }
+  else if (query.sensor != EXPORT_ANY_SENSOR)
+  {
+    id = (uint16_t)query.sensor;
+  }
+}
+
+// Set up reader for the next sensor from id on that the query selects
+bool HistoryExport::openSensor()
+{
+  size_t count = peers->count();
+  for (; id < count && id < HISTORY_MAX_SERIES; id++)
+  {
+    peer_entry peer;
+    if (!peers->snapshot(id, &peer) || (query.sensor != EXPORT_ANY_SENSOR && query.sensor != id) ||
+        (query.sensorType != 0 && peer.sensorType != query.sensorType))
+    {
+      continue;
+    }
+    uint32_t fromMs = query.fromMs;
+    uint32_t toMs = query.toMs;
+    skip = 0;
+    if (query.resume && id == query.resumeId)
+    {
+      // Ranges wrap like History's: a resume point inside the range starts
+      // there, one within half the clock before fromMs leaves fromMs as it
+      // is, and any other lies past toMs, with nothing left of this sensor
+      if (query.resumeMs - fromMs <= query.toMs - fromMs)
+      {
+        fromMs = query.resumeMs;
+        if (query.toMs - query.fromMs == UINT32_MAX)
+        {
+          toMs = query.resumeMs + INT32_MAX; // The whole clock: all that compares as later
+        }
+        skip = query.resumeCount;
+        lastId = id;
+        lastMs = query.resumeMs;
+        lastCount = 0;
+      }
+      else if ((int32_t)(query.resumeMs - fromMs) >= 0)
+      {
+        continue;
+      }
+    }
+    reader = HistoryReader(*history, id, fromMs, toMs);
+    sensorType = peer.sensorType;
+    zone = peer.zone;
+    open = true;
+    return true;
+  }
+  return false;
+}
+
+// Put the next header, record or trailer in unit; false when there is none
+bool HistoryExport::nextUnit()
+{
+  int n = 0;
+  if (!started)
+  {
+    started = true;
+    if (query.format == EXPORT_CSV)
+    {
+      n = snprintf(unit, sizeof(unit), "id,type,zone,ms,value\n");
+    }
+  }
+  else if (query.limit > 0 && written >= query.limit)
+  {
+    char token[EXPORT_TOKEN_MAX];
+    exportFormatToken(token, sizeof(token), lastId, lastMs, lastCount);
+    const char *fmt = query.format == EXPORT_CSV ? "# resume %s\n" : "{\"resume\":\"%s\"}\n";
+    n = snprintf(unit, sizeof(unit), fmt, token);
+    finished = true;
+  }
+  else
+  {
+    uint32_t ms;
+    int32_t value;
+    while (true)
+    {
+      if (!open && !openSensor())
+      {
+        finished = true;
+        return false;
+      }
+      if (!reader.next(&ms, &value))
+      {
+        open = false;
+        id++;
+        continue;
+      }
+      // Records are in time order, so those at resumeMs come first
+      if (skip > 0 && ms == query.resumeMs)
+      {
+        skip--;
+        lastCount++;
+        continue;
+      }
+      skip = 0;
+      break;
+    }
+    const char *fmt = query.format == EXPORT_CSV ? "%u,%s,%u,%lu,%ld\n"
+                                                 : "{\"id\":%u,\"type\":\"%s\",\"zone\":%u,\"ms\":%lu,\"value\":%ld}\n";
+    n = snprintf(unit, sizeof(unit), fmt, id, sensorTypeName(sensorType), zone, (unsigned long)ms, (long)value);
+    written++;
+    if (id == lastId && ms == lastMs && lastCount < EXPORT_ALL_AT_MS - 1)
+    {
+      lastCount++;
+    }
+    else
+    {
+      lastId = id;
+      lastMs = ms;
+      lastCount = 1;
+    }
+  }
+  unitLen = n < 0 ? 0 : (size_t)n < sizeof(unit) ? (uint16_t)n : (uint16_t)(sizeof(unit) - 1);
+  unitSent = 0;
+  return true;
+}
+
+size_t HistoryExport::write(char *buf, size_t len)
+{
+  size_t pos = 0;
+  while (pos < len)
+  {
+    if (unitSent == unitLen && (finished || !nextUnit()))
+    {
+      break;
+    }
+    size_t n = unitLen - unitSent;
+    if (n > len - pos)
+    {
+      n = len - pos;
+    }
+    memcpy(buf + pos, unit + unitSent, n);
+    pos += n;
+    unitSent += n;
+  }
+  return pos;
+}
+
+static_assert(sizeof(history_columns_header) == 20, "history_columns_header must keep the columns aligned");
+
+enum
+{
+  COLUMNS_HEADER,
+  COLUMNS_GAPS,
+  COLUMNS_VALUES,
+  COLUMNS_DONE
+};
+
+HistoryColumns::HistoryColumns(const History &history, const PeerTable &peers, uint16_t id, uint32_t fromMs,
+                               uint32_t toMs, uint32_t stepMs, uint32_t nowMs)
+    : history(&history), fromMs(fromMs), toMs(toMs), stepMs(stepMs), phase(COLUMNS_HEADER), emitted(0), kept(false),
+      keptMs(0), keptValue(0), unitLen(0), unitSent(0), reader(history, id, fromMs, toMs)
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = HISTORY_COLUMNS_MAGIC;
+  header.version = HISTORY_COLUMNS_VERSION;
+  header.id = id;
+  peer_entry peer;
+  if (peers.snapshot(id, &peer))
+  {
+    header.sensorType = peer.sensorType;
+    header.zone = peer.zone;
+  }
+  header.nowMs = nowMs;
+
+  // Count the points, and pin the range so the columns see the same ones
+  uint32_t ms, lastMs = 0;
+  int32_t value;
+  while (nextPoint(&ms, &value))
+  {
+    if (header.count == 0)
+    {
+      header.firstMs = ms;
+    }
+    lastMs = ms;
+    header.count++;
+  }
+  if (header.count > 0)
+  {
+    this->fromMs = header.firstMs;
+    this->toMs = lastMs;
+  }
+}
+
+// Next point at least stepMs after the last one kept
+bool HistoryColumns::nextPoint(uint32_t *ms, int32_t *value)
+{
+  uint32_t sampleMs;
+  int32_t sampleValue;
+  while (reader.next(&sampleMs, &sampleValue))
+  {
+    if (!kept || sampleMs - keptMs >= stepMs)
+    {
+      kept = true;
+      keptMs = sampleMs;
+      keptValue = sampleValue;
+      *ms = sampleMs;
+      *value = sampleValue;
+      return true;
+    }
+  }
+  return false;
+}
+
+void HistoryColumns::restart()
+{
+  reader = HistoryReader(*history, header.id, fromMs, toMs);
+  kept = false;
+  emitted = 0;
+}
+
+// Put the header or the next column entry in unit; false when done
+bool HistoryColumns::nextUnit()
+{
+  uint32_t ms;
+  int32_t value;
+  while (true)
+  {
+    switch (phase)
+    {
+    case COLUMNS_HEADER:
+      memcpy(unit, &header, sizeof(header));
+      unitLen = sizeof(header);
+      unitSent = 0;
+      phase = COLUMNS_GAPS;
+      restart();
+      return true;
+    case COLUMNS_GAPS:
+      if (emitted < header.count)
+      {
+        uint32_t previousMs = kept ? keptMs : header.firstMs;
+        uint32_t gap = nextPoint(&ms, &value) ? ms - previousMs : 0;
+        memcpy(unit, &gap, sizeof(gap));
+        unitLen = sizeof(gap);
+        unitSent = 0;
+        emitted++;
+        return true;
+      }
+      phase = COLUMNS_VALUES;
+      restart();
+      break;
+    case COLUMNS_VALUES:
+      if (emitted < header.count)
+      {
+        value = keptValue;
+        nextPoint(&ms, &value);
+        int16_t clamped = value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+        memcpy(unit, &clamped, sizeof(clamped));
+        unitLen = sizeof(clamped);
+        unitSent = 0;
+        emitted++;
+        return true;
+      }
+      phase = COLUMNS_DONE;
+      break;
+    default:
+      return false;
+    }
+  }
+}
+
+size_t HistoryColumns::write(char *buf, size_t len)
+{
+  size_t pos = 0;
+  while (pos < len)
+  {
+    if (unitSent == unitLen && !nextUnit())
+    {
+      break;
+    }
+    size_t n = unitLen - unitSent;
+    if (n > len - pos)
+    {
+      n = len - pos;
+    }
+    memcpy(buf + pos, unit + unitSent, n);
+    pos += n;
+    unitSent += n;
+  }
+  return pos;
+}
@@ -0,0 +1,160 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <History.h>
+#include <PeerTable.h>
+
+// Body of /export: the readings kept in History, one record per line,
+// sensor by sensor in peer ID order and oldest first within a sensor.
+//   ndjson  {"id":3,"type":"Light","zone":1,"ms":123456,"value":2048}
+//   csv     id,type,zone,ms,value header, then 3,Light,1,123456,2048
+// Times are the Server's millis() when the reading arrived. They wrap
+// every 49.7 days, and from and to are taken modulo 2^32 like History's.
+//
+// Like the Views writers it fills the response buffer a chunk at a time
+// from a fixed-size cursor, decoding one History block at a time, so
+// memory use does not depend on the range exported.
+//
+// A resume token "<id>.<ms>.<n>" names the last record received: the nth
+// of sensor id's records at ms. An export given one starts right after
+// it, so records that share a time are neither skipped nor repeated. An
+// export that reaches its record limit ends with the token to carry on
+// from, {"resume":"3.123456.1"} or "# resume 3.123456.1". Clients can also
+// build a token from the last complete record of an interrupted download;
+// "<id>.<ms>" with no count resumes after every record at ms.
+
+#define EXPORT_NDJSON 0
+#define EXPORT_CSV 1
+
+#define EXPORT_UNIT_MAX 96   // Longest record
+#define EXPORT_TOKEN_MAX 24  // Longest resume token, with its NUL
+#define EXPORT_ANY_SENSOR -1 // export_query.sensor for every sensor
+#define EXPORT_ALL_AT_MS 0xffff // export_query.resumeCount of a token without a count
+
+typedef struct export_query
+{
+  uint8_t format;
+  uint32_t fromMs; // Inclusive range
+  uint32_t toMs;
+  int32_t sensor;     // Peer ID, or EXPORT_ANY_SENSOR
+  uint8_t sensorType; // Only this type, 0 for any
+  uint32_t limit;     // Most records, 0 for no limit
+  bool resume;        // Start after resumeId/resumeMs/resumeCount
+  uint16_t resumeId;
+  uint32_t resumeMs;
+  uint16_t resumeCount; // Records at resumeMs already received, EXPORT_ALL_AT_MS for all
+} export_query;
+
+// Everything kept, as NDJSON
+void exportQueryInit(export_query *query);
+
+// Parse "<id>.<ms>.<n>" or "<id>.<ms>" into query's resume fields; false
+// if token is neither
+bool exportParseToken(const char *token, export_query *query);
+size_t exportFormatToken(char *buf, size_t len, uint16_t id, uint32_t ms, uint16_t count);
+
+// Parse a format name, ndjson or csv; false if name is neither
+bool exportParseFormat(const char *name, uint8_t *format);
+
+// Parse a sensor filter into query: a peer ID or a sensor type name
+bool exportParseSensor(const char *value, export_query *query);
+
+class HistoryExport
+{
+public:
+  HistoryExport(const History &history, const PeerTable &peers, const export_query &query);
+
+  // Fill at most len bytes of buf; returns the bytes written, 0 once done
+  size_t write(char *buf, size_t len);
+
+  uint32_t records() const { return written; }
+
+private:
+  bool nextUnit();
+  bool openSensor();
+
+  const History *history;
+  const PeerTable *peers;
+  export_query query;
+  uint16_t id;         // Sensor being written
+  bool open;           // reader is set up for id
+  bool started;        // The CSV header is out
+  bool finished;       // The last unit is in unit
+  uint32_t written;    // Records so far
+  uint16_t lastId;     // Last record written, for the resume token
+  uint32_t lastMs;
+  uint16_t lastCount;  // Records of lastId at lastMs so far, skipped ones included
+  uint16_t skip;       // Records at resumeMs still to skip
+  uint8_t sensorType;  // Of id
+  uint8_t zone;
+  uint16_t unitLen;    // Bytes held in unit
+  uint16_t unitSent;   // Bytes of unit already copied out
+  char unit[EXPORT_UNIT_MAX];
+  HistoryReader reader;
+};
+
+// Body of /history.bin: one sensor's readings as columns a browser maps
+// straight onto typed arrays, all little-endian:
+//   history_columns_header
+//   uint32 gaps[count]   ms since the previous point, the first since firstMs
+//   int16 values[count]  readings, clamped to the int16 range
+// The header is a multiple of 4 bytes so both columns are aligned.
+//
+// The constructor decodes the range once to count the points and pin the
+// range to the first and last of them; each column is then decoded again
+// as it is written, so memory use stays fixed. stepMs thins the points to
+// at most one per step, which keeps a long range cheap to chart. If the
+// Server drops the oldest block of the range before the columns are out,
+// the missing points repeat the last one so the columns keep their length.
+
+#define HISTORY_COLUMNS_MAGIC 0x4248 // "HB"
+#define HISTORY_COLUMNS_VERSION 1
+
+typedef struct history_columns_header
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t sensorType;
+  uint16_t id;
+  uint8_t zone;
+  uint8_t reserved;
+  uint32_t count;
+  uint32_t firstMs; // Time of the first point
+  uint32_t nowMs;   // Server's millis() when the response started
+} history_columns_header;
+
+class HistoryColumns
+{
+public:
+  HistoryColumns(const History &history, const PeerTable &peers, uint16_t id, uint32_t fromMs, uint32_t toMs,
+                 uint32_t stepMs, uint32_t nowMs);
+
+  // Fill at most len bytes of buf; returns the bytes written, 0 once done
+  size_t write(char *buf, size_t len);
+
+  uint32_t count() const { return header.count; }
+
+private:
+  bool nextPoint(uint32_t *ms, int32_t *value);
+  void restart();
+  bool nextUnit();
+
+  const History *history;
+  history_columns_header header;
+  uint32_t fromMs;
+  uint32_t toMs;
+  uint32_t stepMs;
+  uint8_t phase;      // Header, gaps, values or done
+  uint32_t emitted;   // Points of the current column written
+  bool kept;          // A point was kept in this pass
+  uint32_t keptMs;    // Time of the last point kept
+  int32_t keptValue;
+  uint16_t unitLen;   // Bytes held in unit
+  uint16_t unitSent;  // Bytes of unit already copied out
+  uint8_t unit[sizeof(history_columns_header)];
+  HistoryReader reader;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "Health.h"
+
+#include <Pairing.h>
+#include <math.h>
+#include <string.h>
+
+static const char *const stateNames[HEALTH_STATE_COUNT] = {"unknown", "learning", "ok", "drift",
+                                                           "step", "stuck", "silent"};
+
+const char *healthStateName(uint8_t state)
+{
+  return state < HEALTH_STATE_COUNT ? stateNames[state] : "unknown";
+}
+
+SensorHealth::SensorHealth()
+{
+  memset(tracks, 0, sizeof(tracks));
+  for (size_t id = 0; id < HEALTH_MAX_IDS; id++)
+  {
+    published[id].store(HEALTH_UNKNOWN, std::memory_order_relaxed);
+    lastMs[id].store(0, std::memory_order_relaxed);
+    silentAfterMs[id].store(0, std::memory_order_relaxed);
+  }
+}
+
+// Update the value checks of a smoke instance with one reading
+void SensorHealth::checkValue(health_track &track, uint32_t nowMs, uint32_t gapMs, int32_t value)
+{
+  float x = (float)value;
+  if (track.readings == 1)
+  {
+    track.mean = x;
+    track.baseline = x;
+    track.lastValue = value;
+    track.sameSinceMs = nowMs;
+    track.state = HEALTH_LEARNING;
+    return;
+  }
+
+  if (value != track.lastValue)
+  {
+    track.lastValue = value;
+    track.sameSinceMs = nowMs;
+  }
+
+  // Step: the CUSUM sees each reading against the mean before it
+  float sigma = sqrtf(track.variance);
+  sigma = sigma > HEALTH_MIN_SIGMA ? sigma : HEALTH_MIN_SIGMA;
+  float z = (x - track.mean) / sigma;
+  track.cusumHigh = fmaxf(0, track.cusumHigh + z - HEALTH_CUSUM_SLACK);
+  track.cusumLow = fmaxf(0, track.cusumLow - z - HEALTH_CUSUM_SLACK);
+  bool step = track.cusumHigh > HEALTH_CUSUM_LIMIT || track.cusumLow > HEALTH_CUSUM_LIMIT;
+
+  float deviation = x - track.mean;
+  track.mean += deviation / (1 << HEALTH_FAST_SHIFT);
+  track.variance += (deviation * deviation - track.variance) / (1 << HEALTH_FAST_SHIFT);
+  if ((int32_t)(track.stepUntilMs - nowMs) <= 0)
+  {
+    float weight = gapMs < HEALTH_BASELINE_MS ? (float)gapMs / HEALTH_BASELINE_MS : 1;
+    track.baseline += (x - track.baseline) * weight;
+  }
+
+  if (track.readings < HEALTH_LEARN_READINGS)
+  {
+    track.state = HEALTH_LEARNING;
+    return;
+  }
+  if (track.readings == HEALTH_LEARN_READINGS)
+  {
+    track.baseline = track.mean;
+    track.reference = track.mean;
+    track.cusumHigh = 0;
+    track.cusumLow = 0;
+    step = false;
+  }
+  if (step)
+  {
+    // Start over from the new level
+    track.stepUntilMs = nowMs + HEALTH_STEP_HOLD_MS;
+    track.mean = x;
+    track.cusumHigh = 0;
+    track.cusumLow = 0;
+  }
+
+  // Drift clears with hysteresis, once the baseline is back within half the limit
+  float moved = fabsf(track.baseline - track.reference);
+  track.drifted = moved > HEALTH_DRIFT_LIMIT || (track.drifted && moved > HEALTH_DRIFT_LIMIT / 2);
+
+  uint32_t sameMs = nowMs - track.sameSinceMs;
+  if (sameMs >= HEALTH_STUCK_MS || (value == 0 && sameMs >= HEALTH_RAIL_STUCK_MS))
+  {
+    track.state = HEALTH_STUCK;
+  }
+  else if ((int32_t)(track.stepUntilMs - nowMs) > 0)
+  {
+    track.state = HEALTH_STEP;
+  }
+  else if (track.drifted)
+  {
+    track.state = HEALTH_DRIFT;
+  }
+  else
+  {
+    track.state = HEALTH_OK;
+  }
+}
+
+uint8_t SensorHealth::observe(uint16_t id, uint8_t sensorType, uint32_t nowMs, int32_t value)
+{
+  if (id >= HEALTH_MAX_IDS)
+  {
+    return HEALTH_UNKNOWN;
+  }
+  health_track &track = tracks[id];
+  uint32_t gap = 0;
+  if (track.readings > 0)
+  {
+    gap = nowMs - track.lastMs;
+    track.intervalMs = track.readings == 1 ? gap : track.intervalMs + ((int32_t)(gap - track.intervalMs) >> 3);
+  }
+  if (track.readings < UINT16_MAX)
+  {
+    track.readings++;
+  }
+  track.lastMs = nowMs;
+
+  if (sensorType == SENSOR_SMOKE)
+  {
+    checkValue(track, nowMs, gap, value);
+  }
+  else
+  {
+    track.state = track.readings < HEALTH_LEARN_READINGS ? HEALTH_LEARNING : HEALTH_OK;
+  }
+
+  uint32_t silentAfter = track.intervalMs * HEALTH_SILENT_INTERVALS;
+  silentAfterMs[id].store(silentAfter > HEALTH_SILENT_MIN_MS ? silentAfter : HEALTH_SILENT_MIN_MS,
+                          std::memory_order_relaxed);
+  lastMs[id].store(nowMs, std::memory_order_relaxed);
+  published[id].store(track.state, std::memory_order_release);
+  return track.state;
+}
+
+void SensorHealth::clear(uint16_t id)
+{
+  if (id >= HEALTH_MAX_IDS)
+  {
+    return;
+  }
+  published[id].store(HEALTH_UNKNOWN, std::memory_order_release);
+  memset(&tracks[id], 0, sizeof(tracks[id]));
+}
+
+uint8_t SensorHealth::state(uint16_t id, uint32_t nowMs) const
+{
+  if (id >= HEALTH_MAX_IDS)
+  {
+    return HEALTH_UNKNOWN;
+  }
+  uint8_t current = published[id].load(std::memory_order_acquire);
+  if (current == HEALTH_UNKNOWN)
+  {
+    return current;
+  }
+  uint32_t silentFor = nowMs - lastMs[id].load(std::memory_order_relaxed);
+  // A reading that raced ahead of nowMs is not silence
+  if ((int32_t)silentFor > 0 && silentFor > silentAfterMs[id].load(std::memory_order_relaxed))
+  {
+    return HEALTH_SILENT;
+  }
+  return current;
+}
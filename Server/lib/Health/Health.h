@@ -0,0 +1,107 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Online health checks of each sensor instance, indexed by peer ID, in
+// constant memory per instance.
+//
+// Every instance is watched for silence: it is silent once it has not
+// reported for HEALTH_SILENT_INTERVALS of its usual reporting interval
+// (an EWMA of the gaps between its readings), and never sooner than
+// HEALTH_SILENT_MIN_MS.
+//
+// Smoke readings are also checked against the sensor's own history:
+//   stuck  the same value for HEALTH_STUCK_MS, or HEALTH_RAIL_STUCK_MS
+//          at 0, which is what a dead ADC or a cut wire reads
+//   step   a two-sided CUSUM of readings against a fast EWMA mean,
+//          in units of its EWMA standard deviation, crossed
+//          HEALTH_CUSUM_LIMIT; held for HEALTH_STEP_HOLD_MS
+//   drift  a baseline following the readings with a time constant of
+//          HEALTH_BASELINE_MS moved HEALTH_DRIFT_LIMIT away from where
+//          it was at the end of learning; readings taken while a step
+//          is held do not move it, so a burst of smoke is not drift
+// The first HEALTH_LEARN_READINGS readings of an instance only train the
+// checks.
+//
+// observe() runs in the Server's radio task. The state and the timing
+// silence is judged from are published through atomics, so readers in
+// other tasks never see a half-updated instance.
+
+#ifndef HEALTH_MAX_IDS
+#define HEALTH_MAX_IDS 256 // Matches PEER_TABLE_MAX
+#endif
+
+#define HEALTH_LEARN_READINGS 64
+#define HEALTH_FAST_SHIFT 4          // Fast EWMA weight 1/16
+#define HEALTH_BASELINE_MS 600000
+#define HEALTH_MIN_SIGMA 1.0f        // Smoke readings are whole percent
+#define HEALTH_CUSUM_SLACK 1.0f      // Sigmas of change the CUSUM ignores
+#define HEALTH_CUSUM_LIMIT 8.0f
+#define HEALTH_STEP_HOLD_MS 60000
+#define HEALTH_DRIFT_LIMIT 8.0f      // Percent the baseline may move
+#define HEALTH_STUCK_MS 600000
+#define HEALTH_RAIL_STUCK_MS 60000
+#define HEALTH_SILENT_INTERVALS 8
+#define HEALTH_SILENT_MIN_MS 30000
+
+enum
+{
+  HEALTH_UNKNOWN, // Never heard
+  HEALTH_LEARNING,
+  HEALTH_OK,
+  HEALTH_DRIFT,
+  HEALTH_STEP,
+  HEALTH_STUCK,
+  HEALTH_SILENT,
+  HEALTH_STATE_COUNT
+};
+
+// Writer-side state of one instance
+typedef struct health_track
+{
+  uint16_t readings;    // Since the instance was cleared, saturating
+  uint8_t state;        // From the readings alone, silence aside
+  bool drifted;         // Baseline is past the drift limit
+  float mean;           // Fast EWMA
+  float variance;       // Fast EWMA of the squared deviation
+  float baseline;       // Slow EWMA, weighted by time
+  float reference;      // Baseline at the end of learning
+  float cusumHigh;
+  float cusumLow;
+  int32_t lastValue;
+  uint32_t lastMs;
+  uint32_t sameSinceMs; // First reading of the current run of lastValue
+  uint32_t intervalMs;  // EWMA of the gaps between readings
+  uint32_t stepUntilMs; // STEP is held until then
+} health_track;
+
+// Short lowercase name of a state, "ok", "stuck", ...
+const char *healthStateName(uint8_t state);
+
+class SensorHealth
+{
+public:
+  SensorHealth();
+
+  // Check a reading of instance id; returns its state after it, silence aside
+  uint8_t observe(uint16_t id, uint8_t sensorType, uint32_t nowMs, int32_t value);
+
+  // Forget instance id, as when its peer ID is given to another sensor
+  void clear(uint16_t id);
+
+  // State of id as of nowMs, silence included
+  uint8_t state(uint16_t id, uint32_t nowMs) const;
+
+private:
+  void checkValue(health_track &track, uint32_t nowMs, uint32_t gapMs, int32_t value);
+
+  health_track tracks[HEALTH_MAX_IDS]; // Only touched by the writer
+  std::atomic<uint8_t> published[HEALTH_MAX_IDS];
+  std::atomic<uint32_t> lastMs[HEALTH_MAX_IDS];
+  std::atomic<uint32_t> silentAfterMs[HEALTH_MAX_IDS];
+};
+
+#endif
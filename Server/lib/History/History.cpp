@@ -0,0 +1,635 @@
+#include "History.h"
+
+#include <new>
+#include <string.h>
+
+static_assert(sizeof(history_block) == HISTORY_BLOCK_SIZE, "history_block must fill HISTORY_BLOCK_SIZE");
+
+// Longest span of one block: with HISTORY_MAX_AGE_MS, it bounds how far
+// apart the times held are
+#define HISTORY_MAX_SPAN_MS (HISTORY_MAX_AGE_MS / 2)
+
+// Payload bits of each code: code i is i one bits and a zero, the last is four one bits
+#define HISTORY_CODES 5
+static const uint8_t timeWidths[HISTORY_CODES] = {0, 4, 7, 12, 32};
+static const uint8_t valueWidths[HISTORY_CODES] = {0, 5, 8, 12, 32};
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Smallest code that holds v
+static uint8_t pickCode(const uint8_t *widths, uint32_t v)
+{
+  uint8_t code = 0;
+  while (code < HISTORY_CODES - 1 && (widths[code] == 32 || v >> widths[code] != 0))
+  {
+    code++;
+  }
+  return code;
+}
+
+static uint8_t prefixBits(uint8_t code)
+{
+  return code < HISTORY_CODES - 1 ? code + 1 : HISTORY_CODES - 1;
+}
+
+// Write count bits of value, most significant first, into zeroed data
+static void putBits(uint8_t *data, uint32_t pos, uint32_t value, uint8_t count)
+{
+  while (count > 0)
+  {
+    uint8_t room = 8 - (pos & 7);
+    uint8_t n = count < room ? count : room;
+    uint8_t chunk = (uint8_t)((value >> (count - n)) & ((1u << n) - 1));
+    data[pos >> 3] |= (uint8_t)(chunk << (room - n));
+    pos += n;
+    count -= n;
+  }
+}
+
+static uint32_t putCode(uint8_t *data, uint32_t pos, const uint8_t *widths, uint8_t code, uint32_t v)
+{
+  uint8_t ones = prefixBits(code);
+  // The prefix is code ones and, below the last code, a zero
+  putBits(data, pos, code < HISTORY_CODES - 1 ? ((1u << ones) - 2) : ((1u << ones) - 1), ones);
+  pos += ones;
+  putBits(data, pos, v, widths[code]);
+  return pos + widths[code];
+}
+
+void historyBlockInit(history_block *block, uint32_t ms, int32_t value)
+{
+  memset(block, 0, sizeof(*block));
+  block->firstMs = ms;
+  block->firstValue = value;
+  block->lastMs = ms;
+  block->lastValue = value;
+  block->count = 1;
+}
+
+bool historyBlockAppend(history_block *block, uint32_t ms, int32_t value)
+{
+  if (block->count == 0xffff)
+  {
+    return false;
+  }
+  if ((int32_t)(ms - block->lastMs) < 0)
+  {
+    ms = block->lastMs;
+  }
+  uint32_t gap = ms - block->lastMs;
+  uint32_t dod = zigzag((int32_t)(gap - block->lastGapMs));
+  uint32_t delta = zigzag((int32_t)((uint32_t)value - (uint32_t)block->lastValue));
+  uint8_t timeCode = pickCode(timeWidths, dod);
+  uint8_t valueCode = pickCode(valueWidths, delta);
+  uint32_t need = prefixBits(timeCode) + timeWidths[timeCode] + prefixBits(valueCode) + valueWidths[valueCode];
+  if (block->bitLen + need > HISTORY_BLOCK_DATA * 8)
+  {
+    return false;
+  }
+
+  uint32_t pos = putCode(block->data, block->bitLen, timeWidths, timeCode, dod);
+  pos = putCode(block->data, pos, valueWidths, valueCode, delta);
+  block->bitLen = (uint16_t)pos;
+  block->lastMs = ms;
+  block->lastGapMs = gap;
+  block->lastValue = value;
+  block->count++;
+  return true;
+}
+
+size_t historyBlockUsed(const history_block *block)
+{
+  return HISTORY_BLOCK_HEADER + (block->bitLen + 7) / 8;
+}
+
+HistoryBlockReader::HistoryBlockReader(const history_block *block)
+    : block(block), index(0), bitPos(0), ms(block->firstMs), gapMs(0), value(block->firstValue)
+{
+}
+
+uint32_t HistoryBlockReader::bits(uint8_t count)
+{
+  uint32_t v = 0;
+  while (count > 0)
+  {
+    uint8_t room = 8 - (bitPos & 7);
+    uint8_t n = count < room ? count : room;
+    uint8_t chunk = (uint8_t)(block->data[bitPos >> 3] >> (room - n)) & (uint8_t)((1u << n) - 1);
+    v = (v << n) | chunk;
+    bitPos += n;
+    count -= n;
+  }
+  return v;
+}
+
+// Code of the next value: the number of one bits before a zero, up to max
+uint8_t HistoryBlockReader::prefix(uint8_t max)
+{
+  uint8_t code = 0;
+  while (code < max && bits(1) == 1)
+  {
+    code++;
+  }
+  return code;
+}
+
+bool HistoryBlockReader::next(uint32_t *outMs, int32_t *outValue)
+{
+  if (index >= block->count)
+  {
+    return false;
+  }
+  if (index > 0)
+  {
+    uint8_t timeCode = prefix(HISTORY_CODES - 1);
+    gapMs += (uint32_t)unzigzag(bits(timeWidths[timeCode]));
+    ms += gapMs;
+    uint8_t valueCode = prefix(HISTORY_CODES - 1);
+    value = (int32_t)((uint32_t)value + (uint32_t)unzigzag(bits(valueWidths[valueCode])));
+  }
+  index++;
+  *outMs = ms;
+  *outValue = value;
+  return true;
+}
+
+History::History()
+    : pool(nullptr), owner(nullptr), next(nullptr), previous(nullptr), level(nullptr), version(nullptr),
+      blockCount(0), freeHead(HISTORY_NONE), sweep(0), inUse(0)
+{
+  for (size_t id = 0; id < HISTORY_MAX_SERIES; id++)
+  {
+    oldest[id].store(HISTORY_NONE, std::memory_order_relaxed);
+    newest[id] = HISTORY_NONE;
+    held[id] = 0;
+  }
+}
+
+History::~History()
+{
+  release();
+}
+
+bool History::begin(size_t budgetBytes)
+{
+  if (blockCount != 0)
+  {
+    return true;
+  }
+
+  size_t perBlock = sizeof(history_block) + 3 * sizeof(uint16_t) + sizeof(uint8_t) + sizeof(std::atomic<uint32_t>);
+  size_t count = budgetBytes / perBlock;
+  if (count > HISTORY_NONE)
+  {
+    count = HISTORY_NONE; // Indexes stay below HISTORY_NONE
+  }
+  if (count == 0)
+  {
+    return false;
+  }
+
+  pool = new (std::nothrow) history_block[count];
+  owner = new (std::nothrow) uint16_t[count];
+  next = new (std::nothrow) uint16_t[count];
+  previous = new (std::nothrow) uint16_t[count];
+  level = new (std::nothrow) uint8_t[count];
+  version = new (std::nothrow) std::atomic<uint32_t>[count];
+  if (pool == nullptr || owner == nullptr || next == nullptr || previous == nullptr || level == nullptr ||
+      version == nullptr)
+  {
+    release();
+    return false;
+  }
+  memset(pool, 0, count * sizeof(history_block));
+  for (size_t i = 0; i < count; i++)
+  {
+    owner[i] = HISTORY_NONE;
+    next[i] = i + 1 < count ? (uint16_t)(i + 1) : HISTORY_NONE;
+    previous[i] = HISTORY_NONE;
+    level[i] = 0;
+    version[i].store(0, std::memory_order_relaxed);
+  }
+  freeHead = 0;
+  blockCount = (uint16_t)count;
+  return true;
+}
+
+void History::release()
+{
+  delete[] pool;
+  delete[] owner;
+  delete[] next;
+  delete[] previous;
+  delete[] level;
+  delete[] version;
+  pool = nullptr;
+  owner = nullptr;
+  next = nullptr;
+  previous = nullptr;
+  level = nullptr;
+  version = nullptr;
+  blockCount = 0;
+  freeHead = HISTORY_NONE;
+}
+
+void History::writeBegin(uint16_t index)
+{
+  version[index].store(version[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void History::writeEnd(uint16_t index)
+{
+  version[index].store(version[index].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Roll the samples of older and then newer up into out: one per stepMs
+// from the first sample, at the start of its step, which keeps the gaps
+// steady and cheap to encode, with the mean of the values in the step,
+// which evens out noise. False if they do not fit in one block.
+static bool rollUp(const history_block *older, const history_block *newer, uint32_t stepMs, history_block *out)
+{
+  HistoryBlockReader readers[2] = {HistoryBlockReader(older), HistoryBlockReader(newer)};
+  size_t source = 0;
+  bool started = false;
+  uint32_t step = 0, stepCount = 0;
+  int64_t stepSum = 0;
+  uint32_t ms;
+  int32_t value;
+  while (true)
+  {
+    bool more = readers[source].next(&ms, &value);
+    if (!more && ++source < 2)
+    {
+      continue;
+    }
+    uint32_t sampleStep = more ? (ms - older->firstMs) / stepMs : step + 1;
+    if (stepCount > 0 && sampleStep != step)
+    {
+      uint32_t stepStartMs = older->firstMs + step * stepMs;
+      int32_t mean = (int32_t)(stepSum / stepCount);
+      if (!started)
+      {
+        historyBlockInit(out, stepStartMs, mean);
+        started = true;
+      }
+      else if (!historyBlockAppend(out, stepStartMs, mean))
+      {
+        return false;
+      }
+      stepCount = 0;
+      stepSum = 0;
+    }
+    if (!more)
+    {
+      return true;
+    }
+    step = sampleStep;
+    stepSum += value;
+    stepCount++;
+  }
+}
+
+void History::freeBlock(uint16_t index)
+{
+  writeBegin(index);
+  owner[index] = HISTORY_NONE;
+  next[index] = freeHead;
+  writeEnd(index);
+  freeHead = index;
+  inUse--;
+}
+
+void History::dropOldest(uint16_t id)
+{
+  uint16_t index = oldest[id].load(std::memory_order_relaxed);
+  oldest[id].store(next[index], std::memory_order_release);
+  if (newest[id] == index)
+  {
+    newest[id] = HISTORY_NONE;
+  }
+  held[id]--;
+  freeBlock(index);
+}
+
+// Thin the block at index and the next newer one of id into the first,
+// one level up, and free the second
+void History::merge(uint16_t id, uint16_t index)
+{
+  uint16_t second = next[index];
+  history_block merged;
+  // Steps of twice the mean gap, so about half the samples stay; longer if they do not fit
+  uint32_t spanMs = pool[second].lastMs - pool[index].firstMs;
+  uint32_t stepMs = 2 * (spanMs / (pool[index].count + pool[second].count - 1u)) + 1;
+  while (!rollUp(&pool[index], &pool[second], stepMs, &merged))
+  {
+    stepMs += stepMs / 2; // Down to one step, which fits
+  }
+
+  uint16_t after = next[second];
+  writeBegin(index);
+  memcpy(&pool[index], &merged, sizeof(merged));
+  next[index] = after;
+  level[index]++;
+  writeEnd(index);
+  // Readers that copied the second block start over at the oldest
+  writeBegin(after);
+  previous[after] = index;
+  writeEnd(after);
+  held[id]--;
+  freeBlock(second);
+}
+
+// Free a block when the pool is full: the instance holding the most blocks
+// merges the oldest pair of the lowest level that keeps its share of
+// blocks without them, or drops its oldest block if no level below the
+// last has a pair to spare
+void History::reclaim()
+{
+  uint16_t victim = 0;
+  for (uint16_t id = 1; id < HISTORY_MAX_SERIES; id++)
+  {
+    if (held[id] > held[victim])
+    {
+      victim = id;
+    }
+  }
+
+  uint16_t share = held[victim] / HISTORY_LEVELS;
+  uint16_t perLevel[HISTORY_LEVELS] = {0};
+  uint16_t first = oldest[victim].load(std::memory_order_relaxed);
+  for (uint16_t index = first; index != HISTORY_NONE; index = next[index])
+  {
+    perLevel[level[index]]++;
+  }
+  for (uint8_t k = 0; k + 1 < HISTORY_LEVELS; k++)
+  {
+    // Fresh samples keep a full block besides the one being written
+    if (perLevel[k] < (k == 0 && share < 2 ? 2 : share) + 2)
+    {
+      continue;
+    }
+    // The newest block is still being written
+    for (uint16_t index = first; index != newest[victim] && next[index] != newest[victim]; index = next[index])
+    {
+      if (level[index] == k && level[next[index]] == k &&
+          pool[next[index]].lastMs - pool[index].firstMs <= HISTORY_MAX_SPAN_MS)
+      {
+        merge(victim, index);
+        return;
+      }
+    }
+  }
+  dropOldest(victim);
+}
+
+// Take a free block for id, making one if the pool is full, and link it
+// after the newest block of id. Leaves the block open for writing.
+uint16_t History::take(uint16_t id)
+{
+  if (freeHead == HISTORY_NONE)
+  {
+    reclaim();
+  }
+  uint16_t index = freeHead;
+  freeHead = next[index];
+
+  writeBegin(index);
+  uint16_t tail = newest[id];
+  owner[index] = id;
+  next[index] = HISTORY_NONE;
+  previous[index] = tail;
+  level[index] = 0;
+  inUse++;
+  held[id]++;
+
+  if (tail != HISTORY_NONE)
+  {
+    writeBegin(tail);
+    next[tail] = index;
+    writeEnd(tail);
+  }
+  newest[id] = index;
+  if (oldest[id].load(std::memory_order_relaxed) == HISTORY_NONE)
+  {
+    oldest[id].store(index, std::memory_order_release);
+  }
+  return index;
+}
+
+void History::append(uint16_t id, uint32_t ms, int32_t value)
+{
+  if (id >= HISTORY_MAX_SERIES || blockCount == 0)
+  {
+    return;
+  }
+
+  // One instance a call, so the history of a sensor gone quiet ages out too
+  sweep = (uint16_t)((sweep + 1) % HISTORY_MAX_SERIES);
+  uint16_t stale = oldest[sweep].load(std::memory_order_relaxed);
+  if (stale != HISTORY_NONE && (int32_t)(ms - pool[stale].lastMs) > (int32_t)HISTORY_MAX_AGE_MS)
+  {
+    dropOldest(sweep);
+  }
+
+  uint16_t index = newest[id];
+  if (index != HISTORY_NONE && (int32_t)(ms - pool[index].firstMs) <= (int32_t)HISTORY_MAX_SPAN_MS)
+  {
+    writeBegin(index);
+    bool appended = historyBlockAppend(&pool[index], ms, value);
+    writeEnd(index);
+    if (appended)
+    {
+      return;
+    }
+  }
+
+  index = take(id);
+  historyBlockInit(&pool[index], ms, value);
+  writeEnd(index);
+}
+
+void History::clear(uint16_t id)
+{
+  if (id >= HISTORY_MAX_SERIES)
+  {
+    return;
+  }
+
+  while (oldest[id].load(std::memory_order_relaxed) != HISTORY_NONE)
+  {
+    dropOldest(id);
+  }
+}
+
+uint16_t History::oldestBlock(uint16_t id) const
+{
+  return id < HISTORY_MAX_SERIES ? oldest[id].load(std::memory_order_acquire) : HISTORY_NONE;
+}
+
+bool History::read(uint16_t id, uint16_t index, history_block *out, uint16_t *nextIndex,
+                   uint16_t *previousIndex) const
+{
+  if (index >= blockCount)
+  {
+    return false;
+  }
+
+  uint32_t seq;
+  bool owned;
+  do
+  {
+    seq = version[index].load(std::memory_order_acquire);
+    while (seq & 1)
+    {
+      seq = version[index].load(std::memory_order_acquire);
+    }
+    owned = owner[index] == id;
+    if (owned)
+    {
+      memcpy(out, &pool[index], sizeof(*out));
+      *nextIndex = next[index];
+      if (previousIndex != nullptr)
+      {
+        *previousIndex = previous[index];
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (version[index].load(std::memory_order_relaxed) != seq);
+  return owned;
+}
+
+size_t History::blocks(uint16_t id) const
+{
+  size_t count = 0;
+  for (uint16_t index = oldestBlock(id); index != HISTORY_NONE; index = next[index])
+  {
+    count++;
+  }
+  return count;
+}
+
+HistoryReader::HistoryReader(const History &history, uint16_t id, uint32_t fromMs, uint32_t toMs)
+    : history(&history), id(id), fromMs(fromMs), toMs(toMs), index(HISTORY_NONE), nextIndex(HISTORY_NONE),
+      started(false), entered(false), reader(&block), returned(false), resumed(false), lastMs(0)
+{
+  memset(&block, 0, sizeof(block));
+  reader = HistoryBlockReader(&block);
+}
+
+HistoryReader::HistoryReader(const HistoryReader &other) : reader(other.reader)
+{
+  *this = other;
+}
+
+HistoryReader &HistoryReader::operator=(const HistoryReader &other)
+{
+  history = other.history;
+  id = other.id;
+  fromMs = other.fromMs;
+  toMs = other.toMs;
+  index = other.index;
+  nextIndex = other.nextIndex;
+  started = other.started;
+  entered = other.entered;
+  block = other.block;
+  reader = other.reader;
+  reader.rebind(&block);
+  returned = other.returned;
+  resumed = other.resumed;
+  lastMs = other.lastMs;
+  return *this;
+}
+
+bool HistoryReader::overlaps(const history_block &candidate) const
+{
+  return inRange(candidate.firstMs) || inRange(candidate.lastMs) ||
+         fromMs - candidate.firstMs <= candidate.lastMs - candidate.firstMs;
+}
+
+// Past the end of the range: nothing more to return
+void HistoryReader::finish()
+{
+  nextIndex = HISTORY_NONE;
+  block.count = 0;
+  reader = HistoryBlockReader(&block);
+}
+
+bool HistoryReader::next(uint32_t *ms, int32_t *value)
+{
+  while (true)
+  {
+    uint32_t sampleMs;
+    int32_t sampleValue;
+    while (reader.next(&sampleMs, &sampleValue))
+    {
+      // Samples are in time order, so one out of range after one in it ends the range
+      if (!inRange(sampleMs))
+      {
+        if (entered)
+        {
+          finish();
+          return false;
+        }
+        continue;
+      }
+      entered = true;
+      if (resumed && (int32_t)(sampleMs - lastMs) <= 0)
+      {
+        continue;
+      }
+      returned = true;
+      resumed = false;
+      lastMs = sampleMs;
+      *ms = sampleMs;
+      *value = sampleValue;
+      return true;
+    }
+
+    // Next block that can hold samples in the range
+    uint16_t linkedFrom = started ? index : HISTORY_NONE;
+    index = started ? nextIndex : history->oldestBlock(id);
+    started = true;
+    while (true)
+    {
+      if (index == HISTORY_NONE)
+      {
+        return false;
+      }
+      uint16_t previousIndex;
+      if (!history->read(id, index, &block, &nextIndex, &previousIndex) ||
+          (linkedFrom != HISTORY_NONE && previousIndex != linkedFrom))
+      {
+        // Reused or merged since it was linked: start over from the oldest block
+        index = history->oldestBlock(id);
+        linkedFrom = HISTORY_NONE;
+        resumed = returned;
+        entered = false;
+        continue;
+      }
+      if (!overlaps(block))
+      {
+        if (entered)
+        {
+          finish();
+          return false;
+        }
+      }
+      else if (!resumed || (int32_t)(block.lastMs - lastMs) > 0)
+      {
+        break;
+      }
+      linkedFrom = index;
+      index = nextIndex;
+    }
+    reader = HistoryBlockReader(&block);
+  }
+}
@@ -0,0 +1,213 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed reading history of every sensor instance, indexed by peer ID.
+//
+// Each instance's samples (millis(), value) go into a chain of fixed-size
+// blocks. A block holds its first sample in the header and every later one
+// in a bit stream, Gorilla-style:
+//   time   delta-of-delta of the gaps between samples, zigzag-encoded:
+//          0 -> '0'; below 2^4 -> '10' + 4 bits; below 2^7 -> '110' + 7 bits;
+//          below 2^12 -> '1110' + 12 bits; else '1111' + 32 bits
+//   value  difference from the previous value, zigzag-encoded:
+//          0 -> '0'; below 2^5 -> '10' + 5 bits; below 2^8 -> '110' + 8 bits;
+//          below 2^12 -> '1110' + 12 bits; else '1111' + 32 bits
+// The first time bucket is narrower than Gorilla's: the sensors' send
+// times jitter by a few milliseconds, which it holds. Readings on a steady
+// period with a steady value cost 2 bits. Values are
+// integers, so differences suit them better than the XOR of float bit
+// patterns Gorilla uses. Blocks are append-only and decode front to back,
+// and the header's first and last times let range queries skip whole
+// blocks without decoding them.
+//
+// Blocks come from one pool, allocated once by begin() from a RAM budget
+// the caller picks, e.g. what the heap can spare after Wi-Fi is up; until
+// then, or if the allocation failed, nothing is recorded. When the pool is
+// full, the instance holding the most blocks gives one up: two of its
+// older blocks of the same level are rolled up into one a level up, with
+// one sample per step of twice their mean gap, at the step's start and
+// with the mean value of the step. Each level keeps about 1/HISTORY_LEVELS
+// of the instance's blocks before its oldest pair is rolled up, so
+// resolution halves with each step back in time and 90 blocks hold days of
+// a 10 Hz sensor. Only a block at the last level is dropped outright.
+//
+// Times are millis() and wrap every 49.7 days, so they compare as serial
+// numbers: blocks older than HISTORY_MAX_AGE_MS are dropped, and none
+// spans more than half of that, which keeps every time held within 2^31 ms
+// of the others.
+//
+// append() runs in the Server's radio task while the web handlers read
+// from another task. Each block is guarded by a seqlock like the
+// SensorStore slots: readers copy a block under an even version and retry
+// if the writer touched it meanwhile.
+
+#ifndef HISTORY_MAX_SERIES
+#define HISTORY_MAX_SERIES 256 // Matches PEER_TABLE_MAX
+#endif
+
+#ifndef HISTORY_RAM_BUDGET
+#define HISTORY_RAM_BUDGET 24576 // Most begin() is given on the Server: about 90 blocks
+#endif
+
+#ifndef HISTORY_LEVELS
+#define HISTORY_LEVELS 16 // Levels of thinning; a block at level k spans about 2^k fresh ones
+#endif
+
+#ifndef HISTORY_MAX_AGE_MS
+#define HISTORY_MAX_AGE_MS (7UL * 24 * 3600 * 1000)
+#endif
+
+#define HISTORY_BLOCK_SIZE 256
+#define HISTORY_BLOCK_HEADER 24
+#define HISTORY_BLOCK_DATA (HISTORY_BLOCK_SIZE - HISTORY_BLOCK_HEADER)
+#define HISTORY_NONE 0xffff // No block
+
+typedef struct history_block
+{
+  uint32_t firstMs;
+  int32_t firstValue;
+  uint32_t lastMs; // Last sample, and the gap before it, for the encoder
+  int32_t lastValue;
+  uint32_t lastGapMs;
+  uint16_t count;  // Samples, the first included
+  uint16_t bitLen; // Bits of data in use
+  uint8_t data[HISTORY_BLOCK_DATA];
+} history_block;
+
+// Start a block with its first sample
+void historyBlockInit(history_block *block, uint32_t ms, int32_t value);
+
+// Append a sample; false, leaving the block unchanged, if it does not fit.
+// Times before the last sample, modulo 2^32, are taken as its time.
+bool historyBlockAppend(history_block *block, uint32_t ms, int32_t value);
+
+// Bytes of the block in use: the header and the bits written
+size_t historyBlockUsed(const history_block *block);
+
+// Streaming decoder of one block
+class HistoryBlockReader
+{
+public:
+  explicit HistoryBlockReader(const history_block *block);
+
+  // Next sample in time order, or false after the last
+  bool next(uint32_t *ms, int32_t *value);
+
+  // Carry on from a copy of the block, e.g. when the copy itself is copied
+  void rebind(const history_block *copy) { block = copy; }
+
+private:
+  uint32_t bits(uint8_t count);
+  uint8_t prefix(uint8_t max);
+
+  const history_block *block;
+  uint16_t index;
+  uint32_t bitPos;
+  uint32_t ms;
+  uint32_t gapMs;
+  int32_t value;
+};
+
+class History
+{
+public:
+  History();
+  ~History();
+
+  // Allocate as many blocks as fit in budgetBytes, bookkeeping included;
+  // false if that is none or the allocation failed. Call once, before the
+  // first append().
+  bool begin(size_t budgetBytes);
+
+  // Blocks in the pool; 0 before begin()
+  size_t capacity() const { return blockCount; }
+
+  // Record a reading of instance id
+  void append(uint16_t id, uint32_t ms, int32_t value);
+
+  // Drop the history of instance id, e.g. when its slot is given to a new sensor
+  void clear(uint16_t id);
+
+  // Oldest block of id, or HISTORY_NONE
+  uint16_t oldestBlock(uint16_t id) const;
+
+  // Consistent copy of the block at index and the indexes of the next
+  // newer block of id and of the block that linked to it when it was taken
+  // or merged; false if the block no longer belongs to id
+  bool read(uint16_t id, uint16_t index, history_block *out, uint16_t *nextIndex,
+            uint16_t *previousIndex = nullptr) const;
+
+  // Blocks in use by id, and in the whole pool
+  size_t blocks(uint16_t id) const;
+  size_t blocksInUse() const { return inUse; }
+
+private:
+  History(const History &) = delete;
+  History &operator=(const History &) = delete;
+
+  uint16_t take(uint16_t id);
+  void reclaim();
+  void merge(uint16_t id, uint16_t index);
+  void dropOldest(uint16_t id);
+  void freeBlock(uint16_t index);
+  void writeBegin(uint16_t index);
+  void writeEnd(uint16_t index);
+  void release();
+
+  history_block *pool;
+  uint16_t *owner;    // Instance the block belongs to, HISTORY_NONE when free
+  uint16_t *next;     // Next newer block of the same instance, or the next free block
+  uint16_t *previous; // Block that linked to it
+  uint8_t *level;     // Times the block was thinned
+  std::atomic<uint32_t> *version;
+  uint16_t blockCount;
+  std::atomic<uint16_t> oldest[HISTORY_MAX_SERIES];
+  // Only touched by the writer
+  uint16_t newest[HISTORY_MAX_SERIES];
+  uint16_t held[HISTORY_MAX_SERIES]; // Blocks of each instance
+  uint16_t freeHead;                 // First free block
+  uint16_t sweep;                    // Instance checked for aged blocks next
+  size_t inUse;
+};
+
+// Samples of one instance between fromMs and toMs inclusive, oldest
+// first, decoded a block at a time. The range is taken modulo 2^32, so it
+// may span the millis() wrap, and 0 to UINT32_MAX is everything kept. If
+// the writer reuses or merges the next block before the reader gets to it,
+// the reader carries on from the instance's oldest block, skipping samples
+// up to the last time it returned. Readers can be copied, and the copy
+// carries on where the original was.
+class HistoryReader
+{
+public:
+  HistoryReader(const History &history, uint16_t id, uint32_t fromMs, uint32_t toMs);
+  HistoryReader(const HistoryReader &other);
+  HistoryReader &operator=(const HistoryReader &other);
+
+  bool next(uint32_t *ms, int32_t *value);
+
+private:
+  bool inRange(uint32_t ms) const { return ms - fromMs <= toMs - fromMs; }
+  bool overlaps(const history_block &candidate) const;
+  void finish();
+
+  const History *history;
+  uint16_t id;
+  uint32_t fromMs;
+  uint32_t toMs;
+  uint16_t index;     // Block being decoded
+  uint16_t nextIndex; // Block after it, HISTORY_NONE at the end
+  bool started;
+  bool entered; // A sample in the range was seen since the last start
+  history_block block;
+  HistoryBlockReader reader;
+  bool returned;   // Whether any sample was returned yet
+  bool resumed;    // Carrying on from the oldest block after a reuse
+  uint32_t lastMs; // Time of the last sample returned
+};
+
+#endif
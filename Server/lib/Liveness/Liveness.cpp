@@ -0,0 +1,229 @@
+#include "Liveness.h"
+
+#include <SensorFrame.h>
+#include <string.h>
+
+static const char *const stateNames[LIVENESS_STATE_COUNT] = {"unknown", "online", "offline"};
+
+const char *livenessStateName(uint8_t state)
+{
+  return state < LIVENESS_STATE_COUNT ? stateNames[state] : "unknown";
+}
+
+SensorLiveness::SensorLiveness() : cursor(0), cursorMs(0), armedCount(0)
+{
+  floorMs = LIVENESS_FLOOR_INTERVALS * frameHeartbeatMs(0);
+  memset(tracks, 0, sizeof(tracks));
+  for (size_t id = 0; id < LIVENESS_MAX_IDS; id++)
+  {
+    tracks[id].slot = LIVENESS_NONE;
+    published[id].store(LIVENESS_UNKNOWN, std::memory_order_relaxed);
+    publishedTimeout[id].store(0, std::memory_order_relaxed);
+  }
+  for (size_t slot = 0; slot < LIVENESS_WHEEL_SLOTS; slot++)
+  {
+    slots[slot] = LIVENESS_NONE;
+  }
+}
+
+uint32_t SensorLiveness::timeoutOf(const liveness_track &track) const
+{
+  uint32_t timeout;
+  if (track.gaps == 0)
+  {
+    // Expected at the heartbeat interval, give or take half of it
+    timeout = LIVENESS_MISSED * frameHeartbeatMs(0) + 2 * frameHeartbeatMs(0);
+  }
+  else
+  {
+    timeout = (uint32_t)(LIVENESS_MISSED * track.meanX8 / 8 + track.devX4);
+  }
+  timeout = timeout > floorMs ? timeout : floorMs;
+  return timeout < LIVENESS_MAX_TIMEOUT_MS ? timeout : LIVENESS_MAX_TIMEOUT_MS;
+}
+
+void SensorLiveness::arm(uint16_t id, uint32_t deadlineMs)
+{
+  int32_t ahead = (int32_t)(deadlineMs - cursorMs);
+  uint32_t ticks = ahead > 0 ? (uint32_t)ahead / LIVENESS_TICK_MS : 0;
+  liveness_track &track = tracks[id];
+  track.slot = (uint16_t)((cursor + ticks) % LIVENESS_WHEEL_SLOTS);
+  track.turns = (uint16_t)(ticks / LIVENESS_WHEEL_SLOTS);
+  track.prev = LIVENESS_NONE;
+  track.next = slots[track.slot];
+  if (track.next != LIVENESS_NONE)
+  {
+    tracks[track.next].prev = id;
+  }
+  slots[track.slot] = id;
+  armedCount++;
+}
+
+void SensorLiveness::disarm(uint16_t id)
+{
+  liveness_track &track = tracks[id];
+  if (track.slot == LIVENESS_NONE)
+  {
+    return;
+  }
+  if (track.prev != LIVENESS_NONE)
+  {
+    tracks[track.prev].next = track.next;
+  }
+  else
+  {
+    slots[track.slot] = track.next;
+  }
+  if (track.next != LIVENESS_NONE)
+  {
+    tracks[track.next].prev = track.prev;
+  }
+  track.slot = LIVENESS_NONE;
+  armedCount--;
+}
+
+bool SensorLiveness::onFrame(uint16_t id, uint32_t nowMs)
+{
+  if (id >= LIVENESS_MAX_IDS)
+  {
+    return false;
+  }
+  liveness_track &track = tracks[id];
+  bool back = track.state == LIVENESS_OFFLINE;
+  if (track.state != LIVENESS_UNKNOWN)
+  {
+    uint32_t gap = nowMs - track.lastMs;
+    int32_t m = (int32_t)(gap < LIVENESS_MAX_GAP_MS ? gap : LIVENESS_MAX_GAP_MS);
+    if (track.gaps == 0)
+    {
+      track.meanX8 = m << 3;
+      track.devX4 = m << 1; // Half the first gap, as RFC 6298 starts
+    }
+    else
+    {
+      int32_t error = m - (track.meanX8 >> 3);
+      track.meanX8 += error;
+      error = error < 0 ? -error : error;
+      track.devX4 += error - (track.devX4 >> 2);
+    }
+    if (track.gaps < UINT16_MAX)
+    {
+      track.gaps++;
+    }
+  }
+  track.lastMs = nowMs;
+  track.state = LIVENESS_ONLINE;
+
+  disarm(id);
+  if (armedCount == 0)
+  {
+    cursorMs = nowMs; // The wheel stood still while nothing was armed
+  }
+  uint32_t timeout = timeoutOf(track);
+  arm(id, nowMs + timeout);
+  publishedTimeout[id].store(timeout, std::memory_order_relaxed);
+  published[id].store(LIVENESS_ONLINE, std::memory_order_release);
+  return back;
+}
+
+void SensorLiveness::clear(uint16_t id)
+{
+  if (id >= LIVENESS_MAX_IDS)
+  {
+    return;
+  }
+  disarm(id);
+  memset(&tracks[id], 0, sizeof(tracks[id]));
+  tracks[id].slot = LIVENESS_NONE;
+  published[id].store(LIVENESS_UNKNOWN, std::memory_order_release);
+  publishedTimeout[id].store(0, std::memory_order_relaxed);
+}
+
+void SensorLiveness::setLevel(int8_t level)
+{
+  uint32_t floor = LIVENESS_FLOOR_INTERVALS * frameHeartbeatMs(level);
+  if (floor == floorMs)
+  {
+    return;
+  }
+  floorMs = floor;
+  for (uint16_t id = 0; id < LIVENESS_MAX_IDS; id++)
+  {
+    liveness_track &track = tracks[id];
+    if (track.slot == LIVENESS_NONE)
+    {
+      continue;
+    }
+    disarm(id);
+    uint32_t timeout = timeoutOf(track);
+    arm(id, track.lastMs + timeout);
+    publishedTimeout[id].store(timeout, std::memory_order_relaxed);
+  }
+}
+
+size_t SensorLiveness::tick(uint32_t nowMs, void (*onOffline)(uint16_t id))
+{
+  size_t expired = 0;
+  if (armedCount == 0)
+  {
+    cursorMs = nowMs;
+    return 0;
+  }
+  while ((int32_t)(nowMs - cursorMs) >= LIVENESS_TICK_MS && armedCount > 0)
+  {
+    uint16_t id = slots[cursor];
+    while (id != LIVENESS_NONE)
+    {
+      liveness_track &track = tracks[id];
+      uint16_t next = track.next;
+      if (track.turns > 0)
+      {
+        track.turns--;
+      }
+      else
+      {
+        disarm(id);
+        track.state = LIVENESS_OFFLINE;
+        published[id].store(LIVENESS_OFFLINE, std::memory_order_release);
+        expired++;
+        if (onOffline != nullptr)
+        {
+          onOffline(id);
+        }
+      }
+      id = next;
+    }
+    cursor = (uint16_t)((cursor + 1) % LIVENESS_WHEEL_SLOTS);
+    cursorMs += LIVENESS_TICK_MS;
+  }
+  return expired;
+}
+
+uint32_t SensorLiveness::idleMs(uint32_t nowMs, uint32_t maxMs) const
+{
+  if (armedCount == 0)
+  {
+    return maxMs;
+  }
+  int32_t until = (int32_t)(cursorMs + LIVENESS_TICK_MS - nowMs);
+  if (until <= 0)
+  {
+    return 0;
+  }
+  return (uint32_t)until < maxMs ? (uint32_t)until : maxMs;
+}
+
+uint8_t SensorLiveness::state(uint16_t id) const
+{
+  return id < LIVENESS_MAX_IDS ? published[id].load(std::memory_order_acquire) : (uint8_t)LIVENESS_UNKNOWN;
+}
+
+uint32_t SensorLiveness::timeoutMs(uint16_t id) const
+{
+  return id < LIVENESS_MAX_IDS ? publishedTimeout[id].load(std::memory_order_relaxed) : 0;
+}
+
+size_t SensorLiveness::armed() const
+{
+  return armedCount;
+}
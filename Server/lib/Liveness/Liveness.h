@@ -0,0 +1,110 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Liveness of each sensor instance, indexed by peer ID.
+//
+// Every frame from an instance pushes its deadline back. The interval it
+// keeps is learned from the gaps between its frames, as a mean and a mean
+// deviation in the way TCP learns its round trip time (RFC 6298), and it
+// goes offline once nothing arrived for LIVENESS_MISSED mean intervals
+// plus four deviations. That timeout is never shorter than
+// LIVENESS_FLOOR_INTERVALS heartbeat intervals at the reporting level the
+// sensors were last told (see frameHeartbeatMs()), so raising the level
+// does not take the fleet offline before the learned intervals catch up,
+// and never longer than LIVENESS_MAX_TIMEOUT_MS. Gaps are learned up to
+// LIVENESS_MAX_GAP_MS, so an outage does not teach an instance to be
+// quiet. Until its first gap an instance is expected at the heartbeat
+// interval.
+//
+// Deadlines live in a hashed timer wheel of LIVENESS_WHEEL_SLOTS slots of
+// LIVENESS_TICK_MS, each slot a doubly linked list through the instances,
+// so arming and disarming are O(1) and a tick visits only the instances
+// in the slot that came due. A deadline more than one turn of the wheel
+// away waits out its remaining turns in its slot. An instance goes
+// offline within one tick after its deadline, never before it.
+//
+// onFrame(), tick() and setLevel() run in the Server's radio task. The
+// state and the timeout are published through atomics for other tasks.
+
+#ifndef LIVENESS_MAX_IDS
+#define LIVENESS_MAX_IDS 256 // Matches PEER_TABLE_MAX
+#endif
+
+#define LIVENESS_TICK_MS 25
+#define LIVENESS_WHEEL_SLOTS 64 // 1.6 s per turn
+#define LIVENESS_MISSED 3
+#define LIVENESS_FLOOR_INTERVALS 2
+#define LIVENESS_MAX_GAP_MS 30000
+#define LIVENESS_MAX_TIMEOUT_MS 120000
+#define LIVENESS_NONE 0xffff // No instance, or no slot
+
+enum
+{
+  LIVENESS_UNKNOWN, // Never heard
+  LIVENESS_ONLINE,
+  LIVENESS_OFFLINE,
+  LIVENESS_STATE_COUNT
+};
+
+// Radio task state of one instance
+typedef struct liveness_track
+{
+  uint32_t lastMs;  // Last frame
+  int32_t meanX8;   // Mean gap in ms, times 8
+  int32_t devX4;    // Mean deviation of the gaps in ms, times 4
+  uint16_t gaps;    // Learned so far, saturating
+  uint16_t slot;    // LIVENESS_NONE while not armed
+  uint16_t turns;   // Turns of the wheel left before the deadline
+  uint16_t next;    // Neighbours in the slot's list
+  uint16_t prev;
+  uint8_t state;
+} liveness_track;
+
+// Short lowercase name of a state, "online", ...
+const char *livenessStateName(uint8_t state);
+
+class SensorLiveness
+{
+public:
+  SensorLiveness();
+
+  // A frame from instance id arrived; returns true if it was offline
+  bool onFrame(uint16_t id, uint32_t nowMs);
+
+  // Forget instance id, as when its peer ID is given to another sensor
+  void clear(uint16_t id);
+
+  // The sensors were told a new reporting level; re-arms every deadline
+  void setLevel(int8_t level);
+
+  // Take every instance whose deadline passed by nowMs offline, calling
+  // onOffline for each; returns how many went
+  size_t tick(uint32_t nowMs, void (*onOffline)(uint16_t id));
+
+  // How long tick() can wait after nowMs, at most maxMs
+  uint32_t idleMs(uint32_t nowMs, uint32_t maxMs) const;
+
+  uint8_t state(uint16_t id) const;
+  uint32_t timeoutMs(uint16_t id) const; // Silence that takes id offline
+  size_t armed() const;
+
+private:
+  uint32_t timeoutOf(const liveness_track &track) const;
+  void arm(uint16_t id, uint32_t deadlineMs);
+  void disarm(uint16_t id);
+
+  liveness_track tracks[LIVENESS_MAX_IDS]; // Only touched by the radio task
+  uint16_t slots[LIVENESS_WHEEL_SLOTS];    // First instance in each slot
+  uint16_t cursor;                         // Slot the next tick fires
+  uint32_t cursorMs;                       // Start of the cursor slot's interval
+  size_t armedCount;
+  uint32_t floorMs;
+  std::atomic<uint8_t> published[LIVENESS_MAX_IDS];
+  std::atomic<uint32_t> publishedTimeout[LIVENESS_MAX_IDS];
+};
+
+#endif
@@ -0,0 +1,591 @@
+#include "Metrics.h"
+
+#include <Pairing.h>
+#include <TextBuffer.h>
+#include <stdio.h>
+#include <string.h>
+
+const uint32_t metricsLatencyBoundsUs[METRICS_LATENCY_BUCKETS] = {50, 100, 250, 500, 1000, 2500, 5000, 10000};
+
+enum metrics_family
+{
+  FAMILY_FRAMES,
+  FAMILY_BYTES,
+  FAMILY_SEQ_GAPS,
+  FAMILY_DUPLICATES,
+  FAMILY_RSSI,
+  FAMILY_AGE,
+  FAMILY_SEND_FAILURES,
+  FAMILY_TX_RATE,
+  FAMILY_DELIVERY,
+  FAMILY_AIRTIME,
+  FAMILY_AIRTIME_SAVED,
+  FAMILY_BACKLOG_READINGS,
+  FAMILY_BACKLOG_DEPTH,
+  FAMILY_LATENCY,
+  FAMILY_GLOBAL,
+  FAMILY_RADIO_QUEUE,
+  FAMILY_RADIO_WAIT,
+  FAMILY_TASKS,
+  FAMILY_CHANNEL,
+  FAMILY_STATS,
+  FAMILY_HTTP,
+  FAMILY_COUNT
+};
+
+// Name, type and help text of the per-sensor families, in metrics_family order
+static const char *const sensorFamilies[][3] = {
+    {"espnow_frames_received_total", "counter", "Reading frames received from the sensor"},
+    {"espnow_bytes_received_total", "counter", "Payload bytes received from the sensor"},
+    {"espnow_seq_gaps_total", "counter", "Frames missing from the sensor's sequence"},
+    {"espnow_duplicate_frames_total", "counter", "Frames received twice"},
+    {"espnow_last_rssi_dbm", "gauge", "RSSI of the last frame from the sensor"},
+    {"espnow_last_seen_age_seconds", "gauge", "Time since the last frame from the sensor"},
+    {"espnow_send_failures_total", "counter", "Frames to the sensor that were not delivered"},
+    {"espnow_tx_rate_kbps", "gauge", "PHY rate of the next frame to the sensor"},
+    {"espnow_delivery_ratio", "gauge", "Smoothed share of frames to the sensor that were delivered"},
+    {"espnow_tx_airtime_us_total", "counter", "Modelled airtime of the frames sent to the sensor"},
+    {"espnow_tx_airtime_saved_us_total", "counter", "Airtime saved against sending every frame to the sensor at 1 Mbit/s"},
+    {"espnow_backlog_readings_total", "counter", "Readings the sensor held through an outage and forwarded later"},
+    {"espnow_backlog_depth", "gauge", "Readings the sensor still held after its last backlog frame"},
+    {"espnow_dispatch_latency_us", "histogram", "Time from frame receipt to the end of its handling"},
+};
+
+static const char *const taskNames[METRICS_TASK_COUNT] = {"radio", "http"};
+
+Metrics::Metrics() : sensorSlots(0), unknownFrames(0), txQueued(0), txCompleted(0),
+                     heapFree(0), heapMinFree(0), heapMaxAlloc(0), unitsTruncated(0),
+                     radioDepth(0), radioHighWater(0), radioDrops(0), radioWaitSumUs(0),
+                     channelPermille(0), reportLevel(0), statsWithoutSeries(0), statsWithoutSketch(0), routeCount(0)
+{
+  for (size_t b = 0; b <= METRICS_LATENCY_BUCKETS; b++)
+  {
+    radioWaitBuckets[b].store(0, std::memory_order_relaxed);
+  }
+  for (size_t t = 0; t < METRICS_TASK_COUNT; t++)
+  {
+    taskBusyUs[t].store(0, std::memory_order_relaxed);
+    taskStackFree[t].store(0, std::memory_order_relaxed);
+  }
+  for (size_t id = 0; id < METRICS_MAX_SENSORS; id++)
+  {
+    clear(id);
+  }
+  for (size_t r = 0; r < METRICS_MAX_ROUTES; r++)
+  {
+    routes[r] = nullptr;
+    routeRequests[r].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::clear(uint16_t id)
+{
+  if (id >= METRICS_MAX_SENSORS)
+  {
+    return;
+  }
+
+  sensorType[id].store(0, std::memory_order_relaxed);
+  framesReceived[id].store(0, std::memory_order_relaxed);
+  bytesReceived[id].store(0, std::memory_order_relaxed);
+  seqGaps[id].store(0, std::memory_order_relaxed);
+  duplicates[id].store(0, std::memory_order_relaxed);
+  sendFailures[id].store(0, std::memory_order_relaxed);
+  txRateKbps[id].store(0, std::memory_order_relaxed);
+  deliveryPermille[id].store(0, std::memory_order_relaxed);
+  txAirtimeUs[id].store(0, std::memory_order_relaxed);
+  txAirtimeSavedUs[id].store(0, std::memory_order_relaxed);
+  backlogReadings[id].store(0, std::memory_order_relaxed);
+  backlogDepth[id].store(0, std::memory_order_relaxed);
+  lastRssi[id].store(0, std::memory_order_relaxed);
+  lastFrameMs[id].store(0, std::memory_order_relaxed);
+  latencySumUs[id].store(0, std::memory_order_relaxed);
+  for (size_t b = 0; b <= METRICS_LATENCY_BUCKETS; b++)
+  {
+    latencyBuckets[id][b].store(0, std::memory_order_relaxed);
+  }
+  lastSeq[id] = 0;
+}
+
+void Metrics::onFrame(uint16_t id, uint8_t type, size_t bytes, bool hasSeq, uint16_t seq, int8_t rssi, uint32_t nowMs)
+{
+  if (id >= METRICS_MAX_SENSORS)
+  {
+    return;
+  }
+
+  uint32_t previousFrames = framesReceived[id].fetch_add(1, std::memory_order_relaxed);
+  bytesReceived[id].fetch_add(bytes, std::memory_order_relaxed);
+  lastFrameMs[id].store(nowMs, std::memory_order_relaxed);
+  if (rssi != 0)
+  {
+    lastRssi[id].store(rssi, std::memory_order_relaxed);
+  }
+
+  if (hasSeq)
+  {
+    if (previousFrames > 0)
+    {
+      uint16_t delta = (uint16_t)(seq - lastSeq[id]);
+      if (delta == 0)
+      {
+        duplicates[id].fetch_add(1, std::memory_order_relaxed);
+      }
+      else if (delta < 0x8000)
+      {
+        seqGaps[id].fetch_add(delta - 1, std::memory_order_relaxed);
+      }
+      // A large backwards jump means the sensor restarted; just resync
+    }
+    lastSeq[id] = seq;
+  }
+
+  if (sensorType[id].load(std::memory_order_relaxed) != type)
+  {
+    sensorType[id].store(type, std::memory_order_relaxed);
+  }
+  if (id >= sensorSlots.load(std::memory_order_relaxed))
+  {
+    sensorSlots.store(id + 1, std::memory_order_relaxed);
+  }
+}
+
+// Histogram bucket of a latency, METRICS_LATENCY_BUCKETS for +Inf
+static size_t latencyBucket(uint32_t latencyUs)
+{
+  size_t bucket = 0;
+  while (bucket < METRICS_LATENCY_BUCKETS && latencyUs > metricsLatencyBoundsUs[bucket])
+  {
+    bucket++;
+  }
+  return bucket;
+}
+
+void Metrics::onDispatched(uint16_t id, uint32_t latencyUs)
+{
+  if (id >= METRICS_MAX_SENSORS)
+  {
+    return;
+  }
+
+  latencyBuckets[id][latencyBucket(latencyUs)].fetch_add(1, std::memory_order_relaxed);
+  latencySumUs[id].fetch_add(latencyUs, std::memory_order_relaxed);
+}
+
+void Metrics::onBacklog(uint16_t id, uint8_t readings, uint16_t remaining)
+{
+  if (id >= METRICS_MAX_SENSORS)
+  {
+    return;
+  }
+
+  backlogReadings[id].fetch_add(readings, std::memory_order_relaxed);
+  backlogDepth[id].store(remaining, std::memory_order_relaxed);
+}
+
+void Metrics::onUnknownFrame()
+{
+  unknownFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::onSendQueued()
+{
+  txQueued.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::onSendCompleted(int id, bool delivered)
+{
+  txCompleted.fetch_add(1, std::memory_order_relaxed);
+  if (!delivered && id >= 0 && id < METRICS_MAX_SENSORS)
+  {
+    sendFailures[id].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::onSendRejected(int id)
+{
+  if (id >= 0 && id < METRICS_MAX_SENSORS)
+  {
+    sendFailures[id].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::setLink(int id, uint16_t rateKbps, uint16_t delivery, uint32_t airtimeUs, uint32_t baselineUs)
+{
+  if (id < 0 || id >= METRICS_MAX_SENSORS)
+  {
+    return;
+  }
+  txRateKbps[id].store(rateKbps, std::memory_order_relaxed);
+  deliveryPermille[id].store(delivery, std::memory_order_relaxed);
+  txAirtimeUs[id].store(airtimeUs, std::memory_order_relaxed);
+  txAirtimeSavedUs[id].store(baselineUs - airtimeUs, std::memory_order_relaxed);
+}
+
+int Metrics::registerRoute(const char *path)
+{
+  for (uint16_t r = 0; r < routeCount; r++)
+  {
+    if (strcmp(routes[r], path) == 0)
+    {
+      return r;
+    }
+  }
+  if (routeCount >= METRICS_MAX_ROUTES)
+  {
+    return -1;
+  }
+  routes[routeCount] = path;
+  return routeCount++;
+}
+
+void Metrics::countRequest(int route)
+{
+  if (route >= 0 && route < routeCount)
+  {
+    routeRequests[route].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::setHeap(uint32_t freeBytes, uint32_t minFreeBytes, uint32_t maxAllocBytes)
+{
+  heapFree.store(freeBytes, std::memory_order_relaxed);
+  heapMinFree.store(minFreeBytes, std::memory_order_relaxed);
+  heapMaxAlloc.store(maxAllocBytes, std::memory_order_relaxed);
+}
+
+void Metrics::onRadioQueued(uint32_t depth)
+{
+  radioDepth.store(depth, std::memory_order_relaxed);
+  uint32_t previous = radioHighWater.load(std::memory_order_relaxed);
+  while (depth > previous && !radioHighWater.compare_exchange_weak(previous, depth, std::memory_order_relaxed))
+  {
+  }
+}
+
+void Metrics::onRadioDropped()
+{
+  radioDrops.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::onRadioDequeued(uint32_t waitUs)
+{
+  radioWaitBuckets[latencyBucket(waitUs)].fetch_add(1, std::memory_order_relaxed);
+  radioWaitSumUs.fetch_add(waitUs, std::memory_order_relaxed);
+}
+
+void Metrics::setRadioQueueDepth(uint32_t depth)
+{
+  radioDepth.store(depth, std::memory_order_relaxed);
+}
+
+void Metrics::addTaskBusy(uint8_t task, uint32_t busyUs)
+{
+  if (task < METRICS_TASK_COUNT)
+  {
+    taskBusyUs[task].fetch_add(busyUs, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::setChannel(uint16_t utilisationPermille, int8_t level)
+{
+  channelPermille.store(utilisationPermille, std::memory_order_relaxed);
+  reportLevel.store(level, std::memory_order_relaxed);
+}
+
+void Metrics::setStatsMissing(uint16_t withoutSeries, uint16_t withoutSketch)
+{
+  statsWithoutSeries.store(withoutSeries, std::memory_order_relaxed);
+  statsWithoutSketch.store(withoutSketch, std::memory_order_relaxed);
+}
+
+void Metrics::setTaskStack(uint8_t task, uint32_t freeBytes)
+{
+  if (task < METRICS_TASK_COUNT)
+  {
+    taskStackFree[task].store(freeBytes, std::memory_order_relaxed);
+  }
+}
+
+bool Metrics::familyDone(uint16_t family, uint16_t index) const
+{
+  switch (family)
+  {
+  case FAMILY_GLOBAL:
+  case FAMILY_RADIO_QUEUE:
+  case FAMILY_RADIO_WAIT:
+  case FAMILY_TASKS:
+  case FAMILY_CHANNEL:
+  case FAMILY_STATS:
+    return index > 0;
+  case FAMILY_HTTP:
+    return index > routeCount;
+  default:
+    // Index 0 is the HELP/TYPE header, then one unit per sensor
+    return index > sensorSlots.load(std::memory_order_relaxed);
+  }
+}
+
+size_t Metrics::formatUnit(char *buf, size_t len, uint16_t family, uint16_t index, uint32_t nowMs) const
+{
+  size_t pos = 0;
+  buf[0] = '\0';
+
+  if (family == FAMILY_GLOBAL)
+  {
+    uint32_t queued = txQueued.load(std::memory_order_relaxed);
+    uint32_t completed = txCompleted.load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "# HELP espnow_tx_queue_depth Unicast frames handed to the driver and not yet completed\n");
+    appendf(buf, len, pos, "# TYPE espnow_tx_queue_depth gauge\nespnow_tx_queue_depth %lu\n",
+            (unsigned long)(queued - completed));
+    appendf(buf, len, pos, "# HELP espnow_unknown_frames_total Frames from senders that are not paired\n");
+    appendf(buf, len, pos, "# TYPE espnow_unknown_frames_total counter\nespnow_unknown_frames_total %lu\n",
+            (unsigned long)unknownFrames.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP heap_free_bytes Free heap\n# TYPE heap_free_bytes gauge\nheap_free_bytes %lu\n",
+            (unsigned long)heapFree.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP heap_min_free_bytes Lowest free heap since boot\n# TYPE heap_min_free_bytes gauge\nheap_min_free_bytes %lu\n",
+            (unsigned long)heapMinFree.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP heap_max_alloc_bytes Largest allocatable block\n# TYPE heap_max_alloc_bytes gauge\nheap_max_alloc_bytes %lu\n",
+            (unsigned long)heapMaxAlloc.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP metrics_truncated_units_total Blocks of this exposition cut short by METRICS_UNIT_MAX\n");
+    appendf(buf, len, pos, "# TYPE metrics_truncated_units_total counter\nmetrics_truncated_units_total %lu\n",
+            (unsigned long)unitsTruncated.load(std::memory_order_relaxed));
+    return pos;
+  }
+
+  if (family == FAMILY_RADIO_QUEUE)
+  {
+    appendf(buf, len, pos, "# HELP radio_queue_depth Radio events waiting for the radio task\n");
+    appendf(buf, len, pos, "# TYPE radio_queue_depth gauge\nradio_queue_depth %lu\n",
+            (unsigned long)radioDepth.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP radio_queue_high_water Most radio events ever waiting at once\n");
+    appendf(buf, len, pos, "# TYPE radio_queue_high_water gauge\nradio_queue_high_water %lu\n",
+            (unsigned long)radioHighWater.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP radio_queue_drops_total Radio events dropped because the queue was full\n");
+    appendf(buf, len, pos, "# TYPE radio_queue_drops_total counter\nradio_queue_drops_total %lu\n",
+            (unsigned long)radioDrops.load(std::memory_order_relaxed));
+    return pos;
+  }
+
+  if (family == FAMILY_RADIO_WAIT)
+  {
+    const char *name = "radio_queue_wait_us";
+    appendf(buf, len, pos, "# HELP %s Time radio events spent queued\n# TYPE %s histogram\n", name, name);
+    unsigned long cumulative = 0;
+    for (size_t b = 0; b < METRICS_LATENCY_BUCKETS; b++)
+    {
+      cumulative += radioWaitBuckets[b].load(std::memory_order_relaxed);
+      appendf(buf, len, pos, "%s_bucket{le=\"%lu\"} %lu\n", name, (unsigned long)metricsLatencyBoundsUs[b], cumulative);
+    }
+    cumulative += radioWaitBuckets[METRICS_LATENCY_BUCKETS].load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+    appendf(buf, len, pos, "%s_sum %lu\n%s_count %lu\n", name, (unsigned long)radioWaitSumUs.load(std::memory_order_relaxed), name, cumulative);
+    return pos;
+  }
+
+  if (family == FAMILY_TASKS)
+  {
+    appendf(buf, len, pos, "# HELP task_busy_us_total Time each task spent working; its rate is the task's CPU share\n");
+    appendf(buf, len, pos, "# TYPE task_busy_us_total counter\n");
+    for (size_t t = 0; t < METRICS_TASK_COUNT; t++)
+    {
+      appendf(buf, len, pos, "task_busy_us_total{task=\"%s\"} %lu\n", taskNames[t],
+              (unsigned long)taskBusyUs[t].load(std::memory_order_relaxed));
+    }
+    appendf(buf, len, pos, "# HELP task_stack_free_bytes Lowest free stack of each task since boot\n");
+    appendf(buf, len, pos, "# TYPE task_stack_free_bytes gauge\n");
+    for (size_t t = 0; t < METRICS_TASK_COUNT; t++)
+    {
+      appendf(buf, len, pos, "task_stack_free_bytes{task=\"%s\"} %lu\n", taskNames[t],
+              (unsigned long)taskStackFree[t].load(std::memory_order_relaxed));
+    }
+    return pos;
+  }
+
+  if (family == FAMILY_CHANNEL)
+  {
+    uint16_t permille = channelPermille.load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "# HELP espnow_rx_utilisation_ratio Share of the channel taken by frames received, over the last period\n");
+    appendf(buf, len, pos, "# TYPE espnow_rx_utilisation_ratio gauge\nespnow_rx_utilisation_ratio %u.%03u\n",
+            (unsigned)(permille / 1000), (unsigned)(permille % 1000));
+    appendf(buf, len, pos, "# HELP report_level Reporting level sent to the sensors; each step halves their rate\n");
+    appendf(buf, len, pos, "# TYPE report_level gauge\nreport_level %d\n", (int)reportLevel.load(std::memory_order_relaxed));
+    return pos;
+  }
+
+  if (family == FAMILY_STATS)
+  {
+    appendf(buf, len, pos, "# HELP stats_instances_without_series Sensor instances whose readings get no window statistics\n");
+    appendf(buf, len, pos, "# TYPE stats_instances_without_series gauge\nstats_instances_without_series %u\n",
+            (unsigned)statsWithoutSeries.load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "# HELP stats_instances_without_sketch Sound and smoke instances that get no quantile sketch\n");
+    appendf(buf, len, pos, "# TYPE stats_instances_without_sketch gauge\nstats_instances_without_sketch %u\n",
+            (unsigned)statsWithoutSketch.load(std::memory_order_relaxed));
+    return pos;
+  }
+
+  if (family == FAMILY_HTTP)
+  {
+    if (index == 0)
+    {
+      appendf(buf, len, pos, "# HELP http_requests_total HTTP requests served per route\n# TYPE http_requests_total counter\n");
+    }
+    else
+    {
+      appendf(buf, len, pos, "http_requests_total{route=\"%s\"} %lu\n", routes[index - 1],
+              (unsigned long)routeRequests[index - 1].load(std::memory_order_relaxed));
+    }
+    return pos;
+  }
+
+  const char *name = sensorFamilies[family][0];
+  if (index == 0)
+  {
+    appendf(buf, len, pos, "# HELP %s %s\n# TYPE %s %s\n", name, sensorFamilies[family][2], name, sensorFamilies[family][1]);
+    return pos;
+  }
+
+  uint16_t id = index - 1;
+  uint8_t type = sensorType[id].load(std::memory_order_relaxed);
+  if (type == 0)
+  {
+    return 0; // Slot never used
+  }
+
+  char labels[48];
+  snprintf(labels, sizeof(labels), "sensor=\"%u\",type=\"%s\"", (unsigned)id, sensorTypeName(type));
+
+  switch (family)
+  {
+  case FAMILY_FRAMES:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)framesReceived[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_BYTES:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)bytesReceived[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_SEQ_GAPS:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)seqGaps[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_DUPLICATES:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)duplicates[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_RSSI:
+    appendf(buf, len, pos, "%s{%s} %ld\n", name, labels, (long)lastRssi[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_AGE:
+  {
+    uint32_t ageMs = nowMs - lastFrameMs[id].load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "%s{%s} %lu.%03lu\n", name, labels, (unsigned long)(ageMs / 1000), (unsigned long)(ageMs % 1000));
+    break;
+  }
+  case FAMILY_SEND_FAILURES:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)sendFailures[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_TX_RATE:
+  {
+    // Left out until a frame has been sent to the sensor
+    unsigned kbps = txRateKbps[id].load(std::memory_order_relaxed);
+    if (kbps != 0)
+    {
+      appendf(buf, len, pos, "%s{%s} %u\n", name, labels, kbps);
+    }
+    break;
+  }
+  case FAMILY_DELIVERY:
+  {
+    if (txRateKbps[id].load(std::memory_order_relaxed) == 0)
+    {
+      break;
+    }
+    unsigned permille = deliveryPermille[id].load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "%s{%s} %u.%03u\n", name, labels, permille / 1000, permille % 1000);
+    break;
+  }
+  case FAMILY_AIRTIME:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)txAirtimeUs[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_AIRTIME_SAVED:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)txAirtimeSavedUs[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_BACKLOG_READINGS:
+    appendf(buf, len, pos, "%s{%s} %lu\n", name, labels, (unsigned long)backlogReadings[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_BACKLOG_DEPTH:
+    appendf(buf, len, pos, "%s{%s} %u\n", name, labels, (unsigned)backlogDepth[id].load(std::memory_order_relaxed));
+    break;
+  case FAMILY_LATENCY:
+  {
+    unsigned long cumulative = 0;
+    for (size_t b = 0; b < METRICS_LATENCY_BUCKETS; b++)
+    {
+      cumulative += latencyBuckets[id][b].load(std::memory_order_relaxed);
+      appendf(buf, len, pos, "%s_bucket{%s,le=\"%lu\"} %lu\n", name, labels, (unsigned long)metricsLatencyBoundsUs[b], cumulative);
+    }
+    cumulative += latencyBuckets[id][METRICS_LATENCY_BUCKETS].load(std::memory_order_relaxed);
+    appendf(buf, len, pos, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, cumulative);
+    appendf(buf, len, pos, "%s_sum{%s} %lu\n", name, labels, (unsigned long)latencySumUs[id].load(std::memory_order_relaxed));
+    appendf(buf, len, pos, "%s_count{%s} %lu\n", name, labels, cumulative);
+    break;
+  }
+  }
+  return pos;
+}
+
+// Cut a unit that filled its buffer back to whole lines and say so, so a
+// scrape never sees half a sample
+size_t Metrics::markTruncated(char *buf, size_t len, uint16_t family, uint16_t index) const
+{
+  static const size_t noteMax = 64;
+  unitsTruncated.fetch_add(1, std::memory_order_relaxed);
+  size_t pos = len > noteMax ? len - noteMax : 0;
+  while (pos > 0 && buf[pos - 1] != '\n')
+  {
+    pos--;
+  }
+  appendf(buf, len, pos, "# truncated: family %u item %u\n", (unsigned)family, (unsigned)index);
+  return pos;
+}
+
+size_t Metrics::format(char *buf, size_t len, metrics_cursor *cursor, uint32_t nowMs) const
+{
+  size_t pos = 0;
+
+  while (true)
+  {
+    // Finish copying out the current unit first
+    if (cursor->unitSent < cursor->unitLen)
+    {
+      size_t n = cursor->unitLen - cursor->unitSent;
+      if (n > len - pos)
+      {
+        n = len - pos;
+      }
+      memcpy(buf + pos, cursor->unit + cursor->unitSent, n);
+      pos += n;
+      cursor->unitSent += n;
+      if (cursor->unitSent < cursor->unitLen)
+      {
+        return pos;
+      }
+    }
+
+    if (cursor->family >= FAMILY_COUNT)
+    {
+      return pos;
+    }
+    if (familyDone(cursor->family, cursor->index))
+    {
+      cursor->family++;
+      cursor->index = 0;
+      continue;
+    }
+
+    cursor->unitLen = formatUnit(cursor->unit, sizeof(cursor->unit), cursor->family, cursor->index, nowMs);
+    if ((size_t)cursor->unitLen + 1 >= sizeof(cursor->unit))
+    {
+      cursor->unitLen = markTruncated(cursor->unit, sizeof(cursor->unit), cursor->family, cursor->index);
+    }
+    cursor->unitSent = 0;
+    cursor->index++;
+  }
+}
@@ -0,0 +1,171 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Radio, pipeline and HTTP counters served on /metrics in the Prometheus
+// text format. Counters are relaxed atomics so the ESP-NOW callbacks can
+// update them without taking a lock, and format() writes into a caller
+// buffer so serving them never builds a String.
+
+#ifndef METRICS_MAX_SENSORS
+#define METRICS_MAX_SENSORS 256 // Matches PEER_TABLE_MAX
+#endif
+
+#ifndef METRICS_MAX_ROUTES
+#define METRICS_MAX_ROUTES 24
+#endif
+
+// Upper bounds (microseconds) of the receive-to-dispatch latency buckets
+#define METRICS_LATENCY_BUCKETS 8
+extern const uint32_t metricsLatencyBoundsUs[METRICS_LATENCY_BUCKETS];
+
+// Tasks whose busy time and stack are reported
+enum metrics_task
+{
+  METRICS_TASK_RADIO, // Frame processing and rule evaluation
+  METRICS_TASK_HTTP,  // Web handlers (async_tcp)
+  METRICS_TASK_COUNT
+};
+
+// Largest block of text format() emits in one piece. A block that does
+// not fit is cut back to whole lines, ends with a "# truncated" comment
+// and counts in metrics_truncated_units_total.
+#ifndef METRICS_UNIT_MAX
+#define METRICS_UNIT_MAX 1024 // A latency histogram of a 4-digit sensor ID with 10-digit counts is 896
+#endif
+
+// Position in the output between format() calls
+typedef struct metrics_cursor
+{
+  uint16_t family;   // Metric family being written
+  uint16_t index;    // Sensor or route within the family
+  uint16_t unitLen;  // Bytes held in unit
+  uint16_t unitSent; // Bytes of unit already copied out
+  char unit[METRICS_UNIT_MAX];
+} metrics_cursor;
+
+class Metrics
+{
+public:
+  Metrics();
+
+  // A reading frame arrived from sensor id. hasSeq is false for frames
+  // without a header; rssi is 0 when unknown.
+  void onFrame(uint16_t id, uint8_t sensorType, size_t bytes, bool hasSeq, uint16_t seq, int8_t rssi, uint32_t nowMs);
+
+  // The frame from sensor id was fully handled latencyUs after it arrived
+  void onDispatched(uint16_t id, uint32_t latencyUs);
+
+  // Sensor id forwarded readings it held through an outage, and holds
+  // remaining more
+  void onBacklog(uint16_t id, uint8_t readings, uint16_t remaining);
+
+  // Zero the counters of sensor id, as when its peer ID is given to another sensor
+  void clear(uint16_t id);
+
+  // A frame from a sender that is not paired
+  void onUnknownFrame();
+
+  // Outgoing unicast frames: queued with the driver, then completed
+  void onSendQueued();
+  void onSendCompleted(int id, bool delivered);
+
+  // esp_now_send() refused a frame for sensor id
+  void onSendRejected(int id);
+
+  // State of the link to sensor id after a send or its result: the rate of
+  // the next frame, the smoothed delivery ratio, and the modelled airtime of
+  // the frames sent so far against the same frames at 1 Mbit/s
+  void setLink(int id, uint16_t rateKbps, uint16_t deliveryPermille, uint32_t airtimeUs, uint32_t baselineUs);
+
+  // Receive airtime share of the channel and the reporting level chosen from it
+  void setChannel(uint16_t utilisationPermille, int8_t level);
+
+  // Sensor instances the window statistics had no slot, or no quantile sketch, for
+  void setStatsMissing(uint16_t withoutSeries, uint16_t withoutSketch);
+
+  // Register an HTTP route at setup; returns the index for countRequest().
+  // Registering the same path twice returns the same index.
+  int registerRoute(const char *path);
+  void countRequest(int route);
+
+  // Heap statistics, sampled just before formatting
+  void setHeap(uint32_t freeBytes, uint32_t minFreeBytes, uint32_t maxAllocBytes);
+
+  // Radio event queue between the Wi-Fi task and the radio task: an event
+  // was queued (depth after queuing), refused because the queue was full,
+  // or taken off waitUs after it was queued
+  void onRadioQueued(uint32_t depth);
+  void onRadioDropped();
+  void onRadioDequeued(uint32_t waitUs);
+  void setRadioQueueDepth(uint32_t depth);
+
+  // Time a task spent working, and its lowest free stack, sampled before formatting
+  void addTaskBusy(uint8_t task, uint32_t busyUs);
+  void setTaskStack(uint8_t task, uint32_t freeBytes);
+
+  // Write the next part of the text exposition into buf. Returns the bytes
+  // written, or 0 once everything has been written.
+  size_t format(char *buf, size_t len, metrics_cursor *cursor, uint32_t nowMs) const;
+
+private:
+  size_t formatUnit(char *buf, size_t len, uint16_t family, uint16_t index, uint32_t nowMs) const;
+  bool familyDone(uint16_t family, uint16_t index) const;
+  size_t markTruncated(char *buf, size_t len, uint16_t family, uint16_t index) const;
+
+  // Per sensor, indexed by peer ID
+  std::atomic<uint8_t> sensorType[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> framesReceived[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> bytesReceived[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> seqGaps[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> duplicates[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> sendFailures[METRICS_MAX_SENSORS];
+  std::atomic<uint16_t> txRateKbps[METRICS_MAX_SENSORS];
+  std::atomic<uint16_t> deliveryPermille[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> txAirtimeUs[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> txAirtimeSavedUs[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> backlogReadings[METRICS_MAX_SENSORS];
+  std::atomic<uint16_t> backlogDepth[METRICS_MAX_SENSORS];
+  std::atomic<int32_t> lastRssi[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> lastFrameMs[METRICS_MAX_SENSORS];
+  std::atomic<uint32_t> latencyBuckets[METRICS_MAX_SENSORS][METRICS_LATENCY_BUCKETS + 1];
+  std::atomic<uint32_t> latencySumUs[METRICS_MAX_SENSORS];
+  uint16_t lastSeq[METRICS_MAX_SENSORS]; // Only touched by the radio task
+  std::atomic<uint16_t> sensorSlots;     // Highest sensor ID seen + 1
+
+  // Global
+  std::atomic<uint32_t> unknownFrames;
+  std::atomic<uint32_t> txQueued;
+  std::atomic<uint32_t> txCompleted;
+  std::atomic<uint32_t> heapFree;
+  std::atomic<uint32_t> heapMinFree;
+  std::atomic<uint32_t> heapMaxAlloc;
+  mutable std::atomic<uint32_t> unitsTruncated; // Counted by format()
+
+  // Radio pipeline
+  std::atomic<uint32_t> radioDepth;
+  std::atomic<uint32_t> radioHighWater;
+  std::atomic<uint32_t> radioDrops;
+  std::atomic<uint32_t> radioWaitBuckets[METRICS_LATENCY_BUCKETS + 1];
+  std::atomic<uint32_t> radioWaitSumUs;
+  std::atomic<uint32_t> taskBusyUs[METRICS_TASK_COUNT];
+  std::atomic<uint32_t> taskStackFree[METRICS_TASK_COUNT];
+
+  // Channel load and reporting-rate control
+  std::atomic<uint16_t> channelPermille;
+  std::atomic<int8_t> reportLevel;
+
+  // Window statistics pools
+  std::atomic<uint16_t> statsWithoutSeries;
+  std::atomic<uint16_t> statsWithoutSketch;
+
+  // HTTP
+  const char *routes[METRICS_MAX_ROUTES];
+  std::atomic<uint32_t> routeRequests[METRICS_MAX_ROUTES];
+  uint16_t routeCount;
+};
+
+#endif
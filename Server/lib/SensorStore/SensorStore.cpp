@@ -0,0 +1,178 @@
+#include "SensorStore.h"
+
+#include <string.h>
+
+SensorStore::SensorStore() : used(0)
+{
+  memset(type, 0, sizeof(type));
+  memset(frames, 0, sizeof(frames));
+  for (size_t id = 0; id < SENSOR_STORE_MAX; id++)
+  {
+    version[id].store(0, std::memory_order_relaxed);
+  }
+}
+
+// Wait out a write in progress and return the even version to read under
+uint32_t SensorStore::readBegin(uint16_t id) const
+{
+  uint32_t seq = version[id].load(std::memory_order_acquire);
+  while (seq & 1)
+  {
+    seq = version[id].load(std::memory_order_acquire);
+  }
+  return seq;
+}
+
+// Whether a write overlapped reads that started at version seq
+bool SensorStore::readRetry(uint16_t id, uint32_t seq) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return version[id].load(std::memory_order_relaxed) != seq;
+}
+
+void SensorStore::update(uint16_t id, uint8_t sensorType, uint8_t sensorZone, int32_t sensorValue,
+                         const char *sensorStatus, uint8_t sensorFlags, uint32_t nowMs)
+{
+  if (id >= SENSOR_STORE_MAX)
+  {
+    return;
+  }
+
+  uint32_t seq = version[id].load(std::memory_order_relaxed);
+  version[id].store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  type[id] = sensorType;
+  zone[id] = sensorZone;
+  flags[id] = sensorFlags;
+  value[id] = sensorValue;
+  lastSeenMs[id] = nowMs;
+  frames[id]++;
+  strncpy(status[id], sensorStatus, SENSOR_STATUS_LEN - 1);
+  status[id][SENSOR_STATUS_LEN - 1] = '\0';
+
+  version[id].store(seq + 2, std::memory_order_release);
+
+  if (id >= used.load(std::memory_order_relaxed))
+  {
+    used.store(id + 1, std::memory_order_release);
+  }
+}
+
+void SensorStore::clear(uint16_t id)
+{
+  if (id >= SENSOR_STORE_MAX)
+  {
+    return;
+  }
+
+  uint32_t seq = version[id].load(std::memory_order_relaxed);
+  version[id].store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  type[id] = 0;
+  zone[id] = 0;
+  flags[id] = 0;
+  value[id] = 0;
+  lastSeenMs[id] = 0;
+  frames[id] = 0;
+  status[id][0] = '\0';
+
+  version[id].store(seq + 2, std::memory_order_release);
+}
+
+bool SensorStore::snapshot(uint16_t id, sensor_snapshot *out) const
+{
+  if (id >= size())
+  {
+    return false;
+  }
+
+  uint32_t seq;
+  do
+  {
+    seq = readBegin(id);
+    out->type = type[id];
+    out->zone = zone[id];
+    out->flags = flags[id];
+    out->value = value[id];
+    out->lastSeenMs = lastSeenMs[id];
+    out->frames = frames[id];
+    memcpy(out->status, status[id], SENSOR_STATUS_LEN);
+  } while (readRetry(id, seq));
+
+  out->status[SENSOR_STATUS_LEN - 1] = '\0';
+  return out->type != 0;
+}
+
+int SensorStore::latestOfType(uint8_t sensorType) const
+{
+  int latest = -1;
+  uint32_t latestMs = 0;
+  size_t count = size();
+  for (size_t id = 0; id < count; id++)
+  {
+    uint8_t t;
+    uint32_t seenMs;
+    uint32_t seq;
+    do
+    {
+      seq = readBegin(id);
+      t = type[id];
+      seenMs = lastSeenMs[id];
+    } while (readRetry(id, seq));
+
+    if (t == sensorType && (latest < 0 || (int32_t)(seenMs - latestMs) > 0))
+    {
+      latest = (int)id;
+      latestMs = seenMs;
+    }
+  }
+  return latest;
+}
+
+void SensorStore::aggregateZones(uint8_t sensorType, zone_summary *zones, size_t zoneCount) const
+{
+  memset(zones, 0, zoneCount * sizeof(zone_summary));
+
+  size_t count = size();
+  for (size_t id = 0; id < count; id++)
+  {
+    uint8_t t, z;
+    int32_t v;
+    uint32_t seenMs;
+    uint32_t seq;
+    do
+    {
+      seq = readBegin(id);
+      t = type[id];
+      z = zone[id];
+      v = value[id];
+      seenMs = lastSeenMs[id];
+    } while (readRetry(id, seq));
+
+    if (t != sensorType || z >= zoneCount)
+    {
+      continue;
+    }
+
+    zone_summary &summary = zones[z];
+    if (summary.count == 0)
+    {
+      summary.min = v;
+      summary.max = v;
+      summary.newest = seenMs;
+    }
+    else
+    {
+      summary.min = v < summary.min ? v : summary.min;
+      summary.max = v > summary.max ? v : summary.max;
+      if ((int32_t)(seenMs - summary.newest) > 0)
+      {
+        summary.newest = seenMs;
+      }
+    }
+    summary.sum += v;
+    summary.count++;
+  }
+}
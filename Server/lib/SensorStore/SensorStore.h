@@ -0,0 +1,92 @@
+#ifndef SENSOR_STORE_H
+#define SENSOR_STORE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Latest state of every sensor instance, indexed by peer ID.
+// Fields are kept as separate arrays (struct-of-arrays) so scans over one
+// field, such as "all smoke values in zone 3", touch only that field's
+// cache lines. Status strings are stored apart from the numeric fields.
+//
+// update() runs in the Server's radio task while the async web
+// handlers read from another task. Each slot is guarded by a seqlock: the
+// writer makes the slot's version odd while it writes and even again when
+// done, and readers retry until they copied a slot under one even version.
+// Readers never block the writer; there is a single writer.
+
+#ifndef SENSOR_STORE_MAX
+#define SENSOR_STORE_MAX 256 // Matches PEER_TABLE_MAX
+#endif
+
+#define SENSOR_STATUS_LEN 20
+
+// Flag bits kept per instance
+#define SENSOR_FLAG_BLINK 0x01 // Smoke sensor asked for LEDs to blink
+
+// Consistent copy of one slot
+typedef struct sensor_snapshot
+{
+  uint8_t type;
+  uint8_t zone;
+  uint8_t flags;
+  int32_t value;
+  uint32_t lastSeenMs;
+  uint32_t frames;
+  char status[SENSOR_STATUS_LEN];
+} sensor_snapshot;
+
+typedef struct zone_summary
+{
+  uint16_t count;  // Instances of the type seen in the zone
+  int32_t min;     // Lowest latest value
+  int32_t max;     // Highest latest value
+  int64_t sum;     // Sum of latest values, for the mean
+  uint32_t newest; // Most recent lastSeenMs in the zone
+} zone_summary;
+
+class SensorStore
+{
+public:
+  SensorStore();
+
+  // Record a reading from sensor instance id
+  void update(uint16_t id, uint8_t sensorType, uint8_t sensorZone, int32_t sensorValue,
+              const char *sensorStatus, uint8_t sensorFlags, uint32_t nowMs);
+
+  // Number of slots in use (highest ID seen + 1); unused slots have type 0
+  size_t size() const { return used.load(std::memory_order_acquire); }
+
+  // Empty slot id, as when its peer ID is given to another sensor
+  void clear(uint16_t id);
+
+  // Copy slot id as written by a single update(); false for unused slots
+  bool snapshot(uint16_t id, sensor_snapshot *out) const;
+
+  // Instance of the given type with the most recent reading, or -1
+  int latestOfType(uint8_t sensorType) const;
+
+  // Summarise the latest values of one sensor type per zone. zones[z]
+  // receives the summary for zone z; zones beyond zoneCount are ignored.
+  void aggregateZones(uint8_t sensorType, zone_summary *zones, size_t zoneCount) const;
+
+  // Per-instance columns, valid for ids below size(). Written under the
+  // slot's version; read them from other tasks through snapshot().
+  uint8_t type[SENSOR_STORE_MAX];
+  uint8_t zone[SENSOR_STORE_MAX];
+  uint8_t flags[SENSOR_STORE_MAX];
+  int32_t value[SENSOR_STORE_MAX];
+  uint32_t lastSeenMs[SENSOR_STORE_MAX];
+  uint32_t frames[SENSOR_STORE_MAX];
+  char status[SENSOR_STORE_MAX][SENSOR_STATUS_LEN];
+
+private:
+  uint32_t readBegin(uint16_t id) const;
+  bool readRetry(uint16_t id, uint32_t seq) const;
+
+  std::atomic<uint32_t> version[SENSOR_STORE_MAX];
+  std::atomic<size_t> used;
+};
+
+#endif
@@ -0,0 +1,434 @@
+#include "Stats.h"
+
+#include <Pairing.h>
+#include <math.h>
+#include <string.h>
+
+// Sketch bins: one per value below STATS_EXACT, then each about 10% wider
+// than the one before
+#define STATS_EXACT 20
+#define STATS_GROWTH 1.1f
+
+static const uint32_t windowLengths[STATS_WINDOWS] = {60000, 600000, 3600000};
+static int32_t binLower[STATS_SKETCH_BINS]; // Lowest value of each bin
+
+static void buildBins()
+{
+  float bound = STATS_EXACT;
+  for (int32_t i = 0; i < STATS_SKETCH_BINS; i++)
+  {
+    if (i < STATS_EXACT)
+    {
+      binLower[i] = i;
+      continue;
+    }
+    int32_t lower = (int32_t)ceilf(bound);
+    binLower[i] = lower > binLower[i - 1] ? lower : binLower[i - 1] + 1;
+    bound *= STATS_GROWTH;
+  }
+}
+
+static uint8_t binOf(int32_t value)
+{
+  if (value <= 0)
+  {
+    return 0;
+  }
+  if (value < STATS_EXACT)
+  {
+    return (uint8_t)value;
+  }
+  // Last bin whose lower bound is at most value
+  uint8_t low = STATS_EXACT, high = STATS_SKETCH_BINS - 1;
+  while (low < high)
+  {
+    uint8_t mid = (uint8_t)((low + high + 1) / 2);
+    if (binLower[mid] <= value)
+    {
+      low = mid;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+  return low;
+}
+
+// Middle of the values bin i holds
+static int32_t binValue(uint8_t i)
+{
+  if (i < STATS_EXACT || i == STATS_SKETCH_BINS - 1)
+  {
+    return binLower[i];
+  }
+  return (binLower[i] + binLower[i + 1] - 1) / 2;
+}
+
+uint32_t statsWindowMs(uint8_t window)
+{
+  return window < STATS_WINDOWS ? windowLengths[window] : 0;
+}
+
+bool statsSketched(uint8_t sensorType)
+{
+  return sensorType == SENSOR_SOUND || sensorType == SENSOR_SMOKE;
+}
+
+WindowStats::WindowStats() : seriesMissing(0), sketchesMissing(0)
+{
+  buildBins();
+  memset(series, 0, sizeof(series));
+  memset(sketches, 0, sizeof(sketches));
+  for (size_t slot = 0; slot < STATS_MAX_SERIES; slot++)
+  {
+    version[slot].store(0, std::memory_order_relaxed);
+    slotUsed[slot] = false;
+    slotType[slot] = 0;
+    slotLastMs[slot] = 0;
+  }
+  for (size_t sketch = 0; sketch < STATS_MAX_SKETCHES; sketch++)
+  {
+    sketchUsed[sketch] = false;
+  }
+  for (size_t id = 0; id < STATS_MAX_IDS; id++)
+  {
+    slotOf[id].store(STATS_NONE, std::memory_order_relaxed);
+    missingOf[id].store(0, std::memory_order_relaxed);
+  }
+}
+
+void WindowStats::writeBegin(uint8_t slot)
+{
+  version[slot].store(version[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void WindowStats::writeEnd(uint8_t slot)
+{
+  version[slot].store(version[slot].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void WindowStats::setMissing(uint16_t id, uint8_t bits)
+{
+  uint8_t previous = missingOf[id].load(std::memory_order_relaxed);
+  if (bits == previous)
+  {
+    return;
+  }
+  // Only the writer changes the counts, so a load and a store will do
+  if ((bits ^ previous) & STATS_MISSING_SERIES)
+  {
+    uint16_t n = seriesMissing.load(std::memory_order_relaxed);
+    seriesMissing.store(bits & STATS_MISSING_SERIES ? n + 1 : n - 1, std::memory_order_relaxed);
+  }
+  if ((bits ^ previous) & STATS_MISSING_SKETCH)
+  {
+    uint16_t n = sketchesMissing.load(std::memory_order_relaxed);
+    sketchesMissing.store(bits & STATS_MISSING_SKETCH ? n + 1 : n - 1, std::memory_order_relaxed);
+  }
+  missingOf[id].store(bits, std::memory_order_relaxed);
+}
+
+uint8_t WindowStats::missing(uint16_t id) const
+{
+  return id < STATS_MAX_IDS ? missingOf[id].load(std::memory_order_relaxed) : 0;
+}
+
+void WindowStats::freeSeries(uint8_t slot)
+{
+  slotOf[series[slot].id].store(STATS_NONE, std::memory_order_release);
+  writeBegin(slot);
+  if (series[slot].sketch != STATS_NONE)
+  {
+    sketchUsed[series[slot].sketch] = false;
+    series[slot].sketch = STATS_NONE;
+  }
+  series[slot].id = 0xffff;
+  writeEnd(slot);
+  slotUsed[slot] = false;
+}
+
+// A free slot, or for smoke the slot of the least recently updated
+// instance of another type; STATS_NONE if there is neither
+uint8_t WindowStats::allocateSeries(uint8_t sensorType)
+{
+  uint8_t victim = STATS_NONE;
+  for (uint8_t slot = 0; slot < STATS_MAX_SERIES; slot++)
+  {
+    if (!slotUsed[slot])
+    {
+      return slot;
+    }
+    if (slotType[slot] != SENSOR_SMOKE && (victim == STATS_NONE || slotLastMs[slot] < slotLastMs[victim]))
+    {
+      victim = slot;
+    }
+  }
+  if (sensorType != SENSOR_SMOKE || victim == STATS_NONE)
+  {
+    return STATS_NONE;
+  }
+  uint16_t evicted = series[victim].id;
+  freeSeries(victim);
+  setMissing(evicted, STATS_MISSING_SERIES);
+  return victim;
+}
+
+// A free sketch, or for smoke the sketch of the least recently updated
+// sound instance; STATS_NONE if there is neither
+uint8_t WindowStats::allocateSketch(uint8_t sensorType)
+{
+  for (uint8_t sketch = 0; sketch < STATS_MAX_SKETCHES; sketch++)
+  {
+    if (!sketchUsed[sketch])
+    {
+      sketchUsed[sketch] = true;
+      return sketch;
+    }
+  }
+  if (sensorType != SENSOR_SMOKE)
+  {
+    return STATS_NONE;
+  }
+  uint8_t victim = STATS_NONE;
+  for (uint8_t slot = 0; slot < STATS_MAX_SERIES; slot++)
+  {
+    if (slotUsed[slot] && slotType[slot] == SENSOR_SOUND && series[slot].sketch != STATS_NONE &&
+        (victim == STATS_NONE || slotLastMs[slot] < slotLastMs[victim]))
+    {
+      victim = slot;
+    }
+  }
+  if (victim == STATS_NONE)
+  {
+    return STATS_NONE;
+  }
+  uint8_t sketch = series[victim].sketch;
+  writeBegin(victim);
+  series[victim].sketch = STATS_NONE;
+  writeEnd(victim);
+  setMissing(series[victim].id, STATS_MISSING_SKETCH);
+  return sketch;
+}
+
+void WindowStats::add(uint16_t id, uint8_t sensorType, uint32_t nowMs, int32_t value)
+{
+  if (id >= STATS_MAX_IDS)
+  {
+    return;
+  }
+  uint8_t slot = slotOf[id].load(std::memory_order_relaxed);
+  if (slot == STATS_NONE)
+  {
+    slot = allocateSeries(sensorType);
+    if (slot == STATS_NONE)
+    {
+      setMissing(id, STATS_MISSING_SERIES);
+      return;
+    }
+    slotUsed[slot] = true;
+    slotType[slot] = sensorType;
+    writeBegin(slot);
+    memset(&series[slot], 0, sizeof(series[slot]));
+    series[slot].id = id;
+    series[slot].sketch = STATS_NONE;
+    writeEnd(slot);
+    slotOf[id].store(slot, std::memory_order_release);
+  }
+  slotLastMs[slot] = nowMs;
+
+  stats_series &s = series[slot];
+  // Retried on every reading until one frees up or, for smoke, is taken over
+  uint8_t sketch = s.sketch;
+  if (sketch == STATS_NONE && statsSketched(sensorType))
+  {
+    sketch = allocateSketch(sensorType);
+  }
+  setMissing(id, statsSketched(sensorType) && sketch == STATS_NONE ? STATS_MISSING_SKETCH : 0);
+
+  writeBegin(slot);
+  if (sketch != s.sketch)
+  {
+    memset(&sketches[sketch], 0, sizeof(sketches[sketch]));
+    s.sketch = sketch;
+  }
+  for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+  {
+    uint32_t period = nowMs / (windowLengths[w] / STATS_BUCKETS);
+    stats_bucket &bucket = s.buckets[w][period % STATS_BUCKETS];
+    if (bucket.count == 0 || bucket.period != period)
+    {
+      bucket.period = period;
+      bucket.count = 0;
+      bucket.min = value;
+      bucket.max = value;
+      bucket.sum = 0;
+      bucket.sumSquares = 0;
+    }
+    bucket.count++;
+    bucket.min = value < bucket.min ? value : bucket.min;
+    bucket.max = value > bucket.max ? value : bucket.max;
+    bucket.sum += value;
+    bucket.sumSquares += (int64_t)value * value;
+  }
+  if (s.sketch != STATS_NONE)
+  {
+    uint32_t period = nowMs / STATS_SKETCH_MS;
+    stats_sketch_half &half = sketches[s.sketch].halves[period % 2];
+    if (half.count == 0 || half.period != period)
+    {
+      memset(&half, 0, sizeof(half));
+      half.period = period;
+    }
+    uint8_t bin = binOf(value);
+    if (half.bins[bin] < 0xffff)
+    {
+      half.bins[bin]++;
+      half.count++;
+    }
+  }
+  writeEnd(slot);
+}
+
+void WindowStats::clear(uint16_t id)
+{
+  if (id >= STATS_MAX_IDS)
+  {
+    return;
+  }
+  setMissing(id, 0);
+  uint8_t slot = slotOf[id].load(std::memory_order_relaxed);
+  if (slot != STATS_NONE)
+  {
+    freeSeries(slot);
+  }
+}
+
+// Window w of one slot as of nowMs
+static void statsSummarise(const stats_series *series, uint8_t window, uint32_t nowMs, stats_summary *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->windowMs = statsWindowMs(window);
+  if (window >= STATS_WINDOWS)
+  {
+    return;
+  }
+
+  uint32_t period = nowMs / (windowLengths[window] / STATS_BUCKETS);
+  int64_t sum = 0, sumSquares = 0;
+  for (size_t i = 0; i < STATS_BUCKETS; i++)
+  {
+    const stats_bucket &bucket = series->buckets[window][i];
+    if (bucket.count == 0 || period - bucket.period >= STATS_BUCKETS)
+    {
+      continue;
+    }
+    out->min = out->count == 0 || bucket.min < out->min ? bucket.min : out->min;
+    out->max = out->count == 0 || bucket.max > out->max ? bucket.max : out->max;
+    out->count += bucket.count;
+    sum += bucket.sum;
+    sumSquares += bucket.sumSquares;
+  }
+  if (out->count > 0)
+  {
+    double mean = (double)sum / out->count;
+    double variance = (double)sumSquares / out->count - mean * mean;
+    out->mean = (float)mean;
+    out->stddev = variance > 0 ? (float)sqrt(variance) : 0;
+  }
+}
+
+// Quantiles of one sketch as of nowMs; false if there is none
+static bool statsQuantiles(const stats_sketch *sketch, uint32_t nowMs, stats_quantiles *out)
+{
+  memset(out, 0, sizeof(*out));
+  if (sketch == nullptr)
+  {
+    return false;
+  }
+
+  // Both halves, while they are of the current or the previous period
+  uint32_t period = nowMs / STATS_SKETCH_MS;
+  uint32_t counts[STATS_SKETCH_BINS] = {0};
+  for (size_t h = 0; h < 2; h++)
+  {
+    const stats_sketch_half &half = sketch->halves[h];
+    if (half.count == 0 || period - half.period >= 2)
+    {
+      continue;
+    }
+    for (size_t i = 0; i < STATS_SKETCH_BINS; i++)
+    {
+      counts[i] += half.bins[i];
+    }
+    out->count += half.count;
+  }
+  if (out->count == 0)
+  {
+    return true;
+  }
+
+  // Nearest rank: the smallest value with at least q of the readings at or below it
+  static const uint16_t permille[3] = {500, 950, 990};
+  int32_t *results[3] = {&out->p50, &out->p95, &out->p99};
+  uint32_t seen = 0;
+  uint8_t q = 0;
+  for (uint8_t i = 0; i < STATS_SKETCH_BINS && q < 3; i++)
+  {
+    seen += counts[i];
+    while (q < 3 && (uint64_t)seen * 1000 >= (uint64_t)out->count * permille[q])
+    {
+      *results[q++] = binValue(i);
+    }
+  }
+  return true;
+}
+
+// Run read(series) on id's slot until it ran under one even version;
+// false if id has no slot
+template <typename Read>
+static bool readSlot(const std::atomic<uint32_t> &version, const stats_series &series, uint16_t id, Read read)
+{
+  uint32_t seq;
+  bool owned;
+  do
+  {
+    seq = version.load(std::memory_order_acquire);
+    while (seq & 1)
+    {
+      seq = version.load(std::memory_order_acquire);
+    }
+    owned = series.id == id;
+    if (owned)
+    {
+      read(series);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (version.load(std::memory_order_relaxed) != seq);
+  return owned;
+}
+
+bool WindowStats::summary(uint16_t id, uint8_t window, uint32_t nowMs, stats_summary *out) const
+{
+  uint8_t slot = id < STATS_MAX_IDS ? slotOf[id].load(std::memory_order_acquire) : STATS_NONE;
+  if (slot == STATS_NONE || window >= STATS_WINDOWS)
+  {
+    return false;
+  }
+  return readSlot(version[slot], series[slot], id, [&](const stats_series &s)
+                  { statsSummarise(&s, window, nowMs, out); });
+}
+
+bool WindowStats::quantiles(uint16_t id, uint32_t nowMs, stats_quantiles *out) const
+{
+  uint8_t slot = id < STATS_MAX_IDS ? slotOf[id].load(std::memory_order_acquire) : STATS_NONE;
+  bool sketched = false;
+  if (slot == STATS_NONE)
+  {
+    return false;
+  }
+  return readSlot(version[slot], series[slot], id, [&](const stats_series &s)
+                  { sketched = statsQuantiles(s.sketch != STATS_NONE ? &sketches[s.sketch] : nullptr, nowMs, out); }) &&
+         sketched;
+}
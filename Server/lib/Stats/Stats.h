@@ -0,0 +1,155 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sliding-window statistics of the readings of each sensor instance,
+// indexed by peer ID.
+//
+// Each window is split into STATS_BUCKETS buckets of equal length; a
+// reading goes into the bucket of its time, clearing it first if it last
+// held an older period, so adding one costs the same however many
+// readings the window holds. A window's statistics combine the buckets of
+// the last STATS_BUCKETS periods, so the window slides a bucket at a time
+// and covers between 5/6 and all of its length.
+//
+// Sound and smoke readings also go into a quantile sketch: a histogram
+// over logarithmic bins, which estimates any quantile within about 5% of
+// the value (exactly for values below 20) in fixed memory. It keeps two
+// halves of STATS_SKETCH_MS each and answers from both, covering the last
+// 5 to 10 minutes.
+//
+// Instances get a slot on their first reading while slots are free, and
+// sound and smoke instances a sketch from a smaller pool while sketches are
+// free; clear() returns both, so memory follows the sensors that joined
+// rather than PEER_TABLE_MAX. The smoke trend rule needs both, so a smoke
+// instance that finds a pool empty takes the slot of the least recently
+// updated instance of another type, or the sketch of the least recently
+// updated sound instance. Instances left without either are counted for
+// /status/stats and /metrics. add() runs in the Server's radio task;
+// readers in other tasks work from a slot, and its sketch, under a seqlock
+// like the SensorStore slots, retrying if add() touched it.
+
+#ifndef STATS_MAX_SERIES
+#define STATS_MAX_SERIES 16 // Instances with statistics
+#endif
+
+#ifndef STATS_MAX_SKETCHES
+#define STATS_MAX_SKETCHES 8 // Instances with quantiles
+#endif
+
+#ifndef STATS_MAX_IDS
+#define STATS_MAX_IDS 256 // Matches PEER_TABLE_MAX
+#endif
+
+#define STATS_WINDOWS 3   // 1 minute, 10 minutes, 1 hour
+#define STATS_BUCKETS 6
+#define STATS_SKETCH_BINS 96
+#define STATS_SKETCH_MS 300000
+#define STATS_NONE 0xff // No slot
+
+// What an instance is missing, for missing()
+#define STATS_MISSING_SERIES 0x01 // Its readings are not being kept
+#define STATS_MISSING_SKETCH 0x02 // A sound or smoke instance without quantiles
+
+typedef struct stats_summary
+{
+  uint32_t windowMs;
+  uint32_t count; // Readings in the window
+  int32_t min;
+  int32_t max;
+  float mean;
+  float stddev;
+} stats_summary;
+
+typedef struct stats_quantiles
+{
+  uint32_t count; // Readings in the sketch
+  int32_t p50;
+  int32_t p95;
+  int32_t p99;
+} stats_quantiles;
+
+typedef struct stats_bucket
+{
+  uint32_t period; // Time / bucket length when the bucket was started
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+  int64_t sumSquares;
+} stats_bucket;
+
+typedef struct stats_sketch_half
+{
+  uint32_t period; // Time / STATS_SKETCH_MS
+  uint32_t count;
+  uint16_t bins[STATS_SKETCH_BINS];
+} stats_sketch_half;
+
+typedef struct stats_sketch
+{
+  stats_sketch_half halves[2];
+} stats_sketch;
+
+typedef struct stats_series
+{
+  uint16_t id;    // Instance the slot belongs to
+  uint8_t sketch; // Its sketch, or STATS_NONE
+  stats_bucket buckets[STATS_WINDOWS][STATS_BUCKETS];
+} stats_series;
+
+// Length of window w, 0 to STATS_WINDOWS - 1
+uint32_t statsWindowMs(uint8_t window);
+
+// Whether instances of the type get a quantile sketch
+bool statsSketched(uint8_t sensorType);
+
+class WindowStats
+{
+public:
+  WindowStats();
+
+  // Record a reading of instance id
+  void add(uint16_t id, uint8_t sensorType, uint32_t nowMs, int32_t value);
+
+  // Drop the statistics of instance id and free its slot
+  void clear(uint16_t id);
+
+  // Statistics of window w of id as of nowMs; false if id has no slot
+  bool summary(uint16_t id, uint8_t window, uint32_t nowMs, stats_summary *out) const;
+
+  // p50/p95/p99 of id as of nowMs; false if id has no sketch
+  bool quantiles(uint16_t id, uint32_t nowMs, stats_quantiles *out) const;
+
+  // STATS_MISSING_* bits of id as of its last reading
+  uint8_t missing(uint16_t id) const;
+
+  // Instances whose last reading found no slot, or no sketch
+  uint16_t withoutSeries() const { return seriesMissing.load(std::memory_order_relaxed); }
+  uint16_t withoutSketch() const { return sketchesMissing.load(std::memory_order_relaxed); }
+
+private:
+  void writeBegin(uint8_t slot);
+  void writeEnd(uint8_t slot);
+  uint8_t allocateSeries(uint8_t sensorType);
+  uint8_t allocateSketch(uint8_t sensorType);
+  void freeSeries(uint8_t slot);
+  void setMissing(uint16_t id, uint8_t bits);
+
+  stats_series series[STATS_MAX_SERIES];
+  std::atomic<uint32_t> version[STATS_MAX_SERIES];
+  std::atomic<uint8_t> slotOf[STATS_MAX_IDS];
+  bool slotUsed[STATS_MAX_SERIES];     // Only touched by the writer, as are the two below
+  uint8_t slotType[STATS_MAX_SERIES];  // Sensor type of the instance
+  uint32_t slotLastMs[STATS_MAX_SERIES]; // Time of its last reading
+  stats_sketch sketches[STATS_MAX_SKETCHES];
+  bool sketchUsed[STATS_MAX_SKETCHES]; // Only touched by the writer
+  std::atomic<uint8_t> missingOf[STATS_MAX_IDS];
+  std::atomic<uint16_t> seriesMissing;
+  std::atomic<uint16_t> sketchesMissing;
+};
+
+#endif
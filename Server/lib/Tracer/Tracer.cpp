@@ -0,0 +1,298 @@
+#include "Tracer.h"
+
+#include <TextBuffer.h>
+#include <string.h>
+
+static const char *const stageNames[TRACE_STAGE_COUNT] = {
+    "sample_to_send",
+    "send_to_receive",
+    "receive_to_dispatch",
+    "receive_to_command",
+    "command_to_send_cb",
+    "receive_to_emit",
+};
+
+Tracer::Tracer() : recentHead(0), emitHead(0)
+{
+  for (size_t s = 0; s < TRACE_STAGE_COUNT; s++)
+  {
+    for (size_t b = 0; b < TRACE_BUCKETS; b++)
+    {
+      buckets[s][b].store(0, std::memory_order_relaxed);
+    }
+    maxUs[s].store(0, std::memory_order_relaxed);
+  }
+  for (size_t id = 0; id < TRACE_MAX_SENSORS; id++)
+  {
+    lastVersion[id].store(0, std::memory_order_relaxed);
+    lastTrace[id].store(0, std::memory_order_relaxed);
+    lastReceiveUs[id].store(0, std::memory_order_relaxed);
+    emitted[id].store(0, std::memory_order_relaxed);
+  }
+  memset(commandTrace, 0, sizeof(commandTrace));
+  memset(commandSentUs, 0, sizeof(commandSentUs));
+  memset(recent, 0, sizeof(recent));
+  recentVersion.store(0, std::memory_order_relaxed);
+  memset(emits, 0, sizeof(emits));
+}
+
+void Tracer::recentBegin()
+{
+  recentVersion.store(recentVersion.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Tracer::recentEnd()
+{
+  recentVersion.store(recentVersion.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Tracer::record(uint8_t stage, uint32_t latencyUs)
+{
+  size_t bucket = 0;
+  while (bucket < TRACE_BUCKETS - 1 && latencyUs >= (1u << (bucket + 4)))
+  {
+    bucket++;
+  }
+  buckets[stage][bucket].fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t previous = maxUs[stage].load(std::memory_order_relaxed);
+  while (latencyUs > previous && !maxUs[stage].compare_exchange_weak(previous, latencyUs, std::memory_order_relaxed))
+  {
+  }
+}
+
+trace_record *Tracer::findRecent(uint32_t traceId)
+{
+  for (size_t i = 0; i < TRACE_RECENT; i++)
+  {
+    if (recent[i].traceId == traceId)
+    {
+      return &recent[i];
+    }
+  }
+  return nullptr;
+}
+
+uint32_t Tracer::onReceive(uint16_t sensorId, uint16_t seq, uint32_t sampleToSendUs, int32_t sendToReceiveUs,
+                           uint32_t receiveUs)
+{
+  uint32_t traceId = ((uint32_t)(sensorId + 1) << 16) | seq;
+
+  if (sampleToSendUs > 0)
+  {
+    record(TRACE_SAMPLE_TO_SEND, sampleToSendUs);
+  }
+  // Sync error can put the receive a little before the send; count that as 0
+  uint32_t airUs = 0;
+  if (sendToReceiveUs != TRACE_NOT_SYNCED)
+  {
+    airUs = sendToReceiveUs > 0 ? (uint32_t)sendToReceiveUs : 0;
+    record(TRACE_SEND_TO_RECEIVE, airUs);
+  }
+  if (sensorId < TRACE_MAX_SENSORS)
+  {
+    std::atomic<uint32_t> &version = lastVersion[sensorId];
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    lastTrace[sensorId].store(traceId, std::memory_order_relaxed);
+    lastReceiveUs[sensorId].store(receiveUs, std::memory_order_relaxed);
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  recentBegin();
+  uint8_t head = recentHead.load(std::memory_order_relaxed);
+  trace_record &slot = recent[head];
+  recentHead.store((head + 1) % TRACE_RECENT, std::memory_order_relaxed);
+  memset(&slot, 0, sizeof(slot));
+  slot.traceId = traceId;
+  slot.sampleToSendUs = sampleToSendUs;
+  slot.sendToReceiveUs = airUs;
+  slot.receiveUs = receiveUs;
+  recentEnd();
+  return traceId;
+}
+
+void Tracer::onDispatch(uint32_t traceId, uint32_t nowUs)
+{
+  trace_record *trace = findRecent(traceId);
+  if (trace != nullptr)
+  {
+    recentBegin();
+    trace->dispatchUs = nowUs - trace->receiveUs;
+    recentEnd();
+    record(TRACE_RECEIVE_TO_DISPATCH, trace->dispatchUs);
+  }
+}
+
+void Tracer::onCommandSent(uint32_t traceId, uint16_t peerId, uint32_t nowUs)
+{
+  trace_record *trace = findRecent(traceId);
+  if (trace != nullptr && trace->commandUs == 0)
+  {
+    // Only the first command of a fan-out counts towards the command stage
+    recentBegin();
+    trace->commandUs = nowUs - trace->receiveUs;
+    recentEnd();
+    record(TRACE_RECEIVE_TO_COMMAND, trace->commandUs);
+  }
+  if (peerId < TRACE_MAX_SENSORS)
+  {
+    commandTrace[peerId] = traceId;
+    commandSentUs[peerId] = nowUs;
+  }
+}
+
+void Tracer::onCommandSendCb(uint16_t peerId, uint32_t nowUs)
+{
+  if (peerId >= TRACE_MAX_SENSORS || commandTrace[peerId] == 0)
+  {
+    return;
+  }
+
+  uint32_t latencyUs = nowUs - commandSentUs[peerId];
+  record(TRACE_COMMAND_TO_SEND_CB, latencyUs);
+
+  trace_record *trace = findRecent(commandTrace[peerId]);
+  if (trace != nullptr && trace->sendCbUs == 0)
+  {
+    recentBegin();
+    trace->sendCbUs = nowUs - trace->receiveUs;
+    recentEnd();
+  }
+  commandTrace[peerId] = 0;
+}
+
+void Tracer::clear(uint16_t sensorId)
+{
+  if (sensorId >= TRACE_MAX_SENSORS)
+  {
+    return;
+  }
+
+  std::atomic<uint32_t> &version = lastVersion[sensorId];
+  version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  lastTrace[sensorId].store(0, std::memory_order_relaxed);
+  lastReceiveUs[sensorId].store(0, std::memory_order_relaxed);
+  version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  commandTrace[sensorId] = 0;
+}
+
+void Tracer::onEmit(uint16_t sensorId, uint32_t nowUs)
+{
+  if (sensorId >= TRACE_MAX_SENSORS)
+  {
+    return;
+  }
+
+  // The sensor's last frame, both fields from the same onReceive()
+  uint32_t seq, traceId, receiveUs;
+  do
+  {
+    seq = lastVersion[sensorId].load(std::memory_order_acquire);
+    traceId = lastTrace[sensorId].load(std::memory_order_relaxed);
+    receiveUs = lastReceiveUs[sensorId].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || lastVersion[sensorId].load(std::memory_order_relaxed) != seq);
+  if (traceId == 0 || emitted[sensorId].load(std::memory_order_relaxed) == traceId)
+  {
+    return;
+  }
+  emitted[sensorId].store(traceId, std::memory_order_relaxed);
+
+  uint32_t latencyUs = nowUs - receiveUs;
+  record(TRACE_RECEIVE_TO_EMIT, latencyUs);
+
+  trace_emit &emit = emits[emitHead];
+  emitHead = (emitHead + 1) % TRACE_RECENT;
+  emit.traceId = traceId;
+  emit.emitUs = latencyUs;
+}
+
+uint32_t Tracer::count(uint8_t stage) const
+{
+  uint32_t total = 0;
+  for (size_t b = 0; b < TRACE_BUCKETS; b++)
+  {
+    total += buckets[stage][b].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint32_t Tracer::percentileUs(uint8_t stage, uint8_t pct) const
+{
+  uint32_t total = count(stage);
+  if (total == 0)
+  {
+    return 0;
+  }
+
+  // Report the upper bound of the bucket holding the percentile, capped at the largest sample
+  uint32_t largest = maxUs[stage].load(std::memory_order_relaxed);
+  uint32_t rank = (uint32_t)(((uint64_t)total * pct + 99) / 100);
+  uint32_t seen = 0;
+  for (size_t b = 0; b < TRACE_BUCKETS - 1; b++)
+  {
+    seen += buckets[stage][b].load(std::memory_order_relaxed);
+    if (seen >= rank)
+    {
+      uint32_t bound = 1u << (b + 4);
+      return bound < largest ? bound : largest;
+    }
+  }
+  return largest;
+}
+
+size_t Tracer::formatReport(char *buf, size_t len) const
+{
+  size_t pos = 0;
+  if (len == 0)
+  {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  appendf(buf, len, pos, "%-20s %8s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p95 us", "p99 us", "max us");
+  for (uint8_t stage = 0; stage < TRACE_STAGE_COUNT; stage++)
+  {
+    appendf(buf, len, pos, "%-20s %8lu %10lu %10lu %10lu %10lu\n", stageNames[stage],
+            (unsigned long)count(stage), (unsigned long)percentileUs(stage, 50), (unsigned long)percentileUs(stage, 95),
+            (unsigned long)percentileUs(stage, 99), (unsigned long)maxUs[stage].load(std::memory_order_relaxed));
+  }
+
+  // The recent traces as of one moment, oldest first
+  trace_record traces[TRACE_RECENT];
+  uint32_t seq;
+  do
+  {
+    seq = recentVersion.load(std::memory_order_acquire);
+    uint8_t head = recentHead.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < TRACE_RECENT; i++)
+    {
+      traces[i] = recent[(head + i) % TRACE_RECENT];
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || recentVersion.load(std::memory_order_relaxed) != seq);
+
+  appendf(buf, len, pos, "\n%-10s %10s %10s %10s %10s %10s %10s\n", "trace", "sample us", "air", "dispatch", "command",
+          "send cb", "emit");
+  for (trace_record &trace : traces)
+  {
+    if (trace.traceId == 0)
+    {
+      continue;
+    }
+    for (const trace_emit &emit : emits)
+    {
+      if (emit.traceId == trace.traceId)
+      {
+        trace.emitUs = emit.emitUs;
+      }
+    }
+    appendf(buf, len, pos, "%08lx   %10lu %10lu %10lu %10lu %10lu %10lu\n", (unsigned long)trace.traceId,
+            (unsigned long)trace.sampleToSendUs, (unsigned long)trace.sendToReceiveUs, (unsigned long)trace.dispatchUs,
+            (unsigned long)trace.commandUs, (unsigned long)trace.sendCbUs, (unsigned long)trace.emitUs);
+  }
+  return pos;
+}
@@ -0,0 +1,131 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// End-to-end latency tracing of reading frames.
+// A trace starts when a sensor samples a value and follows the frame
+// over the air and through the Server: receive in OnDataRecv, dispatch,
+// any command it triggers, that command's send callback and the first
+// HTTP response that shows the reading. Each step is recorded as a latency
+// per stage.
+//
+// The air stage spans two clocks. A sensor synchronized with the Server
+// (see Shared/ClockSync) stamps its frames in Server time, so the send
+// time compares directly with the Server's receive time; frames from a
+// sensor not yet synchronized skip the stage. The send callback is the
+// driver's report that the MAC layer finished with the frame, not an
+// acknowledgement from the sensor's firmware.
+// Trace IDs are ((sensor ID + 1) << 16) | frame sequence number, so the
+// frame header needs no extra field for them.
+//
+// Every call but onEmit() and formatReport() comes from the Server's radio
+// task; those two come from the web server's task, on the other core. The
+// radio task publishes each sensor's last frame, and the recent traces,
+// under seqlocks the web side reads them through. Emit latencies stay on
+// the web side, keyed by trace ID, and are joined to the recent traces when
+// the report is formatted, so one never lands on a trace that reused a slot.
+
+#ifndef TRACE_MAX_SENSORS
+#define TRACE_MAX_SENSORS 256 // Matches PEER_TABLE_MAX
+#endif
+
+#define TRACE_RECENT 8   // Complete traces kept for the report
+#define TRACE_BUCKETS 20 // Bucket i counts latencies below 2^(i + 4) us; the last is unbounded
+#define TRACE_NOT_SYNCED INT32_MIN // sendToReceiveUs of a frame not stamped in Server time
+
+enum trace_stage
+{
+  TRACE_SAMPLE_TO_SEND,      // Sensor: sample taken until frame handed to ESP-NOW
+  TRACE_SEND_TO_RECEIVE,     // Air: frame handed to ESP-NOW until OnDataRecv entry, in Server time
+  TRACE_RECEIVE_TO_DISPATCH, // Server: OnDataRecv entry until the frame is handled
+  TRACE_RECEIVE_TO_COMMAND,  // Server: OnDataRecv entry until a triggered command is sent
+  TRACE_COMMAND_TO_SEND_CB,  // Server: command sent until the driver's send callback
+  TRACE_RECEIVE_TO_EMIT,     // Server: OnDataRecv entry until an HTTP response shows the reading
+  TRACE_STAGE_COUNT
+};
+
+typedef struct trace_record
+{
+  uint32_t traceId;
+  uint32_t sampleToSendUs;
+  uint32_t sendToReceiveUs; // 0 when the sensor was not synchronized
+  uint32_t receiveUs;  // Server micros() at OnDataRecv entry
+  uint32_t dispatchUs; // Offsets from receiveUs, 0 when the stage did not happen
+  uint32_t commandUs;
+  uint32_t sendCbUs;
+  uint32_t emitUs;
+} trace_record;
+
+class Tracer
+{
+public:
+  Tracer();
+
+  // A reading frame arrived; returns its trace ID. sendToReceiveUs is the
+  // Server's receive time minus the frame's send time, or TRACE_NOT_SYNCED
+  uint32_t onReceive(uint16_t sensorId, uint16_t seq, uint32_t sampleToSendUs, int32_t sendToReceiveUs,
+                     uint32_t receiveUs);
+
+  // The frame of traceId has been handled
+  void onDispatch(uint32_t traceId, uint32_t nowUs);
+
+  // Handling traceId sent a command to peerId
+  void onCommandSent(uint32_t traceId, uint16_t peerId, uint32_t nowUs);
+
+  // The send callback for a command to peerId fired
+  void onCommandSendCb(uint16_t peerId, uint32_t nowUs);
+
+  // An HTTP response showed the latest reading of sensorId
+  void onEmit(uint16_t sensorId, uint32_t nowUs);
+
+  // Forget the last frame and outstanding command of sensorId, as when its
+  // peer ID is given to another sensor
+  void clear(uint16_t sensorId);
+
+  // Approximate latency below which pct percent of a stage's samples fall
+  uint32_t percentileUs(uint8_t stage, uint8_t pct) const;
+  uint32_t count(uint8_t stage) const;
+
+  // Per-stage latency breakdown plus the most recent traces, as text
+  size_t formatReport(char *buf, size_t len) const;
+
+private:
+  typedef struct trace_emit
+  {
+    uint32_t traceId;
+    uint32_t emitUs;
+  } trace_emit;
+
+  void record(uint8_t stage, uint32_t latencyUs);
+  trace_record *findRecent(uint32_t traceId);
+  void recentBegin();
+  void recentEnd();
+
+  std::atomic<uint32_t> buckets[TRACE_STAGE_COUNT][TRACE_BUCKETS];
+  std::atomic<uint32_t> maxUs[TRACE_STAGE_COUNT];
+
+  // Last frame per sensor, for the emit stage: written by the radio task
+  // under lastVersion, and the trace the web side last counted
+  std::atomic<uint32_t> lastVersion[TRACE_MAX_SENSORS];
+  std::atomic<uint32_t> lastTrace[TRACE_MAX_SENSORS];
+  std::atomic<uint32_t> lastReceiveUs[TRACE_MAX_SENSORS];
+  std::atomic<uint32_t> emitted[TRACE_MAX_SENSORS];
+
+  // Outstanding command per peer, for the send callback stage
+  uint32_t commandTrace[TRACE_MAX_SENSORS];
+  uint32_t commandSentUs[TRACE_MAX_SENSORS];
+
+  // Written by the radio task under recentVersion; emitUs stays 0 there
+  trace_record recent[TRACE_RECENT];
+  std::atomic<uint8_t> recentHead;
+  std::atomic<uint32_t> recentVersion;
+
+  // Emit latencies of the last traces shown, web side only
+  trace_emit emits[TRACE_RECENT];
+  uint8_t emitHead;
+};
+
+#endif
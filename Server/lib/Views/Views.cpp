@@ -0,0 +1,286 @@
+#include "Views.h"
+
+#include <Pairing.h>
+#include <TextBuffer.h>
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t zoneTypes[] = {SENSOR_SOUND, SENSOR_MOTION, SENSOR_SMOKE, SENSOR_LIGHT};
+#define ZONE_TYPE_COUNT (sizeof(zoneTypes) / sizeof(zoneTypes[0]))
+
+// Append s as a quoted JSON string. Statuses come from the sensors' own
+// frames, so quotes, backslashes and control characters are escaped.
+static void appendJsonString(char *buf, size_t len, size_t &pos, const char *s)
+{
+  appendf(buf, len, pos, "\"");
+  for (; *s != '\0'; s++)
+  {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+    {
+      appendf(buf, len, pos, "\\%c", c);
+    }
+    else if (c < 0x20)
+    {
+      appendf(buf, len, pos, "\\u%04x", c);
+    }
+    else
+    {
+      appendf(buf, len, pos, "%c", c);
+    }
+  }
+  appendf(buf, len, pos, "\"");
+}
+
+// Copy out what is left of the current unit; true once all of it is out
+static bool drain(char *buf, size_t len, size_t &pos, view_cursor *cursor)
+{
+  size_t n = cursor->unitLen - cursor->unitSent;
+  if (n > len - pos)
+  {
+    n = len - pos;
+  }
+  memcpy(buf + pos, cursor->unit + cursor->unitSent, n);
+  pos += n;
+  cursor->unitSent += n;
+  return cursor->unitSent == cursor->unitLen;
+}
+
+// Start the next element: the opening bracket before the first, a separator after
+static size_t beginItem(view_cursor *cursor)
+{
+  size_t pos = 0;
+  appendf(cursor->unit, sizeof(cursor->unit), pos, "%s", cursor->items == 0 ? "[" : ", ");
+  cursor->items++;
+  return pos;
+}
+
+static void setUnit(view_cursor *cursor, size_t unitLen)
+{
+  cursor->unitLen = unitLen;
+  cursor->unitSent = 0;
+}
+
+static void closeArray(view_cursor *cursor)
+{
+  size_t pos = 0;
+  appendf(cursor->unit, sizeof(cursor->unit), pos, "%s", cursor->items == 0 ? "[]" : "]");
+  setUnit(cursor, pos);
+  cursor->closed = true;
+}
+
+size_t viewSensors(char *buf, size_t len, view_cursor *cursor, const SensorStore &store, const SensorHealth &health,
+                   const SensorLiveness &liveness, uint32_t nowMs, view_emit_fn onEmit)
+{
+  size_t pos = 0;
+  while (drain(buf, len, pos, cursor) && !cursor->closed)
+  {
+    sensor_snapshot sensor;
+    while (cursor->index < store.size() && !store.snapshot(cursor->index, &sensor))
+    {
+      cursor->index++;
+    }
+    if (cursor->index >= store.size())
+    {
+      closeArray(cursor);
+      continue;
+    }
+
+    uint16_t id = cursor->index++;
+    if (onEmit != nullptr)
+    {
+      onEmit(id);
+    }
+    size_t unitPos = beginItem(cursor);
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+            "{\"id\": %u, \"type\": \"%s\", \"zone\": %u, \"value\": %ld, \"status\": ", (unsigned)id,
+            sensorTypeName(sensor.type), (unsigned)sensor.zone, (long)sensor.value);
+    appendJsonString(cursor->unit, sizeof(cursor->unit), unitPos, sensor.status);
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+            ", \"health\": \"%s\", \"liveness\": \"%s\", \"ageMs\": %lu, \"frames\": %lu}",
+            healthStateName(health.state(id, nowMs)), livenessStateName(liveness.state(id)),
+            (unsigned long)(nowMs - sensor.lastSeenMs), (unsigned long)sensor.frames);
+    setUnit(cursor, unitPos);
+  }
+  return pos;
+}
+
+size_t viewZones(char *buf, size_t len, view_cursor *cursor, const SensorStore &store)
+{
+  size_t pos = 0;
+  while (drain(buf, len, pos, cursor) && !cursor->closed)
+  {
+    // index walks the zones of each type in turn; a type is summarised when its first zone comes up
+    size_t typeIndex = cursor->index / VIEW_ZONE_COUNT;
+    size_t zone = cursor->index % VIEW_ZONE_COUNT;
+    if (typeIndex >= ZONE_TYPE_COUNT)
+    {
+      closeArray(cursor);
+      continue;
+    }
+    if (zone == 0)
+    {
+      store.aggregateZones(zoneTypes[typeIndex], cursor->zones, VIEW_ZONE_COUNT);
+    }
+    cursor->index++;
+
+    const zone_summary &summary = cursor->zones[zone];
+    if (summary.count == 0)
+    {
+      continue;
+    }
+    size_t unitPos = beginItem(cursor);
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+            "{\"zone\": %u, \"type\": \"%s\", \"count\": %u, \"min\": %ld, \"max\": %ld, \"mean\": %ld}",
+            (unsigned)zone, sensorTypeName(zoneTypes[typeIndex]), (unsigned)summary.count, (long)summary.min,
+            (long)summary.max, (long)(summary.sum / summary.count));
+    setUnit(cursor, unitPos);
+  }
+  return pos;
+}
+
+size_t viewPeers(char *buf, size_t len, view_cursor *cursor, const PeerTable &peers, const PeerCache &cache)
+{
+  size_t pos = 0;
+  while (drain(buf, len, pos, cursor) && !cursor->closed)
+  {
+    // Entries of removed sensors are skipped
+    peer_entry peer;
+    while (cursor->index < peers.count() && !peers.snapshot(cursor->index, &peer))
+    {
+      cursor->index++;
+    }
+    if (cursor->index >= peers.count())
+    {
+      closeArray(cursor);
+      continue;
+    }
+
+    uint16_t id = cursor->index++;
+    size_t unitPos = beginItem(cursor);
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+            "{\"id\": %u, \"mac\": \"%02X:%02X:%02X:%02X:%02X:%02X\", \"type\": \"%s\", "
+            "\"capabilities\": %u, \"driverSlot\": %s}",
+            (unsigned)id, peer.mac[0], peer.mac[1], peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5],
+            sensorTypeName(peer.sensorType), (unsigned)peer.capabilities, cache.contains(id) ? "true" : "false");
+    setUnit(cursor, unitPos);
+  }
+  return pos;
+}
+
+size_t viewStats(char *buf, size_t len, view_cursor *cursor, const WindowStats &stats, const SensorStore &store,
+                 uint32_t nowMs)
+{
+  size_t pos = 0;
+  while (drain(buf, len, pos, cursor) && !cursor->closed)
+  {
+    sensor_snapshot sensor;
+    stats_summary summary;
+    while (cursor->index < store.size() && !store.snapshot(cursor->index, &sensor))
+    {
+      cursor->index++;
+    }
+    if (cursor->index >= store.size())
+    {
+      closeArray(cursor);
+      continue;
+    }
+
+    uint16_t id = cursor->index++;
+    size_t unitPos = beginItem(cursor);
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos, "{\"id\": %u, \"type\": \"%s\", \"zone\": %u, \"windows\": ",
+            (unsigned)id, sensorTypeName(sensor.type), (unsigned)sensor.zone);
+    // Instances the pools had no room for are listed with null statistics
+    if (!stats.summary(id, 0, nowMs, &summary))
+    {
+      appendf(cursor->unit, sizeof(cursor->unit), unitPos, "null");
+    }
+    else
+    {
+      for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+      {
+        if (w > 0 && !stats.summary(id, w, nowMs, &summary))
+        {
+          break;
+        }
+        appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+                "%s{\"windowMs\": %lu, \"count\": %lu, \"min\": %ld, \"max\": %ld, \"mean\": %.2f, \"stddev\": %.2f}",
+                w == 0 ? "[" : ", ", (unsigned long)summary.windowMs, (unsigned long)summary.count, (long)summary.min,
+                (long)summary.max, (double)summary.mean, (double)summary.stddev);
+      }
+      appendf(cursor->unit, sizeof(cursor->unit), unitPos, "]");
+    }
+    stats_quantiles quantiles;
+    if (stats.quantiles(id, nowMs, &quantiles))
+    {
+      appendf(cursor->unit, sizeof(cursor->unit), unitPos,
+              ", \"quantiles\": {\"count\": %lu, \"p50\": %ld, \"p95\": %ld, \"p99\": %ld}",
+              (unsigned long)quantiles.count, (long)quantiles.p50, (long)quantiles.p95, (long)quantiles.p99);
+    }
+    else if (statsSketched(sensor.type))
+    {
+      appendf(cursor->unit, sizeof(cursor->unit), unitPos, ", \"quantiles\": null");
+    }
+    appendf(cursor->unit, sizeof(cursor->unit), unitPos, "}");
+    setUnit(cursor, unitPos);
+  }
+  return pos;
+}
+
+size_t viewLight(char *buf, size_t len, const sensor_snapshot *light)
+{
+  size_t pos = 0;
+  appendf(buf, len, pos, "{\"lightLevel\": %ld, \"brightnessPercentage\": ", (long)light->value);
+  appendJsonString(buf, len, pos, light->status);
+  appendf(buf, len, pos, "}");
+  return pos;
+}
+
+size_t viewPage(char *buf, size_t len, const char *page, const view_var *vars, size_t count)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  size_t pos = 0;
+  const char *p = page;
+  while (*p != '\0' && pos < len - 1)
+  {
+    // Copy up to the next '%' in one go
+    const char *mark = strchr(p, '%');
+    size_t run = mark != nullptr ? (size_t)(mark - p) : strlen(p);
+    if (run > 0)
+    {
+      if (run > len - 1 - pos)
+      {
+        run = len - 1 - pos;
+      }
+      memcpy(buf + pos, p, run);
+      pos += run;
+      p += run;
+      continue;
+    }
+
+    // A '%' that does not open a known placeholder is kept as it is
+    const view_var *var = nullptr;
+    size_t nameLen = 0;
+    for (size_t i = 0; i < count && var == nullptr; i++)
+    {
+      nameLen = strlen(vars[i].name);
+      if (strncmp(p + 1, vars[i].name, nameLen) == 0 && p[1 + nameLen] == '%')
+      {
+        var = &vars[i];
+      }
+    }
+    if (var == nullptr)
+    {
+      buf[pos++] = *p++;
+      continue;
+    }
+    appendf(buf, len, pos, "%s", var->value);
+    p += nameLen + 2;
+  }
+  buf[pos] = '\0';
+  return pos;
+}
@@ -0,0 +1,56 @@
+#ifndef VIEWS_H
+#define VIEWS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <Health.h>
+#include <Liveness.h>
+#include <PeerCache.h>
+#include <PeerTable.h>
+#include <SensorStore.h>
+#include <Stats.h>
+
+// Bodies of the dashboard and status routes. Like Metrics::format() the
+// JSON arrays are written a chunk at a time into the response buffer, one
+// element per unit, so serving them never builds a String. They only read
+// the stores, which lets host tools build and benchmark them.
+
+#define VIEW_UNIT_MAX 384   // Longest array element
+#define VIEW_ZONE_COUNT 16  // Zones summarised on /status/zones
+
+// Progress through one chunked response; zero it before the first call
+typedef struct view_cursor
+{
+  uint16_t index;    // Next sensor, peer or type/zone pair
+  uint16_t items;    // Elements written so far
+  uint16_t unitLen;  // Bytes held in unit
+  uint16_t unitSent; // Bytes of unit already copied out
+  bool closed;       // The closing bracket is in unit
+  char unit[VIEW_UNIT_MAX];
+  zone_summary zones[VIEW_ZONE_COUNT]; // Zones of the type being written
+} view_cursor;
+
+// Called for each sensor as it is written, for latency tracing
+typedef void (*view_emit_fn)(uint16_t id);
+
+// A %NAME% placeholder of a page and its replacement
+typedef struct view_var
+{
+  const char *name;
+  const char *value;
+} view_var;
+
+// Chunked writers: each call fills at most len bytes of buf and returns the
+// bytes written, 0 once the response is complete.
+size_t viewSensors(char *buf, size_t len, view_cursor *cursor, const SensorStore &store, const SensorHealth &health,
+                   const SensorLiveness &liveness, uint32_t nowMs, view_emit_fn onEmit);
+size_t viewZones(char *buf, size_t len, view_cursor *cursor, const SensorStore &store);
+size_t viewPeers(char *buf, size_t len, view_cursor *cursor, const PeerTable &peers, const PeerCache &cache);
+size_t viewStats(char *buf, size_t len, view_cursor *cursor, const WindowStats &stats, const SensorStore &store,
+                 uint32_t nowMs);
+
+// Single-buffer writers; return the length, truncated to fit and NUL-terminated
+size_t viewLight(char *buf, size_t len, const sensor_snapshot *light);
+size_t viewPage(char *buf, size_t len, const char *page, const view_var *vars, size_t count);
+
+#endif
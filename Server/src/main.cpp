@@ -1,429 +1,1398 @@
-
-#include <WiFi.h>
-#include <esp_now.h>
-#include <ESPAsyncWebServer.h>
-#include "pageindex.h" // Include the HTML file
-#include <esp_wifi.h>
-
-// Network Credentials
-const char *wifi_network_ssid = "Man2";           // Wi-Fi network SSID
-const char *wifi_network_password = "manman2024"; // Wi-Fi network password
-
-// Access Point Configuration
-const char *soft_ap_ssid = "ESP32_WS";         // AP SSID
-const char *soft_ap_password = "helloesp32WS"; // AP Password
-IPAddress local_ip(192, 168, 1, 1);
-IPAddress gateway(192, 168, 1, 1);
-IPAddress subnet(255, 255, 255, 0);
-
-// ESP-NOW Communication
-uint8_t soundSensorSlaveMAC[] = {0xd8, 0xbc, 0x38, 0xfb, 0xa5, 0x7c};  // sound sensor slave MAC
-uint8_t motionSensorSlaveMAC[] = {0xc0, 0x5d, 0x89, 0xb1, 0x93, 0xa0}; // motion sensor slave MAC
-uint8_t smokeSensorSlaveMAC[] = {0xfc, 0xe8, 0xc0, 0x74, 0x50, 0x14};  // smoke sensor slave MAC
-uint8_t lightSensorSlaveMAC[] = {0xa8, 0x42, 0xe3, 0xc8, 0x36, 0x88};  // light sensor slave MAC
-
-// Create AsyncWebServer object on port 80
-AsyncWebServer server(80);
-
-// Data Structure for ESP-NOW
-typedef struct struct_message_motion
-{
-  int motionValue;
-  char motionStatus[20];
-} struct_message_motion;
-typedef struct struct_message_sound
-{
-  int soundLevel;
-  char soundStatus[20];
-} struct_message_sound;
-
-typedef struct struct_message_light
-{
-  int lightLevel;
-  char brightnessPercentage[10];
-} struct_message_light;
-
-typedef struct struct_message_smoke
-{
-  int smokePercentage;
-  char smokeStatus[20];
-  bool blinkLED; // Flag to trigger LED blinking
-} struct_message_smoke;
-
-struct_message_sound receivedDataSound;   // Data received from sound sensor
-struct_message_motion receivedDataMotion; // Data received from motion sensor
-struct_message_smoke receivedDataSmoke;   // Data received from smoke sensor
-struct_message_light receivedDataLight;   // Data received from light sensor
-
-// Get Wi-Fi channel for the specified SSID
-int32_t get_wifi_channel(const char *ssid)
-{
-  int n = WiFi.scanNetworks();
-  for (int i = 0; i < n; ++i)
-  {
-    if (String(ssid) == WiFi.SSID(i))
-    {
-      return WiFi.channel(i);
-    }
-  }
-  return 0;
-}
-
-// Set Wi-Fi channel for ESP32
-void scan_and_set_wifi_channel()
-{
-  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
-  int master_channel = get_wifi_channel(wifi_network_ssid);
-
-  if (master_channel == 0)
-  {
-    Serial.println("SSID not found!");
-  }
-  else
-  {
-    Serial.printf("SSID found. Channel: %d\n", master_channel);
-    if (WiFi.channel() != master_channel)
-    {
-      esp_wifi_set_promiscuous(true);
-      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
-      esp_wifi_set_promiscuous(false);
-    }
-  }
-  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
-}
-
-// Initialize ESP-NOW and add peers
-void initESPNow()
-{
-  if (esp_now_init() != ESP_OK)
-  {
-    Serial.println("Error initializing ESP-NOW");
-    return;
-  }
-
-  // Add Sound Sensor Slave as a peer
-  esp_now_peer_info_t peerInfo;
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, soundSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK)
-  {
-    Serial.println("Failed to add Sound Sensor Slave");
-  }
-  else
-  {
-    Serial.println("Sound Sensor Slave added successfully");
-  }
-
-  // Add Motion Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, motionSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK)
-  {
-    Serial.println("Failed to add Motion Sensor Slave");
-  }
-  else
-  {
-    Serial.println("Motion Sensor Slave added successfully");
-  }
-
-  // Add Smoke Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, smokeSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK)
-  {
-    Serial.println("Failed to add Smoke Sensor Slave");
-  }
-  else
-  {
-    Serial.println("Smoke Sensor Slave added successfully");
-  }
-
-  // Add Light Sensor Slave as a peer
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, lightSensorSlaveMAC, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  if (esp_now_add_peer(&peerInfo) != ESP_OK)
-  {
-    Serial.println("Failed to add Light Sensor Slave");
-  }
-  else
-  {
-    Serial.println("Light Sensor Slave added successfully");
-  }
-}
-
-void sendTurnOnCommand()
-{
-  const char command[] = "turn on"; // Data to send
-
-  // Send to Sound Sensor Slave
-  esp_err_t result = esp_now_send(soundSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'turn on' sent successfully to Sound Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Sound Sensor Slave: %d\n", result);
-  }
-
-  // Send to Light Sensor Slave
-  result = esp_now_send(lightSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command sent 'turn on' successfully to Light Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Light Sensor Slave: %d\n", result);
-  }
-}
-void sendTurnOffMotionCommand()
-{
-  const char command[] = "disable"; // Data to send
-
-  // Send to Sound Sensor Slave
-  esp_err_t result = esp_now_send(soundSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'disable' sent successfully to Sound Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Sound Sensor Slave: %d\n", result);
-  }
-
-  // Send to Light Sensor Slave
-  result = esp_now_send(lightSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'disable' sent successfully to Light Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Light Sensor Slave: %d\n", result);
-  }
-}
-void sendTurnOffSmokeCommand()
-{
-  const char command[] = "disable1"; // Data to send
-
-  // Send to Sound Sensor Slave
-  esp_err_t result = esp_now_send(soundSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'disable1' sent successfully to Sound Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Sound Sensor Slave: %d\n", result);
-  }
-
-  // Send to Light Sensor Slave
-  result = esp_now_send(lightSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'disable1' sent successfully to Light Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Light Sensor Slave: %d\n", result);
-  }
-  result = esp_now_send(motionSensorSlaveMAC, (uint8_t *)command, sizeof(command));
-  if (result == ESP_OK)
-  {
-    Serial.println("Command 'disable1' sent successfully to motion Sensor Slave");
-  }
-  else
-  {
-    Serial.printf("Error sending to Light Sensor Slave: %d\n", result);
-  }
-}
-// Handle Received Data
-// Handle Received Data
-void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len)
-{
-  Serial.print("Data received from: ");
-  for (int i = 0; i < 6; i++)
-  {
-    Serial.printf("%02X", mac[i]);
-    if (i < 5)
-      Serial.print(":");
-  }
-  Serial.println();
-
-  // Check the sender's MAC address
-  if (memcmp(mac, soundSensorSlaveMAC, 6) == 0)
-  {
-    if (len == sizeof(struct_message_sound))
-    {
-      memcpy(&receivedDataSound, incomingData, sizeof(receivedDataSound));
-
-      if(receivedDataSound.soundLevel = 0){
-        strcpy(receivedDataSound.soundStatus, "DISABLED");  
-      }
-      Serial.printf("Sound Level: %d, Sound Status: %s\n", receivedDataSound.soundLevel, receivedDataSound.soundStatus);
-    }
-  }
-  else if (memcmp(mac, motionSensorSlaveMAC, 6) == 0)
-  {
-    if (len == sizeof(struct_message_motion))
-    {
-      memcpy(&receivedDataMotion, incomingData, sizeof(receivedDataMotion));
-      Serial.printf("Motion Level: %d, Motion Status: %s\n", receivedDataMotion.motionValue, receivedDataMotion.motionStatus);
-
-      // Add command logic for motion sensor
-      if (receivedDataMotion.motionValue == 1)
-      {
-        Serial.println("Motion detected. Sending Turn On Command...");
-        sendTurnOnCommand();
-      }
-      else if (receivedDataMotion.motionValue == 2)
-      {
-        Serial.println("No motion detected. Sending Turn Off Command...");
-        sendTurnOffMotionCommand();
-      }
-    }
-  }
-  else if (memcmp(mac, smokeSensorSlaveMAC, 6) == 0)
-  {
-    if (len == sizeof(struct_message_smoke))
-    {
-      memcpy(&receivedDataSmoke, incomingData, sizeof(receivedDataSmoke));
-      Serial.printf("Smoke Level: %d, Smoke Status: %s\n", receivedDataSmoke.smokePercentage, receivedDataSmoke.smokeStatus);
-      if (receivedDataSmoke.smokePercentage > 100)
-      {
-        Serial.println("Smoke detected. Sending Turn Off Command...");
-        sendTurnOffSmokeCommand();
-      }
-    }
-  }
-  else if (memcmp(mac, lightSensorSlaveMAC, 6) == 0)
-  {
-    if (len == sizeof(struct_message_light))
-    {
-      memcpy(&receivedDataLight, incomingData, sizeof(receivedDataLight));
-      Serial.printf("Light Level: %d, Brightness Percentage: %s\n", receivedDataLight.lightLevel, receivedDataLight.brightnessPercentage);
-    }
-  }
-  else
-  {
-    Serial.println("Received data length mismatch.");
-  }
-}
-
-// Serve the webpage with sensor data
-void serveWebpage(AsyncWebServerRequest *request)
-{
-  String html = PAGEINDEX; // HTML page from external file
-
-  html.replace("%STATUS%", String(receivedDataSound.soundStatus));
-  html.replace("%MOTION%", String(receivedDataMotion.motionStatus));
-  html.replace("%SMOKE%", String(receivedDataSmoke.smokeStatus));
-
-  html.replace("%LIGHT%", String(receivedDataLight.brightnessPercentage));
-
-  request->send(200, "text/html", html);
-}
-
-// Serve the light sensor data as JSON
-void serveLightData(AsyncWebServerRequest *request)
-{
-  String json = "{\"lightLevel\": " + String(receivedDataLight.lightLevel) + ", ";
-  json += "\"brightnessPercentage\": \"" + String(receivedDataLight.brightnessPercentage) + "\"}";
-  request->send(200, "application/json", json);
-}
-void serveSmokeData(AsyncWebServerRequest *request)
-{
-  String response = String(receivedDataSmoke.smokeStatus);
-  request->send(200, "text/plain", response);
-}
-void handleIPAddress(AsyncWebServerRequest *request)
-{
-  String ipAddress = WiFi.localIP().toString();
-  request->send(200, "text/plain", ipAddress);
-}
-// Setup Function
-void setup()
-{
-  Serial.begin(115200);
-
-  // Set Wi-Fi mode to AP+STA
-  WiFi.mode(WIFI_AP_STA);
-  WiFi.setSleep(WIFI_PS_NONE);
-  WiFi.channel(1); // Set initial channel
-
-  // Configure Access Point
-  WiFi.softAP(soft_ap_ssid, soft_ap_password);
-  delay(1000);
-  WiFi.softAPConfig(local_ip, gateway, subnet);
-  Serial.print("AP IP Address: ");
-  Serial.println(WiFi.softAPIP());
-
-  // Connect to Wi-Fi network (STA)
-  WiFi.begin(wifi_network_ssid, wifi_network_password);
-  while (WiFi.status() != WL_CONNECTED)
-  {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println("Connected to Wi-Fi!");
-
-  // Print the local IP address
-  Serial.print("Local IP Address: ");
-  Serial.println(WiFi.localIP());
-
-  scan_and_set_wifi_channel();
-  initESPNow();
-
-  // Register the callback for receiving data
-  esp_now_register_recv_cb(OnDataRecv);
-
-  // Serve the webpage with sensor data
-  server.on("/", HTTP_GET, serveWebpage);
-
-  // Serve the light sensor data as JSON
-  server.on("/status/light", HTTP_GET, serveLightData);
-  server.on("/status/smoke", HTTP_GET, serveSmokeData);
-
-  // Serve the sound sensor data
-  server.on("/status/sound", HTTP_GET, [](AsyncWebServerRequest *request)
-            {
-    String response = String(receivedDataSound.soundStatus);
-    request->send(200, "text/plain", response); });
-
-  // Serve the motion sensor data
-  server.on("/status/motion", HTTP_GET, [](AsyncWebServerRequest *request)
-            {
-    String response = String(receivedDataMotion.motionStatus);
-    request->send(200, "text/plain", response); });
-
-  // Serve the smoke sensor data
-  server.on("/status/smoke", HTTP_GET, [](AsyncWebServerRequest *request)
-            {
-    String response = String(receivedDataSmoke.smokeStatus);
-    request->send(200, "text/plain", response); });
-
-  // Serve the IP address
-  server.on("/ip", HTTP_GET, handleIPAddress);
-
-  // Start the server
-  server.begin();
-}
-
-// Loop Function
-void loop()
-{
-  // Add any repeated tasks here if needed
-}
+
+#include <WiFi.h>
+#include <esp_now.h>
+#include <ESPAsyncWebServer.h>
+#include <SPIFFS.h>
+#include "pageindex.h" // Include the HTML file
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include <BootProfiler.h>
+#include <Pairing.h>
+#include <PeerTable.h>
+#include <PeerCache.h>
+#include <SendQueue.h>
+#include <SensorStore.h>
+#include <History.h>
+#include <Export.h>
+#include <Health.h>
+#include <Liveness.h>
+#include <Stats.h>
+#include <SensorFrame.h>
+#include <Backlog.h>
+#include <Metrics.h>
+#include <Dispatch.h>
+#include <Views.h>
+#include <CaptureSink.h>
+#include <Tracer.h>
+#include <ClockSync.h>
+#include <LinkQuality.h>
+#include <ReportControl.h>
+#include <BinLog.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// Network Credentials
+const char *wifi_network_ssid = "Man2";           // Wi-Fi network SSID
+const char *wifi_network_password = "manman2024"; // Wi-Fi network password
+
+// Access Point Configuration
+const char *soft_ap_ssid = "ESP32_WS";         // AP SSID
+const char *soft_ap_password = "helloesp32WS"; // AP Password
+IPAddress local_ip(192, 168, 1, 1);
+IPAddress gateway(192, 168, 1, 1);
+IPAddress subnet(255, 255, 255, 0);
+
+// ESP-NOW Communication
+PeerTable peerTable; // Sensors admitted through the join handshake
+
+// The peer table as the radio task, its only writer, serialized it after a
+// change, waiting for loop() to save it to NVS; loop() never reads the
+// table itself, which admit() may be changing
+uint8_t peerTableBlob[PEER_TABLE_BLOB_SIZE(PEER_TABLE_MAX)];
+size_t peerTableBlobLen = 0; // 0 when nothing is waiting
+portMUX_TYPE peerTableBlobLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Create AsyncWebServer object on port 80
+AsyncWebServer server(80);
+
+// Latest readings of every sensor instance, indexed by peer ID
+SensorStore sensorStore;
+
+// Compressed recent readings of every sensor instance, indexed by peer ID; its pool is allocated in setup()
+History history;
+
+// Sliding-window statistics and quantiles of every sensor instance, indexed by peer ID
+WindowStats windowStats;
+
+// Drift, stuck, step and silence checks of every sensor instance, indexed by peer ID
+SensorHealth sensorHealth;
+
+// Heartbeat deadlines of every sensor instance, indexed by peer ID
+SensorLiveness liveness;
+
+// Link quality and PHY rate of unicast frames to each sensor, indexed by peer ID
+link_quality peerLinks[PEER_TABLE_MAX];
+
+// Reporting level of the sensors, chosen from the receive load of the channel
+ReportController reportController;
+
+// Radio, pipeline and HTTP counters served on /metrics
+Metrics metrics;
+
+// Per-stage latency of reading frames, served on /trace
+Tracer tracer;
+uint32_t activeTraceId = 0; // Trace of the frame the radio task is dispatching, 0 outside it
+
+// Radio pipeline: the ESP-NOW callbacks run in the Wi-Fi task and only
+// queue events. The radio task does all frame handling and rule evaluation
+// on the core the HTTP server does not use. Smoke alarm frames jump the
+// queue, and the radio task sends their pre-built commands before it does
+// anything else with them.
+#define RADIO_QUEUE_DEPTH 32
+#define RADIO_SEND_RESERVE 8  // Slots only send completions may use, so driver slots are always released
+#define RADIO_ALARM_RESERVE 4 // Slots only alarm frames and send completions may use
+#define LOST_SEND_MAX 16      // Refused send completions held for the radio task
+#define RADIO_TASK_CORE 1     // async_tcp runs on core 0, see CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini
+#define RADIO_TASK_PRIORITY 5 // Above loop()
+#define RADIO_TASK_STACK 8192
+#define RADIO_IDLE_MS 1000 // Longest the radio task waits before servicing capture requests and broadcasts
+
+#define HEAP_RESERVE 65536 // Heap left free for lwIP, AsyncTCP and the web server's requests
+
+enum radio_event_kind
+{
+  RADIO_EVENT_RECEIVED,
+  RADIO_EVENT_SENT,
+  RADIO_EVENT_ALARM // Received, and fires the smoke rule
+};
+
+typedef struct radio_event
+{
+  uint8_t kind; // radio_event_kind
+  uint8_t mac[6];
+  int8_t rssi;    // 0 when unknown
+  uint8_t rate;   // wifi_phy_rate_t of received frames, 1 Mbit/s when unknown
+  bool delivered; // Send completions only
+  uint16_t len;
+  uint64_t timeUs; // esp_timer_get_time() in the callback, the clock micros() reads
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} radio_event;
+
+QueueHandle_t radioQueue;
+TaskHandle_t radioTask;
+
+// Senders and outcomes of the send completions the radio queue had no room
+// for, so the radio task still unpins their driver slots and counts them;
+// filled by the Wi-Fi task
+uint8_t lostSendMacs[LOST_SEND_MAX][6];
+bool lostSendDelivered[LOST_SEND_MAX];
+size_t lostSendCount = 0;
+portMUX_TYPE lostSendLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Peer IDs /unpair asked the radio task to remove, one bit each
+std::atomic<uint32_t> unpairRequests[PEER_TABLE_MAX / 32];
+
+// Outcome of one send of the alarm fast path, logged once all are out
+typedef struct alarm_send
+{
+  uint16_t id;
+  bool slot;        // A driver slot was free; if not, the send was queued
+  esp_err_t result; // Of esp_now_send()
+  uint32_t sentUs;
+} alarm_send;
+
+// The smoke rule's fan-out, rebuilt whenever the peer table changes
+dispatch_alarm_plan alarmPlan;
+alarm_send alarmSends[PEER_TABLE_MAX];
+size_t alarmSendCount = 0;
+
+// RSSI and PHY rate of the last ESP-NOW frame, captured in promiscuous mode
+volatile int8_t lastFrameRssi = 0;
+volatile uint8_t lastFrameRate = 0;
+uint8_t lastFrameSource[6];
+
+// Get Wi-Fi channel for the specified SSID
+int32_t get_wifi_channel(const char *ssid)
+{
+  int n = WiFi.scanNetworks();
+  for (int i = 0; i < n; ++i)
+  {
+    if (String(ssid) == WiFi.SSID(i))
+    {
+      return WiFi.channel(i);
+    }
+  }
+  return 0;
+}
+
+// Set Wi-Fi channel for ESP32
+void scan_and_set_wifi_channel()
+{
+  Serial.printf("\nScanning for SSID: %s\n", wifi_network_ssid);
+  int master_channel = get_wifi_channel(wifi_network_ssid);
+
+  if (master_channel == 0)
+  {
+    Serial.println("SSID not found!");
+  }
+  else
+  {
+    Serial.printf("SSID found. Channel: %d\n", master_channel);
+    if (WiFi.channel() != master_channel)
+    {
+      esp_wifi_set_promiscuous(true);
+      esp_wifi_set_channel(master_channel, WIFI_SECOND_CHAN_NONE);
+      esp_wifi_set_promiscuous(false);
+    }
+  }
+  Serial.printf("Current Wi-Fi channel: %d\n", WiFi.channel());
+}
+
+const uint8_t broadcastMAC[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+// Register a peer with the ESP-NOW driver
+bool addDriverPeer(const uint8_t *mac)
+{
+  if (esp_now_is_peer_exist(mac))
+  {
+    return true;
+  }
+
+  esp_now_peer_info_t peerInfo;
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, mac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+
+  return esp_now_add_peer(&peerInfo) == ESP_OK;
+}
+
+// Remove a peer evicted from the driver peer cache
+void removeDriverPeer(const uint8_t *mac)
+{
+  esp_now_del_peer(mac);
+}
+
+// Driver slots for unicast sends; sensors are registered lazily and evicted LRU
+PeerCache peerCache(addDriverPeer, removeDriverPeer);
+
+// Unicast sends waiting for a driver slot, sent as send completions free them
+SendQueue sendQueue;
+
+// Record the RSSI and rate of ESP-NOW frames, which the receive callback does not report
+void captureRssi(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+  if (type != WIFI_PKT_MGMT)
+  {
+    return;
+  }
+
+  // ESP-NOW frames are vendor-specific action frames (subtype 0xd0, category 127)
+  const wifi_promiscuous_pkt_t *pkt = (const wifi_promiscuous_pkt_t *)buf;
+  const uint8_t *frame = pkt->payload;
+  if (pkt->rx_ctrl.sig_len < 25 || frame[0] != 0xd0 || frame[24] != 127)
+  {
+    return;
+  }
+  memcpy(lastFrameSource, frame + 10, 6);
+  lastFrameRssi = pkt->rx_ctrl.rssi;
+  lastFrameRate = pkt->rx_ctrl.rate;
+}
+
+// Reload the peer table from NVS in a single read
+void loadPeerTable()
+{
+  static uint8_t blob[PEER_TABLE_BLOB_SIZE(PEER_TABLE_MAX)];
+
+  Preferences prefs;
+  prefs.begin("pairing", true);
+  size_t len = prefs.getBytes("peers", blob, sizeof(blob));
+  prefs.end();
+
+  if (len == 0)
+  {
+    Serial.println("No paired sensors stored");
+  }
+  else if (!peerTable.deserialize(blob, len))
+  {
+    Serial.println("Stored peer table is invalid, starting empty");
+    peerTable.clear();
+  }
+  else
+  {
+    Serial.printf("Loaded %u paired sensors\n", (unsigned)peerTable.count());
+  }
+}
+
+// Hand the changed peer table to loop() for saving; radio task only
+void queuePeerTableSave()
+{
+  portENTER_CRITICAL(&peerTableBlobLock);
+  peerTableBlobLen = peerTable.serialize(peerTableBlob, sizeof(peerTableBlob));
+  portEXIT_CRITICAL(&peerTableBlobLock);
+}
+
+// Write the last peer table the radio task handed over to NVS, if any
+void savePeerTable()
+{
+  static uint8_t blob[PEER_TABLE_BLOB_SIZE(PEER_TABLE_MAX)];
+  portENTER_CRITICAL(&peerTableBlobLock);
+  size_t len = peerTableBlobLen;
+  memcpy(blob, peerTableBlob, len);
+  peerTableBlobLen = 0;
+  portEXIT_CRITICAL(&peerTableBlobLock);
+  if (len == 0)
+  {
+    return;
+  }
+
+  Preferences prefs;
+  prefs.begin("pairing", false);
+  prefs.putBytes("peers", blob, len);
+  prefs.end();
+  Serial.printf("Saved %u paired sensors\n", (unsigned)((const peer_table_header *)blob)->count);
+}
+
+// Initialize ESP-NOW and add peers
+void initESPNow()
+{
+  if (esp_now_init() != ESP_OK)
+  {
+    Serial.println("Error initializing ESP-NOW");
+    return;
+  }
+
+  // Sensors get a driver slot only when a command is sent to them
+  loadPeerTable();
+  dispatchPlanAlarm(peerTable, &alarmPlan);
+  for (size_t id = 0; id < PEER_TABLE_MAX; id++)
+  {
+    linkInit(&peerLinks[id]);
+  }
+
+  // Join accepts for sensors that take no commands are broadcast
+  if (!addDriverPeer(broadcastMAC))
+  {
+    Serial.println("Failed to add broadcast peer");
+  }
+
+  // Sniff management frames for per-sensor RSSI
+  wifi_promiscuous_filter_t filter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(captureRssi);
+  esp_wifi_set_promiscuous(true);
+}
+
+// Copy a sensor's link state to /metrics
+void publishLink(int id)
+{
+  const link_quality &link = peerLinks[id];
+  metrics.setLink(id, linkRateKbps(link.rate), link.deliveryPermille, link.airtimeUs, link.baselineUs);
+}
+
+// Pick the PHY rate for a unicast frame of len bytes to sensor id, which
+// holds its driver slot. The rate is per interface and retries of frames in
+// flight take it up, so it only goes faster once this is the only send in
+// flight; until then a faster link's frame goes at the rate already set.
+// Going slower, as broadcasts do, only makes those retries more robust.
+void applyPeerRate(int id, size_t len)
+{
+  uint8_t ceiling = peerCache.inFlight() > 1 ? linkAppliedRate() : LINK_RATE_54M;
+  linkApplyRate(linkOnSend(&peerLinks[id], len, ceiling));
+  publishLink(id);
+}
+
+// Send status of unicast frames; frees the sensor's driver slot for eviction
+void handleSendCompleted(const radio_event *event)
+{
+  peerCache.release(event->mac);
+  int id = peerTable.find(event->mac);
+  metrics.onSendCompleted(id, event->delivered);
+  if (id >= 0)
+  {
+    tracer.onCommandSendCb(id, (uint32_t)event->timeUs);
+    linkOnResult(&peerLinks[id], event->delivered);
+    publishLink(id);
+  }
+}
+
+// Admit a sensor that broadcast a join request and answer it
+// Forget everything kept about the sensor that held peer ID id (radio task)
+void clearPeerState(uint16_t id)
+{
+  linkInit(&peerLinks[id]);
+  sensorStore.clear(id);
+  history.clear(id);
+  windowStats.clear(id);
+  sensorHealth.clear(id);
+  liveness.clear(id);
+  metrics.clear(id);
+  tracer.clear(id);
+}
+
+void handleJoinRequest(const uint8_t *mac, const pairing_frame *request, int8_t rssi)
+{
+  bool changed;
+  int id = peerTable.admit(mac, request->sensorType, request->capabilities, request->zone, &changed);
+  if (id < 0)
+  {
+    Serial.println("Peer table full, join request rejected");
+    return;
+  }
+  if (changed)
+  {
+    queuePeerTableSave();
+    clearPeerState(id);
+    dispatchPlanAlarm(peerTable, &alarmPlan);
+  }
+  // The new sensor starts from its stored or nominal setting until told the current one
+  reportController.requestRefresh();
+  linkOnRssi(&peerLinks[id], rssi);
+
+  pairing_frame accept;
+  pairingMakeJoinAccept(&accept, request, id, mac);
+
+  // Only sensors that take commands are worth a driver slot
+  const uint8_t *destination = broadcastMAC;
+  if (request->capabilities & SENSOR_CAP_ACCEPTS_COMMANDS)
+  {
+    if (!peerCache.acquire(id, mac))
+    {
+      Serial.printf("No driver slot for %s Sensor Slave %d\n", sensorTypeName(request->sensorType), id);
+      return;
+    }
+    destination = mac;
+    applyPeerRate(id, sizeof(accept));
+  }
+  else
+  {
+    linkApplyRate(LINK_RATE_1M);
+  }
+  if (esp_now_send(destination, (uint8_t *)&accept, sizeof(accept)) == ESP_OK)
+  {
+    metrics.onSendQueued();
+  }
+  else if (destination != broadcastMAC)
+  {
+    peerCache.release(mac);
+  }
+  Serial.printf("%s Sensor Slave joined as peer %d\n", sensorTypeName(request->sensorType), id);
+}
+
+// Answer a paired sensor's clock sync request with our receive and transmit times
+void handleClockSyncRequest(const uint8_t *mac, const clock_sync_frame *request, uint64_t receiveUs)
+{
+  if (peerTable.find(mac) < 0)
+  {
+    return;
+  }
+
+  // Broadcast like the join accept, so report-only sensors need no driver slot
+  clock_sync_frame response;
+  clockSyncMakeResponse(&response, request, mac, receiveUs, esp_timer_get_time());
+  linkApplyRate(LINK_RATE_1M);
+  if (esp_now_send(broadcastMAC, (uint8_t *)&response, sizeof(response)) == ESP_OK)
+  {
+    metrics.onSendQueued();
+  }
+}
+
+// Tell sensors to resynchronize their clocks
+void sendClockSyncBeacon()
+{
+  clock_sync_frame beacon;
+  clockSyncMakeBeacon(&beacon, esp_timer_get_time());
+  linkApplyRate(LINK_RATE_1M);
+  if (esp_now_send(broadcastMAC, (uint8_t *)&beacon, sizeof(beacon)) == ESP_OK)
+  {
+    metrics.onSendQueued();
+  }
+}
+
+// Broadcast the reporting interval and threshold of every sensor type
+void sendReportControl(const report_control_frame *frame)
+{
+  linkApplyRate(LINK_RATE_1M);
+  if (esp_now_send(broadcastMAC, (const uint8_t *)frame, sizeof(*frame)) == ESP_OK)
+  {
+    metrics.onSendQueued();
+    BINLOG(REPORT_LEVEL, (int)frame->level, (unsigned)reportController.utilisationPermille());
+    // Heartbeats slow down with the level
+    liveness.setLevel(frame->level);
+  }
+}
+
+// Periodic broadcasts, sent from the radio task so that every send and PHY
+// rate change happens on one task
+void serviceBroadcasts()
+{
+  // Act as the time source for the sensors
+  static unsigned long lastBeaconTime = 0;
+  if (millis() - lastBeaconTime >= CLOCK_SYNC_BEACON_INTERVAL)
+  {
+    lastBeaconTime = millis();
+    sendClockSyncBeacon();
+  }
+
+  report_control_frame control;
+  if (reportController.update(millis(), &control))
+  {
+    sendReportControl(&control);
+  }
+  metrics.setChannel(reportController.utilisationPermille(), reportController.level());
+  metrics.setStatsMissing(windowStats.withoutSeries(), windowStats.withoutSketch());
+}
+
+// Send a unicast frame to a sensor that holds a driver slot for it (radio task)
+void sendToPeer(uint16_t id, const uint8_t *data, uint8_t len, uint32_t traceId)
+{
+  const peer_entry &peer = peerTable.at(id);
+  applyPeerRate(id, len);
+  esp_err_t result = esp_now_send(peer.mac, data, len);
+  if (result == ESP_OK)
+  {
+    metrics.onSendQueued();
+    if (traceId != 0)
+    {
+      tracer.onCommandSent(traceId, id, micros());
+    }
+    BINLOG(COMMAND_SENT, (const char *)data, sensorTypeName(peer.sensorType), id);
+  }
+  else
+  {
+    peerCache.release(peer.mac); // No send callback will follow
+    metrics.onSendRejected(id);
+    BINLOG(COMMAND_SEND_ERROR, sensorTypeName(peer.sensorType), id, result);
+  }
+}
+
+// Send what waits in the send queue while driver slots are free (radio task)
+void resumeQueuedSends()
+{
+  queued_send send;
+  while (sendQueue.peek(&send))
+  {
+    const peer_entry &peer = peerTable.at(send.peerId);
+    if (!peerCache.acquire(send.peerId, peer.mac))
+    {
+      if (peerCache.full())
+      {
+        return; // The next send completion frees a slot
+      }
+      // The driver refused the peer; waiting will not change that
+      sendQueue.pop();
+      BINLOG(NO_DRIVER_SLOT, sensorTypeName(peer.sensorType), send.peerId);
+      continue;
+    }
+    sendQueue.pop();
+    sendToPeer(send.peerId, send.data, send.len, send.traceId);
+  }
+}
+
+// Send a command to every paired sensor of the given types that accepts
+// commands; targets past the free driver slots wait in the send queue
+void sendCommand(const char *command, uint32_t typeMask)
+{
+  uint16_t targets[PEER_TABLE_MAX];
+  size_t targetCount = dispatchTargets(peerTable, typeMask, targets, PEER_TABLE_MAX);
+  uint8_t len = (uint8_t)(strlen(command) + 1);
+  for (size_t i = 0; i < targetCount; i++)
+  {
+    uint16_t id = targets[i];
+    const peer_entry &peer = peerTable.at(id);
+    // Not worth a driver slot and the retries; alarms still go to every target
+    if (liveness.state(id) == LIVENESS_OFFLINE)
+    {
+      BINLOG(COMMAND_SKIPPED, command, sensorTypeName(peer.sensorType), id);
+      continue;
+    }
+    // Nothing jumps the sends already waiting
+    bool waiting = sendQueue.size() > 0;
+    queued_send send = {id, len, (const uint8_t *)command, activeTraceId};
+    if (!waiting && peerCache.acquire(id, peer.mac))
+    {
+      sendToPeer(id, send.data, len, activeTraceId);
+    }
+    else if (!waiting && !peerCache.full())
+    {
+      BINLOG(NO_DRIVER_SLOT, sensorTypeName(peer.sensorType), id); // The driver refused the peer
+    }
+    else if (sendQueue.push(send, false))
+    {
+      BINLOG(COMMAND_QUEUED, command, sensorTypeName(peer.sensorType), id);
+    }
+    else
+    {
+      BINLOG(SEND_QUEUE_FULL, command, sensorTypeName(peer.sensorType), id);
+    }
+  }
+}
+
+// Send the smoke alarm's planned commands for an alarm frame; false if it
+// is not from a paired smoke sensor. Targets past the free driver slots go
+// to the front of the send queue. Logging waits for logAlarmSends().
+bool sendAlarm(const radio_event *event)
+{
+  int sender = peerTable.find(event->mac);
+  if (sender < 0 || peerTable.at(sender).sensorType != SENSOR_SMOKE)
+  {
+    return false;
+  }
+  alarmSendCount = 0;
+  for (size_t i = 0; i < alarmPlan.count; i++)
+  {
+    uint16_t id = alarmPlan.targets[i];
+    const peer_entry &peer = peerTable.at(id);
+    alarm_send &send = alarmSends[alarmSendCount++];
+    send.id = id;
+    send.slot = peerCache.acquire(id, peer.mac);
+    if (!send.slot)
+    {
+      continue;
+    }
+    applyPeerRate(id, alarmPlan.len);
+    send.result = esp_now_send(peer.mac, (const uint8_t *)alarmPlan.command.command, alarmPlan.len);
+    send.sentUs = micros();
+    if (send.result != ESP_OK)
+    {
+      peerCache.release(peer.mac); // No send callback will follow
+      metrics.onSendRejected(id);
+    }
+    else
+    {
+      metrics.onSendQueued();
+    }
+  }
+  // Last first, so the alarm's sends keep their order at the front of the queue
+  for (size_t i = alarmSendCount; i-- > 0;)
+  {
+    if (!alarmSends[i].slot)
+    {
+      queued_send send = {alarmSends[i].id, alarmPlan.len, (const uint8_t *)alarmPlan.command.command, 0};
+      sendQueue.push(send, true);
+    }
+  }
+  return true;
+}
+
+// Log and trace the sends of the last sendAlarm()
+void logAlarmSends()
+{
+  for (size_t i = 0; i < alarmSendCount; i++)
+  {
+    const alarm_send &send = alarmSends[i];
+    const char *typeName = sensorTypeName(peerTable.at(send.id).sensorType);
+    if (!send.slot)
+    {
+      BINLOG(COMMAND_QUEUED, alarmPlan.command.command, typeName, send.id);
+    }
+    else if (send.result == ESP_OK)
+    {
+      if (activeTraceId != 0)
+      {
+        tracer.onCommandSent(activeTraceId, send.id, send.sentUs);
+      }
+      BINLOG(COMMAND_SENT, alarmPlan.command.command, typeName, send.id);
+    }
+    else
+    {
+      BINLOG(COMMAND_SEND_ERROR, typeName, send.id, send.result);
+    }
+  }
+  alarmSendCount = 0;
+}
+
+// The command the recent readings of instance id trigger, if any
+bool trendRule(uint16_t id, const sensor_reading *reading, rule_command *command)
+{
+  stats_summary minute;
+  stats_quantiles quantiles;
+  if (!windowStats.summary(id, 0, millis(), &minute))
+  {
+    return false;
+  }
+  reading_trend trend = {minute.count, minute.mean, 0};
+  if (windowStats.quantiles(id, millis(), &quantiles))
+  {
+    trend.p95 = quantiles.p95;
+  }
+  return dispatchTrendRule(reading, &trend, command);
+}
+
+// Handle Received Data; alarmSent when sendAlarm() already sent the smoke rule's commands
+void handleFrame(const radio_event *event, bool alarmSent)
+{
+  const uint8_t *mac = event->mac;
+  const uint8_t *incomingData = event->data;
+  int len = event->len;
+  uint32_t receivedUs = (uint32_t)event->timeUs;
+  int8_t rssi = event->rssi;
+
+  // Every frame heard counts towards the channel load
+  reportController.onFrame(linkAirtimeUs(linkRateFromPhy(event->rate), len));
+
+  // Clock sync requests are answered before logging; the receive time was taken in the callback
+  clock_sync_frame syncFrame;
+  if (clockSyncParseFrame(incomingData, len, &syncFrame))
+  {
+    if (syncFrame.kind == CLOCK_SYNC_REQUEST)
+    {
+      handleClockSyncRequest(mac, &syncFrame, event->timeUs);
+    }
+    return;
+  }
+
+  BINLOG(FRAME_FROM, binlogMac(mac));
+
+  // Join requests from sensors that are (re)pairing
+  pairing_frame pairingFrame;
+  if (pairingParseFrame(incomingData, len, &pairingFrame))
+  {
+    if (pairingFrame.kind == PAIRING_JOIN_REQUEST)
+    {
+      handleJoinRequest(mac, &pairingFrame, rssi);
+    }
+    return;
+  }
+
+  // Look up the sender in the peer table
+  int id = peerTable.find(mac);
+  if (id < 0)
+  {
+    metrics.onUnknownFrame();
+    BINLOG(UNPAIRED_FRAME);
+    return;
+  }
+  uint8_t sensorType = peerTable.at(id).sensorType;
+  uint8_t zone = peerTable.at(id).zone;
+  linkOnRssi(&peerLinks[id], rssi);
+  if (liveness.onFrame(id, millis()))
+  {
+    BINLOG(SENSOR_ONLINE, sensorTypeName(sensorType), (unsigned)id);
+  }
+
+  frame_header header;
+  bool serverClock = false;
+  bool hasSeq = frameParseHeader(incomingData, len, &header, &serverClock);
+  metrics.onFrame(id, sensorType, len, hasSeq, hasSeq ? header.seq : 0, rssi, millis());
+  // Heartbeats are counted, and decode as nothing
+  bool traced = hasSeq && frameIsReading(header.kind);
+  int32_t sendToReceiveUs = serverClock ? (int32_t)(receivedUs - header.sendUs) : TRACE_NOT_SYNCED;
+  activeTraceId = traced ? tracer.onReceive(id, header.seq, header.sendUs - header.sampleUs, sendToReceiveUs, receivedUs) : 0;
+
+  // Readings held through an outage are too old for the store and the
+  // rules; they only fill in the history
+  backlog_frame backlog;
+  if (hasSeq && header.kind == FRAME_BACKLOG && backlogParseFrame(incomingData, len, &backlog))
+  {
+    for (uint8_t i = 0; i < backlog.count; i++)
+    {
+      history.append(id, millis() - backlog.samples[i].ageMs, backlog.samples[i].value);
+    }
+    metrics.onBacklog(id, backlog.count, backlog.remaining);
+    BINLOG(BACKLOG_RECEIVED, sensorTypeName(sensorType), (unsigned)id, (unsigned)backlog.count,
+           (unsigned)backlog.remaining);
+  }
+
+  sensor_reading reading;
+  if (dispatchDecode(sensorType, incomingData, len, &reading))
+  {
+    sensorStore.update(id, sensorType, zone, reading.value, reading.status, reading.flags, millis());
+    // A queued reading follows its held predecessors in a backlog frame, and joins the history there
+    if (!hasSeq || header.kind != FRAME_READING_QUEUED)
+    {
+      history.append(id, millis(), reading.value);
+    }
+    windowStats.add(id, sensorType, millis(), reading.value);
+    uint8_t previousHealth = sensorHealth.state(id, millis());
+    uint8_t health = sensorHealth.observe(id, sensorType, millis(), reading.value);
+    if (health != previousHealth && (health > HEALTH_OK || previousHealth > HEALTH_OK))
+    {
+      BINLOG(SENSOR_HEALTH, sensorTypeName(sensorType), (unsigned)id, healthStateName(health));
+    }
+    if (reading.flags & SENSOR_FLAG_BLINK)
+    {
+      reportController.onIncident(millis());
+    }
+    BINLOG(READING, sensorTypeName(sensorType), (int)reading.value, reading.status);
+
+    rule_command command;
+    if (dispatchRule(&reading, &command) || trendRule(id, &reading, &command))
+    {
+      BINLOG(RULE_FIRED, sensorTypeName(sensorType), command.command, (unsigned)command.typeMask);
+      if (alarmSent)
+      {
+        logAlarmSends();
+      }
+      else
+      {
+        sendCommand(command.command, command.typeMask);
+      }
+    }
+  }
+
+  metrics.onDispatched(id, micros() - receivedUs);
+  tracer.onDispatch(activeTraceId, micros());
+  activeTraceId = 0;
+}
+
+// Queue a radio event without blocking the Wi-Fi task; drops it if fewer than reserve slots are free
+bool queueRadioEvent(const radio_event *event, UBaseType_t reserve)
+{
+  if (uxQueueSpacesAvailable(radioQueue) <= reserve || xQueueSend(radioQueue, event, 0) != pdTRUE)
+  {
+    metrics.onRadioDropped();
+    return false;
+  }
+  metrics.onRadioQueued(uxQueueMessagesWaiting(radioQueue));
+  return true;
+}
+
+// Queue an alarm frame ahead of everything waiting; it may use the alarm reserve
+void queueAlarmEvent(const radio_event *event)
+{
+  if (uxQueueSpacesAvailable(radioQueue) <= RADIO_SEND_RESERVE || xQueueSendToFront(radioQueue, event, 0) != pdTRUE)
+  {
+    metrics.onRadioDropped();
+    return;
+  }
+  metrics.onRadioQueued(uxQueueMessagesWaiting(radioQueue));
+}
+
+// ESP-NOW receive callback (Wi-Fi task)
+void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len)
+{
+  radio_event event;
+  event.timeUs = esp_timer_get_time();
+  event.kind = RADIO_EVENT_RECEIVED;
+  memcpy(event.mac, mac, 6);
+  bool captured = memcmp(mac, lastFrameSource, 6) == 0;
+  event.rssi = captured ? lastFrameRssi : 0;
+  event.rate = captured ? lastFrameRate : 0;
+  event.delivered = false;
+  event.len = len < 0 ? 0 : (len > ESP_NOW_MAX_DATA_LEN ? ESP_NOW_MAX_DATA_LEN : len);
+  memcpy(event.data, incomingData, event.len);
+  if (dispatchPriority(event.data, event.len) == DISPATCH_PRIORITY_ALARM)
+  {
+    event.kind = RADIO_EVENT_ALARM;
+    queueAlarmEvent(&event);
+    return;
+  }
+  queueRadioEvent(&event, RADIO_SEND_RESERVE + RADIO_ALARM_RESERVE);
+}
+
+// ESP-NOW send callback (Wi-Fi task)
+void OnDataSent(const uint8_t *mac, esp_now_send_status_t status)
+{
+  radio_event event;
+  event.timeUs = esp_timer_get_time();
+  event.kind = RADIO_EVENT_SENT;
+  memcpy(event.mac, mac, 6);
+  event.rssi = 0;
+  event.rate = 0;
+  event.delivered = status == ESP_NOW_SEND_SUCCESS;
+  event.len = 0;
+  if (queueRadioEvent(&event, 0))
+  {
+    return;
+  }
+  // Without its completion the peer would stay pinned in the cache for good
+  portENTER_CRITICAL(&lostSendLock);
+  if (lostSendCount < LOST_SEND_MAX)
+  {
+    lostSendDelivered[lostSendCount] = event.delivered;
+    memcpy(lostSendMacs[lostSendCount++], mac, 6);
+  }
+  portEXIT_CRITICAL(&lostSendLock);
+}
+
+// Unpin the peers whose send completions the radio queue refused, and count
+// the completions towards espnow_tx_queue_depth (radio task)
+void releaseLostSends()
+{
+  uint8_t macs[LOST_SEND_MAX][6];
+  bool delivered[LOST_SEND_MAX];
+  portENTER_CRITICAL(&lostSendLock);
+  size_t count = lostSendCount;
+  memcpy(macs, lostSendMacs, count * 6);
+  memcpy(delivered, lostSendDelivered, count * sizeof(bool));
+  lostSendCount = 0;
+  portEXIT_CRITICAL(&lostSendLock);
+  for (size_t i = 0; i < count; i++)
+  {
+    peerCache.release(macs[i]);
+    metrics.onSendCompleted(peerTable.find(macs[i]), delivered[i]);
+  }
+  if (count > 0)
+  {
+    resumeQueuedSends();
+  }
+}
+
+// Remove the sensors /unpair asked for, with their waiting sends and driver slots (radio task)
+void serviceUnpairs()
+{
+  for (size_t word = 0; word < PEER_TABLE_MAX / 32; word++)
+  {
+    uint32_t bits = unpairRequests[word].exchange(0, std::memory_order_acquire);
+    for (uint16_t id = word * 32; bits != 0; id++, bits >>= 1)
+    {
+      if (!(bits & 1))
+      {
+        continue;
+      }
+      uint8_t sensorType = peerTable.at(id).sensorType;
+      if (!peerTable.remove(id))
+      {
+        continue;
+      }
+      sendQueue.cancel(id);
+      peerCache.forget(id);
+      clearPeerState(id);
+      queuePeerTableSave();
+      dispatchPlanAlarm(peerTable, &alarmPlan);
+      Serial.printf("%s Sensor Slave %u unpaired\n", sensorTypeName(sensorType), (unsigned)id);
+    }
+  }
+}
+
+// A sensor missed its liveness deadline (radio task)
+void onSensorOffline(uint16_t id)
+{
+  const peer_entry &peer = peerTable.at(id);
+  BINLOG(SENSOR_OFFLINE, sensorTypeName(peer.sensorType), (unsigned)id, (unsigned long)liveness.timeoutMs(id));
+}
+
+// Radio task: handle queued events in arrival order
+void radioTaskMain(void *)
+{
+  static radio_event event;
+  while (true)
+  {
+    // Wake up for the next liveness tick even when nothing arrives
+    uint32_t waitMs = liveness.idleMs(millis(), RADIO_IDLE_MS);
+    bool received = xQueueReceive(radioQueue, &event, pdMS_TO_TICKS(waitMs)) == pdTRUE;
+    releaseLostSends();
+    // Alarm commands go out before anything else, the services below included
+    bool alarmSent = received && event.kind == RADIO_EVENT_ALARM && sendAlarm(&event);
+    liveness.tick(millis(), onSensorOffline);
+    captureService(peerTable, esp_timer_get_time());
+    serviceUnpairs();
+    serviceBroadcasts();
+    if (!received)
+    {
+      continue;
+    }
+    uint32_t startUs = micros();
+    metrics.onRadioDequeued(startUs - (uint32_t)event.timeUs);
+
+    if (event.kind != RADIO_EVENT_SENT)
+    {
+      captureFrame(event.timeUs, event.mac, event.rssi, event.data, event.len);
+      handleFrame(&event, alarmSent);
+    }
+    else
+    {
+      handleSendCompleted(&event);
+      resumeQueuedSends();
+    }
+    metrics.addTaskBusy(METRICS_TASK_RADIO, micros() - startUs);
+  }
+}
+
+// Consistent copy of the most recently heard sensor of a type
+bool latestSnapshot(uint8_t sensorType, sensor_snapshot *snapshot)
+{
+  int id = sensorStore.latestOfType(sensorType);
+  if (id < 0 || !sensorStore.snapshot(id, snapshot))
+  {
+    return false;
+  }
+  tracer.onEmit(id, micros());
+  return true;
+}
+
+// Status of the most recently heard sensor of a type
+String latestStatus(uint8_t sensorType)
+{
+  sensor_snapshot snapshot;
+  return latestSnapshot(sensorType, &snapshot) ? String(snapshot.status) : String("");
+}
+
+// Liveness of the most recently heard sensor of a type, sent in X-Sensor-Liveness
+const char *latestLiveness(uint8_t sensorType)
+{
+  int id = sensorStore.latestOfType(sensorType);
+  return livenessStateName(id < 0 ? (uint8_t)LIVENESS_UNKNOWN : liveness.state(id));
+}
+
+// Serve the webpage with sensor data
+void serveWebpage(AsyncWebServerRequest *request)
+{
+  static const uint8_t types[] = {SENSOR_SOUND, SENSOR_MOTION, SENSOR_SMOKE, SENSOR_LIGHT};
+  static const char *const names[] = {"STATUS", "MOTION", "SMOKE", "LIGHT"};
+  static char html[sizeof(PAGEINDEX) + 4 * SENSOR_STATUS_LEN]; // Handlers run one at a time on async_tcp
+
+  sensor_snapshot sensors[4];
+  view_var vars[4];
+  for (size_t i = 0; i < 4; i++)
+  {
+    if (!latestSnapshot(types[i], &sensors[i]))
+    {
+      sensors[i].status[0] = '\0';
+    }
+    vars[i] = {names[i], sensors[i].status};
+  }
+  viewPage(html, sizeof(html), PAGEINDEX, vars, 4);
+
+  request->send(200, "text/html", html);
+}
+
+// Serve the light sensor data as JSON
+void serveLightData(AsyncWebServerRequest *request)
+{
+  // Level and percentage from the same frame
+  sensor_snapshot light;
+  if (!latestSnapshot(SENSOR_LIGHT, &light))
+  {
+    memset(&light, 0, sizeof(light));
+  }
+  char json[64 + 6 * SENSOR_STATUS_LEN]; // A status byte may escape to \u00XX
+  viewLight(json, sizeof(json), &light);
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", json);
+  response->addHeader("X-Sensor-Liveness", latestLiveness(SENSOR_LIGHT));
+  request->send(response);
+}
+// Serve the status of the most recently heard smoke sensor, with its health in X-Sensor-Health
+void serveSmokeData(AsyncWebServerRequest *request)
+{
+  int id = sensorStore.latestOfType(SENSOR_SMOKE);
+  sensor_snapshot smoke;
+  if (id < 0 || !sensorStore.snapshot(id, &smoke))
+  {
+    smoke.status[0] = '\0';
+  }
+  else
+  {
+    tracer.onEmit(id, micros());
+  }
+  AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", smoke.status);
+  response->addHeader("X-Sensor-Health", healthStateName(id < 0 ? (uint8_t)HEALTH_UNKNOWN : sensorHealth.state(id, millis())));
+  response->addHeader("X-Sensor-Liveness", latestLiveness(SENSOR_SMOKE));
+  request->send(response);
+}
+
+// Count a sensor as shown on the dashboard for /trace
+void traceEmit(uint16_t id)
+{
+  tracer.onEmit(id, micros());
+}
+
+// Serve every sensor instance as JSON
+void serveSensors(AsyncWebServerRequest *request)
+{
+  view_cursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  uint32_t now = millis();
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+                                                                   [cursor, now](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return viewSensors((char *)buffer, maxLen, &cursor, sensorStore, sensorHealth, liveness, now, traceEmit); });
+  request->send(response);
+}
+
+// Serve per-zone summaries of each sensor type as JSON
+void serveZones(AsyncWebServerRequest *request)
+{
+  view_cursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+                                                                   [cursor](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return viewZones((char *)buffer, maxLen, &cursor, sensorStore); });
+  request->send(response);
+}
+
+// Serve the sliding-window statistics and quantiles of each sensor instance as JSON
+void serveStats(AsyncWebServerRequest *request)
+{
+  view_cursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  uint32_t now = millis();
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+                                                                   [cursor, now](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return viewStats((char *)buffer, maxLen, &cursor, windowStats, sensorStore, now); });
+  request->send(response);
+}
+void handleIPAddress(AsyncWebServerRequest *request)
+{
+  String ipAddress = WiFi.localIP().toString();
+  request->send(200, "text/plain", ipAddress);
+}
+// Serve the paired sensors as JSON
+void servePeers(AsyncWebServerRequest *request)
+{
+  view_cursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+                                                                   [cursor](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return viewPeers((char *)buffer, maxLen, &cursor, peerTable, peerCache); });
+  request->send(response);
+}
+// Serve the radio, pipeline and HTTP counters in the Prometheus text format
+void serveMetrics(AsyncWebServerRequest *request)
+{
+  metrics.setHeap(ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+  metrics.setRadioQueueDepth(uxQueueMessagesWaiting(radioQueue));
+  metrics.setTaskStack(METRICS_TASK_RADIO, uxTaskGetStackHighWaterMark(radioTask));
+  metrics.setTaskStack(METRICS_TASK_HTTP, uxTaskGetStackHighWaterMark(NULL));
+
+  // Written chunk by chunk straight into the response buffer
+  metrics_cursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain; version=0.0.4",
+                                                                   [cursor](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return metrics.format((char *)buffer, maxLen, &cursor, millis()); });
+  request->send(response);
+}
+// Register a GET route and count its requests and handler time on /metrics
+void onRoute(const char *path, ArRequestHandlerFunction handler)
+{
+  int route = metrics.registerRoute(path);
+  server.on(path, HTTP_GET, [route, handler](AsyncWebServerRequest *request)
+            {
+    uint32_t startUs = micros();
+    metrics.countRequest(route);
+    handler(request);
+    metrics.addTaskBusy(METRICS_TASK_HTTP, micros() - startUs); });
+}
+// Serve the boot phase timings as JSON
+void serveBootTimings(AsyncWebServerRequest *request)
+{
+  char json[96 * (BOOT_PROFILER_MAX_PHASES + 1)];
+  bootProfilerFormatJson(json, sizeof(json));
+  request->send(200, "application/json", json);
+}
+// Start or stop recording received frames: /capture?sink=serial|flash|off
+void serveCapture(AsyncWebServerRequest *request)
+{
+  uint8_t sink = captureActiveSink();
+  if (request->hasParam("sink"))
+  {
+    const String &value = request->getParam("sink")->value();
+    if (value == "serial")
+    {
+      sink = CAPTURE_SERIAL;
+    }
+    else if (value == "flash")
+    {
+      sink = CAPTURE_FLASH;
+    }
+    else if (value == "off")
+    {
+      sink = CAPTURE_OFF;
+    }
+    else
+    {
+      request->send(400, "text/plain", "sink must be serial, flash or off");
+      return;
+    }
+    captureRequest(sink);
+  }
+  String json = "{\"sink\": \"" + String(captureSinkName(sink)) + "\", \"bytes\": " + String(captureBytes()) + "}";
+  request->send(200, "application/json", json);
+}
+// Download the last flash capture once it has been stopped
+void serveCaptureFile(AsyncWebServerRequest *request)
+{
+  if (captureActiveSink() == CAPTURE_FLASH)
+  {
+    request->send(409, "text/plain", "Capture still running, stop it with /capture?sink=off");
+    return;
+  }
+  if (!SPIFFS.exists(CAPTURE_FILE))
+  {
+    request->send(404, "text/plain", "No capture");
+    return;
+  }
+  request->send(SPIFFS, CAPTURE_FILE, "application/octet-stream", true);
+}
+// Serve the per-stage latency breakdown and the most recent traces
+void serveTrace(AsyncWebServerRequest *request)
+{
+  static char report[2048];
+  tracer.formatReport(report, sizeof(report));
+  request->send(200, "text/plain", report);
+}
+// Read an optional unsigned parameter; false if it is present but not a number
+bool numberParam(AsyncWebServerRequest *request, const char *name, uint32_t *value)
+{
+  if (!request->hasParam(name))
+  {
+    return true;
+  }
+  const char *text = request->getParam(name)->value().c_str();
+  char *end;
+  unsigned long n = strtoul(text, &end, 10);
+  if (end == text || *end != '\0')
+  {
+    return false;
+  }
+  *value = (uint32_t)n;
+  return true;
+}
+// Stream the reading history: /export?from=&to=&sensor=&format=ndjson|csv&limit=&resume=
+void serveExport(AsyncWebServerRequest *request)
+{
+  export_query query;
+  exportQueryInit(&query);
+  if (!numberParam(request, "from", &query.fromMs) || !numberParam(request, "to", &query.toMs) ||
+      !numberParam(request, "limit", &query.limit))
+  {
+    request->send(400, "text/plain", "from, to and limit must be numbers");
+    return;
+  }
+  if (request->hasParam("format") && !exportParseFormat(request->getParam("format")->value().c_str(), &query.format))
+  {
+    request->send(400, "text/plain", "format must be ndjson or csv");
+    return;
+  }
+  if (request->hasParam("sensor") && !exportParseSensor(request->getParam("sensor")->value().c_str(), &query))
+  {
+    request->send(400, "text/plain", "sensor must be a peer ID or a sensor type");
+    return;
+  }
+  if (request->hasParam("resume"))
+  {
+    if (!exportParseToken(request->getParam("resume")->value().c_str(), &query))
+    {
+      request->send(400, "text/plain", "resume must be a token <id>.<ms>.<n>");
+      return;
+    }
+    query.resume = true;
+  }
+
+  // Written record by record straight into the response buffer
+  HistoryExport body(history, peerTable, query);
+  AsyncWebServerResponse *response = request->beginChunkedResponse(query.format == EXPORT_CSV ? "text/csv" : "application/x-ndjson",
+                                                                   [body](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return body.write((char *)buffer, maxLen); });
+  // Lets clients turn the record times into wall-clock times
+  response->addHeader("X-Uptime-Ms", String(millis()));
+  request->send(response);
+}
+// Serve one sensor's readings as binary columns for the dashboard chart:
+// /history.bin?sensor=<id>[&from=&to=|&last=][&step=]
+void serveHistoryColumns(AsyncWebServerRequest *request)
+{
+  uint32_t id = UINT32_MAX, fromMs = 0, toMs = UINT32_MAX, lastMs = 0, stepMs = 0;
+  if (!numberParam(request, "sensor", &id) || !numberParam(request, "from", &fromMs) ||
+      !numberParam(request, "to", &toMs) || !numberParam(request, "last", &lastMs) ||
+      !numberParam(request, "step", &stepMs) || id >= peerTable.count())
+  {
+    request->send(400, "text/plain", "sensor must be a peer ID; from, to, last and step numbers");
+    return;
+  }
+  uint32_t now = millis();
+  if (lastMs > 0)
+  {
+    // Modulo 2^32, like every history time
+    fromMs = now - lastMs;
+    toMs = now;
+  }
+
+  // Decoded column by column straight into the response buffer
+  HistoryColumns body(history, peerTable, (uint16_t)id, fromMs, toMs, stepMs, now);
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/octet-stream",
+                                                                   [body](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t
+                                                                   { return body.write((char *)buffer, maxLen); });
+  request->send(response);
+}
+// Remove a paired sensor: /unpair?sensor=<id>. It joins again, possibly
+// under another peer ID, when it next boots.
+void serveUnpair(AsyncWebServerRequest *request)
+{
+  uint32_t id = UINT32_MAX;
+  peer_entry peer;
+  if (!numberParam(request, "sensor", &id) || !peerTable.snapshot(id, &peer))
+  {
+    request->send(400, "text/plain", "sensor must be the peer ID of a paired sensor");
+    return;
+  }
+  unpairRequests[id / 32].fetch_or(1u << (id % 32), std::memory_order_release);
+  request->send(202, "application/json", "{\"unpairing\": " + String(id) + "}");
+}
+// Setup Function
+void setup()
+{
+  Serial.begin(115200);
+  binlogBegin();
+
+  // Set Wi-Fi mode to AP+STA
+  bootPhaseBegin("wifi_mode");
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.setSleep(WIFI_PS_NONE);
+  WiFi.channel(1); // Set initial channel
+
+  // Configure Access Point
+  bootPhaseBegin("soft_ap");
+  WiFi.softAP(soft_ap_ssid, soft_ap_password);
+  delay(1000);
+  WiFi.softAPConfig(local_ip, gateway, subnet);
+  Serial.print("AP IP Address: ");
+  Serial.println(WiFi.softAPIP());
+
+  // Connect to Wi-Fi network (STA)
+  bootPhaseBegin("sta_connect");
+  WiFi.begin(wifi_network_ssid, wifi_network_password);
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("Connected to Wi-Fi!");
+
+  // Print the local IP address
+  Serial.print("Local IP Address: ");
+  Serial.println(WiFi.localIP());
+
+  bootPhaseBegin("channel_scan");
+  scan_and_set_wifi_channel();
+  bootPhaseBegin("espnow_init");
+  initESPNow();
+
+  // Storage for frame captures
+  bootPhaseBegin("capture_fs");
+  captureBegin();
+
+  // The reading history takes what the heap can spare once Wi-Fi and SPIFFS
+  // are up, up to HISTORY_RAM_BUDGET; without it the Server runs on, with
+  // empty history charts and exports
+  bootPhaseBegin("history");
+  uint32_t spareHeap = ESP.getFreeHeap() > HEAP_RESERVE ? ESP.getFreeHeap() - HEAP_RESERVE : 0;
+  size_t historyBudget = HISTORY_RAM_BUDGET;
+  historyBudget = historyBudget < spareHeap ? historyBudget : spareHeap;
+  historyBudget = historyBudget < ESP.getMaxAllocHeap() ? historyBudget : ESP.getMaxAllocHeap();
+  if (history.begin(historyBudget))
+  {
+    Serial.printf("Reading history of %u blocks\n", (unsigned)history.capacity());
+  }
+  else
+  {
+    Serial.printf("No heap for the reading history (%u bytes free)\n", (unsigned)ESP.getFreeHeap());
+  }
+
+  // Frames are handled by the radio task, away from the HTTP server
+  radioQueue = xQueueCreate(RADIO_QUEUE_DEPTH, sizeof(radio_event));
+  xTaskCreatePinnedToCore(radioTaskMain, "radio", RADIO_TASK_STACK, NULL, RADIO_TASK_PRIORITY, &radioTask, RADIO_TASK_CORE);
+
+  // Register the callbacks for receiving data and send status
+  esp_now_register_recv_cb(OnDataRecv);
+  esp_now_register_send_cb(OnDataSent);
+
+  bootPhaseBegin("http_server");
+
+  // Serve the webpage with sensor data
+  onRoute("/", serveWebpage);
+
+  // Serve the light sensor data as JSON
+  onRoute("/status/light", serveLightData);
+  onRoute("/status/smoke", serveSmokeData);
+
+  // Serve the sound sensor data
+  onRoute("/status/sound", [](AsyncWebServerRequest *request)
+          {
+    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", latestStatus(SENSOR_SOUND));
+    response->addHeader("X-Sensor-Liveness", latestLiveness(SENSOR_SOUND));
+    request->send(response); });
+
+  // Serve the motion sensor data
+  onRoute("/status/motion", [](AsyncWebServerRequest *request)
+          {
+    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", latestStatus(SENSOR_MOTION));
+    response->addHeader("X-Sensor-Liveness", latestLiveness(SENSOR_MOTION));
+    request->send(response); });
+
+  // Serve every sensor instance and the per-zone summaries
+  onRoute("/status/sensors", serveSensors);
+  onRoute("/status/zones", serveZones);
+  onRoute("/status/stats", serveStats);
+
+  // Serve the IP address
+  onRoute("/ip", handleIPAddress);
+
+  // Serve the paired sensors
+  onRoute("/peers", servePeers);
+  onRoute("/unpair", serveUnpair);
+
+  // Serve the boot phase timings
+  onRoute("/boot", serveBootTimings);
+
+  // Serve the counters for Prometheus
+  onRoute("/metrics", serveMetrics);
+
+  // Serve the reading latency traces
+  onRoute("/trace", serveTrace);
+
+  // Record received frames for replay on a host
+  onRoute("/capture", serveCapture);
+  onRoute("/capture.bin", serveCaptureFile);
+
+  // Stream the reading history for offline analysis, and for the chart
+  onRoute("/export", serveExport);
+  onRoute("/history.bin", serveHistoryColumns);
+
+  // Start the server
+  server.begin();
+  bootPhaseEnd();
+
+  bootProfilerPrint();
+}
+
+// Loop Function
+void loop()
+{
+  // Persist newly paired sensors outside the radio task
+  savePeerTable();
+  delay(10);
+}
@@ -1,116 +1,256 @@
-#ifndef PAGEINDEX_H
-#define PAGEINDEX_H
-
-const char PAGEINDEX[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-  <meta charset="UTF-8">
-  <meta name="viewport" content="width=device-width, initial-scale=1.0">
-  <title>ESP32 Sensor Data</title>
-  <style>
-    body {
-      font-family: Arial, sans-serif;
-      background-color: #B37A4C; /* Background Color */
-      margin: 0;
-      padding: 0;
-    }
-
-    .container {
-      text-align: center;
-      padding: 50px;
-    }
-
-    .status-box {
-      border: 2px solid #CC9966; /* Border Color */
-      padding: 30px; /* Increased padding for larger box */
-      border-radius: 15px;
-      box-shadow: 2px 2px 15px rgba(204, 153, 102, 0.5); /* Shadow Effect */
-      background-color: #FFFDDD; /* Box Background */
-      font-size: 24px; /* Larger font size */
-      font-weight: bold;
-      color: #B37A4C; /* Text Color */
-      width: 400px; /* Increased width */
-      margin: 20px auto; /* Added margin for spacing */
-      text-align: center;
-    }
-
-    .status-box p {
-      margin: 0;
-    }
-
-    .title {
-      font-size: 36px;
-      font-weight: bold;
-      color: #FFFDDD;
-      text-shadow: 2px 2px 4px rgba(0, 0, 0, 0.5);
-      margin-bottom: 20px;
-    }
-  </style>
-<script>
-  // Function to fetch the latest data
-  function fetchData() {
-    // Fetch Sound Status
-    fetch("/status/sound")
-      .then(response => response.text())
-      .then(data => {
-        document.getElementById("soundStatus").innerText = "Sound Status: " + data;
-      })
-      .catch(error => {
-        console.error('Error fetching sound data:', error);
-        document.getElementById("soundStatus").innerText = "Sound Status: Error";
-      });
-
-    // Fetch Motion Status
-    fetch("/status/motion")
-      .then(response => response.text())
-      .then(data => {
-        document.getElementById("motionStatus").innerText = "Motion Sensor: " + data;
-      })
-      .catch(error => {
-        console.error('Error fetching motion data:', error);
-        document.getElementById("motionStatus").innerText = "Motion Sensor: Error";
-      });
-
-    // Fetch Smoke Status
-    fetch("/status/smoke")
-      .then(response => response.text())
-      .then(data => {
-        document.getElementById("smokeStatus").innerText = "Smoke Status: " + data;
-      })
-      .catch(error => {
-        console.error('Error fetching smoke data:', error);
-        document.getElementById("smokeStatus").innerText = "Smoke Status: Error";
-      });
-
-    // Fetch Light Level and Brightness Percentage
-    fetch("/status/light")
-      .then(response => response.json())
-      .then(data => {
-        document.getElementById("brightnessPercentage").innerText = "Brightness: " + data.brightnessPercentage;
-      })
-      .catch(error => {
-        console.error('Error fetching light data:', error);
-        document.getElementById("brightnessPercentage").innerText = "Brightness: Error";
-      });
-  }
-
-  // Refresh data every 2 seconds
-  setInterval(fetchData, 2000);
-</script>
-
-</head>
-<body>
-  <div class="container">
-    <div class="title">My Smart Home Office</div>
-
-    <div class="status-box" id="soundStatus">Sound Status: Loading...</div>
-    <div class="status-box" id="motionStatus">Motion Sensor: Loading...</div>
-    <div class="status-box" id="smokeStatus">Smoke Status: Loading...</div>
-    <div class="status-box" id="brightnessPercentage">Brightness: Loading...</div>
-  </div>
-</body>
-</html>
-)rawliteral";
-
-#endif
+#ifndef PAGEINDEX_H
+#define PAGEINDEX_H
+
+const char PAGEINDEX[] PROGMEM = R"rawliteral(
+<!DOCTYPE html>
+<html lang="en">
+<head>
+  <meta charset="UTF-8">
+  <meta name="viewport" content="width=device-width, initial-scale=1.0">
+  <title>ESP32 Sensor Data</title>
+  <style>
+    body {
+      font-family: Arial, sans-serif;
+      background-color: #B37A4C; /* Background Color */
+      margin: 0;
+      padding: 0;
+    }
+
+    .container {
+      text-align: center;
+      padding: 50px;
+    }
+
+    .status-box {
+      border: 2px solid #CC9966; /* Border Color */
+      padding: 30px; /* Increased padding for larger box */
+      border-radius: 15px;
+      box-shadow: 2px 2px 15px rgba(204, 153, 102, 0.5); /* Shadow Effect */
+      background-color: #FFFDDD; /* Box Background */
+      font-size: 24px; /* Larger font size */
+      font-weight: bold;
+      color: #B37A4C; /* Text Color */
+      width: 400px; /* Increased width */
+      margin: 20px auto; /* Added margin for spacing */
+      text-align: center;
+    }
+
+    .status-box p {
+      margin: 0;
+    }
+
+    .sensor-table {
+      margin: 20px auto;
+      border-collapse: collapse;
+      background-color: #FFFDDD;
+      color: #B37A4C;
+      font-size: 18px;
+    }
+
+    .sensor-table th,
+    .sensor-table td {
+      border: 1px solid #CC9966;
+      padding: 8px 16px;
+    }
+
+    .chart-box {
+      margin: 20px auto;
+      width: 640px;
+      padding: 10px;
+      border: 2px solid #CC9966;
+      border-radius: 15px;
+      background-color: #FFFDDD;
+      color: #B37A4C;
+      font-size: 18px;
+    }
+
+    .title {
+      font-size: 36px;
+      font-weight: bold;
+      color: #FFFDDD;
+      text-shadow: 2px 2px 4px rgba(0, 0, 0, 0.5);
+      margin-bottom: 20px;
+    }
+  </style>
+<script>
+  // The last status of a sensor the Server no longer hears from is only history
+  function offline(response) {
+    return response.headers.get("X-Sensor-Liveness") === "offline" ? " (offline)" : "";
+  }
+
+  // Function to fetch the latest data
+  function fetchData() {
+    // Fetch Sound Status
+    fetch("/status/sound")
+      .then(response => response.text().then(data => data + offline(response)))
+      .then(data => {
+        document.getElementById("soundStatus").innerText = "Sound Status: " + data;
+      })
+      .catch(error => {
+        console.error('Error fetching sound data:', error);
+        document.getElementById("soundStatus").innerText = "Sound Status: Error";
+      });
+
+    // Fetch Motion Status
+    fetch("/status/motion")
+      .then(response => response.text().then(data => data + offline(response)))
+      .then(data => {
+        document.getElementById("motionStatus").innerText = "Motion Sensor: " + data;
+      })
+      .catch(error => {
+        console.error('Error fetching motion data:', error);
+        document.getElementById("motionStatus").innerText = "Motion Sensor: Error";
+      });
+
+    // Fetch Smoke Status
+    fetch("/status/smoke")
+      .then(response => response.text().then(data => [data, response.headers.get("X-Sensor-Health"), offline(response)]))
+      .then(([data, health, gone]) => {
+        // Say when the reading itself is not to be trusted
+        const faulty = health && health !== "ok" && health !== "learning" && health !== "unknown";
+        document.getElementById("smokeStatus").innerText =
+          "Smoke Status: " + data + (gone || (faulty ? " (sensor " + health + ")" : ""));
+      })
+      .catch(error => {
+        console.error('Error fetching smoke data:', error);
+        document.getElementById("smokeStatus").innerText = "Smoke Status: Error";
+      });
+
+    // Fetch Light Level and Brightness Percentage
+    fetch("/status/light")
+      .then(response => response.json().then(data => [data, offline(response)]))
+      .then(([data, gone]) => {
+        document.getElementById("brightnessPercentage").innerText = "Brightness: " + data.brightnessPercentage + gone;
+      })
+      .catch(error => {
+        console.error('Error fetching light data:', error);
+        document.getElementById("brightnessPercentage").innerText = "Brightness: Error";
+      });
+
+    // Fetch every sensor instance
+    fetch("/status/sensors")
+      .then(response => response.json())
+      .then(sensors => {
+        // Cells are set as text: the statuses come from the sensors
+        const rows = sensors.map(s => {
+          const row = document.createElement("tr");
+          const cells = [s.id, s.type, s.zone, s.status, s.value,
+                         Math.round(s.ageMs / 1000) + " s" + (s.liveness === "offline" ? " (offline)" : "")];
+          for (const text of cells) {
+            row.insertCell().textContent = text;
+          }
+          return row;
+        });
+        document.getElementById("sensorRows").replaceChildren(...rows);
+        updateChartSensors(sensors);
+      })
+      .catch(error => {
+        console.error('Error fetching sensor list:', error);
+      });
+  }
+
+  // Offer every sensor instance for the chart, keeping the one chosen
+  function updateChartSensors(sensors) {
+    const select = document.getElementById("chartSensor");
+    const chosen = select.value;
+    select.replaceChildren(...sensors.map(s => new Option(s.id + " " + s.type + " (zone " + s.zone + ")", s.id)));
+    if (sensors.some(s => String(s.id) === chosen)) {
+      select.value = chosen;
+    }
+    drawChart();
+  }
+
+  // Chart the chosen sensor from /history.bin: a 20-byte header, then the
+  // gaps between points as uint32 and the values as int16
+  function drawChart() {
+    const select = document.getElementById("chartSensor");
+    if (select.value === "") {
+      return;
+    }
+    const canvas = document.getElementById("chart");
+    const rangeMs = Number(document.getElementById("chartRange").value);
+    const stepMs = Math.floor(rangeMs / canvas.width);
+    fetch("/history.bin?sensor=" + select.value + "&last=" + rangeMs + "&step=" + stepMs)
+      .then(response => response.arrayBuffer())
+      .then(buffer => {
+        const header = new DataView(buffer, 0, 20);
+        const count = header.getUint32(8, true);
+        const firstMs = header.getUint32(12, true);
+        const nowMs = header.getUint32(16, true);
+        const gaps = new Uint32Array(buffer, 20, count);
+        const values = new Int16Array(buffer, 20 + 4 * count, count);
+
+        const ctx = canvas.getContext("2d");
+        ctx.clearRect(0, 0, canvas.width, canvas.height);
+        if (count === 0) {
+          ctx.fillStyle = "#B37A4C";
+          ctx.fillText("No readings in range", 10, 20);
+          return;
+        }
+        let min = values[0], max = values[0];
+        for (let i = 1; i < count; i++) {
+          min = Math.min(min, values[i]);
+          max = Math.max(max, values[i]);
+        }
+        const span = max > min ? max - min : 1;
+        const top = 20, height = canvas.height - 30;
+        ctx.strokeStyle = "#B37A4C";
+        ctx.beginPath();
+        // Times relative to nowMs, as signed 32-bit so a millis() wrap in range is no jump
+        let t = (firstMs - nowMs) | 0;
+        for (let i = 0; i < count; i++) {
+          t += gaps[i];
+          const x = (t + rangeMs) / rangeMs * canvas.width;
+          const y = top + height - (values[i] - min) / span * height;
+          if (i === 0) {
+            ctx.moveTo(x, y);
+          } else {
+            ctx.lineTo(x, y);
+          }
+        }
+        ctx.stroke();
+        ctx.fillStyle = "#B37A4C";
+        ctx.fillText("max " + max, 5, 12);
+        ctx.fillText("min " + min + ", " + count + " points", 5, canvas.height - 2);
+      })
+      .catch(error => {
+        console.error('Error fetching history:', error);
+      });
+  }
+
+  // Refresh data every 2 seconds
+  setInterval(fetchData, 2000);
+</script>
+
+</head>
+<body>
+  <div class="container">
+    <div class="title">My Smart Home Office</div>
+
+    <div class="status-box" id="soundStatus">Sound Status: Loading...</div>
+    <div class="status-box" id="motionStatus">Motion Sensor: Loading...</div>
+    <div class="status-box" id="smokeStatus">Smoke Status: Loading...</div>
+    <div class="status-box" id="brightnessPercentage">Brightness: Loading...</div>
+
+    <table class="sensor-table">
+      <thead>
+        <tr><th>ID</th><th>Type</th><th>Zone</th><th>Status</th><th>Value</th><th>Last seen</th></tr>
+      </thead>
+      <tbody id="sensorRows"></tbody>
+    </table>
+
+    <div class="chart-box">
+      <select id="chartSensor" onchange="drawChart()"></select>
+      <select id="chartRange" onchange="drawChart()">
+        <option value="600000">10 minutes</option>
+        <option value="3600000">1 hour</option>
+        <option value="21600000">6 hours</option>
+      </select>
+      <canvas id="chart" width="620" height="240"></canvas>
+    </div>
+  </div>
+</body>
+</html>
+)rawliteral";
+
+#endif
@@ -0,0 +1,177 @@
+#include "Backlog.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static_assert(sizeof(backlog_frame) <= 250, "a backlog frame must fit one ESP-NOW frame");
+
+size_t backlogFrameLen(uint8_t count)
+{
+  return offsetof(backlog_frame, samples) + count * sizeof(backlog_sample);
+}
+
+bool backlogParseFrame(const uint8_t *data, int len, backlog_frame *frame)
+{
+  frame_header header;
+  if (len < (int)backlogFrameLen(0) || !frameParseHeader(data, len, &header) || header.kind != FRAME_BACKLOG)
+  {
+    return false;
+  }
+  uint8_t count = data[offsetof(backlog_frame, count)];
+  if (count > BACKLOG_FRAME_SAMPLES || len != (int)backlogFrameLen(count))
+  {
+    return false;
+  }
+  memset(frame, 0, sizeof(*frame));
+  memcpy(frame, data, len);
+  return true;
+}
+
+uint32_t backlogDrainMs(int8_t level)
+{
+  if (level <= 0)
+  {
+    return BACKLOG_DRAIN_MS;
+  }
+  return (uint32_t)BACKLOG_DRAIN_MS << (level < 8 ? level : 8);
+}
+
+Backlog::Backlog()
+    : head(0), count(0), inFlight(0), overwritten(0), pendingCount(0), outage(false), outageSendNo(0), frameSendNo(0),
+      nextFrameMs(0), rng(1)
+{
+}
+
+bool Backlog::keep(uint32_t sampleMs, int32_t value, uint16_t threshold)
+{
+  if (count > 0)
+  {
+    const held_reading &newest = ring[(head + count - 1) % BACKLOG_SLOTS];
+    int32_t change = value > newest.value ? value - newest.value : newest.value - value;
+    if (sampleMs - newest.sampleMs < BACKLOG_SPACING_MS && change < (threshold > 0 ? (int32_t)threshold : 1))
+    {
+      return false;
+    }
+  }
+  if (count == BACKLOG_SLOTS)
+  {
+    head = (head + 1) % BACKLOG_SLOTS;
+    count--;
+    overwritten++;
+    if (inFlight > 0)
+    {
+      inFlight--;
+    }
+  }
+  held_reading &slot = ring[(head + count) % BACKLOG_SLOTS];
+  slot.sampleMs = sampleMs;
+  slot.value = value;
+  count++;
+  return true;
+}
+
+void Backlog::onReadingSent(uint32_t sendNo, uint32_t sampleMs, int32_t value, uint16_t threshold)
+{
+  if (pendingCount == BACKLOG_PENDING_MAX)
+  {
+    // The oldest has waited far longer than a result takes; take it as delivered
+    memmove(pending, pending + 1, (BACKLOG_PENDING_MAX - 1) * sizeof(pending[0]));
+    pendingCount--;
+  }
+  pending_reading &reading = pending[pendingCount++];
+  reading.sendNo = sendNo;
+  reading.sampleMs = sampleMs;
+  reading.value = value;
+  reading.threshold = threshold;
+}
+
+void Backlog::onResult(uint32_t sendNo, bool delivered, uint32_t nowMs, int8_t level)
+{
+  bool lost = false;
+  if (frameSendNo != 0 && sendNo == frameSendNo)
+  {
+    if (delivered)
+    {
+      head = (head + inFlight) % BACKLOG_SLOTS;
+      count -= inFlight;
+    }
+    inFlight = 0;
+    frameSendNo = 0;
+    lost = !delivered;
+  }
+
+  // Readings sent before this one whose results were missed count as delivered
+  while (pendingCount > 0 && (int32_t)(sendNo - pending[0].sendNo) >= 0)
+  {
+    pending_reading reading = pending[0];
+    memmove(pending, pending + 1, (pendingCount - 1) * sizeof(pending[0]));
+    pendingCount--;
+    if (reading.sendNo == sendNo && !delivered)
+    {
+      keep(reading.sampleMs, reading.value, reading.threshold);
+      lost = true;
+    }
+  }
+
+  if (lost)
+  {
+    hold(sendNo);
+  }
+  else if (outage && delivered && (int32_t)(sendNo - outageSendNo) > 0)
+  {
+    outage = false;
+    nextFrameMs = nowMs + random() % backlogDrainMs(level);
+  }
+}
+
+void Backlog::hold(uint32_t sendNo)
+{
+  outage = true;
+  outageSendNo = sendNo;
+  // Readings sent after the lost one are most likely lost too; hold them
+  // now so they stay in order with those taken from here on
+  for (uint8_t i = 0; i < pendingCount; i++)
+  {
+    keep(pending[i].sampleMs, pending[i].value, pending[i].threshold);
+  }
+  pendingCount = 0;
+}
+
+size_t Backlog::nextFrame(backlog_frame *frame, uint32_t nowMs)
+{
+  if (outage || frameSendNo != 0 || inFlight != 0 || count == 0 || (int32_t)(nowMs - nextFrameMs) < 0)
+  {
+    return 0;
+  }
+  uint8_t n = count < BACKLOG_FRAME_SAMPLES ? (uint8_t)count : BACKLOG_FRAME_SAMPLES;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    const held_reading &reading = ring[(head + i) % BACKLOG_SLOTS];
+    frame->samples[i].ageMs = nowMs - reading.sampleMs;
+    frame->samples[i].value = reading.value;
+  }
+  frame->remaining = count - n;
+  frame->count = n;
+  frame->reserved = 0;
+  inFlight = n;
+  return backlogFrameLen(n);
+}
+
+void Backlog::onFrameSent(uint32_t sendNo, uint32_t nowMs, int8_t level)
+{
+  frameSendNo = sendNo;
+  if (sendNo == 0)
+  {
+    inFlight = 0;
+  }
+  nextFrameMs = nowMs + backlogDrainMs(level);
+}
+
+uint32_t Backlog::random()
+{
+  // xorshift32
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
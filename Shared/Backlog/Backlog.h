@@ -0,0 +1,153 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SensorFrame.h>
+
+// Store-and-forward of readings while the Server cannot be reached, e.g.
+// while it reboots or is off the channel.
+//
+// A sensor starts holding its readings when a reading or backlog frame it
+// sent was not delivered (after the driver's retries), and stops when
+// anything it sent since, usually a heartbeat, is delivered. Held readings
+// go into a ring of BACKLOG_SLOTS: a reading within BACKLOG_SPACING_MS of
+// the newest one held and less than the reporting threshold away from it
+// adds nothing, so a fast steady sensor keeps one reading a second, and a
+// full ring overwrites its oldest reading.
+//
+// Once the Server is back the sensor forwards the ring oldest first, up
+// to BACKLOG_FRAME_SAMPLES readings per frame and one frame per
+// backlogDrainMs() of the reporting level, so a Server that finds the
+// channel busy slows every sensor's drain down with the level it
+// broadcasts anyway. The first frame waits a random part of that gap, so
+// sensors that lost the Server together do not all come back in step.
+// Readings stay in the ring until their frame is delivered. Until the ring
+// is empty new readings still go out at once, as FRAME_READING_QUEUED, and
+// are held as well, so the Server adds them to the history after the
+// older ones.
+//
+// Times in the ring are the sender's millis(); backlog frames carry each
+// reading's age when the frame was built, so the Server places them on
+// its own clock without clock sync, even across its reboots.
+
+#ifndef BACKLOG_SLOTS
+// 8 bytes each. A ten-minute outage at one reading a second fills 600, and
+// readings keep coming while the sensor notices the outage and while it
+// drains afterwards (about 40 s for 50 sensors in Tools/backlog)
+#define BACKLOG_SLOTS 768
+#endif
+
+#ifndef BACKLOG_SPACING_MS
+#define BACKLOG_SPACING_MS 1000 // Closest a steady reading is held to the one before it
+#endif
+
+#ifndef BACKLOG_DRAIN_MS
+#define BACKLOG_DRAIN_MS 500 // Gap between backlog frames at reporting level 0 and below
+#endif
+
+#define BACKLOG_FRAME_SAMPLES 29 // Fill an ESP-NOW frame of 250 bytes
+#define BACKLOG_PENDING_MAX 4    // Readings sent and awaiting their result
+
+typedef struct backlog_sample
+{
+  uint32_t ageMs; // Before the frame was built
+  int32_t value;
+} backlog_sample;
+
+typedef struct backlog_frame
+{
+  frame_header header; // kind FRAME_BACKLOG
+  uint16_t remaining;  // Readings the sensor still holds after these
+  uint8_t count;       // Samples that follow
+  uint8_t reserved;
+  backlog_sample samples[BACKLOG_FRAME_SAMPLES]; // Oldest first; only count of them are sent
+} backlog_frame;
+
+// Bytes of a backlog frame with count samples
+size_t backlogFrameLen(uint8_t count);
+
+// Returns true and copies the frame out if data is a backlog frame
+bool backlogParseFrame(const uint8_t *data, int len, backlog_frame *frame);
+
+// Gap between backlog frames at a reporting level: it doubles with every
+// level above 0, as the reporting intervals do
+uint32_t backlogDrainMs(int8_t level);
+
+// One sensor's backlog and the decisions around it, free of ESP-NOW calls.
+// Sends are numbered from 1 in the order they were handed to the driver,
+// counting every frame to the Server, and their results come back in the
+// same order.
+class Backlog
+{
+public:
+  Backlog();
+
+  // Seed for the wait before the first frame after an outage
+  void seed(uint32_t value) { rng = value != 0 ? value : 1; }
+
+  // Whether readings are held instead of sent
+  bool holding() const { return outage; }
+
+  // Readings held, those in a frame awaiting its result included
+  size_t depth() const { return count; }
+
+  // Readings overwritten because the ring was full
+  uint32_t dropped() const { return overwritten; }
+
+  // Hold a reading taken at sampleMs; false if it added nothing
+  bool keep(uint32_t sampleMs, int32_t value, uint16_t threshold);
+
+  // A reading went out as send sendNo without being held; it is held if
+  // its result is a failure. Only the last BACKLOG_PENDING_MAX are kept
+  // track of, which is plenty when results take milliseconds.
+  void onReadingSent(uint32_t sendNo, uint32_t sampleMs, int32_t value, uint16_t threshold);
+
+  // The result of send sendNo, which comes after those of earlier sends
+  void onResult(uint32_t sendNo, bool delivered, uint32_t nowMs, int8_t level);
+
+  // If a backlog frame is due at nowMs, fill in its samples and return its
+  // length; 0 otherwise. The caller stamps the header and sends it, then
+  // calls onFrameSent().
+  size_t nextFrame(backlog_frame *frame, uint32_t nowMs);
+
+  // The frame from nextFrame() went out as send sendNo, or 0 if the driver
+  // refused it
+  void onFrameSent(uint32_t sendNo, uint32_t nowMs, int8_t level);
+
+private:
+  typedef struct held_reading
+  {
+    uint32_t sampleMs;
+    int32_t value;
+  } held_reading;
+
+  typedef struct pending_reading
+  {
+    uint32_t sendNo;
+    uint32_t sampleMs;
+    int32_t value;
+    uint16_t threshold;
+  } pending_reading;
+
+  void hold(uint32_t sendNo);
+  uint32_t random();
+
+  held_reading ring[BACKLOG_SLOTS];
+  uint16_t head;     // Oldest reading
+  uint16_t count;
+  uint16_t inFlight; // Oldest readings in the frame awaiting its result
+  uint32_t overwritten;
+
+  pending_reading pending[BACKLOG_PENDING_MAX];
+  uint8_t pendingCount;
+
+  bool outage;
+  uint32_t outageSendNo; // Send whose failure started the outage
+  uint32_t frameSendNo;  // Backlog frame awaiting its result, 0 for none
+  uint32_t nextFrameMs;
+  uint32_t rng;
+};
+
+#endif
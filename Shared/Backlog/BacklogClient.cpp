@@ -0,0 +1,122 @@
+#ifdef ARDUINO
+
+#include "BacklogClient.h"
+
+#include <Arduino.h>
+#include <BinLog.h>
+#include <ClockSyncClient.h>
+#include <PairingClient.h>
+#include <ReportControlClient.h>
+#include <freertos/FreeRTOS.h>
+
+// Readings are also sent from the receive callbacks, e.g. on "disable", so
+// the backlog is only touched under this lock; sends happen outside it
+static portMUX_TYPE backlogLock = portMUX_INITIALIZER_UNLOCKED;
+static Backlog backlog;
+static uint32_t resultsTaken = 0; // Last send result passed to backlog, only touched by loop()
+static bool forwarding = false;   // Since the master came back, until the backlog is empty
+static unsigned long forwardStartTime = 0;
+
+void backlogBegin()
+{
+  backlog.seed(esp_random());
+}
+
+esp_err_t backlogSendReading(frame_header *header, const uint8_t *data, size_t len, int32_t value, uint32_t sampleUs)
+{
+  uint32_t nowUs = micros();
+  uint32_t sampleMs = millis() - (nowUs - sampleUs) / 1000;
+  uint16_t threshold = reportThreshold();
+
+  portENTER_CRITICAL(&backlogLock);
+  bool holding = backlog.holding();
+  if (holding)
+  {
+    backlog.keep(sampleMs, value, threshold);
+  }
+  // Behind a backlog the reading reaches the history in a backlog frame
+  bool queued = backlog.depth() > 0;
+  portEXIT_CRITICAL(&backlogLock);
+  if (holding)
+  {
+    return ESP_OK;
+  }
+
+  clockSyncStampFrame(header, queued ? FRAME_READING_QUEUED : FRAME_READING, sampleUs, nowUs);
+  uint32_t sendNo = 0;
+  esp_err_t result = pairingSendToMaster(data, len, &sendNo);
+
+  portENTER_CRITICAL(&backlogLock);
+  if (result != ESP_OK || queued)
+  {
+    backlog.keep(sampleMs, value, threshold);
+  }
+  else
+  {
+    backlog.onReadingSent(sendNo, sampleMs, value, threshold);
+  }
+  portEXIT_CRITICAL(&backlogLock);
+  return result;
+}
+
+void backlogLoop()
+{
+  uint32_t results = pairingResultCount();
+  int8_t level = reportLevel();
+  portENTER_CRITICAL(&backlogLock);
+  bool wasHolding = backlog.holding();
+  while (resultsTaken != results)
+  {
+    resultsTaken++;
+    backlog.onResult(resultsTaken, pairingSendDelivered(resultsTaken), millis(), level);
+  }
+  bool holding = backlog.holding();
+  size_t depth = backlog.depth();
+  backlog_frame frame;
+  size_t len = pairingMasterKnown() ? backlog.nextFrame(&frame, millis()) : 0;
+  portEXIT_CRITICAL(&backlogLock);
+
+  if (holding != wasHolding)
+  {
+    if (holding)
+    {
+      BINLOG(BACKLOG_HOLDING);
+    }
+    else
+    {
+      BINLOG(BACKLOG_FORWARDING, (unsigned)depth);
+      forwarding = true;
+      forwardStartTime = millis();
+    }
+  }
+  if (forwarding && depth == 0)
+  {
+    BINLOG(BACKLOG_FORWARDED, (unsigned long)(millis() - forwardStartTime), (unsigned long)backlog.dropped());
+    forwarding = false;
+  }
+
+  if (len == 0)
+  {
+    return;
+  }
+  uint32_t nowUs = micros();
+  clockSyncStampFrame(&frame.header, FRAME_BACKLOG, nowUs, nowUs);
+  uint32_t sendNo = 0;
+  if (pairingSendToMaster((const uint8_t *)&frame, len, &sendNo) != ESP_OK)
+  {
+    sendNo = 0;
+  }
+  portENTER_CRITICAL(&backlogLock);
+  backlog.onFrameSent(sendNo, millis(), level);
+  portEXIT_CRITICAL(&backlogLock);
+}
+
+size_t backlogDepth()
+{
+  portENTER_CRITICAL(&backlogLock);
+  size_t depth = backlog.depth();
+  portEXIT_CRITICAL(&backlogLock);
+  return depth;
+}
+
+#endif
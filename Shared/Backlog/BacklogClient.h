@@ -0,0 +1,33 @@
+#ifndef BACKLOG_CLIENT_H
+#define BACKLOG_CLIENT_H
+
+#ifdef ARDUINO
+
+#include "Backlog.h"
+
+#include <esp_now.h>
+
+// Sensor side of store-and-forward (see Backlog.h). Readings the Server
+// did not get are held in RAM and forwarded once it is back; heartbeats
+// find out when that is. Results are taken in and frames sent from
+// loop(), never from the ESP-NOW callbacks.
+
+// Seed the spread of the first frame after an outage; call once ESP-NOW is up
+void backlogBegin();
+
+// Send a reading frame to the master, or hold the reading while the master
+// cannot be reached. Stamps the frame's header with the kind it goes out
+// as; sampleUs is the micros() the reading was taken at. Returns ESP_OK
+// once the reading is sent or held.
+esp_err_t backlogSendReading(frame_header *header, const uint8_t *data, size_t len, int32_t value, uint32_t sampleUs);
+
+// Take in send results and forward held readings when due; call from loop()
+// before heartbeatLoop()
+void backlogLoop();
+
+// Readings held and not yet delivered to the master
+size_t backlogDepth();
+
+#endif
+
+#endif
@@ -0,0 +1,509 @@
+#include "BinLog.h"
+
+#include <TextBuffer.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct binlog_format
+{
+  const char *name;
+  const char *format;
+  uint8_t level;
+} binlog_format;
+
+static const binlog_format formats[] = {
+#define BINLOG_FORMAT_ENTRY(name, level, format) {#name, format, level},
+    BINLOG_FORMATS(BINLOG_FORMAT_ENTRY)
+#undef BINLOG_FORMAT_ENTRY
+};
+
+static_assert((BINLOG_RING_SLOTS & (BINLOG_RING_SLOTS - 1)) == 0, "BINLOG_RING_SLOTS must be a power of two");
+static_assert(BINLOG_FORMAT_COUNT <= 256, "format IDs are one byte on the wire");
+
+// CRC-8, polynomial 0x07
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static size_t putVarint(uint8_t *buf, size_t len, uint64_t value)
+{
+  size_t pos = 0;
+  do
+  {
+    if (pos == len)
+    {
+      return 0;
+    }
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    buf[pos++] = byte | (value ? 0x80 : 0);
+  } while (value);
+  return pos;
+}
+
+// Reads a varint at *pos; false if it runs past len
+static bool getVarint(const uint8_t *buf, size_t len, size_t *pos, uint64_t *value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < len; shift += 7)
+  {
+    uint8_t byte = buf[(*pos)++];
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+BinLogRing::BinLogRing() : head(0), tail(0), dropped(0)
+{
+  for (uint32_t i = 0; i < BINLOG_RING_SLOTS; i++)
+  {
+    slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool BinLogRing::push(const binlog_record &record)
+{
+  uint32_t pos = head.load(std::memory_order_relaxed);
+  for (;;)
+  {
+    slot &s = slots[pos & (BINLOG_RING_SLOTS - 1)];
+    int32_t diff = (int32_t)(s.seq.load(std::memory_order_acquire) - pos);
+    if (diff == 0)
+    {
+      // The slot is free for this position; claim it
+      if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        s.record = record;
+        s.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      // The consumer has not freed the slot yet: the ring is full
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else
+    {
+      // Another producer took this position
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool BinLogRing::pop(binlog_record *record)
+{
+  slot &s = slots[tail & (BINLOG_RING_SLOTS - 1)];
+  if (s.seq.load(std::memory_order_acquire) != tail + 1)
+  {
+    return false;
+  }
+  *record = s.record;
+  s.seq.store(tail + BINLOG_RING_SLOTS, std::memory_order_release);
+  tail++;
+  return true;
+}
+
+uint32_t BinLogRing::takeDropped()
+{
+  return dropped.exchange(0, std::memory_order_relaxed);
+}
+
+size_t binlogPutInt(uint8_t *buf, size_t len, int64_t value)
+{
+  uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  return putVarint(buf, len, zigzag);
+}
+
+size_t binlogPutFloat(uint8_t *buf, size_t len, float value)
+{
+  if (len < 4)
+  {
+    return 0;
+  }
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (size_t i = 0; i < 4; i++)
+  {
+    buf[i] = (uint8_t)(bits >> (8 * i));
+  }
+  return 4;
+}
+
+size_t binlogPutString(uint8_t *buf, size_t len, const char *value)
+{
+  if (len < 1)
+  {
+    return 0;
+  }
+  size_t n = value != NULL ? strlen(value) : 0;
+  if (n > BINLOG_STRING_MAX)
+  {
+    n = BINLOG_STRING_MAX;
+  }
+  if (n > len - 1)
+  {
+    n = len - 1;
+  }
+  buf[0] = (uint8_t)n;
+  memcpy(buf + 1, value, n);
+  return n + 1;
+}
+
+size_t binlogPutMac(uint8_t *buf, size_t len, const uint8_t *mac)
+{
+  if (len < 6)
+  {
+    return 0;
+  }
+  memcpy(buf, mac, 6);
+  return 6;
+}
+
+size_t binlogEncodeFrame(uint8_t *buf, size_t len, const binlog_record &record)
+{
+  if (len < BINLOG_FRAME_MAX || record.len > BINLOG_ARGS_MAX)
+  {
+    return 0;
+  }
+  size_t pos = 2;
+  buf[pos++] = record.id;
+  pos += putVarint(buf + pos, len - pos, record.timeMs);
+  memcpy(buf + pos, record.args, record.len);
+  pos += record.len;
+  buf[0] = BINLOG_SYNC;
+  buf[1] = (uint8_t)(pos - 2);
+  buf[pos] = crc8(buf + 2, pos - 2);
+  return pos + 1;
+}
+
+const char *binlogFormatName(uint8_t id)
+{
+  return id < BINLOG_FORMAT_COUNT ? formats[id].name : NULL;
+}
+
+const char *binlogFormatString(uint8_t id)
+{
+  return id < BINLOG_FORMAT_COUNT ? formats[id].format : NULL;
+}
+
+uint8_t binlogFormatLevel(uint8_t id)
+{
+  return id < BINLOG_FORMAT_COUNT ? formats[id].level : 0;
+}
+
+char binlogLevelLetter(uint8_t level)
+{
+  switch (level)
+  {
+  case BINLOG_ERROR:
+    return 'E';
+  case BINLOG_WARN:
+    return 'W';
+  case BINLOG_INFO:
+    return 'I';
+  case BINLOG_DEBUG:
+    return 'D';
+  default:
+    return '?';
+  }
+}
+
+size_t binlogFormatRecord(char *out, size_t len, const binlog_record &record)
+{
+  size_t pos = 0;
+  if (len == 0)
+  {
+    return 0;
+  }
+  out[0] = '\0';
+
+  const char *format = binlogFormatString(record.id);
+  if (format == NULL)
+  {
+    appendf(out, len, pos, "binlog: unknown format %u (%u argument bytes)", (unsigned)record.id,
+            (unsigned)record.len);
+    return pos;
+  }
+
+  const uint8_t *args = record.args;
+  size_t argsLen = record.len;
+  size_t argPos = 0;
+  for (const char *p = format; *p != '\0'; p++)
+  {
+    if (*p != '%')
+    {
+      appendf(out, len, pos, "%c", *p);
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      appendf(out, len, pos, "%%");
+      p++;
+      continue;
+    }
+
+    // Copy flags, width and precision; drop length modifiers, the argument
+    // is re-widened below
+    char spec[16] = "%";
+    size_t specLen = 1;
+    p++;
+    while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL)
+    {
+      if (specLen < sizeof(spec) - 4)
+      {
+        spec[specLen++] = *p;
+      }
+      p++;
+    }
+    while (*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+    {
+      p++;
+    }
+    if (*p == '\0')
+    {
+      break;
+    }
+
+    char conversion = *p;
+    bool ok = false;
+    if (strchr("diuxXc", conversion) != NULL)
+    {
+      uint64_t zigzag;
+      if (getVarint(args, argsLen, &argPos, &zigzag))
+      {
+        int64_t value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        if (conversion == 'c')
+        {
+          spec[specLen++] = 'c';
+          spec[specLen] = '\0';
+          appendf(out, len, pos, spec, (int)value);
+        }
+        else
+        {
+          spec[specLen++] = 'l';
+          spec[specLen++] = 'l';
+          spec[specLen++] = conversion;
+          spec[specLen] = '\0';
+          if (conversion == 'd' || conversion == 'i')
+          {
+            appendf(out, len, pos, spec, (long long)value);
+          }
+          else
+          {
+            appendf(out, len, pos, spec, (unsigned long long)value);
+          }
+        }
+        ok = true;
+      }
+    }
+    else if (strchr("fFeEgG", conversion) != NULL)
+    {
+      if (argPos + 4 <= argsLen)
+      {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < 4; i++)
+        {
+          bits |= (uint32_t)args[argPos + i] << (8 * i);
+        }
+        argPos += 4;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        spec[specLen++] = conversion;
+        spec[specLen] = '\0';
+        appendf(out, len, pos, spec, (double)value);
+        ok = true;
+      }
+    }
+    else if (conversion == 's')
+    {
+      if (argPos < argsLen && argPos + 1 + args[argPos] <= argsLen)
+      {
+        char text[BINLOG_ARGS_MAX];
+        size_t n = args[argPos];
+        memcpy(text, args + argPos + 1, n);
+        text[n] = '\0';
+        argPos += 1 + n;
+        spec[specLen++] = 's';
+        spec[specLen] = '\0';
+        appendf(out, len, pos, spec, text);
+        ok = true;
+      }
+    }
+    else if (conversion == 'M')
+    {
+      if (argPos + 6 <= argsLen)
+      {
+        const uint8_t *mac = args + argPos;
+        argPos += 6;
+        appendf(out, len, pos, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        ok = true;
+      }
+    }
+    if (!ok)
+    {
+      // Out of arguments (the record was cut short) or a conversion this decoder does not know
+      argPos = argsLen;
+      appendf(out, len, pos, "?");
+    }
+  }
+  return pos;
+}
+
+BinLogDecoder::BinLogDecoder() : pos(0), want(0)
+{
+  memset(&last, 0, sizeof(last));
+}
+
+uint8_t BinLogDecoder::feed(uint8_t byte)
+{
+  if (pos == 0)
+  {
+    if (byte != BINLOG_SYNC)
+    {
+      return BINLOG_FEED_TEXT;
+    }
+    frame[pos++] = byte;
+    return BINLOG_FEED_PENDING;
+  }
+  if (pos == 1)
+  {
+    // The body holds at least a format ID and a one-byte time
+    if (byte < 2 || byte > BINLOG_FRAME_MAX - 3)
+    {
+      pos = 0;
+      return BINLOG_FEED_BAD;
+    }
+    frame[pos++] = byte;
+    want = (size_t)byte + 3;
+    return BINLOG_FEED_PENDING;
+  }
+
+  frame[pos++] = byte;
+  if (pos < want)
+  {
+    return BINLOG_FEED_PENDING;
+  }
+
+  size_t bodyLen = want - 3;
+  const uint8_t *body = frame + 2;
+  pos = 0;
+  want = 0;
+  if (crc8(body, bodyLen) != frame[bodyLen + 2])
+  {
+    return BINLOG_FEED_BAD;
+  }
+
+  size_t at = 1;
+  uint64_t timeMs;
+  if (!getVarint(body, bodyLen, &at, &timeMs) || bodyLen - at > BINLOG_ARGS_MAX)
+  {
+    return BINLOG_FEED_BAD;
+  }
+  last.id = body[0];
+  last.timeMs = (uint32_t)timeMs;
+  last.len = (uint8_t)(bodyLen - at);
+  memcpy(last.args, body + at, last.len);
+  return BINLOG_FEED_FRAME;
+}
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define BINLOG_TASK_STACK 3072
+#define BINLOG_TASK_PRIORITY 1 // Just above idle, below the Wi-Fi and radio tasks
+#define BINLOG_DRAIN_MS 20
+
+static BinLogRing ring;
+static std::atomic<bool> draining(false);
+
+void binlogPush(uint8_t id, const uint8_t *args, size_t len)
+{
+  binlog_record record;
+  record.timeMs = millis();
+  record.id = id;
+  record.len = (uint8_t)len;
+  memcpy(record.args, args, len);
+  ring.push(record);
+}
+
+// Write queued records to Serial, a batch of frames per write
+static void drain()
+{
+  uint8_t out[8 * BINLOG_FRAME_MAX];
+  size_t n = 0;
+  binlog_record record;
+
+  uint32_t lost = ring.takeDropped();
+  if (lost > 0)
+  {
+    record.timeMs = millis();
+    record.id = BINLOG_ID_DROPPED;
+    record.len = (uint8_t)binlogPutInt(record.args, sizeof(record.args), lost);
+    n += binlogEncodeFrame(out + n, sizeof(out) - n, record);
+  }
+  while (ring.pop(&record))
+  {
+    if (sizeof(out) - n < BINLOG_FRAME_MAX)
+    {
+      Serial.write(out, n);
+      n = 0;
+    }
+    n += binlogEncodeFrame(out + n, sizeof(out) - n, record);
+  }
+  if (n > 0)
+  {
+    Serial.write(out, n);
+  }
+}
+
+// The ring has one consumer; the task and binlogFlush() take turns
+static void drainExclusive()
+{
+  while (draining.exchange(true, std::memory_order_acquire))
+  {
+    delay(1);
+  }
+  drain();
+  draining.store(false, std::memory_order_release);
+}
+
+static void drainTaskMain(void *)
+{
+  for (;;)
+  {
+    drainExclusive();
+    vTaskDelay(pdMS_TO_TICKS(BINLOG_DRAIN_MS));
+  }
+}
+
+void binlogBegin()
+{
+  xTaskCreate(drainTaskMain, "binlog", BINLOG_TASK_STACK, NULL, BINLOG_TASK_PRIORITY, NULL);
+}
+
+void binlogFlush()
+{
+  drainExclusive();
+  Serial.flush();
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Deferred binary logging for the hot paths of the firmwares.
+//
+//   BINLOG(LIGHT_SENT, myData.lightLevel, myData.brightnessPercentage);
+//
+// A call encodes a format ID and its arguments into a lock-free ring, which
+// costs a few microseconds instead of the milliseconds the UART needs for
+// the text. A low-priority task drains the ring to Serial as binary frames
+// and Tools/binlog decodes a capture of the port back into text. The format
+// strings live in BinLogFormats.h and never reach the firmware.
+//
+// Every format has a level. Calls to formats above BINLOG_LEVEL compile to
+// nothing, arguments included; release builds set BINLOG_LEVEL=BINLOG_WARN.
+//
+// A frame on the wire:
+//   BINLOG_SYNC, length, format ID, time (varint, ms since boot), arguments, CRC-8
+// length counts the bytes from the format ID through the arguments and the
+// CRC-8 covers those bytes. Arguments follow the conversions of the format:
+// integers (%d %i %u %x %X %c) as zigzag varints, %f %e %g as little-endian
+// floats, %s as a length byte and the characters, and %M as a 6-byte MAC
+// address. BINLOG_SYNC is not ASCII, so text printed with Serial between
+// frames passes through the decoder unchanged.
+
+#define BINLOG_ERROR 1
+#define BINLOG_WARN 2
+#define BINLOG_INFO 3
+#define BINLOG_DEBUG 4
+
+#ifndef BINLOG_LEVEL
+#define BINLOG_LEVEL BINLOG_DEBUG
+#endif
+
+#ifndef BINLOG_RING_SLOTS
+#define BINLOG_RING_SLOTS 32 // Power of two; records logged while the ring is full are dropped
+#endif
+
+#define BINLOG_SYNC 0xa5
+#define BINLOG_ARGS_MAX 32   // Argument bytes per record; arguments that do not fit are left out
+#define BINLOG_STRING_MAX 20 // Longer %s arguments are truncated
+#define BINLOG_FRAME_MAX (2 + 1 + 5 + BINLOG_ARGS_MAX + 1)
+
+#include "BinLogFormats.h"
+
+enum binlog_format_id
+{
+#define BINLOG_FORMAT_ID(name, level, format) BINLOG_ID_##name,
+  BINLOG_FORMATS(BINLOG_FORMAT_ID)
+#undef BINLOG_FORMAT_ID
+  BINLOG_FORMAT_COUNT
+};
+
+enum binlog_format_level
+{
+#define BINLOG_FORMAT_LEVEL(name, level, format) BINLOG_LEVEL_OF_##name = level,
+  BINLOG_FORMATS(BINLOG_FORMAT_LEVEL)
+#undef BINLOG_FORMAT_LEVEL
+};
+
+typedef struct binlog_record
+{
+  uint32_t timeMs;
+  uint8_t id;  // binlog_format_id
+  uint8_t len; // Bytes used in args
+  uint8_t args[BINLOG_ARGS_MAX];
+} binlog_record;
+
+// Bounded ring of records for any number of producers and one consumer.
+// push() never blocks or takes a lock, so it is safe from the Wi-Fi task
+// callbacks; when the ring is full the record is counted and dropped.
+class BinLogRing
+{
+public:
+  BinLogRing();
+
+  bool push(const binlog_record &record);
+  bool pop(binlog_record *record); // Consumer only
+
+  // Records dropped since the last call
+  uint32_t takeDropped();
+
+private:
+  typedef struct slot
+  {
+    std::atomic<uint32_t> seq; // Position the slot is ready for: pos to write, pos + 1 to read
+    binlog_record record;
+  } slot;
+
+  slot slots[BINLOG_RING_SLOTS];
+  std::atomic<uint32_t> head;
+  uint32_t tail;
+  std::atomic<uint32_t> dropped;
+};
+
+// Argument encoders; return the bytes written, or 0 if the argument does not fit
+size_t binlogPutInt(uint8_t *buf, size_t len, int64_t value);
+size_t binlogPutFloat(uint8_t *buf, size_t len, float value);
+size_t binlogPutString(uint8_t *buf, size_t len, const char *value);
+size_t binlogPutMac(uint8_t *buf, size_t len, const uint8_t *mac);
+
+typedef struct binlog_mac
+{
+  const uint8_t *bytes;
+} binlog_mac;
+
+// Wraps a MAC address for a %M conversion
+inline binlog_mac binlogMac(const uint8_t *mac)
+{
+  return binlog_mac{mac};
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+binlogPut(uint8_t *buf, size_t len, T value)
+{
+  return binlogPutInt(buf, len, (int64_t)value);
+}
+
+inline size_t binlogPut(uint8_t *buf, size_t len, double value)
+{
+  return binlogPutFloat(buf, len, (float)value);
+}
+
+inline size_t binlogPut(uint8_t *buf, size_t len, const char *value)
+{
+  return binlogPutString(buf, len, value);
+}
+
+inline size_t binlogPut(uint8_t *buf, size_t len, binlog_mac value)
+{
+  return binlogPutMac(buf, len, value.bytes);
+}
+
+inline size_t binlogPutAll(uint8_t *, size_t, size_t pos)
+{
+  return pos;
+}
+
+// Encode arguments in order, stopping at the first that does not fit
+template <typename T, typename... Rest>
+inline size_t binlogPutAll(uint8_t *buf, size_t len, size_t pos, T first, Rest... rest)
+{
+  size_t n = binlogPut(buf + pos, len - pos, first);
+  return n == 0 ? pos : binlogPutAll(buf, len, pos + n, rest...);
+}
+
+// Frame a record for the wire; returns the bytes written, 0 if buf is too small
+size_t binlogEncodeFrame(uint8_t *buf, size_t len, const binlog_record &record);
+
+// Name, format string and level of a format ID; NULL (level 0) for IDs
+// this build does not know
+const char *binlogFormatName(uint8_t id);
+const char *binlogFormatString(uint8_t id);
+uint8_t binlogFormatLevel(uint8_t id);
+char binlogLevelLetter(uint8_t level);
+
+// Render a record as text (without time or level); returns bytes written
+// (excluding NUL). Missing or malformed arguments print as '?'.
+size_t binlogFormatRecord(char *out, size_t len, const binlog_record &record);
+
+enum binlog_feed_result
+{
+  BINLOG_FEED_TEXT,    // The byte is plain text
+  BINLOG_FEED_PENDING, // The byte belongs to a frame still being read
+  BINLOG_FEED_FRAME,   // A frame is complete; see record()
+  BINLOG_FEED_BAD      // The frame being read was corrupt and is discarded
+};
+
+// Splits a serial byte stream into text and binlog frames
+class BinLogDecoder
+{
+public:
+  BinLogDecoder();
+
+  uint8_t feed(uint8_t byte); // binlog_feed_result
+  const binlog_record &record() const { return last; }
+
+private:
+  uint8_t frame[BINLOG_FRAME_MAX];
+  size_t pos;
+  size_t want; // Frame size once the length byte is known, 0 before
+  binlog_record last;
+};
+
+#ifdef ARDUINO
+
+// Queue a record stamped with the current time; used by BINLOG()
+void binlogPush(uint8_t id, const uint8_t *args, size_t len);
+
+template <typename... T>
+inline void binlogRecord(uint8_t id, T... args)
+{
+  uint8_t buf[BINLOG_ARGS_MAX];
+  binlogPush(id, buf, binlogPutAll(buf, sizeof(buf), 0, args...));
+}
+
+#define BINLOG(name, ...)                                                                          \
+  do                                                                                               \
+  {                                                                                                \
+    if (BINLOG_LEVEL_OF_##name <= BINLOG_LEVEL)                                                    \
+    {                                                                                              \
+      binlogRecord(BINLOG_ID_##name, ##__VA_ARGS__);                                               \
+    }                                                                                              \
+  } while (0)
+
+// Start the task that drains the ring to Serial; call from setup() after Serial.begin()
+void binlogBegin();
+
+// Write out everything queued so far, e.g. before deep sleep
+void binlogFlush();
+
+#endif
+
+#endif
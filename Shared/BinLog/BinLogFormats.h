@@ -0,0 +1,55 @@
+#ifndef BINLOG_FORMATS_H
+#define BINLOG_FORMATS_H
+
+// Every message the firmwares log through BINLOG(), shared with the host
+// decoder. Format IDs are positions in this list: append new formats at
+// the end and never reorder or remove one, or captures taken with older
+// firmware decode to the wrong text.
+//
+// X(name, level, format); see BinLog.h for the conversions a format may use
+
+#define BINLOG_FORMATS(X)                                                                                          \
+  X(DROPPED, BINLOG_WARN, "binlog: %u records dropped")                                                            \
+  X(SEND_OK, BINLOG_DEBUG, "Last Packet Send Status: Delivery Success")                                            \
+  X(SEND_FAIL, BINLOG_WARN, "Last Packet Send Status: Delivery Fail")                                              \
+  X(NOT_PAIRED, BINLOG_WARN, "Not paired with master yet")                                                         \
+  X(DATA_SENT, BINLOG_DEBUG, "Data sent successfully!")                                                            \
+  X(DATA_SEND_ERROR, BINLOG_ERROR, "Error sending data: %d")                                                       \
+  X(RECEIVED_COMMAND, BINLOG_INFO, "Received message: %s")                                                         \
+  X(LIGHT_SENT, BINLOG_DEBUG, "Sent Light Level: %d, Brightness Percentage: %s")                                   \
+  X(LIGHT_LEVEL, BINLOG_DEBUG, "Light Level: %d, LED Brightness: %d")                                              \
+  X(LIGHT_DISABLE1, BINLOG_INFO, "Disable1 command received, entering deep sleep.")                                \
+  X(LIGHT_DISABLE, BINLOG_INFO, "Disable command received, turning off LEDs.")                                     \
+  X(LIGHT_TURN_ON, BINLOG_INFO, "Turn on command received, enabling light control.")                               \
+  X(SOUND_SENT, BINLOG_DEBUG, "Sent Sound Level: %d, Sound Status: %s")                                            \
+  X(SOUND_ENABLED, BINLOG_INFO, "Sensor and LED enabled")                                                          \
+  X(SOUND_DISABLED, BINLOG_INFO, "Sensor and LED disabled")                                                        \
+  X(MOTION_SENT, BINLOG_DEBUG, "Sent Motion Value: %d, Motion Status: %s")                                         \
+  X(MOTION_DETECTED, BINLOG_INFO, "%lu hr %lu min %lu sec: Motion detected! Sending data to the other ESP32...")   \
+  X(MOTION_DISABLED, BINLOG_INFO, "%lu hr %lu min %lu sec: DISABLED! Sending data to the other ESP32...")          \
+  X(MOTION_TURN_OFF, BINLOG_INFO, "%lu hr %lu min %lu sec: Turn Off! Sending data to the other ESP32...")          \
+  X(MOTION_CLEARED, BINLOG_INFO, "%lu hr %lu min %lu sec: No motion detected! Sending data to the other ESP32...") \
+  X(SMOKE_SENT, BINLOG_DEBUG, "Sent Smoke Percentage: %d%%, Smoke Status: %s")                                     \
+  X(SMOKE_VALUE, BINLOG_DEBUG, "Sensor Value: %d%%")                                                               \
+  X(FRAME_FROM, BINLOG_DEBUG, "Data received from: %M")                                                            \
+  X(UNPAIRED_FRAME, BINLOG_WARN, "Received data from unpaired sensor.")                                            \
+  X(READING, BINLOG_INFO, "%s Level: %d, Status: %s")                                                              \
+  X(LIGHT_READING, BINLOG_INFO, "Light Level: %d, Brightness Percentage: %s")                                      \
+  X(RULE_FIRED, BINLOG_INFO, "%s reading fired a rule: sending '%s' to sensor types 0x%x")                         \
+  X(NO_DRIVER_SLOT, BINLOG_WARN, "No driver slot for %s Sensor Slave %u")                                          \
+  X(COMMAND_SENT, BINLOG_INFO, "Command '%s' sent successfully to %s Sensor Slave %u")                             \
+  X(COMMAND_SEND_ERROR, BINLOG_ERROR, "Error sending to %s Sensor Slave %u: %d")                                   \
+  X(LENGTH_MISMATCH, BINLOG_WARN, "Received data length mismatch.")                                                \
+  X(REPORT_LEVEL, BINLOG_INFO, "Report control: level %d, channel %u permille")                                    \
+  X(SENSOR_HEALTH, BINLOG_WARN, "%s Sensor Slave %u health: %s")                                                   \
+  X(SENSOR_OFFLINE, BINLOG_WARN, "%s Sensor Slave %u offline, silent for %lu ms")                                  \
+  X(SENSOR_ONLINE, BINLOG_INFO, "%s Sensor Slave %u back online")                                                  \
+  X(COMMAND_SKIPPED, BINLOG_INFO, "Command '%s' not sent to offline %s Sensor Slave %u")                           \
+  X(BACKLOG_HOLDING, BINLOG_INFO, "Master unreachable, holding readings")                                          \
+  X(BACKLOG_FORWARDING, BINLOG_INFO, "Master reachable, forwarding %u held readings")                              \
+  X(BACKLOG_FORWARDED, BINLOG_INFO, "Held readings forwarded in %lu ms, %lu overwritten since boot")               \
+  X(BACKLOG_RECEIVED, BINLOG_DEBUG, "%s Sensor Slave %u forwarded %u held readings, %u still held")             \
+  X(COMMAND_QUEUED, BINLOG_DEBUG, "Command '%s' to %s Sensor Slave %u waits for a driver slot")                  \
+  X(SEND_QUEUE_FULL, BINLOG_ERROR, "Send queue full, command '%s' to %s Sensor Slave %u dropped")
+
+#endif
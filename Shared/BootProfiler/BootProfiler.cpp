@@ -0,0 +1,126 @@
+#include "BootProfiler.h"
+
+#include <TextBuffer.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static boot_phase phases[BOOT_PROFILER_MAX_PHASES];
+static size_t phaseCount = 0;
+static bool phaseOpen = false;
+
+// Microseconds since boot (since first use on the host)
+static uint32_t nowUs()
+{
+#ifdef ARDUINO
+  return micros();
+#else
+  static const auto origin = std::chrono::steady_clock::now();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - origin)
+      .count();
+#endif
+}
+
+void bootPhaseBegin(const char *name)
+{
+  uint32_t now = nowUs();
+
+  if (phaseOpen)
+  {
+    phases[phaseCount - 1].durationUs = now - phases[phaseCount - 1].startUs;
+    phaseOpen = false;
+  }
+  if (phaseCount >= BOOT_PROFILER_MAX_PHASES)
+  {
+    return;
+  }
+
+  phases[phaseCount].name = name;
+  phases[phaseCount].startUs = now;
+  phases[phaseCount].durationUs = 0;
+  phaseCount++;
+  phaseOpen = true;
+}
+
+void bootPhaseEnd()
+{
+  uint32_t now = nowUs();
+
+  if (phaseOpen)
+  {
+    phases[phaseCount - 1].durationUs = now - phases[phaseCount - 1].startUs;
+    phaseOpen = false;
+  }
+}
+
+size_t bootProfilerCount()
+{
+  return phaseCount;
+}
+
+const boot_phase *bootProfilerPhases()
+{
+  return phases;
+}
+
+uint32_t bootProfilerTotalUs()
+{
+  if (phaseCount == 0)
+  {
+    return 0;
+  }
+  const boot_phase &last = phases[phaseCount - 1];
+  return last.startUs + last.durationUs;
+}
+
+size_t bootProfilerFormatTable(char *buf, size_t len)
+{
+  size_t pos = 0;
+  if (len == 0)
+  {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  appendf(buf, len, pos, "%-20s %10s %10s\n", "Boot phase", "start us", "took us");
+  for (size_t i = 0; i < phaseCount; i++)
+  {
+    appendf(buf, len, pos, "%-20s %10lu %10lu\n", phases[i].name,
+            (unsigned long)phases[i].startUs, (unsigned long)phases[i].durationUs);
+  }
+  appendf(buf, len, pos, "%-20s %10s %10lu\n", "total", "", (unsigned long)bootProfilerTotalUs());
+  return pos;
+}
+
+size_t bootProfilerFormatJson(char *buf, size_t len)
+{
+  size_t pos = 0;
+  if (len == 0)
+  {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  appendf(buf, len, pos, "{\"totalUs\": %lu, \"phases\": [", (unsigned long)bootProfilerTotalUs());
+  for (size_t i = 0; i < phaseCount; i++)
+  {
+    appendf(buf, len, pos, "%s{\"name\": \"%s\", \"startUs\": %lu, \"durationUs\": %lu}",
+            i == 0 ? "" : ", ", phases[i].name,
+            (unsigned long)phases[i].startUs, (unsigned long)phases[i].durationUs);
+  }
+  appendf(buf, len, pos, "]}");
+  return pos;
+}
+
+#ifdef ARDUINO
+void bootProfilerPrint()
+{
+  char table[64 * (BOOT_PROFILER_MAX_PHASES + 2)];
+  bootProfilerFormatTable(table, sizeof(table));
+  Serial.print(table);
+}
+#endif
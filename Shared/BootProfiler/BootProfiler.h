@@ -0,0 +1,44 @@
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Boot phase profiler shared by all firmwares.
+// Wrap each step of setup() in bootPhaseBegin()/bootPhaseEnd() and call
+// bootProfilerPrint() once at the end of setup().
+
+#ifndef BOOT_PROFILER_MAX_PHASES
+#define BOOT_PROFILER_MAX_PHASES 16 // Phases beyond this are dropped
+#endif
+
+typedef struct boot_phase
+{
+  const char *name;    // Phase label (string literal, not copied)
+  uint32_t startUs;    // Start time in microseconds since boot
+  uint32_t durationUs; // Phase duration in microseconds
+} boot_phase;
+
+// Start a named phase; an unfinished previous phase is closed first
+void bootPhaseBegin(const char *name);
+
+// Close the currently open phase
+void bootPhaseEnd();
+
+// Recorded phases, in the order they were started
+size_t bootProfilerCount();
+const boot_phase *bootProfilerPhases();
+
+// Time from boot until the last phase ended
+uint32_t bootProfilerTotalUs();
+
+// Format the phase table as text or JSON; returns bytes written (excluding NUL)
+size_t bootProfilerFormatTable(char *buf, size_t len);
+size_t bootProfilerFormatJson(char *buf, size_t len);
+
+#ifdef ARDUINO
+// Print the phase table to Serial
+void bootProfilerPrint();
+#endif
+
+#endif
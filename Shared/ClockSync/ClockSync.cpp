@@ -0,0 +1,185 @@
+#include "ClockSync.h"
+
+#include <string.h>
+
+void clockSyncMakeBeacon(clock_sync_frame *frame, uint64_t transmitUs)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = CLOCK_SYNC_MAGIC;
+  frame->kind = CLOCK_SYNC_BEACON;
+  frame->transmitUs = transmitUs;
+}
+
+void clockSyncMakeRequest(clock_sync_frame *frame, uint64_t originUs)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = CLOCK_SYNC_MAGIC;
+  frame->kind = CLOCK_SYNC_REQUEST;
+  frame->originUs = originUs;
+}
+
+void clockSyncMakeResponse(clock_sync_frame *frame, const clock_sync_frame *request, const uint8_t *target,
+                           uint64_t receiveUs, uint64_t transmitUs)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = CLOCK_SYNC_MAGIC;
+  frame->kind = CLOCK_SYNC_RESPONSE;
+  memcpy(frame->target, target, sizeof(frame->target));
+  frame->originUs = request->originUs;
+  frame->receiveUs = receiveUs;
+  frame->transmitUs = transmitUs;
+}
+
+bool clockSyncParseFrame(const uint8_t *data, int len, clock_sync_frame *frame)
+{
+  if (len != (int)sizeof(clock_sync_frame) || data[0] != CLOCK_SYNC_MAGIC)
+  {
+    return false;
+  }
+  memcpy(frame, data, sizeof(clock_sync_frame));
+  return frame->kind >= CLOCK_SYNC_BEACON && frame->kind <= CLOCK_SYNC_RESPONSE;
+}
+
+ClockSync::ClockSync()
+    : count(0), head(0), anchorLocalUs(0), anchorOffsetUs(0), drift(0), delayUs(0), residualUs(0)
+{
+  memset(window, 0, sizeof(window));
+}
+
+bool ClockSync::addExchange(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+  int64_t delay = ((int64_t)t4 - (int64_t)t1) - ((int64_t)t3 - (int64_t)t2);
+  if (delay > CLOCK_SYNC_MAX_DELAY_US)
+  {
+    return false;
+  }
+  if (delay < 0)
+  {
+    delay = 0; // Drift over the exchange can make a very short round trip look negative
+  }
+
+  clock_sync_sample &sample = window[head];
+  sample.localUs = (int64_t)t4;
+  sample.offsetUs = (((int64_t)t2 - (int64_t)t1) + ((int64_t)t3 - (int64_t)t4)) / 2;
+  sample.delayUs = delay;
+  head = (head + 1) % CLOCK_SYNC_WINDOW;
+  if (count < CLOCK_SYNC_WINDOW)
+  {
+    count++;
+  }
+
+  if (count > 1)
+  {
+    residualUs = sample.offsetUs - ((int64_t)toServerUs(t4) - (int64_t)t4);
+  }
+  delayUs = delay;
+  update();
+  return true;
+}
+
+void ClockSync::update()
+{
+  // Queuing only ever lengthens one leg of an exchange, so the exchange
+  // with the shortest round trip has the least biased offset
+  size_t best = 0;
+  for (size_t i = 1; i < count; i++)
+  {
+    if (window[i].delayUs < window[best].delayUs)
+    {
+      best = i;
+    }
+  }
+  anchorLocalUs = window[best].localUs;
+  anchorOffsetUs = window[best].offsetUs;
+
+  // Drift is the least squares slope of offset over local time, fitted to
+  // the exchanges whose round trip is close to the shortest (n >= 1, the
+  // anchor always qualifies)
+  int64_t maxDelay = window[best].delayUs * 2 + 1000;
+  int64_t firstUs = anchorLocalUs;
+  int64_t lastUs = anchorLocalUs;
+  double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (window[i].delayUs > maxDelay)
+    {
+      continue;
+    }
+    double x = (double)(window[i].localUs - anchorLocalUs);
+    double y = (double)(window[i].offsetUs - anchorOffsetUs);
+    sumX += x;
+    sumY += y;
+    sumXX += x * x;
+    sumXY += x * y;
+    n++;
+    if (window[i].localUs < firstUs)
+    {
+      firstUs = window[i].localUs;
+    }
+    if (window[i].localUs > lastUs)
+    {
+      lastUs = window[i].localUs;
+    }
+  }
+
+  // Until the exchanges span long enough, keep the previous drift estimate
+  double denominator = n * sumXX - sumX * sumX;
+  if (n >= 3 && lastUs - firstUs >= CLOCK_SYNC_MIN_DRIFT_SPAN_US && denominator > 0)
+  {
+    drift = (n * sumXY - sumX * sumY) / denominator;
+    double limit = CLOCK_SYNC_MAX_DRIFT_PPM / 1e6;
+    if (drift > limit)
+    {
+      drift = limit;
+    }
+    else if (drift < -limit)
+    {
+      drift = -limit;
+    }
+  }
+
+  // Averaging the good exchanges along the drift line cancels most of the
+  // remaining asymmetry between the two legs
+  anchorOffsetUs += (int64_t)((sumY - drift * sumX) / n);
+}
+
+uint64_t ClockSync::toServerUs(uint64_t localUs) const
+{
+  if (count == 0)
+  {
+    return localUs;
+  }
+  int64_t elapsed = (int64_t)localUs - anchorLocalUs;
+  return (uint64_t)((int64_t)localUs + anchorOffsetUs + (int64_t)(drift * elapsed));
+}
+
+bool ClockSync::synced() const
+{
+  return count > 0;
+}
+
+size_t ClockSync::samples() const
+{
+  return count;
+}
+
+int64_t ClockSync::offsetUs() const
+{
+  return anchorOffsetUs;
+}
+
+double ClockSync::driftPpm() const
+{
+  return drift * 1e6;
+}
+
+int64_t ClockSync::lastDelayUs() const
+{
+  return delayUs;
+}
+
+int64_t ClockSync::lastResidualUs() const
+{
+  return residualUs;
+}
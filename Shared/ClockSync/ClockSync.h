@@ -0,0 +1,93 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Clock synchronization between sensors and the Server.
+// The Server is the time source: it broadcasts a beacon every
+// CLOCK_SYNC_BEACON_INTERVAL and answers sync requests with its receive
+// and transmit times. A sensor turns each request/response exchange into
+// an offset and round-trip delay sample (as in NTP) and estimates the
+// offset and drift of its clock against the Server's from the last few.
+// All times are esp_timer_get_time() microseconds, which do not wrap.
+
+#define CLOCK_SYNC_MAGIC 0xC5 // Distinct from PAIRING_MAGIC and FRAME_MAGIC
+
+#define CLOCK_SYNC_BEACON_INTERVAL 10000 // Milliseconds between Server beacons
+#define CLOCK_SYNC_WINDOW 8              // Exchanges kept for the estimate
+#define CLOCK_SYNC_MAX_DELAY_US 50000    // Exchanges with a longer round trip are dropped
+#define CLOCK_SYNC_MIN_DRIFT_SPAN_US 5000000 // Exchanges must span this long before drift is estimated
+#define CLOCK_SYNC_MAX_DRIFT_PPM 200.0       // Larger drift estimates are clamped
+
+enum clock_sync_kind
+{
+  CLOCK_SYNC_BEACON = 1,   // Server to all: time to resynchronize
+  CLOCK_SYNC_REQUEST = 2,  // Sensor to Server: originUs set
+  CLOCK_SYNC_RESPONSE = 3, // Server to all, for target: all times set
+};
+
+typedef struct clock_sync_frame
+{
+  uint8_t magic;       // Always CLOCK_SYNC_MAGIC
+  uint8_t kind;        // clock_sync_kind
+  uint8_t target[6];   // Sensor a response is meant for
+  uint64_t originUs;   // Sensor clock when the request was sent
+  uint64_t receiveUs;  // Server clock when the request arrived
+  uint64_t transmitUs; // Server clock when the response (or beacon) was sent
+} clock_sync_frame;
+
+void clockSyncMakeBeacon(clock_sync_frame *frame, uint64_t transmitUs);
+void clockSyncMakeRequest(clock_sync_frame *frame, uint64_t originUs);
+void clockSyncMakeResponse(clock_sync_frame *frame, const clock_sync_frame *request, const uint8_t *target,
+                           uint64_t receiveUs, uint64_t transmitUs);
+
+// Returns true and copies the frame out if data is a clock sync frame
+bool clockSyncParseFrame(const uint8_t *data, int len, clock_sync_frame *frame);
+
+typedef struct clock_sync_sample
+{
+  int64_t localUs;  // Sensor clock when the response arrived
+  int64_t offsetUs; // Server clock minus sensor clock
+  int64_t delayUs;  // Round trip excluding the Server's turnaround
+} clock_sync_sample;
+
+class ClockSync
+{
+public:
+  ClockSync();
+
+  // Fold in one exchange: t1 request sent, t2 request received, t3 response
+  // sent, t4 response received. Returns false if the exchange was dropped.
+  bool addExchange(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+
+  // Server time corresponding to a local time; localUs unchanged until synced
+  uint64_t toServerUs(uint64_t localUs) const;
+
+  bool synced() const;
+  size_t samples() const;
+  int64_t offsetUs() const;
+  double driftPpm() const;
+  int64_t lastDelayUs() const;
+
+  // Measured minus predicted offset of the latest exchange, a running
+  // estimate of the sync error
+  int64_t lastResidualUs() const;
+
+private:
+  void update();
+
+  clock_sync_sample window[CLOCK_SYNC_WINDOW];
+  size_t count;
+  size_t head;
+
+  // Estimate: fitted offset at the anchor (the exchange with the shortest
+  // round trip) plus drift times the local time since it
+  int64_t anchorLocalUs;
+  int64_t anchorOffsetUs;
+  double drift;
+  int64_t delayUs;
+  int64_t residualUs;
+};
+
+#endif
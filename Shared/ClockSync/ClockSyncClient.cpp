@@ -0,0 +1,155 @@
+#ifdef ARDUINO
+
+#include "ClockSyncClient.h"
+
+#include <Arduino.h>
+#include <PairingClient.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#define CLOCK_SYNC_RETRY_INTERVAL 2000 // Milliseconds between requests until the first response
+
+static ClockSync clockSync; // Only touched by loop()
+
+// Readings are stamped from the receive callbacks too, so they map times
+// through a copy of the estimate published under this lock
+static portMUX_TYPE clockSyncLock = portMUX_INITIALIZER_UNLOCKED;
+static ClockSync published;
+static uint8_t ownMAC[6];
+
+static uint64_t requestOriginUs = 0; // originUs of the outstanding request, 0 if none
+static unsigned long lastRequestTime = 0;
+static bool beaconPending = false;
+static unsigned long beaconTime = 0;
+
+// Completed exchange handed from the receive callback to loop()
+static uint64_t exchangeUs[4];
+static volatile bool exchangePending = false;
+
+static void sendRequest()
+{
+  clock_sync_frame frame;
+  requestOriginUs = esp_timer_get_time();
+  clockSyncMakeRequest(&frame, requestOriginUs);
+  pairingSendToMaster((uint8_t *)&frame, sizeof(frame));
+  lastRequestTime = millis();
+}
+
+void clockSyncBegin()
+{
+  WiFi.macAddress(ownMAC);
+}
+
+void clockSyncLoop()
+{
+  if (exchangePending)
+  {
+    if (clockSync.addExchange(exchangeUs[0], exchangeUs[1], exchangeUs[2], exchangeUs[3]))
+    {
+      portENTER_CRITICAL(&clockSyncLock);
+      published = clockSync;
+      portEXIT_CRITICAL(&clockSyncLock);
+      Serial.printf("Clock sync: offset %lld us, drift %.2f ppm, delay %lld us, residual %lld us\n",
+                    (long long)clockSync.offsetUs(), clockSync.driftPpm(),
+                    (long long)clockSync.lastDelayUs(), (long long)clockSync.lastResidualUs());
+    }
+    exchangePending = false;
+  }
+
+  if (!pairingMasterKnown())
+  {
+    return;
+  }
+
+  // Answer beacons after a per-sensor delay so the whole fleet does not reply at once
+  if (beaconPending && millis() - beaconTime >= (unsigned long)ownMAC[5] * 4)
+  {
+    beaconPending = false;
+    sendRequest();
+  }
+  else if (!clockSync.synced() && millis() - lastRequestTime >= CLOCK_SYNC_RETRY_INTERVAL)
+  {
+    sendRequest();
+  }
+}
+
+bool clockSyncHandleFrame(const uint8_t *mac, const uint8_t *data, int len)
+{
+  uint64_t receivedUs = esp_timer_get_time();
+
+  clock_sync_frame frame;
+  if (!clockSyncParseFrame(data, len, &frame))
+  {
+    return false;
+  }
+  if (!pairingMasterKnown() || memcmp(mac, pairingMasterMAC(), 6) != 0)
+  {
+    return true;
+  }
+
+  if (frame.kind == CLOCK_SYNC_BEACON)
+  {
+    beaconPending = true;
+    beaconTime = millis();
+  }
+  else if (frame.kind == CLOCK_SYNC_RESPONSE && memcmp(frame.target, ownMAC, 6) == 0 &&
+           frame.originUs == requestOriginUs && !exchangePending)
+  {
+    exchangeUs[0] = frame.originUs;
+    exchangeUs[1] = frame.receiveUs;
+    exchangeUs[2] = frame.transmitUs;
+    exchangeUs[3] = receivedUs;
+    requestOriginUs = 0;
+    exchangePending = true;
+  }
+  return true;
+}
+
+bool clockSyncSynced()
+{
+  portENTER_CRITICAL(&clockSyncLock);
+  bool synced = published.synced();
+  portEXIT_CRITICAL(&clockSyncLock);
+  return synced;
+}
+
+uint64_t clockSyncMicros()
+{
+  uint64_t localUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockSyncLock);
+  uint64_t serverUs = published.toServerUs(localUs);
+  portEXIT_CRITICAL(&clockSyncLock);
+  return serverUs;
+}
+
+uint64_t clockSyncMillis()
+{
+  return clockSyncMicros() / 1000;
+}
+
+void clockSyncStampFrame(frame_header *header, uint8_t kind, uint32_t sampleUs, uint32_t sendUs)
+{
+  // micros() is the low half of esp_timer_get_time(): widen both times
+  // back from now before mapping them
+  uint64_t nowUs = esp_timer_get_time();
+  uint64_t localSampleUs = nowUs - (uint32_t)((uint32_t)nowUs - sampleUs);
+  uint64_t localSendUs = nowUs - (uint32_t)((uint32_t)nowUs - sendUs);
+  portENTER_CRITICAL(&clockSyncLock);
+  bool synced = published.synced();
+  uint32_t serverSampleUs = (uint32_t)published.toServerUs(localSampleUs);
+  uint32_t serverSendUs = (uint32_t)published.toServerUs(localSendUs);
+  portEXIT_CRITICAL(&clockSyncLock);
+
+  if (synced)
+  {
+    frameStamp(header, kind | FRAME_SERVER_CLOCK, serverSampleUs, serverSendUs);
+  }
+  else
+  {
+    frameStamp(header, kind, sampleUs, sendUs);
+  }
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef CLOCK_SYNC_CLIENT_H
+#define CLOCK_SYNC_CLIENT_H
+
+#ifdef ARDUINO
+
+#include "ClockSync.h"
+
+#include <SensorFrame.h>
+
+// Sensor side of clock synchronization.
+// A sync request goes to the paired Server after every beacon, and every
+// CLOCK_SYNC_RETRY_INTERVAL until the first response arrives. Exchanges
+// are folded into the estimate from loop(), never from the receive callback;
+// the other calls may come from any task.
+
+// Learn the sensor's own MAC; call once ESP-NOW is up
+void clockSyncBegin();
+
+// Send due sync requests and fold in completed exchanges; call from loop()
+void clockSyncLoop();
+
+// Handle a received clock sync frame; returns false if data is not one
+bool clockSyncHandleFrame(const uint8_t *mac, const uint8_t *data, int len);
+
+// Whether at least one exchange with the Server has completed
+bool clockSyncSynced();
+
+// Server time now, or local time until synced
+uint64_t clockSyncMicros();
+uint64_t clockSyncMillis();
+
+// frameStamp() with sampleUs and sendUs (micros() readings) mapped to
+// Server time and FRAME_SERVER_CLOCK set once synced, as they are until then
+void clockSyncStampFrame(frame_header *header, uint8_t kind, uint32_t sampleUs, uint32_t sendUs);
+
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+#include "LinkQuality.h"
+
+#include <math.h>
+#include <string.h>
+
+#define LINK_MAC_OVERHEAD 43 // Action frame header, vendor element and FCS around the payload
+#define LINK_ACK_BYTES 14
+#define LINK_SIFS_US 10
+#define LINK_DSSS_PREAMBLE_US 192 // Long preamble and PLCP header
+#define LINK_OFDM_PREAMBLE_US 20
+#define LINK_OFDM_EXTENSION_US 6 // Signal extension at 2.4 GHz
+
+typedef struct link_rate_info
+{
+  uint16_t kbps;
+  int8_t sensitivity; // dBm, from the ESP32 receiver figures
+  uint16_t ackKbps;   // Basic rate the receiver answers at
+  uint8_t phy;        // wifi_phy_rate_t
+  const char *name;
+} link_rate_info;
+
+static const link_rate_info rates[LINK_RATE_COUNT] = {
+    {1000, -98, 1000, 0x00, "1M"},    {2000, -95, 2000, 0x01, "2M"},    {6000, -93, 6000, 0x0B, "6M"},
+    {9000, -91, 6000, 0x0F, "9M"},    {12000, -89, 12000, 0x0A, "12M"}, {18000, -87, 12000, 0x0E, "18M"},
+    {24000, -84, 24000, 0x09, "24M"}, {36000, -80, 24000, 0x0D, "36M"}, {48000, -77, 24000, 0x08, "48M"},
+    {54000, -75, 24000, 0x0C, "54M"},
+};
+
+// Time on air of a PPDU carrying bytes at kbps
+static uint32_t ppduUs(uint16_t kbps, size_t bytes)
+{
+  if (kbps < 6000)
+  {
+    // DSSS: one bit per 1000/kbps us
+    return LINK_DSSS_PREAMBLE_US + (uint32_t)((bytes * 8 * 1000 + kbps - 1) / kbps);
+  }
+  // OFDM: 4 us symbols carrying kbps * 4 / 1000 bits, plus service and tail bits
+  uint32_t bitsPerSymbol = kbps * 4 / 1000;
+  uint32_t symbols = (uint32_t)((16 + 6 + bytes * 8 + bitsPerSymbol - 1) / bitsPerSymbol);
+  return LINK_OFDM_PREAMBLE_US + 4 * symbols + LINK_OFDM_EXTENSION_US;
+}
+
+uint32_t linkAirtimeUs(uint8_t rate, size_t len, bool broadcast)
+{
+  if (rate >= LINK_RATE_COUNT)
+  {
+    rate = LINK_RATE_1M;
+  }
+  uint32_t us = ppduUs(rates[rate].kbps, LINK_MAC_OVERHEAD + len);
+  if (!broadcast)
+  {
+    us += LINK_SIFS_US + ppduUs(rates[rate].ackKbps, LINK_ACK_BYTES);
+  }
+  return us;
+}
+
+double linkModelLoss(uint8_t rate, int rssi)
+{
+  if (rate >= LINK_RATE_COUNT)
+  {
+    rate = LINK_RATE_1M;
+  }
+  // Logistic in the margin over the sensitivity: about 5% at 0 dB, 50% at -2 dB
+  double margin = rssi - rates[rate].sensitivity;
+  return 1.0 / (1.0 + exp((margin + 2.0) / 0.7));
+}
+
+uint16_t linkRateKbps(uint8_t rate)
+{
+  return rate < LINK_RATE_COUNT ? rates[rate].kbps : 0;
+}
+
+int8_t linkRateSensitivity(uint8_t rate)
+{
+  return rate < LINK_RATE_COUNT ? rates[rate].sensitivity : 0;
+}
+
+const char *linkRateName(uint8_t rate)
+{
+  return rate < LINK_RATE_COUNT ? rates[rate].name : "?";
+}
+
+uint8_t linkPhyRate(uint8_t rate)
+{
+  return rates[rate < LINK_RATE_COUNT ? rate : (uint8_t)LINK_RATE_1M].phy;
+}
+
+uint8_t linkRateFromPhy(uint8_t phyRate)
+{
+  for (uint8_t rate = 0; rate < LINK_RATE_COUNT; rate++)
+  {
+    if (rates[rate].phy == phyRate)
+    {
+      return rate;
+    }
+  }
+  // 2 Mbit/s with the short preamble, and 5.5 and 11 Mbit/s, which are never picked here
+  return phyRate < 0x08 ? LINK_RATE_2M : LINK_RATE_1M;
+}
+
+uint8_t linkRssiCap(int8_t rssi)
+{
+  if (rssi == 0)
+  {
+    return LINK_RATE_54M;
+  }
+  uint8_t cap = LINK_RATE_1M;
+  for (uint8_t rate = 0; rate < LINK_RATE_COUNT; rate++)
+  {
+    if (rssi >= rates[rate].sensitivity + LINK_RSSI_MARGIN)
+    {
+      cap = rate;
+    }
+  }
+  return cap;
+}
+
+static void setRate(link_quality *link, uint8_t rate)
+{
+  if (rate != link->rate)
+  {
+    link->rate = rate;
+    link->rateChanges++;
+  }
+  link->successes = 0;
+  link->results = 0;
+  link->probed = false;
+}
+
+void linkInit(link_quality *link)
+{
+  memset(link, 0, sizeof(*link));
+  link->deliveryPermille = 1000;
+  link->rate = LINK_RATE_1M;
+  link->inFlightRate = LINK_RATE_1M;
+  link->probeAfter = LINK_PROBE_MIN;
+}
+
+void linkOnRssi(link_quality *link, int8_t rssi)
+{
+  if (rssi == 0)
+  {
+    return;
+  }
+  if (link->rssi == 0)
+  {
+    link->rssi = rssi;
+    // A new link starts one step below what its signal supports
+    if (link->sent == 0)
+    {
+      uint8_t cap = linkRssiCap(rssi);
+      setRate(link, cap > LINK_RATE_1M ? cap - 1 : LINK_RATE_1M);
+      link->rateChanges = 0;
+    }
+  }
+  else
+  {
+    link->rssi = (int8_t)((3 * link->rssi + rssi) / 4);
+  }
+
+  // The rate in use only has to clear its margin less the hysteresis, so noise does not flap it
+  int lenient = link->rssi + LINK_RSSI_HYSTERESIS;
+  uint8_t cap = linkRssiCap((int8_t)(lenient > -1 ? -1 : lenient));
+  if (link->rate > cap)
+  {
+    setRate(link, cap);
+  }
+}
+
+uint8_t linkOnSend(link_quality *link, size_t len, uint8_t ceiling)
+{
+  uint8_t rate = link->rate < ceiling ? link->rate : ceiling;
+  link->sent++;
+  link->inFlightRate = rate;
+  link->airtimeUs += linkAirtimeUs(rate, len);
+  link->baselineUs += linkAirtimeUs(LINK_RATE_1M, len);
+  return rate;
+}
+
+void linkOnResult(link_quality *link, bool delivered)
+{
+  link->deliveryPermille = (uint16_t)((15 * link->deliveryPermille + (delivered ? 1000 : 0)) / 16);
+  if (delivered)
+  {
+    link->delivered++;
+  }
+  else
+  {
+    link->failed++;
+  }
+
+  // Results of frames sent before the last rate change say nothing about the new rate
+  if (link->inFlightRate != link->rate)
+  {
+    return;
+  }
+  if (link->results < 255)
+  {
+    link->results++;
+  }
+
+  if (delivered)
+  {
+    if (link->successes < 255)
+    {
+      link->successes++;
+    }
+    if (link->successes >= link->probeAfter && link->rate < linkRssiCap(link->rssi) &&
+        link->rate + 1 < LINK_RATE_COUNT)
+    {
+      setRate(link, link->rate + 1);
+      link->probed = true;
+    }
+    return;
+  }
+
+  link->successes = 0;
+  if (link->rate == LINK_RATE_1M)
+  {
+    return;
+  }
+  // A rate that did not hold for long is not worth trying again soon
+  if (link->probed && link->results < LINK_PROBE_MAX)
+  {
+    link->probeAfter = link->probeAfter * 2 > LINK_PROBE_MAX ? LINK_PROBE_MAX : link->probeAfter * 2;
+  }
+  else
+  {
+    link->probeAfter = LINK_PROBE_MIN;
+  }
+  setRate(link, link->rate - 1);
+}
+
+#ifdef ARDUINO
+
+#include <esp_wifi.h>
+
+static uint8_t appliedRate = LINK_RATE_COUNT; // Unknown until first set
+
+void linkApplyRate(uint8_t rate)
+{
+  if (rate >= LINK_RATE_COUNT || rate == appliedRate)
+  {
+    return;
+  }
+  if (esp_wifi_config_espnow_rate(WIFI_IF_STA, (wifi_phy_rate_t)linkPhyRate(rate)) == ESP_OK)
+  {
+    appliedRate = rate;
+  }
+}
+
+uint8_t linkAppliedRate()
+{
+  return appliedRate;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef LINK_QUALITY_H
+#define LINK_QUALITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-peer link quality and PHY rate selection for unicast ESP-NOW frames.
+//
+// Each peer's link tracks the smoothed RSSI of frames heard from it and the
+// outcome of every frame sent to it, and picks the rate for the next frame:
+// after probeAfter deliveries in a row it tries the next faster rate, and it
+// steps back down as soon as a frame fails. Stepping down from a rate that
+// lasted fewer than LINK_PROBE_MAX frames after it was tried counts as a
+// failed try and doubles probeAfter, from LINK_PROBE_MIN up to
+// LINK_PROBE_MAX (AARF). The RSSI, when known, caps the rate at the
+// fastest one whose sensitivity it clears by LINK_RSSI_MARGIN, less
+// LINK_RSSI_HYSTERESIS for the rate already in use, and sets the starting
+// rate of a new link.
+//
+// The driver reports each frame only as delivered or not, after its own
+// retransmissions, so the per-frame retries are not visible; a failure
+// means every retry was lost, which is why one is enough to step down.
+// Broadcasts are never acknowledged and always go at LINK_RATE_1M.
+
+#define LINK_PROBE_MIN 10
+#define LINK_PROBE_MAX 50
+#define LINK_RSSI_MARGIN 4     // dB
+#define LINK_RSSI_HYSTERESIS 2 // dB
+
+// Rates in order of the signal they need, most robust first
+enum link_rate
+{
+  LINK_RATE_1M,
+  LINK_RATE_2M,
+  LINK_RATE_6M,
+  LINK_RATE_9M,
+  LINK_RATE_12M,
+  LINK_RATE_18M,
+  LINK_RATE_24M,
+  LINK_RATE_36M,
+  LINK_RATE_48M,
+  LINK_RATE_54M,
+  LINK_RATE_COUNT
+};
+
+typedef struct link_quality
+{
+  // Observations
+  int8_t rssi;               // Smoothed RSSI of frames from the peer, 0 until one is heard
+  uint16_t deliveryPermille; // Smoothed share of frames to the peer that were delivered
+  uint32_t sent;             // Frames handed to the driver
+  uint32_t delivered;
+  uint32_t failed;
+  uint32_t airtimeUs;        // Modelled airtime of the frames sent, one transmission each
+  uint32_t baselineUs;       // The same frames at LINK_RATE_1M
+  uint32_t rateChanges;
+
+  // Controller
+  uint8_t rate;          // link_rate for the next frame
+  uint8_t inFlightRate;  // Rate of the frame awaiting its result
+  uint8_t successes;     // Deliveries in a row at rate
+  uint8_t results;       // Frames with a result at rate, up to 255
+  uint8_t probeAfter;    // Deliveries in a row needed to try the next rate
+  bool probed;           // rate was reached by trying the next faster one
+} link_quality;
+
+void linkInit(link_quality *link);
+
+// A frame was heard from the peer with this RSSI (0 when unknown)
+void linkOnRssi(link_quality *link, int8_t rssi);
+
+// A frame of len payload bytes is being sent to the peer; returns the rate
+// to send it at, the link's own or ceiling if that is slower. The result of
+// a frame held below the link's rate does not count towards its rate.
+uint8_t linkOnSend(link_quality *link, size_t len, uint8_t ceiling = LINK_RATE_54M);
+
+// The driver reported the outcome of the last frame sent to the peer
+void linkOnResult(link_quality *link, bool delivered);
+
+// Fastest rate the RSSI supports; LINK_RATE_54M when the RSSI is unknown
+uint8_t linkRssiCap(int8_t rssi);
+
+// Rate properties
+uint16_t linkRateKbps(uint8_t rate);
+int8_t linkRateSensitivity(uint8_t rate); // dBm for a few percent frame loss
+const char *linkRateName(uint8_t rate);
+
+// ESP-IDF wifi_phy_rate_t value of a rate, and the rate of one, as in the
+// rx_ctrl.rate of received frames; rates outside link_rate map to the
+// nearest slower one
+uint8_t linkPhyRate(uint8_t rate);
+uint8_t linkRateFromPhy(uint8_t phyRate);
+
+// Airtime of one transmission of an ESP-NOW frame with len payload bytes,
+// from the start of the preamble to the end of the ACK; contention is not
+// counted. Broadcasts have no ACK.
+uint32_t linkAirtimeUs(uint8_t rate, size_t len, bool broadcast = false);
+
+// Modelled chance that one transmission at rate is lost at rssi, for host
+// simulations: a few percent at the rate's sensitivity, rising steeply below
+double linkModelLoss(uint8_t rate, int rssi);
+
+#ifdef ARDUINO
+
+// Rate for the next frames on the station interface, which the sensors and
+// the Server send on. The driver setting is per interface, not per peer,
+// so set it before every send; unchanged rates cost nothing. The driver
+// may retransmit a unicast frame at whatever rate is set when it retries,
+// so a change can also reach the retries of frames already in flight.
+void linkApplyRate(uint8_t rate);
+
+// Rate last set, LINK_RATE_COUNT before the first
+uint8_t linkAppliedRate();
+
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#include "Pairing.h"
+
+#include <string.h>
+
+void pairingMakeJoinRequest(pairing_frame *frame, uint8_t sensorType, uint8_t capabilities, uint8_t zone)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = PAIRING_MAGIC;
+  frame->kind = PAIRING_JOIN_REQUEST;
+  frame->sensorType = sensorType;
+  frame->capabilities = capabilities;
+  frame->zone = zone;
+}
+
+void pairingMakeJoinAccept(pairing_frame *frame, const pairing_frame *request, uint16_t peerId, const uint8_t *target)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = PAIRING_MAGIC;
+  frame->kind = PAIRING_JOIN_ACCEPT;
+  frame->sensorType = request->sensorType;
+  frame->capabilities = request->capabilities;
+  frame->zone = request->zone;
+  frame->peerId = peerId;
+  memcpy(frame->target, target, sizeof(frame->target));
+}
+
+bool pairingParseFrame(const uint8_t *data, int len, pairing_frame *frame)
+{
+  if (len != (int)sizeof(pairing_frame) || data[0] != PAIRING_MAGIC)
+  {
+    return false;
+  }
+  memcpy(frame, data, sizeof(pairing_frame));
+  return frame->kind == PAIRING_JOIN_REQUEST || frame->kind == PAIRING_JOIN_ACCEPT;
+}
+
+const char *sensorTypeName(uint8_t sensorType)
+{
+  switch (sensorType)
+  {
+  case SENSOR_SOUND:
+    return "Sound";
+  case SENSOR_MOTION:
+    return "Motion";
+  case SENSOR_SMOKE:
+    return "Smoke";
+  case SENSOR_LIGHT:
+    return "Light";
+  default:
+    return "Unknown";
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef PAIRING_H
+#define PAIRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Join handshake between sensors and the Server.
+// A sensor broadcasts PAIRING_JOIN_REQUEST with its type and capabilities;
+// the Server admits it into its peer table and answers with
+// PAIRING_JOIN_ACCEPT, from which the sensor learns the Server's MAC.
+// Accepts for sensors that take no commands are broadcast so those
+// sensors never need a slot in the Server's ESP-NOW peer list.
+
+#define PAIRING_MAGIC 0xA5
+
+enum pairing_frame_kind
+{
+  PAIRING_JOIN_REQUEST = 1,
+  PAIRING_JOIN_ACCEPT = 2
+};
+
+enum sensor_type
+{
+  SENSOR_UNKNOWN = 0,
+  SENSOR_SOUND = 1,
+  SENSOR_MOTION = 2,
+  SENSOR_SMOKE = 3,
+  SENSOR_LIGHT = 4
+};
+
+// Bit for a sensor_type in a mask of sensor types
+#define SENSOR_TYPE_BIT(type) (1u << (type))
+
+// Capability bits advertised in the join request
+#define SENSOR_CAP_REPORTS 0x01          // Sends readings to the Server
+#define SENSOR_CAP_ACCEPTS_COMMANDS 0x02 // Acts on "turn on"/"disable" commands
+
+typedef struct pairing_frame
+{
+  uint8_t magic;        // Always PAIRING_MAGIC
+  uint8_t kind;         // pairing_frame_kind
+  uint8_t sensorType;   // sensor_type of the joining node
+  uint8_t capabilities; // SENSOR_CAP_* bits
+  uint8_t zone;         // Room/zone the sensor is installed in
+  uint8_t reserved;
+  uint16_t peerId;      // Slot assigned by the Server (accept only)
+  uint8_t target[6];    // MAC of the accepted sensor (accept only)
+} pairing_frame;
+
+// Fill in a join request for a sensor of the given type
+void pairingMakeJoinRequest(pairing_frame *frame, uint8_t sensorType, uint8_t capabilities, uint8_t zone);
+
+// Fill in the Server's answer to an admitted join request
+void pairingMakeJoinAccept(pairing_frame *frame, const pairing_frame *request, uint16_t peerId, const uint8_t *target);
+
+// Returns true and copies the frame out if data holds a valid pairing frame
+bool pairingParseFrame(const uint8_t *data, int len, pairing_frame *frame);
+
+// Human-readable sensor type name
+const char *sensorTypeName(uint8_t sensorType);
+
+#endif
@@ -0,0 +1,230 @@
+#ifdef ARDUINO
+
+#include "PairingClient.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+#define PAIRING_RETRY_INTERVAL 2000 // Milliseconds between join requests
+#define PAIRING_RESULTS_KEPT 32     // Bits in failedSends
+
+static const uint8_t broadcastMAC[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static uint8_t ownMAC[6];
+static uint8_t masterMAC[6];
+static bool masterKnown = false;
+static bool joinAccepted = false;
+static uint8_t joinSensorType;
+static uint8_t joinCapabilities;
+static uint8_t joinZone;
+static unsigned long lastJoinTime = 0;
+static unsigned long lastMasterSendTime = 0;
+static std::atomic<uint32_t> masterSends(0);   // Frames to the master ESP-NOW took
+static std::atomic<uint32_t> masterResults(0); // Written by the send callback
+static std::atomic<uint32_t> failedSends(0);   // Bit n % 32 for result n
+static link_quality masterLink;
+static volatile int8_t masterRssi = 0; // RSSI of the last frame from the master not yet given to masterLink
+
+static void addPeer(const uint8_t *mac)
+{
+  if (esp_now_is_peer_exist(mac))
+  {
+    return;
+  }
+
+  esp_now_peer_info_t peerInfo;
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, mac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+
+  if (esp_now_add_peer(&peerInfo) != ESP_OK)
+  {
+    Serial.println("Failed to add pairing peer");
+  }
+}
+
+// Record the RSSI of ESP-NOW frames from the master, which the receive callback does not report
+static void captureMasterRssi(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+  if (type != WIFI_PKT_MGMT || !masterKnown)
+  {
+    return;
+  }
+
+  // ESP-NOW frames are vendor-specific action frames (subtype 0xd0, category 127)
+  const wifi_promiscuous_pkt_t *pkt = (const wifi_promiscuous_pkt_t *)buf;
+  const uint8_t *frame = pkt->payload;
+  if (pkt->rx_ctrl.sig_len < 25 || frame[0] != 0xd0 || frame[24] != 127 || memcmp(frame + 10, masterMAC, 6) != 0)
+  {
+    return;
+  }
+  masterRssi = pkt->rx_ctrl.rssi;
+}
+
+static void sendJoinRequest()
+{
+  pairing_frame frame;
+  pairingMakeJoinRequest(&frame, joinSensorType, joinCapabilities, joinZone);
+  linkApplyRate(LINK_RATE_1M);
+  esp_now_send(broadcastMAC, (uint8_t *)&frame, sizeof(frame));
+  lastJoinTime = millis();
+}
+
+void pairingBegin(uint8_t sensorType, uint8_t capabilities, uint8_t zone)
+{
+  joinSensorType = sensorType;
+  joinCapabilities = capabilities;
+  joinZone = zone;
+  WiFi.macAddress(ownMAC);
+  linkInit(&masterLink);
+
+  Preferences prefs;
+  prefs.begin("pairing", true);
+  masterKnown = prefs.getBytes("master", masterMAC, sizeof(masterMAC)) == sizeof(masterMAC);
+  prefs.end();
+
+  // Sniff management frames for the master's RSSI, which caps the rate of frames to it
+  wifi_promiscuous_filter_t filter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(captureMasterRssi);
+  esp_wifi_set_promiscuous(true);
+
+  addPeer(broadcastMAC);
+  if (masterKnown)
+  {
+    addPeer(masterMAC);
+    Serial.printf("Restored master %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  masterMAC[0], masterMAC[1], masterMAC[2], masterMAC[3], masterMAC[4], masterMAC[5]);
+  }
+
+  Serial.println("Sending join request...");
+  sendJoinRequest();
+}
+
+void pairingLoop()
+{
+  if (!joinAccepted && millis() - lastJoinTime >= PAIRING_RETRY_INTERVAL)
+  {
+    sendJoinRequest();
+  }
+}
+
+bool pairingHandleFrame(const uint8_t *mac, const uint8_t *data, int len)
+{
+  pairing_frame frame;
+  if (!pairingParseFrame(data, len, &frame))
+  {
+    return false;
+  }
+
+  // Join requests and broadcast accepts for other sensors are not for us
+  if (frame.kind != PAIRING_JOIN_ACCEPT || memcmp(frame.target, ownMAC, 6) != 0)
+  {
+    return true;
+  }
+
+  if (!masterKnown || memcmp(mac, masterMAC, 6) != 0)
+  {
+    if (masterKnown)
+    {
+      esp_now_del_peer(masterMAC);
+    }
+    memcpy(masterMAC, mac, 6);
+    masterKnown = true;
+    addPeer(masterMAC);
+    linkInit(&masterLink);
+    masterRssi = 0;
+
+    Preferences prefs;
+    prefs.begin("pairing", false);
+    prefs.putBytes("master", masterMAC, sizeof(masterMAC));
+    prefs.end();
+  }
+
+  joinAccepted = true;
+  Serial.printf("Joined master as peer %u\n", frame.peerId);
+  return true;
+}
+
+bool pairingMasterKnown()
+{
+  return masterKnown;
+}
+
+const uint8_t *pairingMasterMAC()
+{
+  return masterMAC;
+}
+
+esp_err_t pairingSendToMaster(const uint8_t *data, size_t len, uint32_t *sendNo)
+{
+  int8_t rssi = masterRssi;
+  if (rssi != 0)
+  {
+    masterRssi = 0;
+    linkOnRssi(&masterLink, rssi);
+  }
+  linkApplyRate(linkOnSend(&masterLink, len));
+  esp_err_t result = esp_now_send(masterMAC, data, len);
+  if (result == ESP_OK)
+  {
+    lastMasterSendTime = millis();
+    uint32_t n = masterSends.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (sendNo != nullptr)
+    {
+      *sendNo = n;
+    }
+  }
+  return result;
+}
+
+unsigned long pairingLastSendTime()
+{
+  return lastMasterSendTime;
+}
+
+void pairingOnSendResult(const uint8_t *mac, bool delivered)
+{
+  if (masterKnown && memcmp(mac, masterMAC, 6) == 0)
+  {
+    linkOnResult(&masterLink, delivered);
+    uint32_t n = masterResults.load(std::memory_order_relaxed) + 1;
+    uint32_t bit = 1u << (n % PAIRING_RESULTS_KEPT);
+    if (delivered)
+    {
+      failedSends.fetch_and(~bit, std::memory_order_relaxed);
+    }
+    else
+    {
+      failedSends.fetch_or(bit, std::memory_order_relaxed);
+    }
+    masterResults.store(n, std::memory_order_release);
+  }
+}
+
+uint32_t pairingResultCount()
+{
+  return masterResults.load(std::memory_order_acquire);
+}
+
+bool pairingSendDelivered(uint32_t sendNo)
+{
+  uint32_t results = pairingResultCount();
+  if (results - sendNo >= PAIRING_RESULTS_KEPT)
+  {
+    return true;
+  }
+  return (failedSends.load(std::memory_order_relaxed) & (1u << (sendNo % PAIRING_RESULTS_KEPT))) == 0;
+}
+
+const link_quality *pairingMasterLink()
+{
+  return &masterLink;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PAIRING_CLIENT_H
+#define PAIRING_CLIENT_H
+
+#ifdef ARDUINO
+
+#include "Pairing.h"
+
+#include <LinkQuality.h>
+#include <esp_now.h>
+
+// Sensor side of the join handshake.
+// The Server's MAC is learned from its join accept and kept in NVS, so it
+// no longer has to be compiled into each sensor.
+
+// Register the broadcast peer, restore the stored master and send the first
+// join request. Turns on promiscuous mode for the master's RSSI.
+void pairingBegin(uint8_t sensorType, uint8_t capabilities, uint8_t zone);
+
+// Re-broadcast the join request until the Server accepts it; call from loop()
+void pairingLoop();
+
+// Handle a received pairing frame; returns false if data is not a pairing frame
+bool pairingHandleFrame(const uint8_t *mac, const uint8_t *data, int len);
+
+// Whether the Server's MAC is known (from NVS or a join accept)
+bool pairingMasterKnown();
+const uint8_t *pairingMasterMAC();
+
+// Send a frame to the Server at the rate its link sustains. sendNo, if
+// given, gets the frame's number when ESP-NOW takes it (see below).
+esp_err_t pairingSendToMaster(const uint8_t *data, size_t len, uint32_t *sendNo = nullptr);
+
+// millis() when pairingSendToMaster() last handed a frame to ESP-NOW
+unsigned long pairingLastSendTime();
+
+// Pass every ESP-NOW send result on from the send callback; results for
+// the Server feed its link's rate selection
+void pairingOnSendResult(const uint8_t *mac, bool delivered);
+
+// Frames pairingSendToMaster() handed to ESP-NOW are numbered from 1, and
+// their results arrive in the same order. The number of the last one
+// whose result arrived:
+uint32_t pairingResultCount();
+
+// Whether send sendNo, whose result has arrived, was delivered. Only the
+// last 32 results are kept; older ones read as delivered.
+bool pairingSendDelivered(uint32_t sendNo);
+
+// Link to the Server, reset when a different Server accepts the sensor
+const link_quality *pairingMasterLink();
+
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+#include "PeerCache.h"
+
+#include <string.h>
+
+PeerCache::PeerCache(peer_cache_add_fn addPeer, peer_cache_remove_fn removePeer)
+    : hits(0), misses(0), evictions(0), useClock(0), addPeer(addPeer), removePeer(removePeer)
+{
+  memset(slots, 0, sizeof(slots));
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    slotPeer[i].store(PEER_CACHE_NO_PEER, std::memory_order_relaxed);
+  }
+}
+
+// Show slot i's peer to contains() after the writer changed it
+void PeerCache::publish(int i)
+{
+  slotPeer[i].store(slots[i].used ? slots[i].peerId : (uint16_t)PEER_CACHE_NO_PEER, std::memory_order_release);
+}
+
+bool PeerCache::acquire(uint16_t peerId, const uint8_t *mac)
+{
+  int freeSlot = -1;
+  int lruSlot = -1;
+
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    cache_slot &slot = slots[i];
+    if (!slot.used)
+    {
+      if (freeSlot < 0)
+      {
+        freeSlot = i;
+      }
+      continue;
+    }
+    if (slot.peerId == peerId)
+    {
+      slot.lastUsed = ++useClock;
+      if (slot.pending < 0xff)
+      {
+        slot.pending++;
+      }
+      hits++;
+      return true;
+    }
+    if (slot.pending == 0 && (lruSlot < 0 || slot.lastUsed < slots[lruSlot].lastUsed))
+    {
+      lruSlot = i;
+    }
+  }
+
+  int target = freeSlot;
+  if (target < 0)
+  {
+    if (lruSlot < 0)
+    {
+      return false; // Every slot has a send in flight
+    }
+    target = lruSlot;
+    removePeer(slots[target].mac);
+    slots[target].used = false;
+    publish(target);
+    evictions++;
+  }
+
+  if (!addPeer(mac))
+  {
+    return false;
+  }
+
+  cache_slot &slot = slots[target];
+  slot.used = true;
+  slot.peerId = peerId;
+  memcpy(slot.mac, mac, 6);
+  slot.pending = 1;
+  slot.lastUsed = ++useClock;
+  publish(target);
+  misses++;
+  return true;
+}
+
+void PeerCache::release(const uint8_t *mac)
+{
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    cache_slot &slot = slots[i];
+    if (slot.used && memcmp(slot.mac, mac, 6) == 0)
+    {
+      if (slot.pending > 0)
+      {
+        slot.pending--;
+      }
+      return;
+    }
+  }
+}
+
+void PeerCache::forget(uint16_t peerId)
+{
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    cache_slot &slot = slots[i];
+    if (!slot.used || slot.peerId != peerId)
+    {
+      continue;
+    }
+    if (slot.pending > 0)
+    {
+      slot.peerId = PEER_CACHE_NO_PEER; // Matched by MAC only, for release()
+      slot.lastUsed = 0;
+    }
+    else
+    {
+      removePeer(slot.mac);
+      slot.used = false;
+    }
+    publish(i);
+  }
+}
+
+bool PeerCache::contains(uint16_t peerId) const
+{
+  if (peerId == PEER_CACHE_NO_PEER)
+  {
+    return false;
+  }
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    if (slotPeer[i].load(std::memory_order_acquire) == peerId)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t PeerCache::size() const
+{
+  size_t n = 0;
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    if (slots[i].used)
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+size_t PeerCache::inFlight() const
+{
+  size_t count = 0;
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    count += slots[i].pending;
+  }
+  return count;
+}
+
+bool PeerCache::full() const
+{
+  for (int i = 0; i < PEER_CACHE_SLOTS; i++)
+  {
+    if (!slots[i].used || slots[i].pending == 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
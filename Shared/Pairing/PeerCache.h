@@ -0,0 +1,81 @@
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// LRU cache of the peers registered with the ESP-NOW driver.
+// The driver only holds ESP_NOW_MAX_TOTAL_PEER_NUM (20) peers, so the
+// Server keeps the whole fleet in its PeerTable and only registers a peer
+// while it is being sent to. A peer is pinned from acquire() until the
+// send callback calls release(), so frames in flight are never evicted.
+// Sends that find every slot pinned wait in a SendQueue for a release().
+//
+// Every call but contains() comes from the Server's radio task; contains()
+// serves /peers on the web server's task and reads only the peer ID each
+// slot publishes.
+
+#ifndef PEER_CACHE_SLOTS
+#define PEER_CACHE_SLOTS 16 // Leaves room below the driver limit for the broadcast peer
+#endif
+
+#define PEER_CACHE_NO_PEER 0xffff // Peer ID of a slot whose peer was forgotten
+
+// Driver hooks: register or remove a peer MAC
+typedef bool (*peer_cache_add_fn)(const uint8_t *mac);
+typedef void (*peer_cache_remove_fn)(const uint8_t *mac);
+
+class PeerCache
+{
+public:
+  PeerCache(peer_cache_add_fn addPeer, peer_cache_remove_fn removePeer);
+
+  // Make sure the peer is registered with the driver and pin it for one send,
+  // evicting the least recently used unpinned peer if all slots are taken.
+  // Returns false when every slot is pinned or the driver refuses the peer.
+  bool acquire(uint16_t peerId, const uint8_t *mac);
+
+  // Unpin a peer once its send has completed
+  void release(const uint8_t *mac);
+
+  // Drop a peer removed from the PeerTable, so its peer ID can go to
+  // another sensor. A slot with sends in flight stays pinned to the old
+  // MAC until they complete, then goes like any unpinned slot.
+  void forget(uint16_t peerId);
+
+  // Whether the peer currently holds a driver slot; safe from any task
+  bool contains(uint16_t peerId) const;
+
+  size_t size() const;
+
+  // Whether every slot has a send in flight, so acquire() must wait for a release()
+  bool full() const;
+
+  // Sends acquired and not yet released
+  size_t inFlight() const;
+
+  uint32_t hits;      // acquire() found the peer already registered
+  uint32_t misses;    // acquire() had to register the peer
+  uint32_t evictions; // Peers removed from the driver to make room
+
+private:
+  typedef struct cache_slot
+  {
+    bool used;
+    uint16_t peerId;
+    uint8_t mac[6];
+    uint8_t pending;   // Sends in flight
+    uint32_t lastUsed; // Value of useClock at the last acquire()
+  } cache_slot;
+
+  void publish(int i);
+
+  cache_slot slots[PEER_CACHE_SLOTS];
+  std::atomic<uint16_t> slotPeer[PEER_CACHE_SLOTS]; // Peer ID of each used slot, or PEER_CACHE_NO_PEER
+  uint32_t useClock;
+  peer_cache_add_fn addPeer;
+  peer_cache_remove_fn removePeer;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "PeerTable.h"
+
+#include <string.h>
+
+static const uint8_t emptyMac[6] = {0, 0, 0, 0, 0, 0};
+
+PeerTable::PeerTable() : entryCount(0)
+{
+  memset(entries, 0, sizeof(entries));
+  for (size_t id = 0; id < PEER_TABLE_MAX; id++)
+  {
+    version[id].store(0, std::memory_order_relaxed);
+  }
+}
+
+// Make entry id's version odd while the writer changes it
+void PeerTable::writeBegin(size_t id)
+{
+  version[id].store(version[id].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void PeerTable::writeEnd(size_t id)
+{
+  version[id].store(version[id].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+int PeerTable::find(const uint8_t *mac) const
+{
+  if (memcmp(mac, emptyMac, 6) == 0)
+  {
+    return -1;
+  }
+
+  size_t n = count();
+  for (size_t i = 0; i < n; i++)
+  {
+    uint32_t seq;
+    bool match;
+    do
+    {
+      seq = version[i].load(std::memory_order_acquire);
+      match = memcmp(entries[i].mac, mac, 6) == 0;
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || version[i].load(std::memory_order_relaxed) != seq);
+    if (match)
+    {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+bool PeerTable::snapshot(size_t id, peer_entry *out) const
+{
+  if (id >= count())
+  {
+    return false;
+  }
+
+  uint32_t seq;
+  do
+  {
+    seq = version[id].load(std::memory_order_acquire);
+    memcpy(out, &entries[id], sizeof(peer_entry));
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || version[id].load(std::memory_order_relaxed) != seq);
+  return memcmp(out->mac, emptyMac, 6) != 0;
+}
+
+int PeerTable::admit(const uint8_t *mac, uint8_t sensorType, uint8_t capabilities, uint8_t zone, bool *changed)
+{
+  *changed = false;
+
+  int id = find(mac);
+  if (id < 0)
+  {
+    // The first empty entry, or a new one at the end
+    size_t n = entryCount.load(std::memory_order_relaxed);
+    size_t slot = 0;
+    while (slot < n && memcmp(entries[slot].mac, emptyMac, 6) != 0)
+    {
+      slot++;
+    }
+    if (slot >= PEER_TABLE_MAX)
+    {
+      return -1;
+    }
+    // Fill the entry before publishing it so concurrent readers never see a partial one
+    writeBegin(slot);
+    memcpy(entries[slot].mac, mac, 6);
+    entries[slot].sensorType = sensorType;
+    entries[slot].capabilities = capabilities;
+    entries[slot].zone = zone;
+    writeEnd(slot);
+    if (slot == n)
+    {
+      entryCount.store(n + 1, std::memory_order_release);
+    }
+    *changed = true;
+    return (int)slot;
+  }
+
+  if (entries[id].sensorType != sensorType || entries[id].capabilities != capabilities || entries[id].zone != zone)
+  {
+    writeBegin(id);
+    entries[id].sensorType = sensorType;
+    entries[id].capabilities = capabilities;
+    entries[id].zone = zone;
+    writeEnd(id);
+    *changed = true;
+  }
+  return id;
+}
+
+bool PeerTable::remove(size_t id)
+{
+  if (id >= entryCount.load(std::memory_order_relaxed) || memcmp(entries[id].mac, emptyMac, 6) == 0)
+  {
+    return false;
+  }
+  writeBegin(id);
+  memset(&entries[id], 0, sizeof(peer_entry));
+  writeEnd(id);
+  return true;
+}
+
+size_t PeerTable::serialize(uint8_t *buf, size_t len) const
+{
+  size_t n = entryCount.load(std::memory_order_relaxed);
+  size_t size = PEER_TABLE_BLOB_SIZE(n);
+  if (len < size)
+  {
+    return 0;
+  }
+
+  peer_table_header header;
+  header.version = PEER_TABLE_VERSION;
+  header.entrySize = sizeof(peer_entry);
+  header.count = (uint16_t)n;
+  memcpy(buf, &header, sizeof(header));
+  memcpy(buf + sizeof(header), entries, n * sizeof(peer_entry));
+  return size;
+}
+
+bool PeerTable::deserialize(const uint8_t *buf, size_t len)
+{
+  peer_table_header header;
+  if (len < sizeof(header))
+  {
+    return false;
+  }
+  memcpy(&header, buf, sizeof(header));
+
+  if (header.version != PEER_TABLE_VERSION || header.entrySize < offsetof(peer_entry, zone) || header.count > PEER_TABLE_MAX ||
+      len < sizeof(header) + (size_t)header.count * header.entrySize)
+  {
+    return false;
+  }
+
+  // Copy entry by entry so blobs written with a smaller peer_entry still load
+  size_t copySize = header.entrySize < sizeof(peer_entry) ? header.entrySize : sizeof(peer_entry);
+  for (size_t i = 0; i < header.count; i++)
+  {
+    memset(&entries[i], 0, sizeof(peer_entry));
+    memcpy(&entries[i], buf + sizeof(header) + i * header.entrySize, copySize);
+  }
+  entryCount.store(header.count, std::memory_order_release);
+  return true;
+}
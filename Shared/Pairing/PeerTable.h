@@ -0,0 +1,88 @@
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Table of sensors admitted by the Server, indexed by peer ID.
+// A removed sensor leaves an empty entry (all-zero MAC) in its place, so
+// the other peer IDs stay stable; admit() gives the first empty entry to
+// the next new sensor. The whole table serializes to a single blob so it
+// can be stored in and reloaded from NVS in one pass. The blob records its
+// entry size, so tables saved before peer_entry grew still load (new
+// fields zeroed).
+//
+// admit() and remove() run in the Server's radio task while the web
+// handlers and the Wi-Fi task read the table. Each entry is guarded by a
+// seqlock, as in SensorStore: other tasks copy entries through snapshot()
+// and find(), and only the writer reads at() directly.
+
+#ifndef PEER_TABLE_MAX
+#define PEER_TABLE_MAX 256
+#endif
+
+#define PEER_TABLE_VERSION 1
+
+typedef struct peer_entry
+{
+  uint8_t mac[6];
+  uint8_t sensorType;   // sensor_type
+  uint8_t capabilities; // SENSOR_CAP_* bits
+  uint8_t zone;         // Room/zone reported in the join request
+} peer_entry;
+
+typedef struct peer_table_header
+{
+  uint8_t version;
+  uint8_t entrySize;
+  uint16_t count;
+} peer_table_header;
+
+// Size in bytes of a serialized table holding count entries
+#define PEER_TABLE_BLOB_SIZE(count) (sizeof(peer_table_header) + (count) * sizeof(peer_entry))
+
+class PeerTable
+{
+public:
+  PeerTable();
+
+  // Peer ID for the MAC, or -1 if it is not in the table
+  int find(const uint8_t *mac) const;
+
+  // Add the MAC (or refresh its type/capabilities/zone) and return its peer ID.
+  // Returns -1 when the table is full. changed is set when the stored
+  // table differs from before and needs saving.
+  int admit(const uint8_t *mac, uint8_t sensorType, uint8_t capabilities, uint8_t zone, bool *changed);
+
+  // Empty the entry of peer ID id; false if it was empty already
+  bool remove(size_t id);
+
+  // Number of entries, empty ones included (highest peer ID + 1)
+  size_t count() const { return entryCount.load(std::memory_order_acquire); }
+
+  // Entry as the writer sees it; empty entries have an all-zero MAC
+  const peer_entry &at(size_t id) const { return entries[id]; }
+
+  // Copy entry id as written by a single admit() or remove(); false for
+  // empty entries and ids past count()
+  bool snapshot(size_t id, peer_entry *out) const;
+
+  void clear() { entryCount.store(0, std::memory_order_release); }
+
+  // Write the table into buf; returns bytes written or 0 if buf is too small
+  size_t serialize(uint8_t *buf, size_t len) const;
+
+  // Replace the table with a blob produced by serialize(); false if malformed
+  bool deserialize(const uint8_t *buf, size_t len);
+
+private:
+  void writeBegin(size_t id);
+  void writeEnd(size_t id);
+
+  peer_entry entries[PEER_TABLE_MAX];
+  std::atomic<uint32_t> version[PEER_TABLE_MAX];
+  std::atomic<size_t> entryCount;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "SendQueue.h"
+
+SendQueue::SendQueue() : dropped(0), head(0), count(0)
+{
+}
+
+bool SendQueue::push(const queued_send &send, bool urgent)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const queued_send &waiting = sends[(head + i) % SEND_QUEUE_DEPTH];
+    if (waiting.peerId == send.peerId && waiting.data == send.data)
+    {
+      if (!urgent)
+      {
+        return true;
+      }
+      removeAt(i); // Moves to the front below
+      break;
+    }
+  }
+  if (count >= SEND_QUEUE_DEPTH)
+  {
+    dropped++;
+    if (!urgent)
+    {
+      return false;
+    }
+    count--; // The last send waiting makes room
+  }
+
+  if (urgent)
+  {
+    head = (head + SEND_QUEUE_DEPTH - 1) % SEND_QUEUE_DEPTH;
+    sends[head] = send;
+  }
+  else
+  {
+    sends[(head + count) % SEND_QUEUE_DEPTH] = send;
+  }
+  count++;
+  return true;
+}
+
+bool SendQueue::peek(queued_send *send) const
+{
+  if (count == 0)
+  {
+    return false;
+  }
+  *send = sends[head];
+  return true;
+}
+
+void SendQueue::pop()
+{
+  if (count == 0)
+  {
+    return;
+  }
+  head = (head + 1) % SEND_QUEUE_DEPTH;
+  count--;
+}
+
+void SendQueue::removeAt(size_t i)
+{
+  for (; i + 1 < count; i++)
+  {
+    sends[(head + i) % SEND_QUEUE_DEPTH] = sends[(head + i + 1) % SEND_QUEUE_DEPTH];
+  }
+  count--;
+}
+
+void SendQueue::cancel(uint16_t peerId)
+{
+  // Compact the sends that stay, in order
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const queued_send &send = sends[(head + i) % SEND_QUEUE_DEPTH];
+    if (send.peerId != peerId)
+    {
+      sends[(head + kept) % SEND_QUEUE_DEPTH] = send;
+      kept++;
+    }
+  }
+  count = kept;
+}
@@ -0,0 +1,55 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Unicast sends waiting for a driver slot.
+// A command fan-out to more sensors than PEER_CACHE_SLOTS pins every slot
+// of the PeerCache until the send callbacks come back, so the targets past
+// that wait here and go out one by one as completions unpin slots. Alarm
+// sends go ahead of everything else waiting.
+
+#ifndef SEND_QUEUE_DEPTH
+#define SEND_QUEUE_DEPTH 256 // One fan-out to a full PeerTable
+#endif
+
+typedef struct queued_send
+{
+  uint16_t peerId;
+  uint8_t len;
+  const uint8_t *data; // Not copied: rule commands are static
+  uint32_t traceId;    // Trace of the frame that fired the rule, 0 if none
+} queued_send;
+
+class SendQueue
+{
+public:
+  SendQueue();
+
+  // Queue a send behind those waiting, or ahead of them when urgent.
+  // A send already waiting for the same peer and data is not queued again,
+  // though an urgent one moves it to the front. Returns false when the
+  // queue is full; an urgent send pushes out the last one waiting instead.
+  bool push(const queued_send &send, bool urgent);
+
+  // The send to try next; false when none is waiting
+  bool peek(queued_send *send) const;
+  void pop();
+
+  // Forget every send waiting for a peer
+  void cancel(uint16_t peerId);
+
+  size_t size() const { return count; }
+
+  uint32_t dropped; // Sends refused or pushed out because the queue was full
+
+private:
+  void removeAt(size_t i);
+
+  queued_send sends[SEND_QUEUE_DEPTH];
+  size_t head;
+  size_t count;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "ReportControl.h"
+
+#include <string.h>
+
+// Indexed by sensor_type - 1: sound, motion, smoke, light
+static const report_setting nominal[REPORT_SENSOR_TYPES] = {
+    {500, 200, 0}, // Sound: ADC counts
+    {0, 0, 0},     // Motion: reports its events only
+    {500, 5, 0},   // Smoke: percent
+    {100, 64, 0},  // Light: ADC counts
+};
+
+report_setting reportNominal(uint8_t sensorType)
+{
+  if (sensorType < 1 || sensorType > REPORT_SENSOR_TYPES)
+  {
+    report_setting none = {0, 0, 0};
+    return none;
+  }
+  return nominal[sensorType - 1];
+}
+
+report_setting reportSettingAt(uint8_t sensorType, int8_t level)
+{
+  report_setting setting = reportNominal(sensorType);
+  if (level < REPORT_LEVEL_MIN)
+  {
+    level = REPORT_LEVEL_MIN;
+  }
+  if (level > REPORT_LEVEL_MAX)
+  {
+    level = REPORT_LEVEL_MAX;
+  }
+  if (level >= 0)
+  {
+    setting.intervalMs <<= level;
+    uint32_t threshold = (uint32_t)setting.threshold << level;
+    setting.threshold = threshold > 0xffff ? 0xffff : (uint16_t)threshold;
+  }
+  else
+  {
+    setting.intervalMs >>= -level;
+    setting.threshold >>= -level;
+  }
+  return setting;
+}
+
+void reportControlMakeFrame(report_control_frame *frame, int8_t level)
+{
+  memset(frame, 0, sizeof(*frame));
+  frame->magic = REPORT_CONTROL_MAGIC;
+  frame->kind = REPORT_CONTROL_SET;
+  frame->level = level;
+  for (uint8_t i = 0; i < REPORT_SENSOR_TYPES; i++)
+  {
+    frame->settings[i] = reportSettingAt(i + 1, level);
+  }
+}
+
+bool reportControlParseFrame(const uint8_t *data, int len, report_control_frame *frame)
+{
+  if (len != (int)sizeof(report_control_frame) || data[0] != REPORT_CONTROL_MAGIC)
+  {
+    return false;
+  }
+  memcpy(frame, data, sizeof(report_control_frame));
+  return frame->kind == REPORT_CONTROL_SET;
+}
+
+bool reportControlSettingFor(const report_control_frame *frame, uint8_t sensorType, report_setting *setting)
+{
+  if (sensorType < 1 || sensorType > REPORT_SENSOR_TYPES)
+  {
+    return false;
+  }
+  *setting = frame->settings[sensorType - 1];
+  return true;
+}
+
+ReportController::ReportController()
+    : started(false), periodStartMs(0), periodAirtimeUs(0), utilisation(0), currentLevel(0), changedMs(0),
+      sentMs(0), incidentMs(0), incidentOn(false), refresh(true)
+{
+}
+
+void ReportController::onFrame(uint32_t airtimeUs)
+{
+  periodAirtimeUs += airtimeUs;
+}
+
+void ReportController::onIncident(uint32_t nowMs)
+{
+  incidentMs = nowMs;
+  if (!incidentOn)
+  {
+    incidentOn = true;
+    // Speed up without waiting for the next period
+    if (currentLevel > REPORT_LEVEL_MIN && utilisation * 5 < REPORT_UTIL_INCIDENT_HIGH * 2)
+    {
+      currentLevel--;
+      changedMs = nowMs;
+      refresh = true;
+    }
+  }
+}
+
+void ReportController::requestRefresh()
+{
+  refresh = true;
+}
+
+bool ReportController::update(uint32_t nowMs, report_control_frame *frame)
+{
+  if (!started)
+  {
+    started = true;
+    periodStartMs = nowMs;
+    changedMs = nowMs;
+    periodAirtimeUs = 0;
+  }
+
+  int8_t level = currentLevel;
+  if (incidentOn && nowMs - incidentMs >= REPORT_CONTROL_INCIDENT)
+  {
+    incidentOn = false;
+    if (level < 0)
+    {
+      level = 0;
+    }
+  }
+
+  uint32_t elapsedMs = nowMs - periodStartMs;
+  if (elapsedMs >= REPORT_CONTROL_PERIOD)
+  {
+    uint32_t permille = periodAirtimeUs / elapsedMs;
+    utilisation = permille > 1000 ? 1000 : (uint16_t)permille;
+    // A period that began before the last change still carries the old load
+    bool settled = (int32_t)(periodStartMs - changedMs) >= 0;
+    periodStartMs = nowMs;
+    periodAirtimeUs = 0;
+
+    uint32_t high = incidentOn ? REPORT_UTIL_INCIDENT_HIGH : REPORT_UTIL_HIGH;
+    int8_t lowest = incidentOn ? REPORT_LEVEL_MIN : 0;
+    if (utilisation > high && settled)
+    {
+      // Each level halves the load: step until it is under 80% of the mark
+      uint32_t load = utilisation;
+      while (load * 5 > high * 4 && level < REPORT_LEVEL_MAX)
+      {
+        load /= 2;
+        level++;
+      }
+    }
+    else if (utilisation * 5 < high * 2 && level > lowest && nowMs - changedMs >= REPORT_CONTROL_HOLD)
+    {
+      level--;
+    }
+  }
+
+  if (level != currentLevel)
+  {
+    currentLevel = level;
+    changedMs = nowMs;
+    refresh = true;
+  }
+  if (!refresh && nowMs - sentMs < REPORT_CONTROL_REFRESH)
+  {
+    return false;
+  }
+  refresh = false;
+  sentMs = nowMs;
+  reportControlMakeFrame(frame, currentLevel);
+  return true;
+}
+
+int8_t ReportController::level() const
+{
+  return currentLevel;
+}
+
+uint16_t ReportController::utilisationPermille() const
+{
+  return utilisation;
+}
+
+bool ReportController::incident() const
+{
+  return incidentOn;
+}
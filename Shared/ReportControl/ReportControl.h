@@ -0,0 +1,106 @@
+#ifndef REPORT_CONTROL_H
+#define REPORT_CONTROL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reporting-rate control from the Server.
+// Each sensor type has a nominal reporting interval and change threshold. A
+// sensor reports when its interval has passed, or earlier when the reading
+// moved by at least the threshold since the last report (but no sooner than
+// a quarter of the interval). The Server scales every type's setting by one
+// level, a power of two: level 0 is nominal, each level above it doubles the
+// interval and the threshold, and REPORT_LEVEL_MIN halves them while an
+// incident is on. ReportController picks the level from the share of the
+// channel the frames the Server receives take, and the Server broadcasts it
+// in a report_control_frame.
+
+#define REPORT_CONTROL_MAGIC 0xC7 // Distinct from PAIRING_MAGIC, FRAME_MAGIC and CLOCK_SYNC_MAGIC
+
+#define REPORT_LEVEL_MIN -1 // Twice the nominal rate, only during incidents
+#define REPORT_LEVEL_MAX 5  // A 32nd of the nominal rate
+
+#define REPORT_CONTROL_PERIOD 2000       // Milliseconds of receive airtime per utilisation sample
+#define REPORT_CONTROL_HOLD 6000         // Milliseconds after a change before the level is lowered again
+#define REPORT_CONTROL_REFRESH 30000     // Milliseconds between broadcasts of an unchanged setting
+#define REPORT_CONTROL_INCIDENT 60000    // Milliseconds an incident keeps its faster reporting
+#define REPORT_UTIL_HIGH 300             // Permille of airtime above which reporting slows down
+#define REPORT_UTIL_INCIDENT_HIGH 500    // The same while an incident is on
+#define REPORT_SENSOR_TYPES 4            // Settings in a frame, one per sensor_type from SENSOR_SOUND
+
+enum report_control_kind
+{
+  REPORT_CONTROL_SET = 1 // Server to all: settings for every sensor type
+};
+
+typedef struct report_setting
+{
+  uint32_t intervalMs; // Report at least this often; 0 reports on events only
+  uint16_t threshold;  // Change in the reading that triggers an early report; 0 never does
+  uint16_t reserved;
+} report_setting;
+
+typedef struct report_control_frame
+{
+  uint8_t magic; // Always REPORT_CONTROL_MAGIC
+  uint8_t kind;  // report_control_kind
+  int8_t level;  // Level the settings were scaled by
+  uint8_t reserved;
+  report_setting settings[REPORT_SENSOR_TYPES]; // Indexed by sensor_type - 1
+} report_control_frame;
+
+// Setting of a sensor_type at level 0, and at any level
+report_setting reportNominal(uint8_t sensorType);
+report_setting reportSettingAt(uint8_t sensorType, int8_t level);
+
+void reportControlMakeFrame(report_control_frame *frame, int8_t level);
+
+// Returns true and copies the frame out if data is a report control frame
+bool reportControlParseFrame(const uint8_t *data, int len, report_control_frame *frame);
+
+// Setting for sensorType in a frame; false if the frame has none for it
+bool reportControlSettingFor(const report_control_frame *frame, uint8_t sensorType, report_setting *setting);
+
+// Congestion controller on the Server. Every REPORT_CONTROL_PERIOD it takes
+// the receive airtime of that period as the channel utilisation. Above the
+// high mark it raises the level at once by as many steps as bring the
+// utilisation back under 80% of it, unless the period began before the
+// last change took effect; below 40% of the mark it lowers the
+// level one step, no sooner than REPORT_CONTROL_HOLD after the last change,
+// so a halved interval cannot overshoot. While an incident is on the high
+// mark is REPORT_UTIL_INCIDENT_HIGH and the level may go to REPORT_LEVEL_MIN.
+class ReportController
+{
+public:
+  ReportController();
+
+  // A frame was received that took airtimeUs on the channel
+  void onFrame(uint32_t airtimeUs);
+
+  // Something worth watching closely happened, e.g. a smoke alarm
+  void onIncident(uint32_t nowMs);
+
+  // Broadcast the setting at the next update, e.g. after a sensor joined
+  void requestRefresh();
+
+  // Call often; returns true and fills frame when the setting should be broadcast
+  bool update(uint32_t nowMs, report_control_frame *frame);
+
+  int8_t level() const;
+  uint16_t utilisationPermille() const; // Of the last complete period
+  bool incident() const;
+
+private:
+  bool started;
+  uint32_t periodStartMs;
+  uint32_t periodAirtimeUs;
+  uint16_t utilisation;
+  int8_t currentLevel;
+  uint32_t changedMs;
+  uint32_t sentMs;
+  uint32_t incidentMs;
+  bool incidentOn;
+  bool refresh;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifdef ARDUINO
+
+#include "ReportControlClient.h"
+
+#include <Arduino.h>
+#include <PairingClient.h>
+#include <Preferences.h>
+
+#define REPORT_STORE_INTERVAL 60000 // Milliseconds between NVS writes of a changed setting
+
+static uint8_t ownType;
+static report_setting current;
+static int8_t currentLevel = 0;
+
+// What NVS holds, and when it was last written
+static report_setting stored;
+static int8_t storedLevel = 0;
+static unsigned long lastStoreTime = 0;
+static int32_t lastValue = 0;
+static unsigned long lastReportTime = 0;
+static bool reported = false;
+
+// Setting handed from the receive callback to loop()
+static report_setting pending;
+static int8_t pendingLevel;
+static volatile bool settingPending = false;
+
+void reportControlBegin(uint8_t sensorType)
+{
+  ownType = sensorType;
+  current = reportNominal(sensorType);
+
+  Preferences prefs;
+  prefs.begin("report", true);
+  report_setting setting;
+  if (prefs.getBytes("setting", &setting, sizeof(setting)) == sizeof(setting))
+  {
+    current = setting;
+    currentLevel = prefs.getChar("level", 0);
+  }
+  prefs.end();
+  stored = current;
+  storedLevel = currentLevel;
+
+  Serial.printf("Reporting every %lu ms, change threshold %u, level %d\n", (unsigned long)current.intervalMs,
+                current.threshold, currentLevel);
+}
+
+void reportControlLoop()
+{
+  if (settingPending)
+  {
+    report_setting setting = pending;
+    int8_t level = pendingLevel;
+    settingPending = false;
+    if (memcmp(&setting, &current, sizeof(setting)) != 0)
+    {
+      Serial.printf("Reporting every %lu ms, change threshold %u, level %d\n", (unsigned long)setting.intervalMs,
+                    setting.threshold, level);
+    }
+    current = setting;
+    currentLevel = level;
+  }
+
+  if ((memcmp(&stored, &current, sizeof(current)) == 0 && storedLevel == currentLevel) ||
+      millis() - lastStoreTime < REPORT_STORE_INTERVAL)
+  {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin("report", false);
+  prefs.putBytes("setting", &current, sizeof(current));
+  prefs.putChar("level", currentLevel);
+  prefs.end();
+  stored = current;
+  storedLevel = currentLevel;
+  lastStoreTime = millis();
+}
+
+bool reportControlHandleFrame(const uint8_t *mac, const uint8_t *data, int len)
+{
+  report_control_frame frame;
+  if (!reportControlParseFrame(data, len, &frame))
+  {
+    return false;
+  }
+  if (!pairingMasterKnown() || memcmp(mac, pairingMasterMAC(), 6) != 0 || settingPending)
+  {
+    return true;
+  }
+  if (reportControlSettingFor(&frame, ownType, &pending))
+  {
+    pendingLevel = frame.level;
+    settingPending = true;
+  }
+  return true;
+}
+
+uint32_t reportIntervalMs()
+{
+  return current.intervalMs;
+}
+
+uint16_t reportThreshold()
+{
+  return current.threshold;
+}
+
+int8_t reportLevel()
+{
+  return currentLevel;
+}
+
+bool reportDue(int32_t value, bool statusChanged)
+{
+  if (statusChanged || !reported)
+  {
+    return true;
+  }
+  unsigned long sinceReport = millis() - lastReportTime;
+  if (current.intervalMs > 0 && sinceReport >= current.intervalMs)
+  {
+    return true;
+  }
+  int32_t change = value > lastValue ? value - lastValue : lastValue - value;
+  return current.threshold > 0 && change >= current.threshold && sinceReport >= current.intervalMs / 4;
+}
+
+void reportSent(int32_t value)
+{
+  lastValue = value;
+  lastReportTime = millis();
+  reported = true;
+}
+
+#endif
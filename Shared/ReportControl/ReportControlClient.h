@@ -0,0 +1,40 @@
+#ifndef REPORT_CONTROL_CLIENT_H
+#define REPORT_CONTROL_CLIENT_H
+
+#ifdef ARDUINO
+
+#include "ReportControl.h"
+
+// Sensor side of reporting-rate control.
+// The sensor starts from the setting and level it last stored in NVS, or
+// its type's nominal setting at level 0, and takes new ones only from the
+// paired master. They are applied from loop(), never from the receive
+// callback. The master moves the level every few seconds while the channel
+// is busy, so a changed setting and level are stored at most once every
+// REPORT_STORE_INTERVAL, the latest ones when it comes round.
+
+// Load the stored setting and level for the sensor's type
+void reportControlBegin(uint8_t sensorType);
+
+// Apply a setting received since the last call, and store the current one
+// when due; call from loop()
+void reportControlLoop();
+
+// Handle a received report control frame; returns false if data is not one
+bool reportControlHandleFrame(const uint8_t *mac, const uint8_t *data, int len);
+
+uint32_t reportIntervalMs();
+uint16_t reportThreshold();
+int8_t reportLevel(); // Of the setting in use
+
+// Whether a reading of value should be sent now: the interval has passed,
+// or the value moved by the threshold and a quarter of the interval has
+// passed, or statusChanged (which always reports)
+bool reportDue(int32_t value, bool statusChanged);
+
+// A reading of value was sent
+void reportSent(int32_t value);
+
+#endif
+
+#endif
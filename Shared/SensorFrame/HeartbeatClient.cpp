@@ -0,0 +1,22 @@
+#ifdef ARDUINO
+
+#include "HeartbeatClient.h"
+
+#include <Arduino.h>
+#include <ClockSyncClient.h>
+#include <PairingClient.h>
+#include <ReportControlClient.h>
+
+void heartbeatLoop()
+{
+  if (!pairingMasterKnown() || millis() - pairingLastSendTime() < frameHeartbeatMs(reportLevel()))
+  {
+    return;
+  }
+  frame_header heartbeat;
+  uint32_t nowUs = micros();
+  clockSyncStampFrame(&heartbeat, FRAME_HEARTBEAT, nowUs, nowUs);
+  pairingSendToMaster((const uint8_t *)&heartbeat, sizeof(heartbeat));
+}
+
+#endif
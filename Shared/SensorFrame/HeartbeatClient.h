@@ -0,0 +1,17 @@
+#ifndef HEARTBEAT_CLIENT_H
+#define HEARTBEAT_CLIENT_H
+
+#ifdef ARDUINO
+
+#include "SensorFrame.h"
+
+// Sensor side of liveness: a heartbeat goes to the master whenever nothing
+// else has for frameHeartbeatMs() at the current reporting level. Sensors
+// that report more often than that never send one.
+
+// Send a heartbeat if one is due; call from loop()
+void heartbeatLoop();
+
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+#include "SensorFrame.h"
+
+#include <string.h>
+
+static uint16_t nextSeq = 0;
+
+void frameStamp(frame_header *header, uint8_t kind, uint32_t sampleUs, uint32_t sendUs)
+{
+  header->magic = FRAME_MAGIC;
+  header->kind = kind;
+  header->seq = nextSeq++;
+  header->sampleUs = sampleUs;
+  header->sendUs = sendUs;
+}
+
+bool frameParseHeader(const uint8_t *data, int len, frame_header *header, bool *serverClock)
+{
+  if (len < (int)sizeof(frame_header) || data[0] != FRAME_MAGIC)
+  {
+    return false;
+  }
+  memcpy(header, data, sizeof(frame_header));
+  if (serverClock != nullptr)
+  {
+    *serverClock = (header->kind & FRAME_SERVER_CLOCK) != 0;
+  }
+  header->kind &= ~FRAME_SERVER_CLOCK;
+  return true;
+}
+
+bool frameIsReading(uint8_t kind)
+{
+  return kind == FRAME_READING || kind == FRAME_READING_QUEUED;
+}
+
+uint32_t frameHeartbeatMs(int8_t level)
+{
+  if (level <= 0)
+  {
+    return FRAME_HEARTBEAT_MS;
+  }
+  return (uint32_t)FRAME_HEARTBEAT_MS << (level < 8 ? level : 8);
+}
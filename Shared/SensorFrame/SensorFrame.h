@@ -0,0 +1,64 @@
+#ifndef SENSOR_FRAME_H
+#define SENSOR_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Header carried at the start of every reading frame a sensor sends.
+// The sequence number lets the Server count lost and duplicated frames;
+// the timestamps (sender micros()) let it trace sample-to-send latency.
+// Once a sensor is synchronized with the Server (see Shared/ClockSync) it
+// stamps Server time instead and sets FRAME_SERVER_CLOCK in the kind, so
+// the Server can trace the time the frame spent in the air as well.
+//
+// A sensor that has sent the Server nothing for frameHeartbeatMs() sends
+// a heartbeat, a frame that is only this header, so that the Server hears
+// from every sensor at least that often, including those that report
+// only on events (see HeartbeatClient.h and Server/lib/Liveness).
+//
+// Readings a sensor could not deliver are kept and forwarded later in
+// backlog frames (see Shared/Backlog). While a sensor still has readings
+// to forward, its new readings go out as FRAME_READING_QUEUED and follow
+// in a backlog frame as well, so the Server can add them to the history
+// in the order they were taken.
+
+#define FRAME_MAGIC 0x5A // Distinct from PAIRING_MAGIC
+#define FRAME_SERVER_CLOCK 0x80 // Or'ed into the kind on the air; frameParseHeader() takes it out
+
+#ifndef FRAME_HEARTBEAT_MS
+#define FRAME_HEARTBEAT_MS 250 // Longest a sensor stays quiet at reporting level 0 and below
+#endif
+
+enum frame_kind
+{
+  FRAME_READING = 1,
+  FRAME_HEARTBEAT = 2,     // The header alone
+  FRAME_BACKLOG = 3,       // Readings kept through an outage, a backlog_frame
+  FRAME_READING_QUEUED = 4 // A reading sent while older ones are still kept
+};
+
+typedef struct frame_header
+{
+  uint8_t magic;     // Always FRAME_MAGIC
+  uint8_t kind;      // frame_kind
+  uint16_t seq;      // Incremented by the sender for every frame
+  uint32_t sampleUs; // When the reading was taken
+  uint32_t sendUs;   // When the frame was handed to ESP-NOW
+} frame_header;
+
+// Fill in the header of an outgoing frame and advance the sequence number
+void frameStamp(frame_header *header, uint8_t kind, uint32_t sampleUs, uint32_t sendUs);
+
+// Returns true and copies the header out if data starts with a frame header.
+// The kind comes out without FRAME_SERVER_CLOCK; serverClock, if given, is
+// set when the timestamps are Server time.
+bool frameParseHeader(const uint8_t *data, int len, frame_header *header, bool *serverClock = nullptr);
+
+// Whether frames of this kind carry a reading in the sensor's own layout
+bool frameIsReading(uint8_t kind);
+
+// Heartbeat interval at a reporting level (see ReportControl.h): it
+// doubles with every level above 0, as the reporting intervals do
+uint32_t frameHeartbeatMs(int8_t level);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TEXT_BUFFER_H
+#define TEXT_BUFFER_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Formatting into a fixed buffer, shared by the text and JSON writers of
+// the firmwares and their host tools.
+
+// snprintf wrapper that keeps track of the write position and truncates
+// safely, always leaving buf NUL-terminated. Returns false if the text did
+// not fit, so callers can tell a cut-off body from a complete one.
+inline bool appendf(char *buf, size_t len, size_t &pos, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+inline bool appendf(char *buf, size_t len, size_t &pos, const char *fmt, ...)
+{
+  if (pos >= len)
+  {
+    return false;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf + pos, len - pos, fmt, args);
+  va_end(args);
+  if (n < 0)
+  {
+    return false;
+  }
+  if ((size_t)n >= len - pos)
+  {
+    pos = len - 1;
+    return false;
+  }
+  pos += (size_t)n;
+  return true;
+}
+
+#endif
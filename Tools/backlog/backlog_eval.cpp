@@ -0,0 +1,448 @@
+// Host evaluation of the sensors' store-and-forward backlog (see
+// Shared/Backlog/Backlog.h): what a Server outage costs in readings, how
+// long the fleet takes to forward what it held, and how hard that hits the
+// channel, on a simulated fleet.
+//
+//   backlog_eval [--sensors 50] [--outage 10] [--after 5] [--loss 0.01] [--rate 1M] [--drift 40] [--seed 1]
+//
+// The fleet is a quarter each of light, sound, smoke and motion sensors
+// reporting as their firmware does: every reading goes through reportDue()
+// at the current reporting level and then through the same decisions as
+// backlogSendReading() and backlogLoop(), and a sensor that has sent
+// nothing for frameHeartbeatMs() sends a heartbeat. Light reads every
+// 100 ms, sound and smoke every 10 ms, and motion has an edge on average
+// every 10 s. Each sensor's clock runs up to --drift ppm off the Server's.
+// Frames go at --rate and are lost with probability --loss; a lost frame
+// is reported as failed after the driver's retries. After one minute the
+// Server stops receiving for --outage minutes, then runs for --after more.
+//
+// The Server side takes the channel airtime of every frame it receives
+// into a ReportController, whose level every sensor follows at once, and
+// places readings on its history as Server/src/main.cpp does: live readings
+// at their arrival, queued readings not at all, and backlog samples at
+// their arrival less their age. It prints:
+//   readings   taken, placed on the history, thinned while held (a steady
+//              reading within BACKLOG_SPACING_MS of the one before),
+//              overwritten in a full ring, still held at the end, and lost
+//              in frames the driver took for delivered
+//   placed     timestamp error of backlog samples, median and worst, and
+//              samples placed before the sensor's previous one
+//   drain      from the Server's return to an empty ring, per sensor type,
+//              median and worst
+//   channel    frames per second and airtime of the busiest second after
+//              the return against the mean before the outage, and the
+//              highest reporting level the controller chose
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Shared/SensorFrame -I../../Shared/Backlog
+//     -I../../Shared/LinkQuality -I../../Shared/ReportControl backlog_eval.cpp
+//     ../../Shared/Pairing/Pairing.cpp ../../Shared/SensorFrame/SensorFrame.cpp
+//     ../../Shared/Backlog/Backlog.cpp ../../Shared/LinkQuality/LinkQuality.cpp
+//     ../../Shared/ReportControl/ReportControl.cpp -o backlog_eval
+
+#include <Backlog.h>
+#include <LinkQuality.h>
+#include <Pairing.h>
+#include <ReportControl.h>
+#include <SensorFrame.h>
+
+#include <algorithm>
+#include <deque>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define OUTAGE_START_MS 60000  // Steady state before the outage
+#define MOTION_PERIOD_MS 10000 // Mean time between motion edges
+#define DELIVERY_MS 1          // Send to arrival and to a delivered result
+#define FAILURE_MS 12          // Send to a failed result, after the driver's retries
+
+static const uint8_t fleetTypes[] = {SENSOR_LIGHT, SENSOR_SOUND, SENSOR_SMOKE, SENSOR_MOTION};
+
+// Reading frame of each sensor type, indexed by sensor_type - 1
+static const size_t readingLen[] = {36, 36, 40, 28};
+
+typedef struct eval_send
+{
+  uint32_t sendNo;
+  uint32_t resultMs;
+  bool delivered;
+} eval_send;
+
+typedef struct eval_sensor
+{
+  uint8_t sensorType;
+  double rate;       // Sensor milliseconds per Server millisecond
+  uint32_t sampleMs; // Next reading, on the Server's clock
+  uint32_t edgeMs;   // Next motion edge
+  int32_t value;
+  bool reported;
+  int32_t reportedValue;
+  uint32_t reportedMs;
+  uint32_t lastSendMs;
+  uint32_t sends;
+  std::deque<eval_send> results;
+  Backlog backlog;
+  uint32_t drainedMs; // 0 until the ring was empty after the outage
+  uint32_t placedMs;  // Newest reading on the Server's history
+  bool placed;
+} eval_sensor;
+
+static std::vector<eval_sensor> sensors;
+static ReportController controller;
+static uint8_t linkRate = LINK_RATE_1M;
+static double loss;
+static unsigned seed = 1;
+static uint32_t clockMs;
+static uint32_t outageEndMs;
+
+// Per second of the run
+static std::vector<uint32_t> framesPerSecond;
+static std::vector<uint32_t> airtimePerSecond;
+
+static uint32_t readingsTaken;
+static uint32_t readingsPlaced;
+static uint32_t readingsThinned;
+static uint32_t orderViolations;
+static std::vector<uint32_t> placementErrors;
+
+static double uniform()
+{
+  return (rand_r(&seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+// The sensor's millis()
+static uint32_t localMs(const eval_sensor &sensor)
+{
+  return (uint32_t)(clockMs * sensor.rate);
+}
+
+static void place(eval_sensor &sensor, uint32_t placedMs)
+{
+  // The history is append-only and clamps anything older than its newest
+  if (sensor.placed && (int32_t)(placedMs - sensor.placedMs) < 0)
+  {
+    orderViolations++;
+    placedMs = sensor.placedMs;
+  }
+  sensor.placedMs = placedMs;
+  sensor.placed = true;
+  readingsPlaced++;
+}
+
+// The Server receives a frame at clockMs + DELIVERY_MS
+static void receive(eval_sensor &sensor, const uint8_t *data, size_t len)
+{
+  uint32_t airtimeUs = linkAirtimeUs(linkRate, len);
+  controller.onFrame(airtimeUs);
+  framesPerSecond[clockMs / 1000]++;
+  airtimePerSecond[clockMs / 1000] += airtimeUs;
+
+  uint32_t arrivalMs = clockMs + DELIVERY_MS;
+  backlog_frame frame;
+  if (backlogParseFrame(data, (int)len, &frame))
+  {
+    for (uint8_t i = 0; i < frame.count; i++)
+    {
+      // The sample was taken at the sensor's millis() of the frame less its age
+      uint32_t builtMs = localMs(sensor);
+      double trueMs = (builtMs - frame.samples[i].ageMs) / sensor.rate;
+      uint32_t placedMs = arrivalMs - frame.samples[i].ageMs;
+      placementErrors.push_back((uint32_t)fabs(placedMs - trueMs));
+      place(sensor, placedMs);
+    }
+    return;
+  }
+  frame_header header;
+  if (frameParseHeader(data, (int)len, &header) && header.kind == FRAME_READING)
+  {
+    place(sensor, arrivalMs);
+  }
+}
+
+// pairingSendToMaster(): returns the send number
+static uint32_t send(eval_sensor &sensor, const uint8_t *data, size_t len)
+{
+  bool up = clockMs < OUTAGE_START_MS || clockMs >= outageEndMs;
+  bool delivered = up && uniform() > loss;
+  if (delivered)
+  {
+    receive(sensor, data, len);
+  }
+  sensor.lastSendMs = clockMs;
+  sensor.results.push_back({++sensor.sends, clockMs + (delivered ? DELIVERY_MS : FAILURE_MS), delivered});
+  return sensor.sends;
+}
+
+// backlogSendReading()
+static void sendReading(eval_sensor &sensor, uint16_t threshold)
+{
+  Backlog &backlog = sensor.backlog;
+  uint32_t sampleMs = localMs(sensor);
+  if (backlog.holding())
+  {
+    readingsThinned += !backlog.keep(sampleMs, sensor.value, threshold);
+    return;
+  }
+  uint8_t data[40];
+  memset(data, 0, sizeof(data));
+  size_t len = readingLen[sensor.sensorType - 1];
+  bool queued = backlog.depth() > 0;
+  frame_header header;
+  frameStamp(&header, queued ? FRAME_READING_QUEUED : FRAME_READING, sampleMs * 1000, sampleMs * 1000);
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + sizeof(header), &sensor.value, sizeof(sensor.value));
+  uint32_t sendNo = send(sensor, data, len);
+  if (queued)
+  {
+    readingsThinned += !backlog.keep(sampleMs, sensor.value, threshold);
+  }
+  else
+  {
+    backlog.onReadingSent(sendNo, sampleMs, sensor.value, threshold);
+  }
+}
+
+// A new reading, and the report if reportDue() would make one
+static void sample(eval_sensor &sensor, int8_t level)
+{
+  switch (sensor.sensorType)
+  {
+  case SENSOR_LIGHT:
+    // Daylight and shadows wandering across the ADC range
+    sensor.value = std::min(4095, std::max(0, sensor.value + (int32_t)(rand_r(&seed) % 33) - 16));
+    sensor.sampleMs += 100;
+    break;
+  case SENSOR_SOUND:
+    // Room noise with the odd loud moment
+    sensor.value = 300 + (int32_t)(rand_r(&seed) % 80) + (uniform() < 0.001 ? 1500 : 0);
+    sensor.sampleMs += 10;
+    break;
+  case SENSOR_SMOKE:
+    // Clean air, whole percents
+    sensor.value = 20 + (uniform() < 0.05 ? (int32_t)(rand_r(&seed) % 3) - 1 : 0);
+    sensor.sampleMs += 10;
+    break;
+  default:
+    sensor.value = !sensor.value;
+    sensor.edgeMs += 1 + (uint32_t)(-log(uniform()) * MOTION_PERIOD_MS);
+    break;
+  }
+  readingsTaken++;
+
+  report_setting setting = reportSettingAt(sensor.sensorType, level);
+  uint32_t sinceReport = clockMs - sensor.reportedMs;
+  int32_t change = abs(sensor.value - sensor.reportedValue);
+  bool due = !sensor.reported || sensor.sensorType == SENSOR_MOTION ||
+             (setting.intervalMs > 0 && sinceReport >= setting.intervalMs) ||
+             (setting.threshold > 0 && change >= setting.threshold && sinceReport >= setting.intervalMs / 4);
+  if (!due)
+  {
+    readingsTaken--; // Not a reading the firmware would report
+    return;
+  }
+  sendReading(sensor, setting.threshold);
+  sensor.reported = true;
+  sensor.reportedValue = sensor.value;
+  sensor.reportedMs = clockMs;
+}
+
+// One pass of the sensor's loop() after its readings
+static void loop(eval_sensor &sensor, int8_t level)
+{
+  Backlog &backlog = sensor.backlog;
+  while (!sensor.results.empty() && sensor.results.front().resultMs <= clockMs)
+  {
+    eval_send result = sensor.results.front();
+    sensor.results.pop_front();
+    backlog.onResult(result.sendNo, result.delivered, localMs(sensor), level);
+  }
+
+  backlog_frame frame;
+  size_t len = backlog.nextFrame(&frame, localMs(sensor));
+  if (len > 0)
+  {
+    frameStamp(&frame.header, FRAME_BACKLOG, 0, localMs(sensor) * 1000);
+    backlog.onFrameSent(send(sensor, (const uint8_t *)&frame, len), localMs(sensor), level);
+  }
+
+  if (clockMs - sensor.lastSendMs >= frameHeartbeatMs(level))
+  {
+    frame_header header;
+    frameStamp(&header, FRAME_HEARTBEAT, 0, localMs(sensor) * 1000);
+    send(sensor, (const uint8_t *)&header, sizeof(header));
+  }
+
+  if (sensor.drainedMs == 0 && clockMs > outageEndMs && !backlog.holding() && backlog.depth() == 0)
+  {
+    sensor.drainedMs = clockMs;
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, double fraction)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)(fraction * (values.size() - 1) + 0.5);
+  return values[rank];
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: backlog_eval [--sensors 50] [--outage 10] [--after 5] [--loss 0.01] [--rate 1M] "
+                  "[--drift 40] [--seed 1]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned count = 50;
+  unsigned firstSeed = seed;
+  double outage = 10;
+  double after = 5;
+  double drift = 40;
+  loss = 0.01;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--sensors") == 0)
+    {
+      count = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--outage") == 0)
+    {
+      outage = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--after") == 0)
+    {
+      after = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--loss") == 0)
+    {
+      loss = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--rate") == 0)
+    {
+      linkRate = LINK_RATE_COUNT;
+      for (uint8_t rate = 0; rate < LINK_RATE_COUNT; rate++)
+      {
+        if (strcmp(linkRateName(rate), value) == 0)
+        {
+          linkRate = rate;
+        }
+      }
+    }
+    else if (strcmp(argv[i - 1], "--drift") == 0)
+    {
+      drift = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = firstSeed = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (count == 0 || count > 1000 || outage < 0 || outage > 60 || after <= 0 || after > 60 || loss < 0 ||
+      loss >= 1 || linkRate == LINK_RATE_COUNT || drift < 0 || drift > 1000)
+  {
+    usage();
+  }
+
+  outageEndMs = OUTAGE_START_MS + (uint32_t)(outage * 60000);
+  uint32_t endMs = outageEndMs + (uint32_t)(after * 60000);
+  framesPerSecond.resize(endMs / 1000 + 1);
+  airtimePerSecond.resize(endMs / 1000 + 1);
+  sensors.resize(count);
+  for (unsigned id = 0; id < count; id++)
+  {
+    eval_sensor &sensor = sensors[id];
+    sensor.sensorType = fleetTypes[id % 4];
+    sensor.rate = 1 + (uniform() * 2 - 1) * drift * 1e-6;
+    sensor.sampleMs = 1 + rand_r(&seed) % 1000; // Powered up over the first second
+    sensor.edgeMs = sensor.sampleMs;
+    sensor.value = sensor.sensorType == SENSOR_LIGHT ? 2000 : 0;
+    sensor.backlog.seed(rand_r(&seed));
+  }
+
+  int8_t level = 0;
+  int8_t maxLevel = 0;
+  for (clockMs = 1; clockMs < endMs; clockMs++)
+  {
+    report_control_frame frame;
+    if (controller.update(clockMs, &frame))
+    {
+      level = frame.level;
+      maxLevel = std::max(maxLevel, level);
+    }
+    for (eval_sensor &sensor : sensors)
+    {
+      uint32_t &nextMs = sensor.sensorType == SENSOR_MOTION ? sensor.edgeMs : sensor.sampleMs;
+      if (nextMs <= clockMs)
+      {
+        sample(sensor, level);
+      }
+      loop(sensor, level);
+    }
+  }
+
+  uint32_t overwritten = 0, held = 0;
+  std::vector<std::vector<uint32_t>> drains(SENSOR_LIGHT + 1);
+  for (eval_sensor &sensor : sensors)
+  {
+    overwritten += sensor.backlog.dropped();
+    held += sensor.backlog.depth();
+    drains[sensor.sensorType].push_back(sensor.drainedMs != 0 ? sensor.drainedMs - outageEndMs : endMs - outageEndMs);
+  }
+
+  printf("sensors %u  outage %.1f min  loss %.3f  rate %s  drift %.0f ppm  seed %u\n\n", count, outage, loss,
+         linkRateName(linkRate), drift, firstSeed);
+  printf("readings   %lu taken, %lu placed, %lu thinned, %lu overwritten, %lu still held, %lu lost\n",
+         (unsigned long)readingsTaken, (unsigned long)readingsPlaced, (unsigned long)readingsThinned,
+         (unsigned long)overwritten, (unsigned long)held,
+         (unsigned long)(readingsTaken - readingsPlaced - readingsThinned - overwritten - held));
+  uint32_t errorMedian = percentile(placementErrors, 0.5);
+  uint32_t errorMax = placementErrors.empty() ? 0 : placementErrors.back();
+  printf("placed     %lu backlog samples, error p50 %lu ms, max %lu ms, %lu out of order\n",
+         (unsigned long)placementErrors.size(), (unsigned long)errorMedian, (unsigned long)errorMax,
+         (unsigned long)orderViolations);
+  printf("drain     ");
+  for (uint8_t type : fleetTypes)
+  {
+    uint32_t median = percentile(drains[type], 0.5);
+    printf(" %s p50 %.1f s max %.1f s", sensorTypeName(type), median / 1000.0, drains[type].back() / 1000.0);
+  }
+  printf("\n");
+
+  // Steady state is the minute before the outage, less the first seconds of joining
+  double steadyFrames = 0, steadyAirtime = 0;
+  for (uint32_t s = 10; s < OUTAGE_START_MS / 1000; s++)
+  {
+    steadyFrames += framesPerSecond[s];
+    steadyAirtime += airtimePerSecond[s];
+  }
+  steadyFrames /= OUTAGE_START_MS / 1000 - 10;
+  steadyAirtime /= OUTAGE_START_MS / 1000 - 10;
+  uint32_t peakFrames = 0, peakAirtime = 0;
+  for (uint32_t s = outageEndMs / 1000; s < framesPerSecond.size(); s++)
+  {
+    peakFrames = std::max(peakFrames, framesPerSecond[s]);
+    peakAirtime = std::max(peakAirtime, airtimePerSecond[s]);
+  }
+  printf("channel    steady %.0f frames/s %.1f%% airtime, peak after return %lu frames/s %.1f%% airtime, "
+         "level up to %d\n",
+         steadyFrames, steadyAirtime / 1e4, (unsigned long)peakFrames, peakAirtime / 1e4, maxLevel);
+  return 0;
+}
@@ -0,0 +1,695 @@
+// Host microbenchmarks for the Server's hot paths: frame handling and
+// rules, sensor lookup and scans, the peer cache, command fan-out, and the
+// bodies of the status, peer, page, metrics, statistics and export routes.
+// The code under test is the Server's own libraries; only the ESP-NOW
+// driver calls are replaced by counters.
+//
+//   bench [--json] [--time ms] [--fleet n] [filter]
+//                                                run the benchmarks whose name contains filter
+//   bench compare <base.json> <new.json> [pct]   flag benchmarks that got slower by more than
+//                                                pct percent (default 10) or allocate more
+//
+// --json prints one JSON object per benchmark and line. Keep one file per
+// commit to track regressions, for example
+//   ./bench --json > bench-$(git rev-parse --short HEAD).json
+// compare exits with status 1 when it finds a regression. Only compare
+// runs made with the same --fleet.
+//
+// --fleet is the number of paired sensors, PEER_TABLE_MAX (256) by
+// default and at most. For the lookup and scan costs at 1,000 sensors,
+// build with -DPEER_TABLE_MAX=1024 -DSENSOR_STORE_MAX=1024
+// -DMETRICS_MAX_SENSORS=1024 -DHEALTH_MAX_IDS=1024 -DLIVENESS_MAX_IDS=1024
+// -DSTATS_MAX_IDS=1024 -DHISTORY_MAX_SERIES=1024 and run with --fleet 1000.
+//
+// ns/op is the median over batches of about 10 ms; allocs/op counts C++
+// heap allocations (operator new), which is what String-free code should
+// keep at zero.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Shared/SensorFrame -I../../Shared/TextBuffer
+//     -I../../Server/lib/Dispatch -I../../Server/lib/SensorStore -I../../Server/lib/Metrics
+//     -I../../Server/lib/Views -I../../Server/lib/History -I../../Server/lib/Export -I../../Server/lib/Stats
+//     -I../../Server/lib/Health -I../../Server/lib/Liveness -I../../Server/src bench.cpp
+//     ../../Shared/Pairing/Pairing.cpp
+//     ../../Shared/Pairing/PeerTable.cpp ../../Shared/Pairing/PeerCache.cpp
+//     ../../Shared/SensorFrame/SensorFrame.cpp ../../Server/lib/Dispatch/Dispatch.cpp
+//     ../../Server/lib/SensorStore/SensorStore.cpp ../../Server/lib/Metrics/Metrics.cpp
+//     ../../Server/lib/Views/Views.cpp ../../Server/lib/History/History.cpp
+//     ../../Server/lib/Export/Export.cpp ../../Server/lib/Stats/Stats.cpp
+//     ../../Server/lib/Health/Health.cpp ../../Server/lib/Liveness/Liveness.cpp -o bench
+
+#include <Dispatch.h>
+#include <Export.h>
+#include <Health.h>
+#include <History.h>
+#include <Liveness.h>
+#include <Metrics.h>
+#include <Pairing.h>
+#include <PeerCache.h>
+#include <PeerTable.h>
+#include <SensorFrame.h>
+#include <SensorStore.h>
+#include <Stats.h>
+#include <Views.h>
+
+#define PROGMEM
+#include <pageindex.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define BENCH_CHUNK 1436        // Bytes per chunk of a chunked response, about one TCP segment
+#define BENCH_BATCH_NS 10000000 // Target length of one timed batch
+#define BENCH_NAME_MAX 64
+
+// Paired sensors, set by --fleet
+static uint16_t fleetSize = PEER_TABLE_MAX;
+
+// Every C++ allocation in the process is counted
+static std::atomic<uint64_t> allocCount(0);
+static std::atomic<uint64_t> allocBytes(0);
+
+void *operator new(size_t size)
+{
+  allocCount.fetch_add(1, std::memory_order_relaxed);
+  allocBytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+
+typedef struct bench_result
+{
+  char name[BENCH_NAME_MAX];
+  double nsPerOp;     // Median over batches
+  double nsMin;       // Fastest batch
+  double allocsPerOp;
+  double allocBytesPerOp;
+  uint64_t iterations;
+} bench_result;
+
+// Keeps results alive so the compiler cannot drop the work
+static volatile size_t sink;
+
+static uint64_t nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Time op() in batches for about timeMs in total
+template <typename Op>
+static bench_result measure(const char *name, uint32_t timeMs, Op op)
+{
+  // Grow the batch until it takes long enough to time
+  uint64_t batch = 1;
+  while (true)
+  {
+    uint64_t start = nowNs();
+    for (uint64_t i = 0; i < batch; i++)
+    {
+      op();
+    }
+    if (nowNs() - start >= BENCH_BATCH_NS / 10 || batch >= (1ull << 40))
+    {
+      break;
+    }
+    batch *= 2;
+  }
+  batch *= 10;
+
+  std::vector<double> perOp;
+  perOp.reserve(1024);
+  uint64_t allocsBefore = allocCount.load();
+  uint64_t bytesBefore = allocBytes.load();
+  uint64_t iterations = 0;
+  uint64_t deadline = nowNs() + (uint64_t)timeMs * 1000000;
+  do
+  {
+    uint64_t start = nowNs();
+    for (uint64_t i = 0; i < batch; i++)
+    {
+      op();
+    }
+    perOp.push_back((double)(nowNs() - start) / batch);
+    iterations += batch;
+  } while (nowNs() < deadline || perOp.size() < 3);
+  // Allocations made by perOp itself are not the benchmark's
+  uint64_t allocs = allocCount.load() - allocsBefore;
+  uint64_t bytes = allocBytes.load() - bytesBefore;
+
+  std::sort(perOp.begin(), perOp.end());
+  bench_result result;
+  memset(&result, 0, sizeof(result));
+  snprintf(result.name, sizeof(result.name), "%s", name);
+  result.nsPerOp = perOp[perOp.size() / 2];
+  result.nsMin = perOp[0];
+  result.allocsPerOp = (double)allocs / iterations;
+  result.allocBytesPerOp = (double)bytes / iterations;
+  result.iterations = iterations;
+  return result;
+}
+
+// Driver stand-ins for PeerCache and esp_now_send()
+static uint32_t driverAdds = 0, driverRemoves = 0, bytesSent = 0;
+
+static bool addDriverPeer(const uint8_t *)
+{
+  driverAdds++;
+  return true;
+}
+
+static void removeDriverPeer(const uint8_t *)
+{
+  driverRemoves++;
+}
+
+// The Server's state with a full fleet paired and reporting
+typedef struct bench_fleet
+{
+  PeerTable peers;
+  PeerCache cache{addDriverPeer, removeDriverPeer};
+  SensorStore store;
+  History history;
+  WindowStats stats;
+  SensorHealth health;
+  SensorLiveness liveness;
+  Metrics metrics;
+  std::vector<std::vector<uint8_t>> frames; // One reading frame per peer
+} bench_fleet;
+
+static void makeMac(uint16_t id, uint8_t *mac)
+{
+  const uint8_t base[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x00};
+  memcpy(mac, base, 6);
+  mac[4] = (uint8_t)(id >> 8);
+  mac[5] = (uint8_t)id;
+}
+
+static std::vector<uint8_t> makeFrame(uint8_t sensorType, uint16_t id)
+{
+  std::vector<uint8_t> frame;
+  switch (sensorType)
+  {
+  case SENSOR_SOUND:
+  {
+    struct_message_sound m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.soundLevel = 40 + id % 20;
+    strcpy(m.soundStatus, "Quiet");
+    frame.assign((const uint8_t *)&m, (const uint8_t *)&m + sizeof(m));
+    break;
+  }
+  case SENSOR_MOTION:
+  {
+    struct_message_motion m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.motionValue = 0;
+    strcpy(m.motionStatus, "No Motion");
+    frame.assign((const uint8_t *)&m, (const uint8_t *)&m + sizeof(m));
+    break;
+  }
+  case SENSOR_SMOKE:
+  {
+    struct_message_smoke m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.smokePercentage = 3;
+    strcpy(m.smokeStatus, "Clear");
+    frame.assign((const uint8_t *)&m, (const uint8_t *)&m + sizeof(m));
+    break;
+  }
+  default:
+  {
+    struct_message_light m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.lightLevel = 300 + id;
+    strcpy(m.brightnessPercentage, "45%");
+    frame.assign((const uint8_t *)&m, (const uint8_t *)&m + sizeof(m));
+    break;
+  }
+  }
+  return frame;
+}
+
+static void setupFleet(bench_fleet &fleet)
+{
+  static const uint8_t types[] = {SENSOR_SOUND, SENSOR_MOTION, SENSOR_SMOKE, SENSOR_LIGHT};
+  fleet.history.begin(HISTORY_RAM_BUDGET);
+  for (uint16_t id = 0; id < fleetSize; id++)
+  {
+    uint8_t mac[6];
+    makeMac(id, mac);
+    uint8_t sensorType = types[id % 4];
+    bool changed;
+    fleet.peers.admit(mac, sensorType, SENSOR_CAP_REPORTS | SENSOR_CAP_ACCEPTS_COMMANDS, id % VIEW_ZONE_COUNT, &changed);
+    fleet.frames.push_back(makeFrame(sensorType, id));
+  }
+}
+
+// What the radio task does with a reading frame, minus logging and sending
+static size_t handleFrame(bench_fleet &fleet, const uint8_t *mac, const uint8_t *data, int len, uint32_t nowMs)
+{
+  int id = fleet.peers.find(mac);
+  if (id < 0)
+  {
+    fleet.metrics.onUnknownFrame();
+    return 0;
+  }
+  uint8_t sensorType = fleet.peers.at(id).sensorType;
+
+  frame_header header;
+  bool hasSeq = frameParseHeader(data, len, &header);
+  fleet.metrics.onFrame(id, sensorType, len, hasSeq, hasSeq ? header.seq : 0, -60, nowMs);
+  fleet.liveness.onFrame(id, nowMs);
+
+  size_t commands = 0;
+  sensor_reading reading;
+  if (dispatchDecode(sensorType, data, len, &reading))
+  {
+    fleet.store.update(id, sensorType, fleet.peers.at(id).zone, reading.value, reading.status, reading.flags, nowMs);
+    fleet.health.observe(id, sensorType, nowMs, reading.value);
+    rule_command command;
+    commands = dispatchRule(&reading, &command);
+  }
+  fleet.metrics.onDispatched(id, 150);
+  return commands;
+}
+
+// sendCommand() with each send completing straight away
+static size_t sendCommand(bench_fleet &fleet, const char *command, uint32_t typeMask)
+{
+  uint16_t targets[PEER_TABLE_MAX];
+  size_t targetCount = dispatchTargets(fleet.peers, typeMask, targets, PEER_TABLE_MAX);
+  for (size_t i = 0; i < targetCount; i++)
+  {
+    const peer_entry &peer = fleet.peers.at(targets[i]);
+    if (!fleet.cache.acquire(targets[i], peer.mac))
+    {
+      continue;
+    }
+    bytesSent += strlen(command) + 1;
+    fleet.metrics.onSendQueued();
+    fleet.cache.release(peer.mac);
+    fleet.metrics.onSendCompleted(targets[i], true);
+  }
+  return targetCount;
+}
+
+// Drain a chunked writer the way the web server does
+template <typename Writer>
+static size_t drainChunks(Writer write)
+{
+  static char chunk[BENCH_CHUNK];
+  size_t total = 0, n;
+  while ((n = write(chunk, sizeof(chunk))) > 0)
+  {
+    total += n;
+  }
+  return total;
+}
+
+static void printHuman(const bench_result &r)
+{
+  printf("%-20s %12.1f ns/op %12.1f min %8.2f allocs/op %10.1f B/op %12llu iters\n", r.name, r.nsPerOp, r.nsMin,
+         r.allocsPerOp, r.allocBytesPerOp, (unsigned long long)r.iterations);
+}
+
+static void printJson(const bench_result &r)
+{
+  printf("{\"name\": \"%s\", \"ns_per_op\": %.2f, \"ns_min\": %.2f, \"allocs_per_op\": %.3f, "
+         "\"alloc_bytes_per_op\": %.1f, \"iterations\": %llu}\n",
+         r.name, r.nsPerOp, r.nsMin, r.allocsPerOp, r.allocBytesPerOp, (unsigned long long)r.iterations);
+}
+
+static bool parseJson(const char *line, bench_result *r)
+{
+  memset(r, 0, sizeof(*r));
+  unsigned long long iterations;
+  int n = sscanf(line,
+                 "{\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, \"ns_min\": %lf, \"allocs_per_op\": %lf, "
+                 "\"alloc_bytes_per_op\": %lf, \"iterations\": %llu}",
+                 r->name, &r->nsPerOp, &r->nsMin, &r->allocsPerOp, &r->allocBytesPerOp, &iterations);
+  r->iterations = iterations;
+  return n == 6;
+}
+
+static bool loadResults(const char *path, std::vector<bench_result> &results)
+{
+  FILE *f = fopen(path, "r");
+  if (f == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), f) != nullptr)
+  {
+    bench_result r;
+    if (parseJson(line, &r))
+    {
+      results.push_back(r);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static int compare(const char *basePath, const char *newPath, double thresholdPct)
+{
+  std::vector<bench_result> base, current;
+  if (!loadResults(basePath, base) || !loadResults(newPath, current))
+  {
+    return 2;
+  }
+
+  int regressions = 0;
+  printf("%-20s %12s %12s %8s %10s\n", "benchmark", "base ns/op", "new ns/op", "change", "allocs/op");
+  for (const bench_result &now : current)
+  {
+    const bench_result *before = nullptr;
+    for (const bench_result &b : base)
+    {
+      if (strcmp(b.name, now.name) == 0)
+      {
+        before = &b;
+      }
+    }
+    if (before == nullptr)
+    {
+      printf("%-20s %12s %12.1f %8s %10.2f new\n", now.name, "-", now.nsPerOp, "-", now.allocsPerOp);
+      continue;
+    }
+
+    double change = before->nsPerOp > 0 ? (now.nsPerOp - before->nsPerOp) * 100.0 / before->nsPerOp : 0;
+    bool slower = change > thresholdPct;
+    bool allocates = now.allocsPerOp > before->allocsPerOp + 0.001;
+    printf("%-20s %12.1f %12.1f %+7.1f%% %10.2f%s%s\n", now.name, before->nsPerOp, now.nsPerOp, change,
+           now.allocsPerOp, slower ? " SLOWER" : "", allocates ? " MORE ALLOCS" : "");
+    regressions += slower || allocates;
+  }
+  return regressions > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 4 && strcmp(argv[1], "compare") == 0)
+  {
+    return compare(argv[2], argv[3], argc >= 5 ? atof(argv[4]) : 10.0);
+  }
+
+  bool json = false;
+  uint32_t timeMs = 500;
+  const char *filter = "";
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--json") == 0)
+    {
+      json = true;
+    }
+    else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+    {
+      timeMs = (uint32_t)atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 32 &&
+             atoi(argv[i + 1]) <= PEER_TABLE_MAX)
+    {
+      fleetSize = (uint16_t)atoi(argv[++i]);
+    }
+    else if (argv[i][0] == '-')
+    {
+      fprintf(stderr, "usage: bench [--json] [--time ms] [--fleet 32..%d] [filter]\n"
+                      "       bench compare <base.json> <new.json> [pct]\n",
+              PEER_TABLE_MAX);
+      return 2;
+    }
+    else
+    {
+      filter = argv[i];
+    }
+  }
+
+  static bench_fleet fleet;
+  setupFleet(fleet);
+  uint32_t nowMs = 1000;
+
+  // Every sensor has reported once so the views have content
+  for (uint16_t id = 0; id < fleetSize; id++)
+  {
+    const std::vector<uint8_t> &frame = fleet.frames[id];
+    handleFrame(fleet, fleet.peers.at(id).mac, frame.data(), (int)frame.size(), nowMs);
+  }
+  // An hour of readings at 2 Hz from 16 sensors fills the history pool
+  for (uint32_t t = 0; t < 7200; t++)
+  {
+    for (uint16_t id = 0; id < 16; id++)
+    {
+      fleet.history.append(id, nowMs + t * 500 + id % 7, 300 + id + (int32_t)((t * 7 + id) % 23));
+    }
+  }
+  // and gives as many sensors as there are slots their windows, and sketches while any are free
+  for (uint32_t t = 0; t < 7200; t++)
+  {
+    for (uint16_t id = 0; id < STATS_MAX_SERIES; id++)
+    {
+      fleet.stats.add(id, fleet.peers.at(id).sensorType, nowMs + t * 500 + id % 7, 300 + id + (int32_t)((t * 7 + id) % 23));
+    }
+  }
+  uint32_t statsMs = nowMs + 7200 * 500;
+  for (const char *path : {"/", "/status/sensors", "/status/zones", "/peers", "/metrics"})
+  {
+    fleet.metrics.countRequest(fleet.metrics.registerRoute(path));
+  }
+
+  static const view_var pageVars[] = {{"STATUS", "Quiet"}, {"MOTION", "No Motion"}, {"SMOKE", "Clear"}, {"LIGHT", "45%"}};
+  static char page[sizeof(PAGEINDEX) + 4 * SENSOR_STATUS_LEN];
+  uint16_t next = 0;
+
+  auto report = [&](const bench_result &result)
+  {
+    if (json)
+    {
+      printJson(result);
+    }
+    else
+    {
+      printHuman(result);
+    }
+    fflush(stdout);
+  };
+  auto selected = [&](const char *name)
+  { return strstr(name, filter) != nullptr; };
+
+  if (selected("frame_dispatch"))
+  {
+    // Frames from the whole fleet in turn
+    report(measure("frame_dispatch", timeMs, [&]
+                   {
+      uint16_t id = next++ % fleetSize;
+      const std::vector<uint8_t> &frame = fleet.frames[id];
+      sink = sink + handleFrame(fleet, fleet.peers.at(id).mac, frame.data(), (int)frame.size(), nowMs); }));
+  }
+  if (selected("peer_find"))
+  {
+    // The sender lookup every frame starts with, over the whole fleet in turn
+    report(measure("peer_find", timeMs, [&]
+                   {
+      uint16_t id = next++ % fleetSize;
+      sink = sink + (size_t)fleet.peers.find(fleet.peers.at(id).mac); }));
+  }
+  if (selected("store_snapshot"))
+  {
+    report(measure("store_snapshot", timeMs, [&]
+                   {
+      sensor_snapshot snapshot;
+      sink = sink + fleet.store.snapshot(next++ % fleetSize, &snapshot); }));
+  }
+  if (selected("store_latest"))
+  {
+    // Scan of the type and last-seen columns, as the per-type routes do
+    report(measure("store_latest", timeMs, [&]
+                   { sink = sink + (size_t)fleet.store.latestOfType(SENSOR_LIGHT); }));
+  }
+  if (selected("zone_aggregate"))
+  {
+    report(measure("zone_aggregate", timeMs, [&]
+                   {
+      zone_summary zones[VIEW_ZONE_COUNT];
+      fleet.store.aggregateZones(SENSOR_SMOKE, zones, VIEW_ZONE_COUNT);
+      sink = sink + zones[0].count; }));
+  }
+  if (selected("cache_hit"))
+  {
+    // A send to a peer that holds a driver slot, completed straight away
+    const peer_entry &peer = fleet.peers.at(0);
+    fleet.cache.acquire(0, peer.mac);
+    fleet.cache.release(peer.mac);
+    report(measure("cache_hit", timeMs, [&]
+                   {
+      sink = sink + fleet.cache.acquire(0, peer.mac);
+      fleet.cache.release(peer.mac); }));
+  }
+  if (selected("cache_evict"))
+  {
+    // Sends to one more peer than there are slots, in turn: every one misses and evicts
+    uint16_t peer = 0;
+    report(measure("cache_evict", timeMs, [&]
+                   {
+      const uint8_t *mac = fleet.peers.at(peer).mac;
+      sink = sink + fleet.cache.acquire(peer, mac);
+      fleet.cache.release(mac);
+      peer = (peer + 1) % (PEER_CACHE_SLOTS + 1); }));
+  }
+  if (selected("unknown_sender"))
+  {
+    static const uint8_t stranger[6] = {0x02, 0x00, 0x00, 0x00, 0xBE, 0xEF};
+    const std::vector<uint8_t> &frame = fleet.frames[0];
+    report(measure("unknown_sender", timeMs, [&]
+                   { sink = sink + handleFrame(fleet, stranger, frame.data(), (int)frame.size(), nowMs); }));
+  }
+  if (selected("command_fanout"))
+  {
+    // The smoke rule's command: half the fleet, more peers than driver slots
+    report(measure("command_fanout", timeMs, [&]
+                   { sink = sink + sendCommand(fleet, "turn_off", SENSOR_TYPE_BIT(SENSOR_SOUND) | SENSOR_TYPE_BIT(SENSOR_MOTION)); }));
+  }
+  if (selected("view_sensors"))
+  {
+    report(measure("view_sensors", timeMs, [&]
+                   {
+      view_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return viewSensors(buf, len, &cursor, fleet.store, fleet.health, fleet.liveness, nowMs, nullptr); }); }));
+  }
+  if (selected("view_zones"))
+  {
+    report(measure("view_zones", timeMs, [&]
+                   {
+      view_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return viewZones(buf, len, &cursor, fleet.store); }); }));
+  }
+  if (selected("view_peers"))
+  {
+    report(measure("view_peers", timeMs, [&]
+                   {
+      view_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return viewPeers(buf, len, &cursor, fleet.peers, fleet.cache); }); }));
+  }
+  if (selected("view_stats"))
+  {
+    report(measure("view_stats", timeMs, [&]
+                   {
+      view_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return viewStats(buf, len, &cursor, fleet.stats, fleet.store, statsMs); }); }));
+  }
+  if (selected("stats_add"))
+  {
+    // One reading into a full series with a sketch, 500 ms after the last
+    uint8_t type = fleet.peers.at(0).sensorType;
+    report(measure("stats_add", timeMs, [&]
+                   {
+      statsMs += 500;
+      fleet.stats.add(0, type, statsMs, 300 + (int32_t)(statsMs % 23));
+      sink = sink + 1; }));
+  }
+  if (selected("view_light"))
+  {
+    report(measure("view_light", timeMs, [&]
+                   {
+      sensor_snapshot light;
+      fleet.store.snapshot(fleet.store.latestOfType(SENSOR_LIGHT), &light);
+      char body[64 + SENSOR_STATUS_LEN];
+      sink = sink + viewLight(body, sizeof(body), &light); }));
+  }
+  if (selected("view_page"))
+  {
+    report(measure("view_page", timeMs, [&]
+                   { sink = sink + viewPage(page, sizeof(page), PAGEINDEX, pageVars, 4); }));
+  }
+  if (selected("metrics_format"))
+  {
+    report(measure("metrics_format", timeMs, [&]
+                   {
+      metrics_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return fleet.metrics.format(buf, len, &cursor, nowMs); }); }));
+  }
+  for (uint8_t format : {EXPORT_NDJSON, EXPORT_CSV})
+  {
+    const char *name = format == EXPORT_CSV ? "export_csv" : "export_ndjson";
+    if (!selected(name))
+    {
+      continue;
+    }
+    // Everything the pool holds
+    export_query query;
+    exportQueryInit(&query);
+    query.format = format;
+    report(measure(name, timeMs, [&]
+                   {
+      HistoryExport body(fleet.history, fleet.peers, query);
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return body.write(buf, len); }); }));
+  }
+  if (selected("history_bin"))
+  {
+    // One sensor's whole history for the chart, against the same as NDJSON below
+    report(measure("history_bin", timeMs, [&]
+                   {
+      HistoryColumns body(fleet.history, fleet.peers, 0, 0, UINT32_MAX, 0, nowMs);
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return body.write(buf, len); }); }));
+  }
+  if (selected("history_json"))
+  {
+    export_query query;
+    exportQueryInit(&query);
+    query.sensor = 0;
+    report(measure("history_json", timeMs, [&]
+                   {
+      HistoryExport body(fleet.history, fleet.peers, query);
+      sink = sink + drainChunks([&](char *buf, size_t len)
+                                { return body.write(buf, len); }); }));
+  }
+  return 0;
+}
@@ -0,0 +1,209 @@
+// Decoder for the binary log frames the firmwares write to Serial (see
+// Shared/BinLog/BinLog.h). Reads a raw capture of the serial port, or the
+// port itself, and prints it as text: log text passes through unchanged and
+// every frame becomes a line with the device time and level.
+//
+//   binlog_decode [--level error|warn|info|debug] [--no-time] [--stats] [file]
+//
+// Without a file it reads stdin. To follow a board live:
+//   stty -F /dev/ttyUSB0 115200 raw && binlog_decode /dev/ttyUSB0
+// The capture must be raw bytes: monitors that filter or translate control
+// characters corrupt the frames (pio device monitor --raw is fine).
+//
+// --level hides frames above the given level, --no-time drops the time
+// column and --stats ends with a count of frames per format and the bytes
+// the frames took on the wire against the text they decode to.
+//
+// The format table is compiled in from Shared/BinLog/BinLogFormats.h, so
+// rebuild the decoder whenever formats are added.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/BinLog -I../../Shared/TextBuffer binlog_decode.cpp
+//     ../../Shared/BinLog/BinLog.cpp -o binlog_decode
+
+#include <BinLog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct decode_options
+{
+  uint8_t level;
+  bool time;
+  bool stats;
+  const char *path;
+} decode_options;
+
+typedef struct decode_stats
+{
+  unsigned long frames[256];
+  unsigned long frameBytes;
+  unsigned long textBytes; // Of the decoded frames, with a newline each
+  unsigned long bad;
+} decode_stats;
+
+static void usage()
+{
+  fprintf(stderr, "usage: binlog_decode [--level error|warn|info|debug] [--no-time] [--stats] [file]\n");
+  exit(2);
+}
+
+static uint8_t parseLevel(const char *name)
+{
+  static const char *names[] = {"error", "warn", "info", "debug"};
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if (strcmp(name, names[i]) == 0)
+    {
+      return BINLOG_ERROR + i;
+    }
+  }
+  usage();
+  return 0;
+}
+
+// Frame size on the wire, for --stats
+static size_t frameSize(const binlog_record &record)
+{
+  uint8_t buf[BINLOG_FRAME_MAX];
+  return binlogEncodeFrame(buf, sizeof(buf), record);
+}
+
+static void printStats(const decode_stats &stats)
+{
+  printf("\n%-22s %8s\n", "format", "frames");
+  unsigned long total = 0;
+  for (int id = 0; id < 256; id++)
+  {
+    if (stats.frames[id] == 0)
+    {
+      continue;
+    }
+    total += stats.frames[id];
+    const char *name = binlogFormatName((uint8_t)id);
+    char unknown[24];
+    if (name == NULL)
+    {
+      snprintf(unknown, sizeof(unknown), "unknown %d", id);
+      name = unknown;
+    }
+    printf("%-22s %8lu\n", name, stats.frames[id]);
+  }
+  printf("%-22s %8lu\n", "total", total);
+  printf("%lu bytes of frames for %lu bytes of text", stats.frameBytes, stats.textBytes);
+  if (stats.frameBytes > 0)
+  {
+    printf(" (%.1fx)", (double)stats.textBytes / stats.frameBytes);
+  }
+  printf("\n%lu corrupt frames\n", stats.bad);
+}
+
+int main(int argc, char **argv)
+{
+  decode_options options;
+  options.level = BINLOG_DEBUG;
+  options.time = true;
+  options.stats = false;
+  options.path = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--level") == 0)
+    {
+      if (i + 1 >= argc)
+      {
+        usage();
+      }
+      options.level = parseLevel(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-time") == 0)
+    {
+      options.time = false;
+    }
+    else if (strcmp(argv[i], "--stats") == 0)
+    {
+      options.stats = true;
+    }
+    else if (argv[i][0] == '-' || options.path != NULL)
+    {
+      usage();
+    }
+    else
+    {
+      options.path = argv[i];
+    }
+  }
+
+  FILE *in = stdin;
+  if (options.path != NULL)
+  {
+    in = fopen(options.path, "rb");
+    if (in == NULL)
+    {
+      perror(options.path);
+      return 1;
+    }
+  }
+  // Line buffered so a live port shows up as it arrives
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  static decode_stats stats;
+  BinLogDecoder decoder;
+  bool lineStart = true;
+  int c;
+  while ((c = fgetc(in)) != EOF)
+  {
+    uint8_t fed = decoder.feed((uint8_t)c);
+    if (fed == BINLOG_FEED_TEXT)
+    {
+      putchar(c);
+      lineStart = c == '\n';
+      continue;
+    }
+    if (fed == BINLOG_FEED_BAD)
+    {
+      stats.bad++;
+      continue;
+    }
+    if (fed != BINLOG_FEED_FRAME)
+    {
+      continue;
+    }
+
+    const binlog_record &record = decoder.record();
+    char text[256];
+    size_t n = binlogFormatRecord(text, sizeof(text), record);
+    stats.frames[record.id]++;
+    stats.frameBytes += frameSize(record);
+    stats.textBytes += n + 1;
+
+    uint8_t level = binlogFormatLevel(record.id);
+    if (level > options.level)
+    {
+      continue;
+    }
+    // Frames are written between the text of other tasks, not inside a line
+    // on purpose; keep them on lines of their own
+    if (!lineStart)
+    {
+      putchar('\n');
+    }
+    if (options.time)
+    {
+      printf("[%6lu.%03lu] ", (unsigned long)(record.timeMs / 1000), (unsigned long)(record.timeMs % 1000));
+    }
+    printf("%c %s\n", binlogLevelLetter(level), text);
+    lineStart = true;
+  }
+
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+  if (options.stats)
+  {
+    printStats(stats);
+  }
+  return 0;
+}
@@ -0,0 +1,223 @@
+// Host test of the boot phase profiler (see Shared/BootProfiler): how
+// much a bootPhaseBegin()/bootPhaseEnd() pair costs and how close the
+// recorded durations come to the time the phases really took.
+//
+//   boot_overhead [--phase-us 2000] [--calls 1000000]
+//
+// It runs a fake setup() of BOOT_PROFILER_MAX_PHASES phases, each spinning
+// for --phase-us, and compares every recorded duration with the same
+// phase timed around the profiler calls. It then times --calls pairs on
+// the full table, which is the cost of a pair in any firmware (the clock
+// read is all that is left once phases are dropped), against a bare clock
+// read, and the text and JSON formatting. It checks that extra phases are
+// dropped, that the total adds up and that a short buffer truncates with a
+// terminating NUL and nothing written past it.
+//
+// On the ESP32 the profiler reads micros() instead of std::chrono, so the
+// pair cost there is two micros() calls and a few stores.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/BootProfiler -I../../Shared/TextBuffer boot_overhead.cpp
+//     ../../Shared/BootProfiler/BootProfiler.cpp -o boot_overhead
+
+#include <BootProfiler.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keeps the clock loop from being optimised away
+static volatile uint64_t sink;
+
+static uint64_t hostUs()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void spin(uint32_t us)
+{
+  uint64_t end = hostUs() + us;
+  while (hostUs() < end)
+  {
+  }
+}
+
+// Best of a few runs of f, in ns per call
+template <typename F> static double timeRuns(size_t calls, F f)
+{
+  double best = 0;
+  for (int run = 0; run < 5; run++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (run == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best / calls;
+}
+
+static const char *const phaseNames[] = {
+    "serial", "nvs", "wifi", "esp_now", "peers", "clock", "history", "radio_task",
+    "http_server", "ota", "mdns", "stats", "liveness", "backlog", "capture", "metrics",
+};
+
+// Phases with the profiler around each, timed from outside as well
+static bool accuracy(uint32_t phaseUs)
+{
+  bool ok = true;
+  uint64_t outsideUs[BOOT_PROFILER_MAX_PHASES];
+  for (size_t i = 0; i < BOOT_PROFILER_MAX_PHASES; i++)
+  {
+    uint64_t start = hostUs();
+    bootPhaseBegin(phaseNames[i % (sizeof(phaseNames) / sizeof(phaseNames[0]))]);
+    spin(phaseUs);
+    bootPhaseEnd();
+    outsideUs[i] = hostUs() - start;
+  }
+
+  // Past the table: dropped, but must not disturb the last phase
+  const boot_phase *phases = bootProfilerPhases();
+  uint32_t lastUs = phases[BOOT_PROFILER_MAX_PHASES - 1].durationUs;
+  bootPhaseBegin("extra");
+  bootPhaseEnd();
+  if (bootProfilerCount() != BOOT_PROFILER_MAX_PHASES || phases[BOOT_PROFILER_MAX_PHASES - 1].durationUs != lastUs)
+  {
+    fprintf(stderr, "a phase past the table changed it\n");
+    ok = false;
+  }
+
+  printf("phase           recorded us  outside us  error us\n");
+  int64_t worst = 0;
+  for (size_t i = 0; i < BOOT_PROFILER_MAX_PHASES; i++)
+  {
+    int64_t error = (int64_t)outsideUs[i] - phases[i].durationUs;
+    worst = llabs(error) > worst ? llabs(error) : worst;
+    printf("%-14s %12lu %11llu %9lld\n", phases[i].name, (unsigned long)phases[i].durationUs,
+           (unsigned long long)outsideUs[i], (long long)error);
+    if (error < -1) // Both clocks round to whole microseconds
+    {
+      fprintf(stderr, "%s: recorded longer than it took\n", phases[i].name);
+      ok = false;
+    }
+  }
+  const boot_phase &last = phases[BOOT_PROFILER_MAX_PHASES - 1];
+  if (bootProfilerTotalUs() != last.startUs + last.durationUs)
+  {
+    fprintf(stderr, "total %lu is not the end of the last phase\n", (unsigned long)bootProfilerTotalUs());
+    ok = false;
+  }
+  printf("worst error %lld us over %d phases of %lu us\n", (long long)worst, BOOT_PROFILER_MAX_PHASES,
+         (unsigned long)phaseUs);
+  return ok;
+}
+
+static bool formatting()
+{
+  bool ok = true;
+  char table[64 * (BOOT_PROFILER_MAX_PHASES + 2)];
+  char json[96 * (BOOT_PROFILER_MAX_PHASES + 1)];
+  size_t tableLen = 0, jsonLen = 0;
+  double tableNs = timeRuns(1000, [&]
+                            {
+    for (int i = 0; i < 1000; i++)
+    {
+      tableLen = bootProfilerFormatTable(table, sizeof(table));
+    } });
+  double jsonNs = timeRuns(1000, [&]
+                           {
+    for (int i = 0; i < 1000; i++)
+    {
+      jsonLen = bootProfilerFormatJson(json, sizeof(json));
+    } });
+  printf("table %zu bytes in %.0f ns, JSON %zu bytes in %.0f ns\n", tableLen, tableNs, jsonLen, jsonNs);
+  if (tableLen + 1 >= sizeof(table) || jsonLen + 1 >= sizeof(json) || json[jsonLen - 1] != '}')
+  {
+    fprintf(stderr, "a full table does not fit the firmware's buffers\n");
+    ok = false;
+  }
+
+  // A short buffer keeps its NUL and the bytes after it
+  char shortBuf[48 + 8];
+  memset(shortBuf, 0x5a, sizeof(shortBuf));
+  size_t n = bootProfilerFormatJson(shortBuf, 48);
+  for (size_t i = 48; i < sizeof(shortBuf); i++)
+  {
+    ok = ok && shortBuf[i] == 0x5a;
+  }
+  if (n != 47 || shortBuf[47] != '\0')
+  {
+    fprintf(stderr, "truncated JSON is %zu bytes, expected 47 and a NUL\n", n);
+    ok = false;
+  }
+  return ok;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: boot_overhead [--phase-us 2000] [--calls 1000000]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t phaseUs = 2000;
+  size_t calls = 1000000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--phase-us") == 0)
+    {
+      phaseUs = (uint32_t)atol(value);
+    }
+    else if (strcmp(argv[i - 1], "--calls") == 0)
+    {
+      calls = (size_t)atol(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (phaseUs == 0 || calls == 0)
+  {
+    usage();
+  }
+
+  bool ok = accuracy(phaseUs);
+
+  double pairNs = timeRuns(calls, [&]
+                           {
+    for (size_t i = 0; i < calls; i++)
+    {
+      bootPhaseBegin("dropped");
+      bootPhaseEnd();
+    } });
+  double clockNs = timeRuns(calls, [&]
+                            {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < calls; i++)
+    {
+      sum += hostUs();
+    }
+    sink = sum; });
+  printf("begin/end pair %.1f ns, clock read %.1f ns\n", pairNs, clockNs);
+
+  ok = formatting() && ok;
+  if (!ok)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
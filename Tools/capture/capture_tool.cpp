@@ -0,0 +1,451 @@
+// Host tool for Server frame captures (see Server/lib/Capture/Capture.h).
+//
+//   capture_tool extract  <serial.log> <out.cap>   pull a capture out of a serial log
+//   capture_tool topcap   <in.cap> <out.pcap>      convert to pcap (LINKTYPE_USER0)
+//   capture_tool frompcap <in.pcap> <out.cap>      convert back
+//   capture_tool replay   <in.cap> [speed]         run the Server pipeline over it
+//
+// replay prints the command stream the Server would have sent and reports
+// throughput. Without a speed it runs as fast as possible; speed 1 replays
+// in real time, 10 ten times faster.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Shared/SensorFrame
+//     -I../../Shared/ClockSync -I../../Server/lib/Capture -I../../Server/lib/Dispatch
+//     -I../../Server/lib/SensorStore capture_tool.cpp ../../Shared/Pairing/Pairing.cpp
+//     ../../Shared/Pairing/PeerTable.cpp ../../Shared/SensorFrame/SensorFrame.cpp
+//     ../../Shared/ClockSync/ClockSync.cpp ../../Server/lib/Capture/Capture.cpp
+//     ../../Server/lib/Dispatch/Dispatch.cpp ../../Server/lib/SensorStore/SensorStore.cpp
+//     -o capture_tool
+
+#include <Capture.h>
+#include <ClockSync.h>
+#include <Dispatch.h>
+#include <Pairing.h>
+#include <PeerTable.h>
+#include <SensorFrame.h>
+#include <SensorStore.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_LINKTYPE_USER0 147
+
+typedef struct pcap_file_header
+{
+  uint32_t magic;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  int32_t thisZone;
+  uint32_t sigFigs;
+  uint32_t snapLen;
+  uint32_t linkType;
+} pcap_file_header;
+
+typedef struct pcap_record_header
+{
+  uint32_t tsSec;
+  uint32_t tsUsec;
+  uint32_t inclLen;
+  uint32_t origLen;
+} pcap_record_header;
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+static bool loadCapture(const char *path, std::vector<uint8_t> &data)
+{
+  if (!readFile(path, data))
+  {
+    return false;
+  }
+  if (!CaptureReader(data.data(), data.size()).valid())
+  {
+    fprintf(stderr, "%s: not a version %d capture\n", path, CAPTURE_VERSION);
+    return false;
+  }
+  return true;
+}
+
+static void append(std::vector<uint8_t> &out, const uint8_t *data, size_t len)
+{
+  out.insert(out.end(), data, data + len);
+}
+
+// Serial log -> capture. A header line starts a new capture; the last one wins.
+static int extract(const char *logPath, const char *capPath)
+{
+  FILE *f = fopen(logPath, "r");
+  if (f == nullptr)
+  {
+    perror(logPath);
+    return 1;
+  }
+
+  std::vector<uint8_t> capture;
+  unsigned captures = 0, bad = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), f) != nullptr)
+  {
+    // Log text from another task may precede the prefix on the same line
+    const char *start = strstr(line, CAPTURE_SERIAL_PREFIX);
+    if (start == nullptr)
+    {
+      continue;
+    }
+    start += strlen(CAPTURE_SERIAL_PREFIX);
+    size_t len = strcspn(start, "\r\n");
+
+    uint8_t piece[CAPTURE_RECORD_MAX];
+    size_t n = captureBase64Decode(start, len, piece, sizeof(piece));
+    if (n == 0)
+    {
+      bad++;
+      continue;
+    }
+    if (n == CAPTURE_HEADER_SIZE && CaptureReader(piece, n).valid())
+    {
+      capture.clear();
+      captures++;
+    }
+    else if (capture.empty())
+    {
+      continue; // Records from before the first header we saw
+    }
+    append(capture, piece, n);
+  }
+  fclose(f);
+
+  if (capture.empty())
+  {
+    fprintf(stderr, "%s: no capture found\n", logPath);
+    return 1;
+  }
+  if (captures > 1)
+  {
+    fprintf(stderr, "%u captures in the log, keeping the last\n", captures);
+  }
+  if (bad > 0)
+  {
+    fprintf(stderr, "%u corrupt lines skipped\n", bad);
+  }
+  fprintf(stderr, "%zu bytes\n", capture.size());
+  return writeFile(capPath, capture) ? 0 : 1;
+}
+
+// Capture -> pcap. Each packet is the capture record without its time delta:
+// kind, mac and then rssi, length and payload (frames) or type, capabilities
+// and zone (peers).
+static int toPcap(const char *capPath, const char *pcapPath)
+{
+  std::vector<uint8_t> data;
+  if (!loadCapture(capPath, data))
+  {
+    return 1;
+  }
+
+  std::vector<uint8_t> out;
+  pcap_file_header header = {PCAP_MAGIC, 2, 4, 0, 0, 65535, PCAP_LINKTYPE_USER0};
+  append(out, (const uint8_t *)&header, sizeof(header));
+
+  CaptureReader reader(data.data(), data.size());
+  capture_record record;
+  size_t packets = 0;
+  while (reader.next(&record))
+  {
+    uint8_t packet[CAPTURE_RECORD_MAX];
+    size_t len = 0;
+    packet[len++] = record.kind;
+    memcpy(packet + len, record.mac, 6);
+    len += 6;
+    if (record.kind == CAPTURE_RECORD_PEER)
+    {
+      packet[len++] = record.sensorType;
+      packet[len++] = record.capabilities;
+      packet[len++] = record.zone;
+    }
+    else
+    {
+      packet[len++] = (uint8_t)record.rssi;
+      packet[len++] = record.len;
+      memcpy(packet + len, record.data, record.len);
+      len += record.len;
+    }
+
+    pcap_record_header rh = {(uint32_t)(record.timeUs / 1000000), (uint32_t)(record.timeUs % 1000000),
+                             (uint32_t)len, (uint32_t)len};
+    append(out, (const uint8_t *)&rh, sizeof(rh));
+    append(out, packet, len);
+    packets++;
+  }
+  if (reader.truncated())
+  {
+    fprintf(stderr, "capture is truncated, converted %zu records\n", packets);
+  }
+  return writeFile(pcapPath, out) ? 0 : 1;
+}
+
+// pcap -> capture, the inverse of toPcap()
+static int fromPcap(const char *pcapPath, const char *capPath)
+{
+  std::vector<uint8_t> data;
+  if (!readFile(pcapPath, data))
+  {
+    return 1;
+  }
+  pcap_file_header header;
+  if (data.size() < sizeof(header))
+  {
+    fprintf(stderr, "%s: too short\n", pcapPath);
+    return 1;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != PCAP_MAGIC || header.linkType != PCAP_LINKTYPE_USER0)
+  {
+    fprintf(stderr, "%s: not a capture_tool pcap\n", pcapPath);
+    return 1;
+  }
+
+  std::vector<uint8_t> out;
+  bool started = false;
+  uint64_t lastUs = 0;
+  size_t pos = sizeof(header);
+  while (pos + sizeof(pcap_record_header) <= data.size())
+  {
+    pcap_record_header rh;
+    memcpy(&rh, data.data() + pos, sizeof(rh));
+    pos += sizeof(rh);
+    if (rh.inclLen < 7 || pos + rh.inclLen > data.size())
+    {
+      fprintf(stderr, "%s: truncated packet\n", pcapPath);
+      break;
+    }
+    const uint8_t *packet = data.data() + pos;
+    pos += rh.inclLen;
+
+    uint64_t timeUs = (uint64_t)rh.tsSec * 1000000 + rh.tsUsec;
+    uint8_t piece[CAPTURE_RECORD_MAX];
+    if (!started)
+    {
+      // The first record carries the capture start time
+      append(out, piece, captureEncodeHeader(piece, sizeof(piece), timeUs));
+      lastUs = timeUs;
+      started = true;
+    }
+
+    if (packet[0] == CAPTURE_RECORD_PEER && rh.inclLen == 10)
+    {
+      peer_entry peer;
+      memcpy(peer.mac, packet + 1, 6);
+      peer.sensorType = packet[7];
+      peer.capabilities = packet[8];
+      peer.zone = packet[9];
+      append(out, piece, captureEncodePeer(piece, sizeof(piece), peer));
+    }
+    else if (packet[0] == CAPTURE_RECORD_FRAME && rh.inclLen >= 9 && rh.inclLen == 9u + packet[8])
+    {
+      append(out, piece, captureEncodeFrame(piece, sizeof(piece), timeUs - lastUs, packet + 1, (int8_t)packet[7],
+                                            packet + 9, packet[8]));
+      lastUs = timeUs;
+    }
+    else
+    {
+      fprintf(stderr, "%s: skipping malformed packet\n", pcapPath);
+    }
+  }
+  if (!started)
+  {
+    fprintf(stderr, "%s: no packets\n", pcapPath);
+    return 1;
+  }
+  return writeFile(capPath, out) ? 0 : 1;
+}
+
+static void formatMAC(const uint8_t *mac, char *out)
+{
+  snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+// Run the capture through the Server's pipeline: pairing, decoding, the
+// sensor store and the command rules
+static int replay(const char *capPath, double speed)
+{
+  std::vector<uint8_t> data;
+  if (!loadCapture(capPath, data))
+  {
+    return 1;
+  }
+
+  static PeerTable peerTable;
+  static SensorStore sensorStore;
+  std::vector<peer_entry> peers; // Peer records not yet loaded into peerTable
+  size_t frames = 0, readings = 0, unknown = 0, undecoded = 0, commands = 0, sends = 0;
+
+  CaptureReader reader(data.data(), data.size());
+  capture_record record;
+  auto wallStart = std::chrono::steady_clock::now();
+  while (reader.next(&record))
+  {
+    double t = (record.timeUs - reader.startUs()) / 1e6;
+    if (speed > 0)
+    {
+      std::this_thread::sleep_until(wallStart + std::chrono::duration<double>(t / speed));
+    }
+
+    bool changed;
+    if (record.kind == CAPTURE_RECORD_PEER)
+    {
+      // Loaded as a whole, so the entries of removed sensors keep their peer IDs
+      peer_entry peer;
+      memcpy(peer.mac, record.mac, 6);
+      peer.sensorType = record.sensorType;
+      peer.capabilities = record.capabilities;
+      peer.zone = record.zone;
+      peers.push_back(peer);
+      continue;
+    }
+    if (!peers.empty())
+    {
+      std::vector<uint8_t> blob(PEER_TABLE_BLOB_SIZE(peers.size()));
+      peer_table_header header = {PEER_TABLE_VERSION, sizeof(peer_entry), (uint16_t)peers.size()};
+      memcpy(blob.data(), &header, sizeof(header));
+      memcpy(blob.data() + sizeof(header), peers.data(), peers.size() * sizeof(peer_entry));
+      peerTable.deserialize(blob.data(), blob.size());
+      peers.clear();
+    }
+    frames++;
+
+    pairing_frame pairingFrame;
+    clock_sync_frame syncFrame;
+    if (pairingParseFrame(record.data, record.len, &pairingFrame))
+    {
+      if (pairingFrame.kind == PAIRING_JOIN_REQUEST)
+      {
+        peerTable.admit(record.mac, pairingFrame.sensorType, pairingFrame.capabilities, pairingFrame.zone, &changed);
+      }
+      continue;
+    }
+    if (clockSyncParseFrame(record.data, record.len, &syncFrame))
+    {
+      continue;
+    }
+
+    int id = peerTable.find(record.mac);
+    if (id < 0)
+    {
+      unknown++;
+      continue;
+    }
+    const peer_entry &peer = peerTable.at(id);
+    sensor_reading reading;
+    if (!dispatchDecode(peer.sensorType, record.data, record.len, &reading))
+    {
+      undecoded++;
+      continue;
+    }
+    readings++;
+    sensorStore.update(id, peer.sensorType, peer.zone, reading.value, reading.status, reading.flags,
+                       (uint32_t)(record.timeUs / 1000));
+
+    rule_command command;
+    if (!dispatchRule(&reading, &command))
+    {
+      continue;
+    }
+    commands++;
+
+    char mac[18];
+    formatMAC(record.mac, mac);
+    printf("%12.6f %s sensor %d (%s) value %d -> \"%s\" to", t, sensorTypeName(peer.sensorType), id, mac,
+           (int)reading.value, command.command);
+    for (size_t target = 0; target < peerTable.count(); target++)
+    {
+      if (dispatchIsTarget(peerTable.at(target), command.typeMask))
+      {
+        printf(" %zu", target);
+        sends++;
+      }
+    }
+    printf("\n");
+  }
+
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  if (reader.truncated())
+  {
+    fprintf(stderr, "capture is truncated\n");
+  }
+  fprintf(stderr, "%zu peers, %zu frames (%zu readings, %zu from unpaired senders, %zu undecodable)\n",
+          peerTable.count(), frames, readings, unknown, undecoded);
+  fprintf(stderr, "%zu commands, %zu sends\n", commands, sends);
+  fprintf(stderr, "%.3f s wall, %.0f frames/s\n", wall, wall > 0 ? frames / wall : 0.0);
+  return 0;
+}
+
+static int usage()
+{
+  fprintf(stderr, "usage: capture_tool extract <serial.log> <out.cap>\n"
+                  "       capture_tool topcap <in.cap> <out.pcap>\n"
+                  "       capture_tool frompcap <in.pcap> <out.cap>\n"
+                  "       capture_tool replay <in.cap> [speed]\n");
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    return usage();
+  }
+  std::string command = argv[1];
+  if (command == "extract" && argc == 4)
+  {
+    return extract(argv[2], argv[3]);
+  }
+  if (command == "topcap" && argc == 4)
+  {
+    return toPcap(argv[2], argv[3]);
+  }
+  if (command == "frompcap" && argc == 4)
+  {
+    return fromPcap(argv[2], argv[3]);
+  }
+  if (command == "replay" && (argc == 3 || argc == 4))
+  {
+    return replay(argv[2], argc == 4 ? atof(argv[3]) : 0);
+  }
+  return usage();
+}
@@ -0,0 +1,285 @@
+// Host simulation of the sensors' clock synchronization (see
+// Shared/ClockSync/ClockSync.h): how far a sensor's corrected time is
+// from the Server's, with skewed clocks and jittery, lossy, asymmetric
+// radio legs.
+//
+//   clocksync_sim [--skew -40,0,25] [--minutes 30] [--latency 1000] [--jitter 200]
+//                 [--queue 0.05] [--asymmetry 600] [--loss 0.02] [--seed 1]
+//
+// The Server's clock is true time. A sensor's clock starts at a random
+// offset of up to a second and runs --skew ppm fast. As ClockSyncClient
+// does, it asks for a sync 2 s after boot and every 2 s until it has one,
+// then after each beacon every CLOCK_SYNC_BEACON_INTERVAL. Each leg of an
+// exchange takes --latency us, plus Gaussian jitter of --jitter us standard
+// deviation, plus with probability --queue a queuing delay exponential
+// with a 5 ms mean; either leg is lost with probability --loss. The Server
+// turns a request round in 200 to 400 us.
+//
+// Each skew runs twice: with symmetric legs, and with the request leg
+// longer by up to --asymmetry us (uniform), which the two-way exchange
+// cannot see. Every 10 ms of the run after the first sync, the corrected
+// time toServerUs() is compared with the Server's. Per run it prints the
+// exchanges used, dropped for their round trip and lost, the RMS, 99th
+// percentile and worst error, and how far the final drift estimate is
+// from the true skew (the estimate is the Server's rate against the
+// sensor's, so -skew is exact). A run whose worst error after the first
+// minute is 1 ms or more is marked, and the tool exits with status 1.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/ClockSync clocksync_sim.cpp
+//     ../../Shared/ClockSync/ClockSync.cpp -o clocksync_sim
+
+#include <ClockSync.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define RETRY_US 2000000       // CLOCK_SYNC_RETRY_INTERVAL in ClockSyncClient.cpp
+#define SAMPLE_US 10000        // Error sampling period
+#define SETTLE_US 60000000     // Worst error counts from here on
+#define QUEUE_MEAN_US 5000.0   // Mean of a queuing delay
+#define TURNAROUND_US 200      // Server handling, plus up to as much again
+
+typedef struct sim_options
+{
+  std::vector<double> skews;
+  double minutes;
+  double latencyUs;
+  double jitterUs;
+  double queue;
+  double asymmetryUs;
+  double loss;
+  unsigned seed;
+} sim_options;
+
+typedef struct run_result
+{
+  uint32_t exchanges; // Folded into the estimate
+  uint32_t dropped;   // Round trip over CLOCK_SYNC_MAX_DELAY_US
+  uint32_t lost;      // A leg was lost
+  double rmsUs;
+  double p99Us;
+  double worstUs;     // After SETTLE_US
+  double driftErrorPpm;
+} run_result;
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static double gaussian(unsigned *seed)
+{
+  return sqrt(-2 * log(uniform(seed))) * cos(2 * M_PI * uniform(seed));
+}
+
+// One leg of an exchange in us, or -1 if it is lost
+static double leg(const sim_options &options, double extraUs, unsigned *seed)
+{
+  if (uniform(seed) < options.loss)
+  {
+    return -1;
+  }
+  double us = options.latencyUs + extraUs + options.jitterUs * gaussian(seed);
+  if (uniform(seed) < options.queue)
+  {
+    us += -log(uniform(seed)) * QUEUE_MEAN_US;
+  }
+  return us > 100 ? us : 100; // Never shorter than the frame's airtime
+}
+
+static run_result run(const sim_options &options, double skewPpm, bool asymmetric, unsigned seed)
+{
+  run_result result;
+  memset(&result, 0, sizeof(result));
+
+  // Sensor clock as a function of true (Server) time
+  double startOffsetUs = (uniform(&seed) - 0.5) * 2e6;
+  double rate = 1 + skewPpm / 1e6;
+  auto localAt = [&](double trueUs)
+  { return (uint64_t)(1e9 + startOffsetUs + trueUs * rate); };
+
+  ClockSync sync;
+  double endUs = options.minutes * 60e6;
+  double nextRequestUs = RETRY_US;
+  std::vector<double> errors;
+  double sumSquares = 0, worst = 0;
+  double sampleUs = 0;
+
+  while (nextRequestUs < endUs)
+  {
+    double requestUs = nextRequestUs;
+
+    // Score the estimate up to this exchange
+    for (; sampleUs < requestUs; sampleUs += SAMPLE_US)
+    {
+      if (!sync.synced())
+      {
+        continue;
+      }
+      double error = fabs((double)sync.toServerUs(localAt(sampleUs)) - sampleUs);
+      errors.push_back(error);
+      sumSquares += error * error;
+      worst = sampleUs >= SETTLE_US && error > worst ? error : worst;
+    }
+
+    double up = leg(options, asymmetric ? uniform(&seed) * options.asymmetryUs : 0, &seed);
+    double down = leg(options, 0, &seed);
+    if (up < 0 || down < 0)
+    {
+      result.lost++;
+    }
+    else
+    {
+      double turnaroundUs = TURNAROUND_US * (1 + uniform(&seed));
+      uint64_t t1 = localAt(requestUs);
+      uint64_t t2 = (uint64_t)(requestUs + up);
+      uint64_t t3 = (uint64_t)(requestUs + up + turnaroundUs);
+      uint64_t t4 = localAt(requestUs + up + turnaroundUs + down);
+      if (sync.addExchange(t1, t2, t3, t4))
+      {
+        result.exchanges++;
+      }
+      else
+      {
+        result.dropped++;
+      }
+    }
+
+    // Retries until the first sync, then the next beacon plus the per-sensor delay
+    if (!sync.synced())
+    {
+      nextRequestUs = requestUs + RETRY_US;
+    }
+    else
+    {
+      double beaconUs = CLOCK_SYNC_BEACON_INTERVAL * 1000.0;
+      nextRequestUs = (floor(requestUs / beaconUs) + 1) * beaconUs + (rand_r(&seed) % 256) * 4000.0;
+    }
+  }
+
+  if (!errors.empty())
+  {
+    std::sort(errors.begin(), errors.end());
+    result.rmsUs = sqrt(sumSquares / errors.size());
+    result.p99Us = errors[(size_t)(errors.size() * 0.99)];
+  }
+  result.worstUs = worst;
+  result.driftErrorPpm = sync.driftPpm() + skewPpm;
+  return result;
+}
+
+static bool parseList(const char *value, std::vector<double> &out)
+{
+  out.clear();
+  char *end;
+  while (*value != '\0')
+  {
+    out.push_back(strtod(value, &end));
+    if (end == value || (*end != ',' && *end != '\0'))
+    {
+      return false;
+    }
+    value = *end == ',' ? end + 1 : end;
+  }
+  return !out.empty();
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: clocksync_sim [--skew -40,0,25] [--minutes 30] [--latency 1000] [--jitter 200]\n"
+                  "                     [--queue 0.05] [--asymmetry 600] [--loss 0.02] [--seed 1]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  sim_options options;
+  options.skews = {-40, 0, 25};
+  options.minutes = 30;
+  options.latencyUs = 1000;
+  options.jitterUs = 200;
+  options.queue = 0.05;
+  options.asymmetryUs = 600;
+  options.loss = 0.02;
+  options.seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    const char *name = argv[i - 1];
+    if (strcmp(name, "--skew") == 0)
+    {
+      if (!parseList(value, options.skews))
+      {
+        usage();
+      }
+    }
+    else if (strcmp(name, "--minutes") == 0)
+    {
+      options.minutes = atof(value);
+    }
+    else if (strcmp(name, "--latency") == 0)
+    {
+      options.latencyUs = atof(value);
+    }
+    else if (strcmp(name, "--jitter") == 0)
+    {
+      options.jitterUs = atof(value);
+    }
+    else if (strcmp(name, "--queue") == 0)
+    {
+      options.queue = atof(value);
+    }
+    else if (strcmp(name, "--asymmetry") == 0)
+    {
+      options.asymmetryUs = atof(value);
+    }
+    else if (strcmp(name, "--loss") == 0)
+    {
+      options.loss = atof(value);
+    }
+    else if (strcmp(name, "--seed") == 0)
+    {
+      options.seed = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (options.minutes < 2 || options.minutes > 24 * 60 || options.latencyUs < 0 || options.jitterUs < 0 ||
+      options.queue < 0 || options.queue > 1 || options.asymmetryUs < 0 || options.loss < 0 || options.loss >= 1)
+  {
+    usage();
+  }
+
+  bool ok = true;
+  printf("skew ppm  legs        used  dropped  lost   rms us   p99 us  worst us  drift err\n");
+  for (double skew : options.skews)
+  {
+    for (bool asymmetric : {false, true})
+    {
+      run_result r = run(options, skew, asymmetric, options.seed);
+      bool over = r.worstUs >= 1000;
+      ok = ok && !over;
+      printf("%8.1f  %-10s %5u  %7u  %4u  %7.0f  %7.0f  %8.0f  %9.2f%s\n", skew,
+             asymmetric ? "asymmetric" : "symmetric", r.exchanges, r.dropped, r.lost, r.rmsUs, r.p99Us, r.worstUs,
+             r.driftErrorPpm, over ? "  over 1 ms" : "");
+    }
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,1146 @@
+// Load generator for the Server: runs the Server's frame handling in this
+// process and a fleet of virtual sensors in child processes, with UDP on
+// localhost standing in for ESP-NOW, and reports how the Server copes as
+// the fleet grows.
+//
+//   fleet_load [--sensors 64,128,256] [--procs 4] [--seconds 10] [--warmup 3]
+//              [--motion-period 10] [--smoke-alarms 2] [--slowdown 1] [--port 47300]
+//              [--rate 1M] [--report-control on|off] [--fast-lane on|off]
+//
+// Each step pairs the given number of sensors, lets them report for
+// --seconds and prints:
+//   offered/s   reading frames the sensors sent
+//   handled/s   frames the radio task processed
+//   qdrop%      frames refused because the radio queue was full
+//   loss%       frames lost before reaching the queue (socket buffers)
+//   queue       radio queue occupancy seen by arriving frames, mean and max
+//   cmd/s       commands received by the sensors
+//   cmd p50/p99 command latency, from the triggering frame leaving its
+//               sensor to the command arriving at each target
+//   air%        share of the channel the frames handled would take at --rate
+//   level       reporting level at the end of the window (see ReportControl.h)
+//   alarms      smoke alarm frames that led to a shutdown command
+//   adrop       smoke alarm frames refused because the radio queue was full
+//   a99/amax    p99 and worst time from an alarm frame reaching the receive
+//               thread to the first shutdown command going out
+//   j50/j99     join latency, from a sensor's first join request to its
+//   jmax        accept, median, p99 and worst over the whole fleet; every
+//               sensor starts joining in the same half second, so this is
+//               the fleet powering up at once. Retries go every second
+//   tries       join requests per paired sensor
+//
+// The sensors follow the firmware: light reports every 100 ms, sound and
+// smoke every 500 ms, motion on every change (exponentially distributed,
+// --motion-period seconds on average per sensor). --smoke-alarms is the
+// number of smoke alarms per minute across the fleet. Motion and smoke
+// trigger the same command fan-out as on the Server.
+//
+// With --report-control on the Server runs the ReportController on the
+// modelled airtime of the frames it handles and sends its setting to every
+// sensor process, and the sensors report at the interval it sets for their
+// type, but no faster than the light (100 ms) and smoke (250 ms) firmware
+// sample. Change thresholds are not modelled: the virtual readings are
+// noise. Smoke alarms are incidents, as on the Server.
+//
+// The Server side mirrors Server/src/main.cpp: a receive thread in place of
+// the Wi-Fi task queues events for a radio thread through a queue of
+// RADIO_QUEUE_DEPTH, and the radio thread pairs, decodes, stores, applies
+// the rules and sends commands through PeerCache. With --fast-lane on, as on
+// the Server, smoke alarm frames are classified on receipt, jump the queue
+// into slots kept free for them and have their pre-built commands sent
+// before anything else; off queues them behind the telemetry like any other
+// frame. Airtime and Serial output
+// are not modelled, other than as air%. --slowdown F stretches the radio thread's work F times
+// to approximate a slower CPU.
+//
+// The peer table holds PEER_TABLE_MAX (256) sensors as on the Server; for
+// larger fleets add -DPEER_TABLE_MAX=4096 -DSENSOR_STORE_MAX=4096
+// -DMETRICS_MAX_SENSORS=4096 to the build.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -pthread -I../../Shared/Pairing -I../../Shared/SensorFrame
+//     -I../../Shared/LinkQuality -I../../Shared/ReportControl -I../../Shared/TextBuffer
+//     -I../../Server/lib/Dispatch -I../../Server/lib/SensorStore -I../../Server/lib/Metrics
+//     fleet_load.cpp ../../Shared/Pairing/Pairing.cpp ../../Shared/Pairing/PeerTable.cpp
+//     ../../Shared/Pairing/PeerCache.cpp ../../Shared/SensorFrame/SensorFrame.cpp
+//     ../../Shared/LinkQuality/LinkQuality.cpp ../../Shared/ReportControl/ReportControl.cpp
+//     ../../Server/lib/Dispatch/Dispatch.cpp ../../Server/lib/SensorStore/SensorStore.cpp
+//     ../../Server/lib/Metrics/Metrics.cpp -o fleet_load
+
+#include <Dispatch.h>
+#include <LinkQuality.h>
+#include <Metrics.h>
+#include <Pairing.h>
+#include <PeerCache.h>
+#include <PeerTable.h>
+#include <ReportControl.h>
+#include <SensorFrame.h>
+#include <SensorStore.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <errno.h>
+#include <math.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define RADIO_QUEUE_DEPTH 32  // As in Server/src/main.cpp
+#define RADIO_ALARM_RESERVE 4 // As in Server/src/main.cpp; no send completions are queued here
+#define MAX_FRAME 250        // ESP_NOW_MAX_DATA_LEN
+#define SOCKET_BUFFER (4 * 1024 * 1024)
+#define LATENCY_BUCKETS 128 // Quarter powers of two of microseconds
+#define MAX_PROCS 64
+
+#define LIGHT_SAMPLE_US 100000 // Loop periods of the light and smoke firmware
+#define SMOKE_SAMPLE_US 250000
+#define JOIN_RETRY_US 1000000
+#define SMOKE_ALARM_LEVEL 150 // Above the rule's threshold of 100
+
+// Every datagram starts with this, followed by the ESP-NOW payload.
+// Towards the Server mac is the sender, towards a sensor the receiver.
+typedef struct udp_link
+{
+  uint8_t mac[6];
+  uint8_t reserved[2];
+  uint64_t originUs; // Commands: when the frame that triggered them was sent
+} udp_link;
+
+typedef struct fleet_options
+{
+  std::vector<unsigned> steps;
+  unsigned procs;
+  unsigned seconds;
+  unsigned warmup;
+  double motionPeriod;
+  double smokeAlarms;
+  double slowdown;
+  uint16_t port;
+  uint8_t rate;      // link_rate the airtime of received frames is modelled at
+  bool reportControl;
+  bool fastLane;
+} fleet_options;
+
+// What one sensor process reports back over its pipe
+typedef struct sensor_report
+{
+  uint64_t readingsSent; // Within the measured window
+  uint64_t framesSent;   // Readings and join requests, within the window
+  uint64_t sendFailures;
+  uint64_t commandsReceived;
+  uint32_t paired;
+  uint32_t latency[LATENCY_BUCKETS];
+  uint64_t joinRequests; // From the start, not just the window
+  uint64_t joinMaxUs;
+  uint32_t joinLatency[LATENCY_BUCKETS];
+} sensor_report;
+
+static uint64_t monotonicUs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleepUntilUs(uint64_t us)
+{
+  timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+  {
+  }
+}
+
+static int latencyBucket(uint64_t us)
+{
+  if (us < 1)
+  {
+    return 0;
+  }
+  int bucket = (int)(4 * log2((double)us));
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// Latency below which the given fraction of samples fall, in ms
+static double latencyPercentile(const uint32_t *buckets, double fraction)
+{
+  uint64_t total = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    total += buckets[i];
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)ceil(fraction * total), seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += buckets[i];
+    if (seen >= rank)
+    {
+      return pow(2.0, (i + 0.5) / 4) / 1000.0;
+    }
+  }
+  return 0;
+}
+
+static int openSocket()
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    perror("socket");
+    exit(1);
+  }
+  int size = SOCKET_BUFFER;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  return fd;
+}
+
+static sockaddr_in localAddress(uint16_t port)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return addr;
+}
+
+// ---- Server side ----
+
+typedef struct radio_event
+{
+  uint8_t mac[6];
+  uint8_t len;
+  bool alarm; // Classified as a smoke alarm on receipt
+  uint64_t originUs;
+  uint64_t timeUs; // When the receive thread got it
+  sockaddr_in from;
+  uint8_t data[MAX_FRAME];
+} radio_event;
+
+// The Server's radio queue: bounded, never blocks the producer
+class RadioQueue
+{
+public:
+  // False if it would leave fewer than reserve slots free; front queues
+  // ahead of everything waiting. depth receives the occupancy after queuing.
+  bool push(const radio_event &event, bool front, uint32_t reserve, uint32_t *depth)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count + reserve >= RADIO_QUEUE_DEPTH)
+    {
+      return false;
+    }
+    if (front)
+    {
+      head = (head + RADIO_QUEUE_DEPTH - 1) % RADIO_QUEUE_DEPTH;
+      events[head] = event;
+    }
+    else
+    {
+      events[(head + count) % RADIO_QUEUE_DEPTH] = event;
+    }
+    count++;
+    *depth = count;
+    ready.notify_one();
+    return true;
+  }
+
+  // False if nothing arrived within timeoutMs
+  bool pop(radio_event *event, uint32_t timeoutMs)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]
+                        { return count > 0; }))
+    {
+      return false;
+    }
+    *event = events[head];
+    head = (head + 1) % RADIO_QUEUE_DEPTH;
+    count--;
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  radio_event events[RADIO_QUEUE_DEPTH];
+  uint32_t head = 0;
+  uint32_t count = 0;
+};
+
+// Counters read by the main thread at the edges of the measured window
+typedef struct server_counters
+{
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> handled{0};
+  std::atomic<uint64_t> commandsSent{0};
+  std::atomic<uint64_t> occupancySum{0};
+  std::atomic<uint32_t> occupancyMax{0};
+  std::atomic<uint32_t> rejectedJoins{0};
+  std::atomic<uint64_t> airtimeUs{0};
+  std::atomic<int32_t> level{0};
+  std::atomic<uint32_t> alarms{0};
+  std::atomic<uint32_t> alarmsDropped{0};
+  std::atomic<uint32_t> alarmLatency[LATENCY_BUCKETS] = {};
+  std::atomic<uint64_t> alarmMaxUs{0};
+} server_counters;
+
+typedef struct counter_sample
+{
+  uint64_t received, dropped, handled, commandsSent, occupancySum, airtimeUs;
+} counter_sample;
+
+static bool addDriverPeer(const uint8_t *)
+{
+  return true;
+}
+
+static void removeDriverPeer(const uint8_t *)
+{
+}
+
+class FleetServer
+{
+public:
+  FleetServer(const fleet_options &options) : options(options)
+  {
+    fd = openSocket();
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr = localAddress(options.port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+      perror("bind");
+      exit(1);
+    }
+    timeval timeout = {0, 100000}; // Lets the receive thread notice stop()
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  ~FleetServer()
+  {
+    close(fd);
+  }
+
+  void start()
+  {
+    receiver = std::thread(&FleetServer::receiveMain, this);
+    radio = std::thread(&FleetServer::radioMain, this);
+  }
+
+  void stop()
+  {
+    running = false;
+    receiver.join();
+    radio.join();
+  }
+
+  counter_sample sample() const
+  {
+    return {counters.received.load(), counters.dropped.load(), counters.handled.load(), counters.commandsSent.load(),
+            counters.occupancySum.load(), counters.airtimeUs.load()};
+  }
+
+  int level() const { return counters.level.load(); }
+
+  // Forget the alarms handled before the measured window
+  void resetAlarms()
+  {
+    counters.alarms = 0;
+    counters.alarmsDropped = 0;
+    counters.alarmMaxUs = 0;
+    for (std::atomic<uint32_t> &bucket : counters.alarmLatency)
+    {
+      bucket = 0;
+    }
+  }
+
+  uint32_t alarms() const { return counters.alarms.load(); }
+  uint32_t alarmsDropped() const { return counters.alarmsDropped.load(); }
+  uint64_t alarmMaxUs() const { return counters.alarmMaxUs.load(); }
+  double alarmPercentile(double fraction) const
+  {
+    uint32_t buckets[LATENCY_BUCKETS];
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+      buckets[i] = counters.alarmLatency[i].load();
+    }
+    return latencyPercentile(buckets, fraction);
+  }
+  uint32_t occupancyMax() const { return counters.occupancyMax.load(); }
+  uint32_t rejectedJoins() const { return counters.rejectedJoins.load(); }
+  size_t paired() const { return peerTable.count(); }
+
+private:
+  // Stand-in for the Wi-Fi task and OnDataRecv(): stamp, classify and queue, nothing else
+  void receiveMain()
+  {
+    uint8_t buf[sizeof(udp_link) + MAX_FRAME];
+    while (running)
+    {
+      radio_event event;
+      socklen_t fromLen = sizeof(event.from);
+      ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&event.from, &fromLen);
+      if (n < (ssize_t)sizeof(udp_link))
+      {
+        continue;
+      }
+      udp_link link;
+      memcpy(&link, buf, sizeof(link));
+      memcpy(event.mac, link.mac, 6);
+      event.originUs = link.originUs;
+      event.timeUs = monotonicUs();
+      event.len = (uint8_t)(n - sizeof(udp_link));
+      memcpy(event.data, buf + sizeof(udp_link), event.len);
+
+      counters.received++;
+      bool alarm = dispatchPriority(event.data, event.len) == DISPATCH_PRIORITY_ALARM;
+      event.alarm = options.fastLane && alarm;
+      uint32_t reserve = options.fastLane && !alarm ? RADIO_ALARM_RESERVE : 0;
+      uint32_t depth;
+      if (!queue.push(event, event.alarm, reserve, &depth))
+      {
+        counters.dropped++;
+        counters.alarmsDropped += alarm;
+        metrics.onRadioDropped();
+        continue;
+      }
+      metrics.onRadioQueued(depth);
+      counters.occupancySum += depth;
+      uint32_t max = counters.occupancyMax.load();
+      while (depth > max && !counters.occupancyMax.compare_exchange_weak(max, depth))
+      {
+      }
+    }
+  }
+
+  void radioMain()
+  {
+    radio_event event;
+    while (running)
+    {
+      bool received = queue.pop(&event, 100);
+      uint64_t startUs = monotonicUs();
+      // Alarm commands go out before anything else, the report control broadcast included
+      bool alarmSent = received && event.alarm && sendAlarm(event);
+      if (options.reportControl)
+      {
+        serviceReportControl();
+      }
+      if (!received)
+      {
+        continue;
+      }
+      metrics.onRadioDequeued((uint32_t)(startUs - event.timeUs));
+      handleFrame(event, alarmSent);
+      counters.handled++;
+
+      // Spin for the extra time a slower CPU would have needed
+      if (options.slowdown > 1)
+      {
+        uint64_t endUs = startUs + (uint64_t)((monotonicUs() - startUs) * options.slowdown);
+        while (monotonicUs() < endUs)
+        {
+        }
+      }
+    }
+  }
+
+  void send(const sockaddr_in &to, const uint8_t *mac, uint64_t originUs, const void *payload, size_t len)
+  {
+    uint8_t buf[sizeof(udp_link) + MAX_FRAME];
+    udp_link link;
+    memset(&link, 0, sizeof(link));
+    memcpy(link.mac, mac, 6);
+    link.originUs = originUs;
+    memcpy(buf, &link, sizeof(link));
+    memcpy(buf + sizeof(link), payload, len);
+    sendto(fd, buf, sizeof(link) + len, 0, (const sockaddr *)&to, sizeof(to));
+  }
+
+  void handleJoinRequest(const radio_event &event, const pairing_frame *request)
+  {
+    bool changed;
+    int id = peerTable.admit(event.mac, request->sensorType, request->capabilities, request->zone, &changed);
+    if (id < 0)
+    {
+      counters.rejectedJoins++;
+      return;
+    }
+    addresses[id] = event.from;
+    if (changed)
+    {
+      dispatchPlanAlarm(peerTable, &alarmPlan);
+    }
+    bool known = false;
+    for (const sockaddr_in &process : processes)
+    {
+      known = known || process.sin_port == event.from.sin_port;
+    }
+    if (!known)
+    {
+      processes.push_back(event.from);
+    }
+    controller.requestRefresh();
+
+    pairing_frame accept;
+    pairingMakeJoinAccept(&accept, request, id, event.mac);
+    send(event.from, event.mac, 0, &accept, sizeof(accept));
+    metrics.onSendQueued();
+  }
+
+  // Count an alarm received at receivedUs as its first command goes out
+  void onAlarmCommand(uint64_t receivedUs)
+  {
+    uint64_t us = monotonicUs() - receivedUs;
+    counters.alarms++;
+    counters.alarmLatency[latencyBucket(us)]++;
+    uint64_t max = counters.alarmMaxUs.load();
+    while (us > max && !counters.alarmMaxUs.compare_exchange_weak(max, us))
+    {
+    }
+  }
+
+  // sendAlarm(): the planned commands; false if the sender is not a paired smoke sensor
+  bool sendAlarm(const radio_event &event)
+  {
+    int sender = peerTable.find(event.mac);
+    if (sender < 0 || peerTable.at(sender).sensorType != SENSOR_SMOKE)
+    {
+      return false;
+    }
+    bool first = true;
+    for (size_t i = 0; i < alarmPlan.count; i++)
+    {
+      uint16_t id = alarmPlan.targets[i];
+      const peer_entry &peer = peerTable.at(id);
+      if (!peerCache.acquire(id, peer.mac))
+      {
+        continue;
+      }
+      send(addresses[id], peer.mac, event.originUs, alarmPlan.command.command, alarmPlan.len);
+      if (first)
+      {
+        onAlarmCommand(event.timeUs);
+        first = false;
+      }
+      metrics.onSendQueued();
+      counters.commandsSent++;
+      peerCache.release(peer.mac);
+      metrics.onSendCompleted(id, true);
+    }
+    return true;
+  }
+
+  // sendCommand() with each send completing as soon as it is handed to the
+  // socket; alarmUs is when the smoke alarm behind it was received, 0 otherwise
+  void sendCommand(const char *command, uint32_t typeMask, uint64_t originUs, uint64_t alarmUs)
+  {
+    uint16_t targets[PEER_TABLE_MAX];
+    size_t targetCount = dispatchTargets(peerTable, typeMask, targets, PEER_TABLE_MAX);
+    for (size_t i = 0; i < targetCount; i++)
+    {
+      uint16_t id = targets[i];
+      const peer_entry &peer = peerTable.at(id);
+      if (!peerCache.acquire(id, peer.mac))
+      {
+        continue;
+      }
+      send(addresses[id], peer.mac, originUs, command, strlen(command) + 1);
+      if (alarmUs != 0)
+      {
+        onAlarmCommand(alarmUs);
+        alarmUs = 0;
+      }
+      metrics.onSendQueued();
+      counters.commandsSent++;
+      peerCache.release(peer.mac);
+      metrics.onSendCompleted(id, true);
+    }
+  }
+
+  // The Server's broadcast of the reporting setting, once to each sensor process
+  void serviceReportControl()
+  {
+    report_control_frame frame;
+    if (controller.update((uint32_t)(monotonicUs() / 1000), &frame))
+    {
+      static const uint8_t broadcastMAC[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+      for (const sockaddr_in &process : processes)
+      {
+        send(process, broadcastMAC, 0, &frame, sizeof(frame));
+      }
+    }
+    counters.level = controller.level();
+  }
+
+  // alarmSent when sendAlarm() already sent the smoke rule's commands
+  void handleFrame(const radio_event &event, bool alarmSent)
+  {
+    uint32_t airtimeUs = linkAirtimeUs(options.rate, event.len);
+    counters.airtimeUs += airtimeUs;
+    controller.onFrame(airtimeUs);
+
+    pairing_frame pairingFrame;
+    if (pairingParseFrame(event.data, event.len, &pairingFrame))
+    {
+      if (pairingFrame.kind == PAIRING_JOIN_REQUEST)
+      {
+        handleJoinRequest(event, &pairingFrame);
+      }
+      return;
+    }
+
+    int id = peerTable.find(event.mac);
+    if (id < 0)
+    {
+      metrics.onUnknownFrame();
+      return;
+    }
+    uint8_t sensorType = peerTable.at(id).sensorType;
+    uint32_t nowMs = (uint32_t)(monotonicUs() / 1000);
+
+    frame_header header;
+    bool hasSeq = frameParseHeader(event.data, event.len, &header);
+    metrics.onFrame(id, sensorType, event.len, hasSeq, hasSeq ? header.seq : 0, 0, nowMs);
+
+    sensor_reading reading;
+    if (dispatchDecode(sensorType, event.data, event.len, &reading))
+    {
+      sensorStore.update(id, sensorType, peerTable.at(id).zone, reading.value, reading.status, reading.flags, nowMs);
+      if (reading.flags & SENSOR_FLAG_BLINK)
+      {
+        controller.onIncident(nowMs);
+      }
+      rule_command command;
+      if (dispatchRule(&reading, &command) && !alarmSent)
+      {
+        sendCommand(command.command, command.typeMask, event.originUs, sensorType == SENSOR_SMOKE ? event.timeUs : 0);
+      }
+    }
+    metrics.onDispatched(id, (uint32_t)(monotonicUs() - event.timeUs));
+  }
+
+  int fd;
+  fleet_options options;
+  std::atomic<bool> running{true};
+  std::thread receiver;
+  std::thread radio;
+  RadioQueue queue;
+  server_counters counters;
+
+  PeerTable peerTable;
+  PeerCache peerCache{addDriverPeer, removeDriverPeer};
+  SensorStore sensorStore;
+  Metrics metrics;
+  sockaddr_in addresses[PEER_TABLE_MAX];
+  std::vector<sockaddr_in> processes; // One address per sensor process, for broadcasts
+  ReportController controller;
+  dispatch_alarm_plan alarmPlan = {};
+};
+
+// ---- Sensor side ----
+
+typedef struct virtual_sensor
+{
+  uint8_t mac[6];
+  uint8_t sensorType;
+  uint8_t capabilities;
+  uint8_t zone;
+  bool paired;
+  bool motion; // Motion sensors: currently seeing motion
+  uint16_t seq;
+  uint64_t firstJoinUs; // 0 until the first join request
+} virtual_sensor;
+
+static const uint8_t fleetTypes[] = {SENSOR_LIGHT, SENSOR_SOUND, SENSOR_SMOKE, SENSOR_MOTION};
+
+static void sensorMac(unsigned proc, unsigned index, uint8_t *mac)
+{
+  mac[0] = 0x02; // Locally administered
+  mac[1] = 0x00;
+  mac[2] = 0x00;
+  mac[3] = (uint8_t)proc;
+  mac[4] = (uint8_t)(index >> 8);
+  mac[5] = (uint8_t)index;
+}
+
+// Uniform in (0, 1]
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+// The reading frame a sensor sends now, laid out as by its firmware
+static size_t makeReading(virtual_sensor &sensor, bool alarm, unsigned *seed, uint8_t *buf)
+{
+  uint32_t nowUs = (uint32_t)monotonicUs();
+  frame_header header;
+  frameStamp(&header, FRAME_READING, nowUs, nowUs);
+  header.seq = sensor.seq++; // Per sensor, as on a real node
+
+  switch (sensor.sensorType)
+  {
+  case SENSOR_LIGHT:
+  {
+    struct_message_light m = {};
+    m.header = header;
+    m.lightLevel = 1000 + rand_r(seed) % 2000;
+    snprintf(m.brightnessPercentage, sizeof(m.brightnessPercentage), "%d%%", m.lightLevel / 40);
+    memcpy(buf, &m, sizeof(m));
+    return sizeof(m);
+  }
+  case SENSOR_SOUND:
+  {
+    struct_message_sound m = {};
+    m.header = header;
+    m.soundLevel = 200 + rand_r(seed) % 100;
+    strcpy(m.soundStatus, "QUIET");
+    memcpy(buf, &m, sizeof(m));
+    return sizeof(m);
+  }
+  case SENSOR_SMOKE:
+  {
+    struct_message_smoke m = {};
+    m.header = header;
+    m.smokePercentage = alarm ? SMOKE_ALARM_LEVEL : rand_r(seed) % 10;
+    strcpy(m.smokeStatus, alarm ? "SMOKE DETECTED" : "NO SMOKE");
+    m.blinkLED = alarm;
+    memcpy(buf, &m, sizeof(m));
+    return sizeof(m);
+  }
+  default:
+  {
+    struct_message_motion m = {};
+    m.header = header;
+    m.motionValue = sensor.motion ? 1 : 2;
+    strcpy(m.motionStatus, sensor.motion ? "Motion Detected" : "No Motion");
+    memcpy(buf, &m, sizeof(m));
+    return sizeof(m);
+  }
+  }
+}
+
+// Reporting interval of a sensor type under a setting, limited by how often its firmware samples
+static uint64_t reportPeriodUs(uint8_t sensorType, const report_setting &setting)
+{
+  uint64_t us = (uint64_t)setting.intervalMs * 1000;
+  uint64_t sampleUs = sensorType == SENSOR_LIGHT ? LIGHT_SAMPLE_US : (sensorType == SENSOR_SMOKE ? SMOKE_SAMPLE_US : 0);
+  return us > sampleUs ? us : sampleUs;
+}
+
+// Time until a sensor's next frame
+static uint64_t nextPeriodUs(const virtual_sensor &sensor, const report_setting *settings, const fleet_options &options,
+                             unsigned *seed)
+{
+  if (sensor.sensorType == SENSOR_MOTION)
+  {
+    return (uint64_t)(-log(uniform(seed)) * options.motionPeriod * 1000000);
+  }
+  return reportPeriodUs(sensor.sensorType, settings[sensor.sensorType]);
+}
+
+// Body of a sensor process: run count sensors until endUs, counting from windowUs
+static sensor_report runSensors(unsigned proc, unsigned count, unsigned fleetSize, const fleet_options &options,
+                                uint64_t startUs, uint64_t windowUs, uint64_t endUs)
+{
+  sensor_report report;
+  memset(&report, 0, sizeof(report));
+
+  int fd = openSocket();
+  sockaddr_in server = localAddress(options.port);
+  if (connect(fd, (sockaddr *)&server, sizeof(server)) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+
+  unsigned seed = 12345 + proc;
+  std::vector<virtual_sensor> sensors(count);
+  typedef std::pair<uint64_t, uint32_t> due_entry;
+  std::priority_queue<due_entry, std::vector<due_entry>, std::greater<due_entry>> due;
+  for (unsigned i = 0; i < count; i++)
+  {
+    virtual_sensor &sensor = sensors[i];
+    sensorMac(proc, i, sensor.mac);
+    unsigned global = proc + i * options.procs; // Interleave types across processes
+    sensor.sensorType = fleetTypes[global % 4];
+    sensor.capabilities = SENSOR_CAP_REPORTS;
+    if (sensor.sensorType == SENSOR_LIGHT || sensor.sensorType == SENSOR_SOUND)
+    {
+      sensor.capabilities |= SENSOR_CAP_ACCEPTS_COMMANDS;
+    }
+    sensor.zone = global % 16;
+    // Joins are spread over the first half second, like a fleet powering up
+    due.push({startUs + rand_r(&seed) % 500000, i});
+  }
+
+  // Reporting settings by sensor_type, shared by the process's sensors like a broadcast
+  report_setting settings[REPORT_SENSOR_TYPES + 1];
+  for (uint8_t type = 0; type <= REPORT_SENSOR_TYPES; type++)
+  {
+    settings[type] = reportNominal(type);
+  }
+
+  // Chance that one smoke frame is an alarm, for the requested fleet-wide rate
+  double smokeFramesPerSec = fleetSize / 4.0 * 1000000.0 / reportPeriodUs(SENSOR_SMOKE, settings[SENSOR_SMOKE]);
+  double alarmChance = smokeFramesPerSec > 0 ? options.smokeAlarms / 60.0 / smokeFramesPerSec : 0;
+
+  uint8_t buf[sizeof(udp_link) + MAX_FRAME];
+  while (true)
+  {
+    uint64_t nowUs = monotonicUs();
+    if (nowUs >= endUs)
+    {
+      break;
+    }
+
+    // Send everything that is due
+    while (!due.empty() && due.top().first <= nowUs)
+    {
+      uint32_t index = due.top().second;
+      due.pop();
+      virtual_sensor &sensor = sensors[index];
+
+      udp_link link;
+      memset(&link, 0, sizeof(link));
+      memcpy(link.mac, sensor.mac, 6);
+      link.originUs = nowUs;
+      memcpy(buf, &link, sizeof(link));
+
+      size_t len;
+      uint64_t nextUs;
+      if (!sensor.paired)
+      {
+        pairing_frame request;
+        pairingMakeJoinRequest(&request, sensor.sensorType, sensor.capabilities, sensor.zone);
+        memcpy(buf + sizeof(link), &request, sizeof(request));
+        len = sizeof(request);
+        nextUs = nowUs + JOIN_RETRY_US;
+        sensor.firstJoinUs = sensor.firstJoinUs == 0 ? nowUs : sensor.firstJoinUs;
+        report.joinRequests++;
+      }
+      else
+      {
+        if (sensor.sensorType == SENSOR_MOTION)
+        {
+          sensor.motion = !sensor.motion;
+        }
+        bool alarm = sensor.sensorType == SENSOR_SMOKE && uniform(&seed) <= alarmChance;
+        len = makeReading(sensor, alarm, &seed, buf + sizeof(link));
+        nextUs = nowUs + nextPeriodUs(sensor, settings, options, &seed);
+        report.readingsSent += nowUs >= windowUs;
+      }
+      if (send(fd, buf, sizeof(link) + len, MSG_DONTWAIT) < 0)
+      {
+        report.sendFailures++;
+      }
+      else if (nowUs >= windowUs)
+      {
+        report.framesSent++;
+      }
+      due.push({nextUs, index});
+    }
+
+    // Take in accepts and commands until the next frame is due
+    uint64_t waitUs = due.empty() ? endUs - nowUs : (due.top().first > nowUs ? due.top().first - nowUs : 0);
+    pollfd pfd = {fd, POLLIN, 0};
+    timespec timeout = {(time_t)(waitUs / 1000000), (long)(waitUs % 1000000) * 1000};
+    if (ppoll(&pfd, 1, &timeout, nullptr) <= 0)
+    {
+      continue;
+    }
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) >= (ssize_t)sizeof(udp_link))
+    {
+      udp_link link;
+      memcpy(&link, buf, sizeof(link));
+
+      // Broadcast reporting settings
+      report_control_frame control;
+      if (reportControlParseFrame(buf + sizeof(link), n - sizeof(link), &control))
+      {
+        for (uint8_t type = 1; type <= REPORT_SENSOR_TYPES; type++)
+        {
+          reportControlSettingFor(&control, type, &settings[type]);
+        }
+        smokeFramesPerSec = fleetSize / 4.0 * 1000000.0 / reportPeriodUs(SENSOR_SMOKE, settings[SENSOR_SMOKE]);
+        alarmChance = smokeFramesPerSec > 0 ? options.smokeAlarms / 60.0 / smokeFramesPerSec : 0;
+        continue;
+      }
+
+      uint32_t index = ((uint32_t)link.mac[4] << 8) | link.mac[5];
+      if (link.mac[3] != proc || index >= count)
+      {
+        continue;
+      }
+      virtual_sensor &sensor = sensors[index];
+      const uint8_t *payload = buf + sizeof(link);
+      size_t len = n - sizeof(link);
+
+      pairing_frame accept;
+      if (pairingParseFrame(payload, len, &accept))
+      {
+        if (accept.kind == PAIRING_JOIN_ACCEPT && memcmp(accept.target, sensor.mac, 6) == 0 && !sensor.paired)
+        {
+          sensor.paired = true;
+          uint64_t joinUs = monotonicUs() - sensor.firstJoinUs;
+          report.joinLatency[latencyBucket(joinUs)]++;
+          report.joinMaxUs = joinUs > report.joinMaxUs ? joinUs : report.joinMaxUs;
+        }
+        continue;
+      }
+
+      // Anything else is a command
+      uint64_t arrivedUs = monotonicUs();
+      if (arrivedUs >= windowUs && link.originUs != 0)
+      {
+        report.commandsReceived++;
+        report.latency[latencyBucket(arrivedUs - link.originUs)]++;
+      }
+    }
+  }
+
+  for (const virtual_sensor &sensor : sensors)
+  {
+    report.paired += sensor.paired;
+  }
+  close(fd);
+  return report;
+}
+
+// ---- Driver ----
+
+static void runStep(unsigned fleetSize, const fleet_options &options)
+{
+  unsigned procs = options.procs < fleetSize ? options.procs : fleetSize;
+  uint64_t startUs = monotonicUs() + 300000; // Time for the children to set up
+  uint64_t windowUs = startUs + options.warmup * 1000000ull;
+  uint64_t endUs = windowUs + options.seconds * 1000000ull;
+
+  // Children are forked before the Server starts its threads
+  int pipes[MAX_PROCS];
+  pid_t pids[MAX_PROCS];
+  for (unsigned proc = 0; proc < procs; proc++)
+  {
+    int fds[2];
+    if (pipe(fds) < 0)
+    {
+      perror("pipe");
+      exit(1);
+    }
+    unsigned count = fleetSize / procs + (proc < fleetSize % procs ? 1 : 0);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(fds[0]);
+      sleepUntilUs(startUs);
+      sensor_report report = runSensors(proc, count, fleetSize, options, startUs, windowUs, endUs);
+      ssize_t written = write(fds[1], &report, sizeof(report));
+      _exit(written == (ssize_t)sizeof(report) ? 0 : 1);
+    }
+    close(fds[1]);
+    pipes[proc] = fds[0];
+    pids[proc] = pid;
+  }
+
+  FleetServer *server = new FleetServer(options);
+  server->start();
+  sleepUntilUs(windowUs);
+  server->resetAlarms();
+  counter_sample before = server->sample();
+  sleepUntilUs(endUs);
+  counter_sample after = server->sample();
+
+  sensor_report total;
+  memset(&total, 0, sizeof(total));
+  for (unsigned proc = 0; proc < procs; proc++)
+  {
+    sensor_report report;
+    if (read(pipes[proc], &report, sizeof(report)) == (ssize_t)sizeof(report))
+    {
+      total.readingsSent += report.readingsSent;
+      total.framesSent += report.framesSent;
+      total.sendFailures += report.sendFailures;
+      total.commandsReceived += report.commandsReceived;
+      total.paired += report.paired;
+      total.joinRequests += report.joinRequests;
+      total.joinMaxUs = report.joinMaxUs > total.joinMaxUs ? report.joinMaxUs : total.joinMaxUs;
+      for (int i = 0; i < LATENCY_BUCKETS; i++)
+      {
+        total.latency[i] += report.latency[i];
+        total.joinLatency[i] += report.joinLatency[i];
+      }
+    }
+    close(pipes[proc]);
+    waitpid(pids[proc], nullptr, 0);
+  }
+  server->stop();
+
+  double seconds = options.seconds;
+  uint64_t received = after.received - before.received;
+  uint64_t dropped = after.dropped - before.dropped;
+  uint64_t handled = after.handled - before.handled;
+  uint64_t queued = received - dropped;
+  double lossPct = total.framesSent > received ? (total.framesSent - received) * 100.0 / total.framesSent : 0;
+  printf("%7u %6u %10.0f %10.0f %6.2f %6.2f %6.1f %4u %10.0f %8.2f %8.2f %6.1f %6d %6u %5u %8.2f %8.2f %8.2f %8.2f "
+         "%8.2f %5.2f\n",
+         fleetSize,
+         total.paired,
+         total.readingsSent / seconds, handled / seconds, received ? dropped * 100.0 / received : 0, lossPct,
+         queued ? (double)(after.occupancySum - before.occupancySum) / queued : 0, server->occupancyMax(),
+         total.commandsReceived / seconds, latencyPercentile(total.latency, 0.5), latencyPercentile(total.latency, 0.99),
+         (after.airtimeUs - before.airtimeUs) / (seconds * 10000), server->level(), server->alarms(),
+         server->alarmsDropped(), server->alarmPercentile(0.99), server->alarmMaxUs() / 1000.0,
+         latencyPercentile(total.joinLatency, 0.5), latencyPercentile(total.joinLatency, 0.99),
+         total.joinMaxUs / 1000.0, total.paired ? (double)total.joinRequests / total.paired : 0);
+  if (server->rejectedJoins() > 0)
+  {
+    fprintf(stderr, "  %u join requests refused, peer table full at %u\n", server->rejectedJoins(), (unsigned)server->paired());
+  }
+  if (total.sendFailures > 0)
+  {
+    fprintf(stderr, "  %llu frames could not be sent by the sensors\n", (unsigned long long)total.sendFailures);
+  }
+  fflush(stdout);
+  delete server;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: fleet_load [--sensors n,n,...] [--procs n] [--seconds s] [--warmup s]\n"
+                  "                  [--motion-period s] [--smoke-alarms per-min] [--slowdown f] [--port p]\n"
+                  "                  [--rate 1M|2M|6M|...|54M] [--report-control on|off] [--fast-lane on|off]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  fleet_options options;
+  options.steps = {64, 128, 256};
+  options.procs = 4;
+  options.seconds = 10;
+  options.warmup = 3;
+  options.motionPeriod = 10;
+  options.smokeAlarms = 2;
+  options.slowdown = 1;
+  options.port = 47300;
+  options.rate = LINK_RATE_1M;
+  options.reportControl = true;
+  options.fastLane = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--sensors") == 0)
+    {
+      options.steps.clear();
+      for (const char *p = value; *p != '\0';)
+      {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p || n == 0)
+        {
+          usage();
+        }
+        options.steps.push_back((unsigned)n);
+        p = *end == ',' ? end + 1 : end;
+      }
+    }
+    else if (strcmp(argv[i - 1], "--procs") == 0)
+    {
+      options.procs = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--seconds") == 0)
+    {
+      options.seconds = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--warmup") == 0)
+    {
+      options.warmup = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--motion-period") == 0)
+    {
+      options.motionPeriod = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--smoke-alarms") == 0)
+    {
+      options.smokeAlarms = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--slowdown") == 0)
+    {
+      options.slowdown = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--port") == 0)
+    {
+      options.port = (uint16_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--rate") == 0)
+    {
+      options.rate = LINK_RATE_COUNT;
+      for (uint8_t rate = 0; rate < LINK_RATE_COUNT; rate++)
+      {
+        if (strcmp(value, linkRateName(rate)) == 0)
+        {
+          options.rate = rate;
+        }
+      }
+      if (options.rate == LINK_RATE_COUNT)
+      {
+        usage();
+      }
+    }
+    else if (strcmp(argv[i - 1], "--report-control") == 0)
+    {
+      if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+      {
+        usage();
+      }
+      options.reportControl = strcmp(value, "on") == 0;
+    }
+    else if (strcmp(argv[i - 1], "--fast-lane") == 0)
+    {
+      if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+      {
+        usage();
+      }
+      options.fastLane = strcmp(value, "on") == 0;
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (options.procs < 1 || options.procs > MAX_PROCS || options.seconds < 1 || options.motionPeriod <= 0)
+  {
+    usage();
+  }
+
+  printf("sensors paired  offered/s  handled/s qdrop%%  loss%% queue  max      cmd/s  p50(ms)  p99(ms)   air%%  level "
+         "alarms adrop  a99(ms) amax(ms)  j50(ms)  j99(ms) jmax(ms) tries\n");
+  for (unsigned fleetSize : options.steps)
+  {
+    runStep(fleetSize, options);
+  }
+  return 0;
+}
@@ -0,0 +1,361 @@
+// Host evaluation of the Server's sensor health checks (see
+// Server/lib/Health/Health.h): detection delay per fault and false alarm
+// rate, on synthetic smoke sensors with injected faults or on recorded
+// captures.
+//
+//   health_eval [--capture file.cap ...] [--runs 50] [--hours 2] [--interval 500] [--seed 1]
+//
+// Without --capture, each run makes --hours of one smoke sensor reporting
+// every --interval ms as the firmware does: a clean-air level between 10
+// and 30 percent wandering slowly with temperature, ADC noise, whole
+// percent readings and a few milliseconds of send jitter. Each fault
+// starts halfway through a run of its own:
+//   clean   none, for the false alarm rate
+//   drift   the clean-air level creeps up 1 percent every 4 minutes
+//   stuck   the reading freezes at its last value
+//   dead    the reading drops to 0 and stays there
+//   step    the reading jumps 15 percent and stays there
+//   silent  the sensor stops reporting
+// Per fault it prints the runs in which the expected state showed up, the
+// median and worst delay from the fault to it, and false alarms: any
+// state other than learning and ok before the fault (anywhere for clean),
+// counted once per episode and per sensor-hour.
+//
+// With --capture, every smoke sensor in the captures is replayed as it
+// was recorded and only the false alarms are counted.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Shared/SensorFrame
+//     -I../../Shared/ClockSync -I../../Server/lib/Capture -I../../Server/lib/Dispatch
+//     -I../../Server/lib/SensorStore -I../../Server/lib/Health health_eval.cpp
+//     ../../Shared/Pairing/Pairing.cpp ../../Shared/Pairing/PeerTable.cpp
+//     ../../Shared/SensorFrame/SensorFrame.cpp ../../Shared/ClockSync/ClockSync.cpp
+//     ../../Server/lib/Capture/Capture.cpp ../../Server/lib/Dispatch/Dispatch.cpp
+//     ../../Server/lib/SensorStore/SensorStore.cpp ../../Server/lib/Health/Health.cpp
+//     -o health_eval
+
+#include <Capture.h>
+#include <ClockSync.h>
+#include <Dispatch.h>
+#include <Health.h>
+#include <Pairing.h>
+#include <PeerTable.h>
+#include <SensorFrame.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define CHECK_EVERY_MS 1000 // How often the state is looked at, as the dashboard would
+
+enum
+{
+  FAULT_CLEAN,
+  FAULT_DRIFT,
+  FAULT_STUCK,
+  FAULT_DEAD,
+  FAULT_STEP,
+  FAULT_SILENT,
+  FAULT_COUNT
+};
+
+static const char *const faultNames[FAULT_COUNT] = {"clean", "drift", "stuck", "dead", "step", "silent"};
+static const uint8_t expected[FAULT_COUNT] = {HEALTH_OK, HEALTH_DRIFT, HEALTH_STUCK, HEALTH_STUCK, HEALTH_STEP,
+                                              HEALTH_SILENT};
+
+typedef struct trace
+{
+  std::vector<uint32_t> ms;
+  std::vector<int32_t> value;
+  uint32_t endMs;   // Replay runs to here, past the last reading for silence
+  uint32_t faultMs; // 0 for none
+} trace;
+
+typedef struct fault_result
+{
+  uint32_t runs;
+  uint32_t detected;
+  std::vector<uint32_t> delaysMs;
+  uint32_t falseAlarms;
+  double cleanHours; // Time before the fault, over all runs
+} fault_result;
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static double gaussian(unsigned *seed)
+{
+  return sqrt(-2 * log(uniform(seed))) * cos(2 * M_PI * uniform(seed));
+}
+
+static trace synthetic(uint8_t fault, double hours, uint32_t intervalMs, unsigned *seed)
+{
+  trace t;
+  t.endMs = (uint32_t)(hours * 3600 * 1000);
+  t.faultMs = fault == FAULT_CLEAN ? 0 : t.endMs / 2;
+  double level = 10 + uniform(seed) * 20;
+  double phase = uniform(seed) * 2 * M_PI;
+  int32_t frozen = 0;
+  for (uint32_t ms = 0; ms < t.endMs; ms += intervalMs)
+  {
+    bool faulty = t.faultMs != 0 && ms >= t.faultMs;
+    if (faulty && fault == FAULT_SILENT)
+    {
+      break;
+    }
+    // Temperature moves clean air a percent or so over a few hours
+    double air = level + 1.2 * sin(phase + 2 * M_PI * ms / (3 * 3600000.0));
+    if (faulty && fault == FAULT_DRIFT)
+    {
+      air += (ms - t.faultMs) / 240000.0;
+    }
+    if (faulty && fault == FAULT_STEP)
+    {
+      air += 15;
+    }
+    int32_t value = (int32_t)lround(air + 0.8 * gaussian(seed));
+    value = value < 0 ? 0 : value > 100 ? 100 : value;
+    if (!faulty)
+    {
+      frozen = value;
+    }
+    else if (fault == FAULT_STUCK)
+    {
+      value = frozen;
+    }
+    else if (fault == FAULT_DEAD)
+    {
+      value = 0;
+    }
+    t.ms.push_back(ms + 3 + (uint32_t)(rand_r(seed) % 7) - 3);
+    t.value.push_back(value);
+  }
+  return t;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(f);
+  return true;
+}
+
+// One trace per smoke sensor of the capture, as the Server would see them
+static bool fromCapture(std::vector<trace> &traces, const char *path)
+{
+  std::vector<uint8_t> data;
+  if (!readFile(path, data))
+  {
+    return false;
+  }
+  CaptureReader reader(data.data(), data.size());
+  if (!reader.valid())
+  {
+    fprintf(stderr, "%s: not a version %d capture\n", path, CAPTURE_VERSION);
+    return false;
+  }
+
+  static PeerTable peerTable;
+  std::vector<trace> series(PEER_TABLE_MAX);
+  capture_record record;
+  while (reader.next(&record))
+  {
+    bool changed;
+    if (record.kind == CAPTURE_RECORD_PEER)
+    {
+      peerTable.admit(record.mac, record.sensorType, record.capabilities, record.zone, &changed);
+      continue;
+    }
+    pairing_frame pairingFrame;
+    clock_sync_frame syncFrame;
+    if (pairingParseFrame(record.data, record.len, &pairingFrame))
+    {
+      if (pairingFrame.kind == PAIRING_JOIN_REQUEST)
+      {
+        peerTable.admit(record.mac, pairingFrame.sensorType, pairingFrame.capabilities, pairingFrame.zone, &changed);
+      }
+      continue;
+    }
+    if (clockSyncParseFrame(record.data, record.len, &syncFrame))
+    {
+      continue;
+    }
+    int id = peerTable.find(record.mac);
+    sensor_reading reading;
+    if (id < 0 || peerTable.at(id).sensorType != SENSOR_SMOKE ||
+        !dispatchDecode(SENSOR_SMOKE, record.data, record.len, &reading))
+    {
+      continue;
+    }
+    series[id].ms.push_back((uint32_t)((record.timeUs - reader.startUs()) / 1000));
+    series[id].value.push_back(reading.value);
+  }
+
+  for (trace &t : series)
+  {
+    if (!t.ms.empty())
+    {
+      t.endMs = t.ms.back();
+      t.faultMs = 0;
+      traces.push_back(t);
+    }
+  }
+  return true;
+}
+
+// Replay t into a fresh instance, looking at its state every CHECK_EVERY_MS
+static void replay(const trace &t, uint8_t fault, fault_result *result)
+{
+  static SensorHealth health;
+  health.clear(0);
+  result->runs++;
+  result->cleanHours += (t.faultMs != 0 ? t.faultMs : t.endMs) / 3600000.0;
+
+  bool alarmed = false, detected = false;
+  size_t next = 0;
+  for (uint32_t nowMs = CHECK_EVERY_MS; nowMs <= t.endMs && !detected; nowMs += CHECK_EVERY_MS)
+  {
+    while (next < t.ms.size() && t.ms[next] <= nowMs)
+    {
+      health.observe(0, SENSOR_SMOKE, t.ms[next], t.value[next]);
+      next++;
+    }
+    uint8_t state = health.state(0, nowMs);
+    bool bad = state != HEALTH_LEARNING && state != HEALTH_OK;
+    if (t.faultMs == 0 || nowMs < t.faultMs)
+    {
+      // One false alarm per episode of bad states
+      result->falseAlarms += bad && !alarmed;
+      alarmed = bad;
+    }
+    else if (state == expected[fault])
+    {
+      detected = true;
+      result->detected++;
+      result->delaysMs.push_back(nowMs - t.faultMs);
+    }
+  }
+}
+
+static void printResult(const char *name, fault_result &result, bool faulty)
+{
+  printf("%-8s %4lu runs", name, (unsigned long)result.runs);
+  if (faulty)
+  {
+    std::sort(result.delaysMs.begin(), result.delaysMs.end());
+    uint32_t median = result.delaysMs.empty() ? 0 : result.delaysMs[result.delaysMs.size() / 2];
+    uint32_t worst = result.delaysMs.empty() ? 0 : result.delaysMs.back();
+    printf("  detected %4lu  delay median %7.1f s  worst %7.1f s", (unsigned long)result.detected, median / 1000.0,
+           worst / 1000.0);
+  }
+  else
+  {
+    printf("  %45s", "");
+  }
+  printf("  false alarms %3lu (%.3f per sensor-hour)\n", (unsigned long)result.falseAlarms,
+         result.cleanHours > 0 ? result.falseAlarms / result.cleanHours : 0);
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: health_eval [--capture file.cap ...] [--runs 50] [--hours 2] [--interval 500] [--seed 1]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<const char *> captures;
+  int runs = 50;
+  double hours = 2;
+  uint32_t intervalMs = 500;
+  unsigned seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--capture") == 0)
+    {
+      captures.push_back(value);
+    }
+    else if (strcmp(argv[i - 1], "--runs") == 0)
+    {
+      runs = atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--hours") == 0)
+    {
+      hours = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--interval") == 0)
+    {
+      intervalMs = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (runs <= 0 || hours <= 0 || hours > 24 * 40 || intervalMs == 0)
+  {
+    usage();
+  }
+
+  if (!captures.empty())
+  {
+    std::vector<trace> traces;
+    for (const char *path : captures)
+    {
+      if (!fromCapture(traces, path))
+      {
+        return 1;
+      }
+    }
+    if (traces.empty())
+    {
+      fprintf(stderr, "no smoke readings\n");
+      return 1;
+    }
+    fault_result result = {};
+    for (const trace &t : traces)
+    {
+      replay(t, FAULT_CLEAN, &result);
+    }
+    printResult("capture", result, false);
+    return 0;
+  }
+
+  for (uint8_t fault = 0; fault < FAULT_COUNT; fault++)
+  {
+    fault_result result = {};
+    for (int run = 0; run < runs; run++)
+    {
+      trace t = synthetic(fault, hours, intervalMs, &seed);
+      replay(t, fault, &result);
+    }
+    printResult(faultNames[fault], result, fault != FAULT_CLEAN);
+  }
+  return 0;
+}
@@ -0,0 +1,532 @@
+// Host benchmark of the Server's compressed reading history (see
+// Server/lib/History/History.h): compression ratio and encode and decode
+// speed per series, on recorded captures or on synthetic traces.
+//
+//   history_bench [--capture file.cap ...] [--hours 1] [--seed 1] [--start ms]
+//                 [--only light|sound|smoke] [--expect-hours h]
+//
+// With --capture, every decodable reading in the captures is a sample of
+// its sensor's series, timed by the capture clock. Without, it makes
+// --hours of one light, sound and smoke sensor reporting as the firmware
+// does: light at 10 Hz on a day curve with ADC noise, sound at 2 Hz with
+// background noise and loud bursts, smoke at 2 Hz with a few percent of
+// noise. Send times jitter by a few milliseconds. --start sets the
+// millis() of the first sample, e.g. 4294000000 to cross the wrap, and
+// --only keeps one of the three.
+//
+// Per series it prints the samples, the blocks they take, bits per sample
+// (headers included), the ratio to 8 bytes per raw (time, value) sample,
+// encode and decode time per sample and the memory 24 h would take. It
+// checks that every series decodes back exactly, then feeds all of them
+// through the Server's block pool, which rolls up older blocks as it fills.
+// A range query over the middle of what each series kept must return
+// points in order with values the input had about then, one over the
+// last 10 s exactly the input, and
+// with --expect-hours every series must reach back at least that far.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Shared/SensorFrame
+//     -I../../Shared/ClockSync -I../../Server/lib/Capture -I../../Server/lib/Dispatch
+//     -I../../Server/lib/SensorStore -I../../Server/lib/History history_bench.cpp
+//     ../../Shared/Pairing/Pairing.cpp ../../Shared/Pairing/PeerTable.cpp
+//     ../../Shared/SensorFrame/SensorFrame.cpp ../../Shared/ClockSync/ClockSync.cpp
+//     ../../Server/lib/Capture/Capture.cpp ../../Server/lib/Dispatch/Dispatch.cpp
+//     ../../Server/lib/SensorStore/SensorStore.cpp ../../Server/lib/History/History.cpp
+//     -o history_bench
+
+#include <Capture.h>
+#include <ClockSync.h>
+#include <Dispatch.h>
+#include <History.h>
+#include <Pairing.h>
+#include <PeerTable.h>
+#include <SensorFrame.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define DAY_MS (24UL * 3600 * 1000)
+
+typedef struct trace
+{
+  std::string name;
+  std::vector<uint32_t> ms;
+  std::vector<int32_t> value;
+} trace;
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static int jitter(unsigned *seed)
+{
+  return (int)(rand_r(seed) % 7) - 3;
+}
+
+static void synthetic(std::vector<trace> &traces, double hours, unsigned seed, uint32_t startMs)
+{
+  uint32_t endMs = (uint32_t)(hours * 3600 * 1000);
+
+  trace light = {"light", {}, {}};
+  for (uint32_t t = 0; t < endMs; t += 100)
+  {
+    double day = sin(2 * M_PI * t / DAY_MS);
+    light.ms.push_back(startMs + t + 3 + jitter(&seed));
+    light.value.push_back(2048 + (int32_t)(1500 * day) + (int32_t)(uniform(&seed) * 17) - 8);
+  }
+
+  trace sound = {"sound", {}, {}};
+  int burst = 0;
+  for (uint32_t t = 0; t < endMs; t += 500)
+  {
+    if (burst == 0 && uniform(&seed) < 0.01)
+    {
+      burst = 2 + rand_r(&seed) % 8;
+    }
+    int32_t level = 250 + (int32_t)(uniform(&seed) * 61) - 30;
+    if (burst > 0)
+    {
+      level = 1500 + rand_r(&seed) % 1500;
+      burst--;
+    }
+    sound.ms.push_back(startMs + t + 3 + jitter(&seed));
+    sound.value.push_back(level);
+  }
+
+  trace smoke = {"smoke", {}, {}};
+  int32_t percent = 3;
+  for (uint32_t t = 0; t < endMs; t += 500)
+  {
+    double step = uniform(&seed);
+    if (step < 0.05 && percent > 0)
+    {
+      percent--;
+    }
+    else if (step > 0.95 && percent < 10)
+    {
+      percent++;
+    }
+    smoke.ms.push_back(startMs + t + 3 + jitter(&seed));
+    smoke.value.push_back(percent);
+  }
+
+  traces.push_back(light);
+  traces.push_back(sound);
+  traces.push_back(smoke);
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(f);
+  return true;
+}
+
+// One series per sensor of the capture, as the Server would record them
+static bool fromCapture(std::vector<trace> &traces, const char *path)
+{
+  std::vector<uint8_t> data;
+  if (!readFile(path, data))
+  {
+    return false;
+  }
+  CaptureReader reader(data.data(), data.size());
+  if (!reader.valid())
+  {
+    fprintf(stderr, "%s: not a version %d capture\n", path, CAPTURE_VERSION);
+    return false;
+  }
+
+  static PeerTable peerTable;
+  std::vector<trace> series(PEER_TABLE_MAX);
+  capture_record record;
+  while (reader.next(&record))
+  {
+    bool changed;
+    if (record.kind == CAPTURE_RECORD_PEER)
+    {
+      peerTable.admit(record.mac, record.sensorType, record.capabilities, record.zone, &changed);
+      continue;
+    }
+    pairing_frame pairingFrame;
+    clock_sync_frame syncFrame;
+    if (pairingParseFrame(record.data, record.len, &pairingFrame))
+    {
+      if (pairingFrame.kind == PAIRING_JOIN_REQUEST)
+      {
+        peerTable.admit(record.mac, pairingFrame.sensorType, pairingFrame.capabilities, pairingFrame.zone, &changed);
+      }
+      continue;
+    }
+    if (clockSyncParseFrame(record.data, record.len, &syncFrame))
+    {
+      continue;
+    }
+    int id = peerTable.find(record.mac);
+    sensor_reading reading;
+    if (id < 0 || !dispatchDecode(peerTable.at(id).sensorType, record.data, record.len, &reading))
+    {
+      continue;
+    }
+    trace &t = series[id];
+    if (t.name.empty())
+    {
+      t.name = std::string(sensorTypeName(peerTable.at(id).sensorType)) + " " + std::to_string(id);
+    }
+    t.ms.push_back((uint32_t)((record.timeUs - reader.startUs()) / 1000));
+    t.value.push_back(reading.value);
+  }
+
+  for (trace &t : series)
+  {
+    if (!t.ms.empty())
+    {
+      traces.push_back(t);
+    }
+  }
+  return true;
+}
+
+static void encode(const trace &t, std::vector<history_block> &blocks)
+{
+  blocks.clear();
+  for (size_t i = 0; i < t.ms.size(); i++)
+  {
+    if (blocks.empty() || !historyBlockAppend(&blocks.back(), t.ms[i], t.value[i]))
+    {
+      blocks.emplace_back();
+      historyBlockInit(&blocks.back(), t.ms[i], t.value[i]);
+    }
+  }
+}
+
+// Keeps the decode loop from being optimised away
+static volatile uint64_t sink;
+
+static size_t decode(const std::vector<history_block> &blocks, uint64_t *sum)
+{
+  size_t count = 0;
+  for (const history_block &block : blocks)
+  {
+    HistoryBlockReader reader(&block);
+    uint32_t ms;
+    int32_t value;
+    while (reader.next(&ms, &value))
+    {
+      *sum += ms + (uint32_t)value;
+      count++;
+    }
+  }
+  return count;
+}
+
+static bool roundTrip(const trace &t, const std::vector<history_block> &blocks)
+{
+  size_t i = 0;
+  for (const history_block &block : blocks)
+  {
+    HistoryBlockReader reader(&block);
+    uint32_t ms;
+    int32_t value;
+    while (reader.next(&ms, &value))
+    {
+      if (i >= t.ms.size() || ms != t.ms[i] || value != t.value[i])
+      {
+        fprintf(stderr, "%s: sample %zu decodes as (%u, %d)\n", t.name.c_str(), i, ms, value);
+        return false;
+      }
+      i++;
+    }
+  }
+  return i == t.ms.size();
+}
+
+// Best of a few runs of f, in ns per sample
+template <typename F> static double timeRuns(size_t samples, F f)
+{
+  double best = 0;
+  for (int run = 0; run < 5; run++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (run == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best / samples;
+}
+
+static bool bench(const std::vector<trace> &traces)
+{
+  bool ok = true;
+  printf("series         samples blocks  bits/sample  ratio  enc ns  dec ns  24h KB\n");
+  for (const trace &t : traces)
+  {
+    std::vector<history_block> blocks;
+    double encodeNs = timeRuns(t.ms.size(), [&] { encode(t, blocks); });
+    uint64_t sum = 0;
+    double decodeNs = timeRuns(t.ms.size(), [&] { decode(blocks, &sum); });
+    sink = sum;
+    if (!roundTrip(t, blocks))
+    {
+      ok = false;
+    }
+
+    size_t used = 0;
+    for (const history_block &block : blocks)
+    {
+      used += historyBlockUsed(&block);
+    }
+    double spanMs = t.ms.back() - t.ms.front() + 1.0;
+    double perDayKB = blocks.size() * (double)HISTORY_BLOCK_SIZE * DAY_MS / spanMs / 1024;
+    printf("%-12s %9zu %6zu %12.2f %6.1f %7.1f %7.1f %7.0f\n", t.name.c_str(), t.ms.size(), blocks.size(),
+           used * 8.0 / t.ms.size(), t.ms.size() * 8.0 / (blocks.size() * HISTORY_BLOCK_SIZE), encodeNs,
+           decodeNs, perDayKB);
+  }
+  return ok;
+}
+
+static bool inRange(uint32_t ms, uint32_t fromMs, uint32_t toMs)
+{
+  return ms - fromMs <= toMs - fromMs;
+}
+
+static std::vector<std::pair<uint32_t, int32_t>> query(const History &history, uint16_t id, uint32_t fromMs,
+                                                       uint32_t toMs)
+{
+  std::vector<std::pair<uint32_t, int32_t>> got;
+  HistoryReader reader(history, id, fromMs, toMs);
+  uint32_t ms;
+  int32_t value;
+  while (reader.next(&ms, &value))
+  {
+    got.push_back({ms, value});
+  }
+  return got;
+}
+
+// Feed every series through the Server's pool in time order, then query
+// what each series kept
+static bool pool(const std::vector<trace> &traces, double expectHours)
+{
+  static History history;
+  history.begin(HISTORY_RAM_BUDGET);
+  std::vector<size_t> pos(traces.size(), 0);
+  while (true)
+  {
+    size_t pick = traces.size();
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+      if (pos[i] < traces[i].ms.size() &&
+          (pick == traces.size() || (int32_t)(traces[i].ms[pos[i]] - traces[pick].ms[pos[pick]]) < 0))
+      {
+        pick = i;
+      }
+    }
+    if (pick == traces.size())
+    {
+      break;
+    }
+    history.append((uint16_t)pick, traces[pick].ms[pos[pick]], traces[pick].value[pos[pick]]);
+    pos[pick]++;
+  }
+
+  bool ok = true;
+  double keptHours = 0;
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    const trace &t = traces[i];
+    history_block oldest;
+    uint16_t next;
+    if (!history.read((uint16_t)i, history.oldestBlock((uint16_t)i), &oldest, &next))
+    {
+      printf("%s: nothing kept\n", t.name.c_str());
+      keptHours = 0;
+      continue;
+    }
+    uint32_t kept = t.ms.back() - oldest.firstMs;
+    printf("%s: %zu blocks back %.2f h\n", t.name.c_str(), history.blocks((uint16_t)i), kept / 3.6e6);
+    keptHours = i == 0 || kept / 3.6e6 < keptHours ? kept / 3.6e6 : keptHours;
+
+    // The middle third: rolled up, so in order, each value between the
+    // least and most read from its time to twice the gap to the next point
+    uint32_t fromMs = oldest.firstMs + kept / 3;
+    uint32_t toMs = t.ms.back() - kept / 3;
+    std::vector<std::pair<uint32_t, int32_t>> got = query(history, (uint16_t)i, fromMs, toMs);
+    size_t j = 0;
+    for (size_t k = 0; k < got.size(); k++)
+    {
+      uint32_t ms = got[k].first;
+      uint32_t spanMs = k + 1 < got.size() ? 2 * (got[k + 1].first - ms) : t.ms.back() - ms;
+      if (!inRange(ms, fromMs, toMs) || (k > 0 && (int32_t)(ms - got[k - 1].first) < 0))
+      {
+        fprintf(stderr, "%s: range query returned time %u out of range or order\n", t.name.c_str(), ms);
+        ok = false;
+        break;
+      }
+      while (j < t.ms.size() && (int32_t)(t.ms[j] - ms) < 0)
+      {
+        j++;
+      }
+      int32_t least = INT32_MAX, most = INT32_MIN;
+      for (size_t m = j; m < t.ms.size() && t.ms[m] - ms <= spanMs; m++)
+      {
+        least = std::min(least, t.value[m]);
+        most = std::max(most, t.value[m]);
+      }
+      if (got[k].second < least || got[k].second > most)
+      {
+        fprintf(stderr, "%s: range query returned (%u, %d), outside the %d to %d read then\n", t.name.c_str(), ms,
+                got[k].second, least, most);
+        ok = false;
+        break;
+      }
+    }
+    if (got.empty() && toMs - fromMs > 60000)
+    {
+      fprintf(stderr, "%s: range query returned nothing\n", t.name.c_str());
+      ok = false;
+    }
+
+    // The last 10 s: not thinned yet, so exactly the input
+    fromMs = t.ms.back() - 10000;
+    toMs = t.ms.back();
+    std::vector<std::pair<uint32_t, int32_t>> expected;
+    for (size_t k = 0; k < t.ms.size(); k++)
+    {
+      if (inRange(t.ms[k], fromMs, toMs))
+      {
+        expected.push_back({t.ms[k], t.value[k]});
+      }
+    }
+    got = query(history, (uint16_t)i, fromMs, toMs);
+    if (got != expected)
+    {
+      fprintf(stderr, "%s: last 10 s returned %zu samples, expected %zu\n", t.name.c_str(), got.size(),
+              expected.size());
+      ok = false;
+    }
+  }
+  printf("pool of %zu blocks (%zu KB): %zu in use, every series kept at least %.2f h\n", history.capacity(),
+         history.capacity() * HISTORY_BLOCK_SIZE / 1024, history.blocksInUse(), keptHours);
+  if (keptHours < expectHours)
+  {
+    fprintf(stderr, "a series kept less than %.2f h\n", expectHours);
+    ok = false;
+  }
+  return ok;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: history_bench [--capture file.cap ...] [--hours 1] [--seed 1] [--start ms]\n"
+                  "                     [--only light|sound|smoke] [--expect-hours h]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<const char *> captures;
+  double hours = 1;
+  unsigned seed = 1;
+  uint32_t startMs = 0;
+  const char *only = nullptr;
+  double expectHours = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--capture") == 0)
+    {
+      captures.push_back(value);
+    }
+    else if (strcmp(argv[i - 1], "--hours") == 0)
+    {
+      hours = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--start") == 0)
+    {
+      startMs = (uint32_t)strtoul(value, nullptr, 10);
+    }
+    else if (strcmp(argv[i - 1], "--only") == 0)
+    {
+      only = value;
+    }
+    else if (strcmp(argv[i - 1], "--expect-hours") == 0)
+    {
+      expectHours = atof(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (hours <= 0 || hours > 24 * 40)
+  {
+    usage();
+  }
+
+  std::vector<trace> traces;
+  for (const char *path : captures)
+  {
+    if (!fromCapture(traces, path))
+    {
+      return 1;
+    }
+  }
+  if (captures.empty())
+  {
+    synthetic(traces, hours, seed, startMs);
+    if (only != nullptr)
+    {
+      traces.erase(std::remove_if(traces.begin(), traces.end(), [&](const trace &t) { return t.name != only; }),
+                   traces.end());
+    }
+  }
+  if (traces.empty())
+  {
+    fprintf(stderr, "no readings\n");
+    return 1;
+  }
+  if (traces.size() > HISTORY_MAX_SERIES)
+  {
+    traces.resize(HISTORY_MAX_SERIES);
+  }
+
+  bool ok = bench(traces);
+  ok = pool(traces, expectHours) && ok;
+  if (!ok)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
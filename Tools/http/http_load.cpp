@@ -0,0 +1,440 @@
+// HTTP load generator for the Server's web routes. Point it at the Server
+// running on the host behind the simulator's socket front end:
+//
+//   (cd ../sim && ./build.sh && ./build/sim --serve 8080) &
+//   http_load [--port 8080] [--connections 16] [--seconds 10] [--warmup 2]
+//             [--paths /status/light,/status/sound,...] [--idle 200]
+//
+// Each connection is kept alive and has one request in flight at a time,
+// cycling through --paths (by default the dashboard page and the status
+// routes). After --warmup seconds, --seconds of requests are measured:
+//   req/s         completed requests per second
+//   p50 ... max   latency from writing the request to reading the last
+//                 byte of the response, in milliseconds
+// overall and per path, with the bytes per response.
+//
+// Then --idle more connections are opened and each makes one request and
+// stays open. The server's /_sim/stats before and after gives the memory
+// each open connection costs: process RSS and the front end's own buffers.
+// Servers without /_sim/stats (a board) skip this step.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 http_load.cpp -o http_load
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define LOAD_MAX_CONNECTIONS 4096
+#define LOAD_MAX_EVENTS 256
+#define LOAD_READ_CHUNK 16384
+
+typedef struct load_options
+{
+  std::string host;
+  uint16_t port;
+  unsigned connections;
+  unsigned seconds;
+  unsigned warmup;
+  unsigned idle;
+  std::vector<std::string> paths;
+} load_options;
+
+typedef struct path_stats
+{
+  std::vector<uint32_t> latenciesUs;
+  uint64_t bytes;
+  uint64_t non2xx;
+} path_stats;
+
+typedef struct load_connection
+{
+  int fd;
+  bool connected;
+  size_t nextPath;
+  std::string out;
+  size_t outPos;
+  std::string in;
+  size_t pathIndex; // Path of the request in flight
+  int64_t sentNs;
+  uint64_t done; // Responses read on this connection
+} load_connection;
+
+static int64_t nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int openConnection(const load_options &options)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+  {
+    perror("http_load: connect");
+    exit(1);
+  }
+  return fd;
+}
+
+// Length of the complete response at the start of in, or 0 if it is still arriving
+static size_t responseLength(const std::string &in, int *code)
+{
+  size_t end = in.find("\r\n\r\n");
+  if (end == std::string::npos)
+  {
+    return 0;
+  }
+  *code = atoi(in.c_str() + 9); // After "HTTP/1.1 "
+  size_t length = 0;
+  for (size_t pos = in.find("\r\n"); pos < end; pos = in.find("\r\n", pos + 2))
+  {
+    if (strncasecmp(in.c_str() + pos + 2, "Content-Length:", 15) == 0)
+    {
+      length = strtoul(in.c_str() + pos + 17, nullptr, 10);
+    }
+  }
+  return in.size() >= end + 4 + length ? end + 4 + length : 0;
+}
+
+// One request at a time on a fresh blocking connection; returns the body, empty on failure
+static std::string fetch(const load_options &options, const char *path, int *code)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+  *code = 0;
+  std::string in;
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+  {
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + options.host + "\r\nConnection: close\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size())
+    {
+      char buf[LOAD_READ_CHUNK];
+      ssize_t n;
+      while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+      {
+        in.append(buf, n);
+      }
+    }
+  }
+  close(fd);
+  size_t length = responseLength(in, code);
+  return length > 0 ? in.substr(in.find("\r\n\r\n") + 4) : std::string();
+}
+
+static long jsonNumber(const std::string &json, const char *key)
+{
+  size_t pos = json.find(std::string("\"") + key + "\":");
+  return pos == std::string::npos ? -1 : atol(json.c_str() + pos + strlen(key) + 3);
+}
+
+static void queueRequest(load_connection *conn, const load_options &options)
+{
+  conn->pathIndex = conn->nextPath;
+  conn->nextPath = (conn->nextPath + 1) % options.paths.size();
+  conn->out = "GET " + options.paths[conn->pathIndex] + " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+  conn->outPos = 0;
+  conn->sentNs = nowNs();
+}
+
+static bool flush(load_connection *conn)
+{
+  while (conn->outPos < conn->out.size())
+  {
+    ssize_t n = send(conn->fd, conn->out.data() + conn->outPos, conn->out.size() - conn->outPos, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn->outPos += n;
+  }
+  return true;
+}
+
+static void printLatencies(const char *label, std::vector<uint32_t> &us, double seconds, uint64_t bytes)
+{
+  if (us.empty())
+  {
+    printf("%-24s %9s\n", label, "0");
+    return;
+  }
+  std::sort(us.begin(), us.end());
+  size_t n = us.size();
+  printf("%-24s %9.1f %8.3f %8.3f %8.3f %8.3f %8.3f %8llu\n", label, n / seconds, us[(n - 1) / 2] / 1e3,
+         us[(n - 1) * 90 / 100] / 1e3, us[(n - 1) * 99 / 100] / 1e3, us[(n - 1) * 999 / 1000] / 1e3,
+         us[n - 1] / 1e3, (unsigned long long)(bytes / n));
+}
+
+static void runLoad(const load_options &options)
+{
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<load_connection> conns(options.connections);
+  for (size_t i = 0; i < conns.size(); i++)
+  {
+    load_connection &conn = conns[i];
+    conn.fd = openConnection(options);
+    conn.connected = false;
+    conn.nextPath = i % options.paths.size();
+    conn.done = 0;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &ev);
+  }
+
+  std::map<size_t, path_stats> stats;
+  uint64_t reconnects = 0;
+  int64_t startNs = nowNs();
+  int64_t measureNs = startNs + (int64_t)options.warmup * 1000000000;
+  int64_t endNs = measureNs + (int64_t)options.seconds * 1000000000;
+  epoll_event events[LOAD_MAX_EVENTS];
+  char buf[LOAD_READ_CHUNK];
+
+  while (nowNs() < endNs)
+  {
+    int n = epoll_wait(epollFd, events, LOAD_MAX_EVENTS, 100);
+    for (int e = 0; e < n; e++)
+    {
+      load_connection &conn = conns[events[e].data.u64];
+      bool failed = (events[e].events & (EPOLLERR | EPOLLHUP)) != 0;
+      if (!failed && !conn.connected && (events[e].events & EPOLLOUT))
+      {
+        conn.connected = true;
+        queueRequest(&conn, options);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = events[e].data.u64;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+        failed = !flush(&conn);
+      }
+      if (!failed && (events[e].events & EPOLLIN))
+      {
+        ssize_t got;
+        while ((got = recv(conn.fd, buf, sizeof(buf), 0)) > 0)
+        {
+          conn.in.append(buf, got);
+        }
+        failed = got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+
+        int code;
+        size_t length;
+        while ((length = responseLength(conn.in, &code)) > 0)
+        {
+          int64_t t = nowNs();
+          if (conn.sentNs >= measureNs)
+          {
+            path_stats &s = stats[conn.pathIndex];
+            s.latenciesUs.push_back((uint32_t)((t - conn.sentNs) / 1000));
+            s.bytes += length;
+            s.non2xx += code < 200 || code > 299;
+          }
+          conn.in.erase(0, length);
+          conn.done++;
+          if (conn.in.empty())
+          {
+            queueRequest(&conn, options);
+            failed = !flush(&conn);
+          }
+        }
+      }
+
+      // The server closed the connection or it broke: reconnect
+      if (failed)
+      {
+        if (nowNs() >= measureNs)
+        {
+          reconnects++;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = openConnection(options);
+        conn.connected = false;
+        conn.in.clear();
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u64 = events[e].data.u64;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &ev);
+      }
+    }
+  }
+
+  double seconds = options.seconds;
+  printf("%-24s %9s %8s %8s %8s %8s %8s %8s\n", "path", "req/s", "p50", "p90", "p99", "p99.9", "max", "bytes");
+  std::vector<uint32_t> all;
+  uint64_t allBytes = 0;
+  uint64_t non2xx = 0;
+  for (auto &entry : stats)
+  {
+    printLatencies(options.paths[entry.first].c_str(), entry.second.latenciesUs, seconds, entry.second.bytes);
+    all.insert(all.end(), entry.second.latenciesUs.begin(), entry.second.latenciesUs.end());
+    allBytes += entry.second.bytes;
+    non2xx += entry.second.non2xx;
+  }
+  printLatencies("all", all, seconds, allBytes);
+  printf("%llu responses, %llu not 2xx, %llu reconnects\n", (unsigned long long)all.size(),
+         (unsigned long long)non2xx, (unsigned long long)reconnects);
+
+  for (load_connection &conn : conns)
+  {
+    close(conn.fd);
+  }
+  close(epollFd);
+}
+
+static void measureIdle(const load_options &options)
+{
+  int code;
+  std::string before = fetch(options, "/_sim/stats", &code);
+  if (code != 200)
+  {
+    printf("\nno /_sim/stats on this server, memory per connection not measured\n");
+    return;
+  }
+
+  // Each idle connection has served one request, like a dashboard tab between polls
+  std::vector<int> fds;
+  std::string request = "GET " + options.paths[0] + " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+  char buf[LOAD_READ_CHUNK];
+  for (unsigned i = 0; i < options.idle; i++)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+    {
+      close(fd);
+      break;
+    }
+    std::string in;
+    ssize_t n;
+    while (responseLength(in, &code) == 0 && (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+      in.append(buf, n);
+    }
+    fds.push_back(fd);
+  }
+
+  std::string after = fetch(options, "/_sim/stats", &code);
+  long conns = jsonNumber(after, "connections") - jsonNumber(before, "connections");
+  long rssKb = jsonNumber(after, "rssKb") - jsonNumber(before, "rssKb");
+  long bytes = jsonNumber(after, "connectionBytes") - jsonNumber(before, "connectionBytes");
+  printf("\n%zu idle connections open (server sees %ld more)\n", fds.size(), conns);
+  if (conns > 0)
+  {
+    printf("  process RSS      %+ld kB, %.0f bytes per connection\n", rssKb, rssKb * 1024.0 / conns);
+    printf("  front-end buffers      %.0f bytes per connection\n", (double)bytes / conns);
+  }
+  for (int fd : fds)
+  {
+    close(fd);
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: http_load [--host a.b.c.d] [--port p] [--connections n] [--seconds s] [--warmup s]\n"
+                  "                 [--paths /a,/b,...] [--idle n]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  load_options options;
+  options.host = "127.0.0.1";
+  options.port = 8080;
+  options.connections = 16;
+  options.seconds = 10;
+  options.warmup = 2;
+  options.idle = 200;
+  options.paths = {"/", "/status/light", "/status/sound", "/status/motion", "/status/smoke", "/status/sensors"};
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--host") == 0)
+    {
+      options.host = value;
+    }
+    else if (strcmp(argv[i - 1], "--port") == 0)
+    {
+      options.port = (uint16_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--connections") == 0)
+    {
+      options.connections = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--seconds") == 0)
+    {
+      options.seconds = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--warmup") == 0)
+    {
+      options.warmup = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--idle") == 0)
+    {
+      options.idle = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--paths") == 0)
+    {
+      options.paths.clear();
+      std::string list(value);
+      for (size_t start = 0; start < list.size();)
+      {
+        size_t comma = list.find(',', start);
+        options.paths.push_back(list.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        start = comma == std::string::npos ? list.size() : comma + 1;
+      }
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (options.connections < 1 || options.connections > LOAD_MAX_CONNECTIONS || options.seconds < 1 ||
+      options.paths.empty())
+  {
+    usage();
+  }
+
+  printf("%s:%u  %u connections  %u s (after %u s warm-up)\n", options.host.c_str(), options.port, options.connections,
+         options.seconds, options.warmup);
+  runLoad(options);
+  if (options.idle > 0)
+  {
+    measureIdle(options);
+  }
+  return 0;
+}
@@ -0,0 +1,377 @@
+// Host simulation of the PHY rate selection in Shared/LinkQuality: sends a
+// stream of ESP-NOW frames over simulated links and compares the airtime
+// and delivery of the adaptive rate against fixed rates.
+//
+//   linkrate_sim [--trace static|marginal|walk|fading|interference|all] [--file trace.csv]
+//                [--frames 3000] [--interval 100] [--len 32] [--retries 7] [--seed 1]
+//
+// Each trace gives the link's RSSI over time:
+//   static        -60 dBm, a sensor in the same room
+//   marginal      -78 dBm, at the edge of the fastest rates
+//   walk          from -50 down to -90 dBm and back, someone carrying a sensor away
+//   fading        -72 dBm swinging 8 dB either side every 20 s
+//   interference  -55 dBm, with noise that costs 25 dB of margin for 2 s every
+//                 15 s; the RSSI does not show it, only the failures do
+// --file reads "ms,rssi" lines instead (# starts a comment) and
+// interpolates between them; it repeats when the frames outlast it.
+//
+// A frame is sent every --interval ms with --len payload bytes. Each
+// transmission is lost with the probability linkModelLoss() gives for its
+// rate at the RSSI of the moment, with up to 3 dB of noise, and is repeated
+// up to --retries times like the driver does. The strategies are:
+//   fixed 1M       every frame at the lowest rate, what the firmware did before
+//   best fixed     the fixed rate with the least airtime that still delivers
+//                  as many frames as 1M, less 0.5%; found after the fact
+//   adaptive       LinkQuality with the RSSI of frames from the peer, as in the firmware
+//   no RSSI        LinkQuality with delivery results only, as before the
+//                  first frame from the peer is heard
+// and each prints the share of frames delivered, the transmissions per
+// frame (the retries the driver hides from the firmware), the airtime, the
+// airtime against fixed 1M and the rate changes.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/LinkQuality linkrate_sim.cpp ../../Shared/LinkQuality/LinkQuality.cpp
+//     -o linkrate_sim
+
+#include <LinkQuality.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define RSSI_NOISE_DB 3
+#define ACK_TIMEOUT_US 200 // Waited after a transmission that was not acknowledged
+
+typedef struct sim_options
+{
+  const char *trace;
+  const char *path;
+  unsigned frames;
+  unsigned intervalMs;
+  unsigned len;
+  unsigned retries;
+  unsigned long seed;
+} sim_options;
+
+typedef struct trace_point
+{
+  double ms;
+  double rssi;
+} trace_point;
+
+typedef struct strategy_result
+{
+  unsigned delivered;
+  unsigned long transmissions;
+  double airtimeUs;
+  uint32_t rateChanges;
+} strategy_result;
+
+static uint64_t rngState;
+
+static uint64_t nextRandom()
+{
+  uint64_t z = (rngState += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static double uniform()
+{
+  return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int noisy(double rssi)
+{
+  return (int)lround(rssi + (uniform() * 2 - 1) * RSSI_NOISE_DB);
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: linkrate_sim [--trace static|marginal|walk|fading|interference|all] [--file trace.csv]\n"
+                  "                    [--frames N] [--interval ms] [--len bytes] [--retries N] [--seed N]\n");
+  exit(2);
+}
+
+// RSSI of a built-in trace at ms into a run of totalMs
+static double traceRssi(const char *trace, double ms, double totalMs)
+{
+  if (strcmp(trace, "static") == 0)
+  {
+    return -60;
+  }
+  if (strcmp(trace, "marginal") == 0)
+  {
+    return -78;
+  }
+  if (strcmp(trace, "walk") == 0)
+  {
+    double half = totalMs / 2;
+    double away = ms < half ? ms / half : (totalMs - ms) / half;
+    return -50 - 40 * away;
+  }
+  if (strcmp(trace, "fading") == 0)
+  {
+    return -72 + 8 * sin(2 * M_PI * ms / 20000);
+  }
+  return -55; // interference
+}
+
+// Margin lost to interference, which the RSSI of frames from the peer does not show
+static double traceInterference(const char *trace, double ms)
+{
+  return strcmp(trace, "interference") == 0 && fmod(ms, 15000) < 2000 ? 25 : 0;
+}
+
+static bool loadTrace(const char *path, std::vector<trace_point> &points)
+{
+  FILE *in = fopen(path, "r");
+  if (in == NULL)
+  {
+    perror(path);
+    return false;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    trace_point point;
+    if (line[0] == '#' || sscanf(line, "%lf,%lf", &point.ms, &point.rssi) != 2)
+    {
+      continue;
+    }
+    if (!points.empty() && point.ms <= points.back().ms)
+    {
+      fprintf(stderr, "%s: times must increase\n", path);
+      fclose(in);
+      return false;
+    }
+    points.push_back(point);
+  }
+  fclose(in);
+  if (points.empty())
+  {
+    fprintf(stderr, "%s: no ms,rssi lines\n", path);
+    return false;
+  }
+  return true;
+}
+
+static double fileRssi(const std::vector<trace_point> &points, double ms)
+{
+  double span = points.back().ms;
+  if (span > 0)
+  {
+    ms = fmod(ms, span);
+  }
+  if (ms <= points[0].ms)
+  {
+    return points[0].rssi;
+  }
+  for (size_t i = 1; i < points.size(); i++)
+  {
+    if (ms <= points[i].ms)
+    {
+      const trace_point &a = points[i - 1];
+      const trace_point &b = points[i];
+      return a.rssi + (b.rssi - a.rssi) * (ms - a.ms) / (b.ms - a.ms);
+    }
+  }
+  return points.back().rssi;
+}
+
+// Send one frame at rate over a link with rssi less the interference; returns whether it was delivered
+static bool sendFrame(const sim_options &options, uint8_t rate, double rssi, strategy_result &result)
+{
+  uint32_t airtime = linkAirtimeUs(rate, options.len);
+  for (unsigned attempt = 0; attempt <= options.retries; attempt++)
+  {
+    result.transmissions++;
+    result.airtimeUs += airtime;
+    if (uniform() >= linkModelLoss(rate, noisy(rssi)))
+    {
+      result.delivered++;
+      return true;
+    }
+    result.airtimeUs += ACK_TIMEOUT_US;
+  }
+  return false;
+}
+
+// Run the frames of one trace through every strategy, each with the same seed
+static void runTrace(const sim_options &options, const char *trace, const std::vector<trace_point> &points)
+{
+  double totalMs = (double)options.frames * options.intervalMs;
+  strategy_result fixed[LINK_RATE_COUNT];
+  strategy_result adaptive;
+  strategy_result blind;
+  memset(fixed, 0, sizeof(fixed));
+  memset(&adaptive, 0, sizeof(adaptive));
+  memset(&blind, 0, sizeof(blind));
+
+  double low = 0;
+  double high = -200;
+  for (uint8_t rate = 0; rate < LINK_RATE_COUNT; rate++)
+  {
+    rngState = options.seed;
+    for (unsigned i = 0; i < options.frames; i++)
+    {
+      double ms = (double)i * options.intervalMs;
+      double rssi = points.empty() ? traceRssi(trace, ms, totalMs) : fileRssi(points, ms);
+      low = rssi < low ? rssi : low;
+      high = rssi > high ? rssi : high;
+      sendFrame(options, rate, rssi - traceInterference(trace, ms), fixed[rate]);
+    }
+  }
+
+  link_quality links[2];
+  strategy_result *results[2] = {&adaptive, &blind};
+  for (int s = 0; s < 2; s++)
+  {
+    link_quality &link = links[s];
+    linkInit(&link);
+    rngState = options.seed;
+    for (unsigned i = 0; i < options.frames; i++)
+    {
+      double ms = (double)i * options.intervalMs;
+      double rssi = points.empty() ? traceRssi(trace, ms, totalMs) : fileRssi(points, ms);
+      if (s == 0)
+      {
+        // A frame heard from the peer since the last send
+        linkOnRssi(&link, noisy(rssi));
+      }
+      uint8_t rate = linkOnSend(&link, options.len);
+      linkOnResult(&link, sendFrame(options, rate, rssi - traceInterference(trace, ms), *results[s]));
+    }
+    results[s]->rateChanges = link.rateChanges;
+  }
+
+  uint8_t best = LINK_RATE_1M;
+  for (uint8_t rate = 1; rate < LINK_RATE_COUNT; rate++)
+  {
+    if (fixed[rate].delivered + options.frames / 200 >= fixed[LINK_RATE_1M].delivered &&
+        fixed[rate].airtimeUs < fixed[best].airtimeUs)
+    {
+      best = rate;
+    }
+  }
+
+  printf("\n%s: %u frames of %u bytes every %u ms, RSSI %.0f to %.0f dBm\n", trace, options.frames, options.len,
+         options.intervalMs, low, high);
+  printf("  %-16s %10s %9s %12s %7s %8s\n", "strategy", "delivered", "tx/frame", "airtime(ms)", "vs 1M", "changes");
+  struct
+  {
+    const char *name;
+    const strategy_result *result;
+  } rows[] = {{"fixed 1M", &fixed[LINK_RATE_1M]}, {NULL, &fixed[best]}, {"adaptive", &adaptive}, {"no RSSI", &blind}};
+  char bestName[24];
+  snprintf(bestName, sizeof(bestName), "best fixed %s", linkRateName(best));
+  rows[1].name = bestName;
+  for (const auto &row : rows)
+  {
+    const strategy_result &r = *row.result;
+    printf("  %-16s %9.2f%% %9.2f %12.1f %6.1f%% %8lu\n", row.name, 100.0 * r.delivered / options.frames,
+           (double)r.transmissions / options.frames, r.airtimeUs / 1000, 100.0 * r.airtimeUs / fixed[LINK_RATE_1M].airtimeUs,
+           (unsigned long)r.rateChanges);
+  }
+  printf("  adaptive saves %.1f%% of the airtime of fixed 1M (%.1f%% without RSSI)\n",
+         100.0 * (1 - adaptive.airtimeUs / fixed[LINK_RATE_1M].airtimeUs),
+         100.0 * (1 - blind.airtimeUs / fixed[LINK_RATE_1M].airtimeUs));
+}
+
+static unsigned parseCount(const char *text)
+{
+  char *end;
+  unsigned long value = strtoul(text, &end, 10);
+  if (*end != '\0' || value == 0 || value > 10000000)
+  {
+    usage();
+  }
+  return (unsigned)value;
+}
+
+int main(int argc, char **argv)
+{
+  sim_options options;
+  options.trace = "all";
+  options.path = NULL;
+  options.frames = 3000;
+  options.intervalMs = 100;
+  options.len = 32;
+  options.retries = 7;
+  options.seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--trace") == 0)
+    {
+      options.trace = value;
+    }
+    else if (strcmp(argv[i - 1], "--file") == 0)
+    {
+      options.path = value;
+    }
+    else if (strcmp(argv[i - 1], "--frames") == 0)
+    {
+      options.frames = parseCount(value);
+    }
+    else if (strcmp(argv[i - 1], "--interval") == 0)
+    {
+      options.intervalMs = parseCount(value);
+    }
+    else if (strcmp(argv[i - 1], "--len") == 0)
+    {
+      options.len = parseCount(value);
+      if (options.len > 250)
+      {
+        usage();
+      }
+    }
+    else if (strcmp(argv[i - 1], "--retries") == 0)
+    {
+      options.retries = strcmp(value, "0") == 0 ? 0 : parseCount(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      options.seed = parseCount(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  std::vector<trace_point> points;
+  if (options.path != NULL)
+  {
+    if (!loadTrace(options.path, points))
+    {
+      return 1;
+    }
+    runTrace(options, options.path, points);
+    return 0;
+  }
+
+  static const char *traces[] = {"static", "marginal", "walk", "fading", "interference"};
+  bool found = false;
+  for (const char *trace : traces)
+  {
+    if (strcmp(options.trace, "all") == 0 || strcmp(options.trace, trace) == 0)
+    {
+      runTrace(options, trace, points);
+      found = true;
+    }
+  }
+  if (!found)
+  {
+    usage();
+  }
+  return 0;
+}
@@ -0,0 +1,314 @@
+// Host evaluation of the Server's sensor liveness tracking (see
+// Server/lib/Liveness/Liveness.h): how soon a dead sensor goes offline,
+// how often a live one does, and what the timer wheel costs, on a
+// simulated fleet.
+//
+//   liveness_eval [--sensors 500] [--minutes 10] [--kill 0.2] [--loss 0.01] [--level 0] [--seed 1]
+//
+// The fleet is a quarter each of light, sound, smoke and motion sensors
+// sending as their firmware does at reporting level --level: light reads
+// every 100 ms, the others are heard at the heartbeat interval (sound and
+// smoke send a heartbeat between readings, motion between its edges),
+// with a few milliseconds of loop and channel jitter. Each frame is lost
+// with probability --loss. Halfway through, each sensor dies with
+// probability --kill and sends nothing more.
+//
+// The Server side runs as the radio task does: every frame goes through
+// onFrame() and then tick(), and between frames the task sleeps for
+// idleMs(). It prints, per sensor type:
+//   timeout    median and largest learned timeout at the kill
+//   detected   dead sensors that went offline
+//   delay      from the last frame sent to offline, median and worst
+//   false      offlines of live sensors, per sensor-hour
+// and then the time per onFrame() and per tick() from replaying the
+// recorded calls, and the share of one core the fleet takes.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -DLIVENESS_MAX_IDS=4096 -I../../Shared/Pairing -I../../Shared/SensorFrame
+//     -I../../Server/lib/Liveness liveness_eval.cpp ../../Shared/Pairing/Pairing.cpp
+//     ../../Shared/SensorFrame/SensorFrame.cpp ../../Server/lib/Liveness/Liveness.cpp -o liveness_eval
+
+#include <Liveness.h>
+#include <Pairing.h>
+#include <SensorFrame.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define LIGHT_INTERVAL_MS 100 // Light firmware loop; it reports on every one at level 0
+#define MOTION_PERIOD_MS 10000 // Mean time between motion edges
+#define JITTER_MS 6           // Loop and channel jitter, uniform
+#define RADIO_IDLE_MS 1000    // As in Server/src/main.cpp
+
+static const uint8_t fleetTypes[] = {SENSOR_LIGHT, SENSOR_SOUND, SENSOR_SMOKE, SENSOR_MOTION};
+
+typedef struct eval_sensor
+{
+  uint8_t sensorType;
+  bool dead;
+  uint32_t lastSentMs;
+  uint32_t offlineMs; // 0 while online
+} eval_sensor;
+
+// One call the radio task made, for the timing replay
+typedef struct eval_call
+{
+  uint32_t nowMs;
+  uint16_t id; // LIVENESS_NONE for a tick on its own
+} eval_call;
+
+typedef struct type_result
+{
+  std::vector<uint32_t> timeoutsMs;
+  std::vector<uint32_t> delaysMs;
+  uint32_t dead;
+  uint32_t falseOfflines;
+  double liveHours;
+} type_result;
+
+static std::vector<eval_sensor> sensors;
+static uint32_t clockMs;
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static void onOffline(uint16_t id)
+{
+  if (sensors[id].offlineMs == 0)
+  {
+    sensors[id].offlineMs = clockMs;
+  }
+}
+
+// Time from one frame of a sensor to its next
+static uint32_t nextGapMs(const eval_sensor &sensor, int8_t level, unsigned *seed)
+{
+  uint32_t gap = frameHeartbeatMs(level);
+  if (sensor.sensorType == SENSOR_LIGHT)
+  {
+    gap = LIGHT_INTERVAL_MS << (level > 0 ? level : 0);
+  }
+  else if (sensor.sensorType == SENSOR_MOTION)
+  {
+    // An edge may come before the heartbeat is due
+    uint32_t edge = (uint32_t)(-log(uniform(seed)) * MOTION_PERIOD_MS);
+    gap = edge < gap ? edge + 1 : gap;
+  }
+  return gap + (uint32_t)(rand_r(seed) % JITTER_MS);
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, double fraction)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)(fraction * (values.size() - 1) + 0.5);
+  return values[rank];
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: liveness_eval [--sensors 500] [--minutes 10] [--kill 0.2] [--loss 0.01] [--level 0] "
+                  "[--seed 1]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned count = 500;
+  double minutes = 10;
+  double kill = 0.2;
+  double loss = 0.01;
+  int level = 0;
+  unsigned seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--sensors") == 0)
+    {
+      count = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--minutes") == 0)
+    {
+      minutes = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--kill") == 0)
+    {
+      kill = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--loss") == 0)
+    {
+      loss = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--level") == 0)
+    {
+      level = atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (count == 0 || count > LIVENESS_MAX_IDS || minutes <= 0 || minutes > 24 * 60 || kill < 0 || kill > 1 ||
+      loss < 0 || loss >= 1 || level < 0 || level > 5)
+  {
+    usage();
+  }
+
+  uint32_t endMs = (uint32_t)(minutes * 60000);
+  uint32_t killMs = endMs / 2;
+  static SensorLiveness liveness;
+  liveness.setLevel((int8_t)level);
+
+  // Frames in flight: (arrival, id), and each sensor's next send
+  typedef std::pair<uint32_t, uint16_t> timed;
+  std::priority_queue<timed, std::vector<timed>, std::greater<timed>> sends, arrivals;
+  sensors.resize(count);
+  for (unsigned id = 0; id < count; id++)
+  {
+    sensors[id].sensorType = fleetTypes[id % 4];
+    sends.push({1 + rand_r(&seed) % 1000, (uint16_t)id}); // Powered up over the first second
+  }
+
+  std::vector<type_result> results(SENSOR_LIGHT + 1);
+  std::vector<eval_call> calls;
+  bool killed = false;
+  clockMs = 0;
+  while (clockMs < endMs)
+  {
+    // The radio task wakes for the next arrival or its tick, whichever is first
+    uint32_t wakeMs = clockMs + liveness.idleMs(clockMs, RADIO_IDLE_MS);
+    if (!arrivals.empty() && arrivals.top().first < wakeMs)
+    {
+      wakeMs = arrivals.top().first;
+    }
+    // Sensors send up to then
+    while (!sends.empty() && sends.top().first <= wakeMs)
+    {
+      timed send = sends.top();
+      sends.pop();
+      eval_sensor &sensor = sensors[send.second];
+      if (!killed && send.first >= killMs)
+      {
+        killed = true;
+        for (unsigned id = 0; id < count; id++)
+        {
+          results[sensors[id].sensorType].timeoutsMs.push_back(liveness.timeoutMs((uint16_t)id));
+          sensors[id].dead = uniform(&seed) <= kill;
+        }
+      }
+      if (sensor.dead)
+      {
+        continue;
+      }
+      sensor.lastSentMs = send.first;
+      if (uniform(&seed) > loss)
+      {
+        arrivals.push({send.first + 1 + rand_r(&seed) % 2, send.second});
+      }
+      sends.push({send.first + nextGapMs(sensor, (int8_t)level, &seed), send.second});
+      if (!arrivals.empty() && arrivals.top().first < wakeMs)
+      {
+        wakeMs = arrivals.top().first;
+      }
+    }
+
+    clockMs = wakeMs;
+    uint16_t id = LIVENESS_NONE;
+    if (!arrivals.empty() && arrivals.top().first <= clockMs)
+    {
+      id = arrivals.top().second;
+      arrivals.pop();
+      if (liveness.onFrame(id, clockMs) && !sensors[id].dead)
+      {
+        // A live sensor that had been taken offline
+        results[sensors[id].sensorType].falseOfflines++;
+      }
+      sensors[id].offlineMs = 0;
+    }
+    liveness.tick(clockMs, onOffline);
+    calls.push_back({clockMs, id});
+  }
+
+  for (unsigned id = 0; id < count; id++)
+  {
+    const eval_sensor &sensor = sensors[id];
+    type_result &result = results[sensor.sensorType];
+    result.liveHours += (sensor.dead ? killMs : endMs) / 3600000.0;
+    if (!sensor.dead)
+    {
+      // Still offline at the end is a false offline too
+      result.falseOfflines += sensor.offlineMs != 0;
+      continue;
+    }
+    result.dead++;
+    if (sensor.offlineMs != 0)
+    {
+      result.delaysMs.push_back(sensor.offlineMs - sensor.lastSentMs);
+    }
+  }
+
+  printf("sensors %u  minutes %.1f  kill %.2f  loss %.3f  level %d  heartbeat %lu ms\n\n", count, minutes, kill, loss,
+         level, (unsigned long)frameHeartbeatMs((int8_t)level));
+  printf("type     timeout p50    max   dead detected  delay p50    max   false/sensor-hour\n");
+  for (uint8_t type : fleetTypes)
+  {
+    type_result &result = results[type];
+    uint32_t timeoutMedian = percentile(result.timeoutsMs, 0.5);
+    uint32_t timeoutMax = result.timeoutsMs.empty() ? 0 : result.timeoutsMs.back();
+    uint32_t delayMedian = percentile(result.delaysMs, 0.5);
+    uint32_t delayMax = result.delaysMs.empty() ? 0 : result.delaysMs.back();
+    printf("%-8s %8lu ms %6lu %6lu %8lu %8lu ms %6lu   %.4f (%lu)\n", sensorTypeName(type),
+           (unsigned long)timeoutMedian, (unsigned long)timeoutMax, (unsigned long)result.dead,
+           (unsigned long)result.delaysMs.size(), (unsigned long)delayMedian, (unsigned long)delayMax,
+           result.liveHours > 0 ? result.falseOfflines / result.liveHours : 0, (unsigned long)result.falseOfflines);
+  }
+
+  // Replay the radio task's calls on a fresh instance, timing only them
+  size_t frames = 0, ticks = calls.size();
+  double best = 0;
+  for (int round = 0; round < 5; round++)
+  {
+    static SensorLiveness replay;
+    for (unsigned id = 0; id < count; id++)
+    {
+      replay.clear((uint16_t)id);
+    }
+    replay.setLevel((int8_t)level);
+    frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const eval_call &call : calls)
+    {
+      if (call.id != LIVENESS_NONE)
+      {
+        replay.onFrame(call.id, call.nowMs);
+        frames++;
+      }
+      replay.tick(call.nowMs, nullptr);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    best = round == 0 || ns < best ? ns : best;
+  }
+  printf("\n%lu frames, %lu wakeups: %.1f ns per wakeup, %.4f%% of one core\n", (unsigned long)frames,
+         (unsigned long)ticks, best / ticks, best / 1e6 / endMs * 100);
+  return 0;
+}
@@ -0,0 +1,371 @@
+// Host simulation of the Server's ESP-NOW peer cache (see
+// Shared/Pairing/PeerCache.h): how often a command finds its target's
+// driver slot, what eviction costs and how often a send has to wait in the
+// SendQueue because every slot is pinned, on a simulated fleet.
+//
+//   peercache_sim [--sensors 200] [--events 20000] [--rate 5] [--ack-us 2000]
+//                 [--pattern fanout|zone|zipf|all] [--seed 1]
+//
+// Half the fleet are light and sound sensors, which take commands; the
+// rest never hold a slot. Command events come --rate times a second on
+// average, and each one is a burst of sends made back to back, as the
+// radio task makes them:
+//   fanout  every command sensor, as sendCommand() does for a type mask
+//   zone    the command sensors of one of 16 zones, picked at random;
+//           zones interleave across the command sensors
+//   zipf    one command sensor, picked with Zipf (s = 1) popularity, as
+//           single-peer traffic like join accepts
+// A send's completion arrives --ack-us later, half to one and a half
+// times that, and is handled in order with the events, as the send
+// callback's queued event is; each one unpins a slot and sends what waits
+// in the SendQueue, as resumeQueuedSends() does. Completions are never
+// lost here.
+//
+// The driver behind the cache is a counter of registered peers that
+// refuses past ESP_NOW_MAX_TOTAL_PEER_NUM less the broadcast peer, and
+// that fails the run if a peer with a send in flight is removed. Per
+// pattern it prints the sends made, how many of them waited for a slot
+// and how long on average, the hit rate, evictions per send, the most
+// peers registered at once and the time per acquire() and release().
+// Once the last event's sends have completed, every target of every
+// event must have been sent its command; the run fails if one was not.
+//
+// PEER_CACHE_SLOTS is a build option; add -DPEER_CACHE_SLOTS=n to compare.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing peercache_sim.cpp
+//     ../../Shared/Pairing/PeerCache.cpp ../../Shared/Pairing/SendQueue.cpp -o peercache_sim
+
+#include <PeerCache.h>
+#include <SendQueue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define DRIVER_MAX_PEERS 19 // ESP_NOW_MAX_TOTAL_PEER_NUM less the broadcast peer
+#define ZONES 16
+
+// Driver state, checked on every call from the cache
+static std::vector<bool> registered;
+static std::vector<uint32_t> inFlight;
+static size_t registeredCount;
+static size_t registeredMax;
+static bool failed; // A driver check failed or a target never got its command
+
+static uint16_t macToId(const uint8_t *mac)
+{
+  return (uint16_t)((mac[4] << 8) | mac[5]);
+}
+
+static void sensorMac(uint16_t id, uint8_t *mac)
+{
+  mac[0] = 0x02; // Locally administered
+  mac[1] = 0x00;
+  mac[2] = 0x00;
+  mac[3] = 0x00;
+  mac[4] = (uint8_t)(id >> 8);
+  mac[5] = (uint8_t)id;
+}
+
+static bool addDriverPeer(const uint8_t *mac)
+{
+  uint16_t id = macToId(mac);
+  if (registered[id] || registeredCount >= DRIVER_MAX_PEERS)
+  {
+    fprintf(stderr, "driver refused peer %u with %zu registered\n", id, registeredCount);
+    failed = true;
+    return false;
+  }
+  registered[id] = true;
+  registeredCount++;
+  registeredMax = registeredCount > registeredMax ? registeredCount : registeredMax;
+  return true;
+}
+
+static void removeDriverPeer(const uint8_t *mac)
+{
+  uint16_t id = macToId(mac);
+  if (!registered[id] || inFlight[id] > 0)
+  {
+    fprintf(stderr, "peer %u removed with %u sends in flight\n", id, inFlight[id]);
+    failed = true;
+  }
+  registered[id] = false;
+  registeredCount--;
+}
+
+// Light and sound sensors take commands
+static bool takesCommands(unsigned id)
+{
+  return id % 4 < 2;
+}
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+typedef struct sim_result
+{
+  uint64_t sends;
+  uint64_t queued;  // Sends that waited for a slot
+  uint64_t refused; // Sends the full queue turned away
+  double waitUs;    // Mean wait of the queued sends
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  size_t registeredMax;
+  double nsPerCall;
+} sim_result;
+
+typedef std::pair<uint64_t, uint16_t> completion; // Time, peer ID
+
+static sim_result run(const std::string &pattern, unsigned sensors, unsigned events, double rate, uint32_t ackUs,
+                      unsigned seed)
+{
+  registered.assign(sensors, false);
+  inFlight.assign(sensors, 0);
+  registeredCount = 0;
+  registeredMax = 0;
+
+  std::vector<uint16_t> commandIds;
+  for (unsigned id = 0; id < sensors; id++)
+  {
+    if (takesCommands(id))
+    {
+      commandIds.push_back((uint16_t)id);
+    }
+  }
+
+  // Zipf weights over the command sensors, in shuffled order
+  std::vector<double> cumulative(commandIds.size());
+  double sum = 0;
+  for (size_t i = 0; i < commandIds.size(); i++)
+  {
+    sum += 1.0 / (i + 1);
+    cumulative[i] = sum;
+  }
+  std::vector<uint16_t> byPopularity = commandIds;
+  for (size_t i = byPopularity.size(); i > 1; i--)
+  {
+    std::swap(byPopularity[i - 1], byPopularity[rand_r(&seed) % i]);
+  }
+
+  PeerCache cache(addDriverPeer, removeDriverPeer);
+  SendQueue queue;
+  static const char command[] = "disable1";
+  std::priority_queue<completion, std::vector<completion>, std::greater<completion>> pending;
+  std::vector<bool> owed(sensors, false);        // Sent to by an event, but not since
+  std::vector<uint64_t> waitingSince(sensors, 0); // When the queued send was first queued
+  sim_result result;
+  memset(&result, 0, sizeof(result));
+  double callNs = 0;
+  uint64_t calls = 0;
+  double waitUs = 0;
+  uint64_t nowUs = 0;
+  uint8_t mac[6];
+
+  auto acquire = [&](uint16_t id)
+  {
+    sensorMac(id, mac);
+    auto start = std::chrono::steady_clock::now();
+    bool slot = cache.acquire(id, mac);
+    callNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    calls++;
+    return slot;
+  };
+  auto send = [&](uint16_t id, uint64_t atUs)
+  {
+    result.sends++;
+    owed[id] = false;
+    inFlight[id]++;
+    pending.push({atUs + (uint64_t)(ackUs * (0.5 + uniform(&seed))), id});
+  };
+  // Send callbacks up to untilUs, each sending what waits, as the radio task does
+  auto complete = [&](uint64_t untilUs)
+  {
+    while (!pending.empty() && pending.top().first <= untilUs)
+    {
+      uint64_t atUs = pending.top().first;
+      uint16_t id = pending.top().second;
+      pending.pop();
+      sensorMac(id, mac);
+      inFlight[id]--;
+      auto start = std::chrono::steady_clock::now();
+      cache.release(mac);
+      callNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      calls++;
+
+      queued_send waiting;
+      while (queue.peek(&waiting) && acquire(waiting.peerId))
+      {
+        queue.pop();
+        waitUs += atUs - waitingSince[waiting.peerId];
+        send(waiting.peerId, atUs);
+      }
+    }
+  };
+
+  for (unsigned event = 0; event < events; event++)
+  {
+    nowUs += (uint64_t)(-log(uniform(&seed)) * 1e6 / rate);
+    complete(nowUs);
+
+    std::vector<uint16_t> targets;
+    if (pattern == "fanout")
+    {
+      targets = commandIds;
+    }
+    else if (pattern == "zone")
+    {
+      unsigned zone = rand_r(&seed) % ZONES;
+      for (size_t i = zone; i < commandIds.size(); i += ZONES)
+      {
+        targets.push_back(commandIds[i]);
+      }
+    }
+    else
+    {
+      double pick = uniform(&seed) * sum;
+      size_t i = std::lower_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+      targets.push_back(byPopularity[i < byPopularity.size() ? i : byPopularity.size() - 1]);
+    }
+
+    // The burst goes out back to back, so no callback is handled within it;
+    // nothing jumps the sends already waiting
+    for (uint16_t id : targets)
+    {
+      owed[id] = true;
+      if (queue.size() == 0 && acquire(id))
+      {
+        send(id, nowUs);
+        continue;
+      }
+      size_t waiting = queue.size();
+      queued_send queued = {id, sizeof(command), (const uint8_t *)command, 0};
+      if (!queue.push(queued, false))
+      {
+        result.refused++;
+      }
+      else if (queue.size() > waiting)
+      {
+        result.queued++;
+        waitingSince[id] = nowUs;
+      }
+    }
+  }
+
+  // Every send still waiting goes out as the last completions come in
+  complete(UINT64_MAX);
+  for (unsigned id = 0; id < sensors; id++)
+  {
+    if (owed[id])
+    {
+      fprintf(stderr, "%s: sensor %u never got its command\n", pattern.c_str(), id);
+      failed = true;
+    }
+  }
+
+  result.waitUs = result.queued ? waitUs / result.queued : 0;
+  result.hits = cache.hits;
+  result.misses = cache.misses;
+  result.evictions = cache.evictions;
+  result.registeredMax = registeredMax;
+  result.nsPerCall = calls ? callNs / calls : 0;
+  return result;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: peercache_sim [--sensors 200] [--events 20000] [--rate 5] [--ack-us 2000]\n"
+                  "                     [--pattern fanout|zone|zipf|all] [--seed 1]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned sensors = 200;
+  unsigned events = 20000;
+  double rate = 5;
+  uint32_t ackUs = 2000;
+  std::string pattern = "all";
+  unsigned seed = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--sensors") == 0)
+    {
+      sensors = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--events") == 0)
+    {
+      events = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--rate") == 0)
+    {
+      rate = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--ack-us") == 0)
+    {
+      ackUs = (uint32_t)atol(value);
+    }
+    else if (strcmp(argv[i - 1], "--pattern") == 0)
+    {
+      pattern = value;
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (sensors < 4 || sensors > 65535 || events == 0 || rate <= 0 ||
+      (pattern != "fanout" && pattern != "zone" && pattern != "zipf" && pattern != "all"))
+  {
+    usage();
+  }
+
+  unsigned commandSensors = 0;
+  for (unsigned id = 0; id < sensors; id++)
+  {
+    commandSensors += takesCommands(id);
+  }
+  printf("%u sensors, %u take commands, %d cache slots, %u events at %.1f/s, completions after ~%u us\n", sensors,
+         commandSensors, PEER_CACHE_SLOTS, events, rate, (unsigned)ackUs);
+  printf("pattern       sends   queued  wait us  refused   hit%%  evict/send  max peers  ns/call\n");
+  const char *const patterns[] = {"fanout", "zone", "zipf"};
+  for (const char *name : patterns)
+  {
+    if (pattern != "all" && pattern != name)
+    {
+      continue;
+    }
+    sim_result r = run(name, sensors, events, rate, ackUs, seed);
+    uint32_t acquired = r.hits + r.misses;
+    printf("%-8s %10llu %8llu %8.0f %8llu %6.1f %11.3f %10zu %8.1f\n", name, (unsigned long long)r.sends,
+           (unsigned long long)r.queued, r.waitUs, (unsigned long long)r.refused, acquired ? r.hits * 100.0 / acquired : 0,
+           r.sends ? (double)r.evictions / r.sends : 0, r.registeredMax, r.nsPerCall);
+  }
+
+  if (failed)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,788 @@
+// Host benchmark of the Server's radio pipeline (see radioTaskMain() in
+// Server/src/main.cpp): how many frames a second the radio queue and task
+// get through, what the Wi-Fi task pays per frame, and how long frames
+// wait, against the old layout that handled every frame inside the
+// receive callback.
+//
+//   pipeline_bench [--sensors 64] [--rates 5000,20000,100000,0] [--seconds 3]
+//                  [--web 1] [--layout queued|inline|both] [--command-every 256]
+//
+// A thread in place of the Wi-Fi task delivers reading frames from a
+// paired fleet of --sensors, round robin, at each of --rates frames a
+// second (0: as fast as it can). With --layout queued it does what
+// OnDataRecv() and OnDataSent() do: stamp, classify and copy each event
+// into a queue of RADIO_QUEUE_DEPTH, keeping RADIO_SEND_RESERVE and
+// RADIO_ALARM_RESERVE slots free for completions and alarms, and a radio
+// thread handles them. With --layout inline the receive thread handles
+// each frame itself, as the Server did before the radio task. Frames the
+// receive thread falls more than RADIO_QUEUE_DEPTH behind on are dropped,
+// as the driver's own buffers would.
+//
+// Handling is handleFrame() less logging, tracing and clock sync: peer
+// lookup, liveness, metrics, decode, the sensor store, history, window
+// stats, health and the rules. Every --command-every frames a motion
+// sensor reports motion, and the command goes to every sound and light
+// sensor through PeerCache; each send completes when the receive thread
+// next looks, as the send callback would, and releases its driver slot.
+// Targets past the free slots wait in a SendQueue for those releases.
+// --web threads render /status/sensors over and over meanwhile, as the
+// web handlers read the stores the radio task writes.
+//
+// With two or more CPUs the receive and web threads are pinned to CPU 0
+// and the radio thread to CPU 1, as the Wi-Fi task and async_tcp run on
+// core 0 and the radio task on core 1. On one CPU the web threads take
+// time from the radio thread as they cannot on the Server, so the queued
+// runs with --web above 0 understate it there. Per run it prints:
+//   offered/s   frames delivered to the receive thread
+//   handled/s   frames handled
+//   drop%       frames refused by the queue or lost behind the receive thread
+//   cdrop       send completions refused by the queue; as on the Server
+//               the radio thread still unpins their driver slots
+//   sends       commands sent, after waiting for a slot or not
+//   queued      of those, sends that waited in the send queue
+//   refused     sends the full send queue turned away
+//   cb p50/p99  time the receive thread spends per frame, in us
+//   wait p50/p99  time from the callback to the radio thread, in us
+//   radio%      share of the radio thread's time spent handling
+//   renders/s   /status/sensors bodies the web threads wrote
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -pthread -I../../Shared/Pairing -I../../Shared/SensorFrame -I../../Shared/TextBuffer
+//     -I../../Server/lib/Dispatch -I../../Server/lib/SensorStore -I../../Server/lib/Metrics
+//     -I../../Server/lib/Views -I../../Server/lib/History -I../../Server/lib/Stats
+//     -I../../Server/lib/Health -I../../Server/lib/Liveness pipeline_bench.cpp
+//     ../../Shared/Pairing/Pairing.cpp ../../Shared/Pairing/PeerTable.cpp
+//     ../../Shared/Pairing/PeerCache.cpp ../../Shared/Pairing/SendQueue.cpp
+//     ../../Shared/SensorFrame/SensorFrame.cpp
+//     ../../Server/lib/Dispatch/Dispatch.cpp ../../Server/lib/SensorStore/SensorStore.cpp
+//     ../../Server/lib/Metrics/Metrics.cpp ../../Server/lib/Views/Views.cpp
+//     ../../Server/lib/History/History.cpp ../../Server/lib/Stats/Stats.cpp
+//     ../../Server/lib/Health/Health.cpp ../../Server/lib/Liveness/Liveness.cpp -o pipeline_bench
+
+#include <Dispatch.h>
+#include <Health.h>
+#include <History.h>
+#include <Liveness.h>
+#include <Metrics.h>
+#include <Pairing.h>
+#include <PeerCache.h>
+#include <PeerTable.h>
+#include <SendQueue.h>
+#include <SensorFrame.h>
+#include <SensorStore.h>
+#include <Stats.h>
+#include <Views.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <math.h>
+#include <mutex>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#define RADIO_QUEUE_DEPTH 32  // As in Server/src/main.cpp
+#define RADIO_SEND_RESERVE 8  // As in Server/src/main.cpp
+#define RADIO_ALARM_RESERVE 4 // As in Server/src/main.cpp
+#define MAX_FRAME 250         // ESP_NOW_MAX_DATA_LEN
+#define LATENCY_BUCKETS 160   // Quarter powers of two of nanoseconds
+#define WEB_CHUNK 1436        // Bytes per chunk of a chunked response, about one TCP segment
+#define MAX_WEB 8
+
+enum event_kind
+{
+  EVENT_RECEIVED,
+  EVENT_SENT,
+  EVENT_ALARM
+};
+
+// radio_event in Server/src/main.cpp, copied whole as xQueueSend() does
+typedef struct radio_event
+{
+  uint8_t kind;
+  uint8_t mac[6];
+  int8_t rssi;
+  uint8_t rate;
+  bool delivered;
+  uint16_t len;
+  uint64_t timeNs;
+  uint8_t data[MAX_FRAME];
+} radio_event;
+
+typedef struct bench_options
+{
+  unsigned sensors;
+  std::vector<double> rates;
+  double seconds;
+  unsigned web;
+  std::string layout;
+  unsigned commandEvery;
+} bench_options;
+
+typedef struct run_result
+{
+  uint64_t offered;
+  uint64_t handled;
+  uint64_t dropped;
+  uint64_t completionsDropped;
+  uint64_t sends;
+  uint64_t queued;
+  uint64_t refused;
+  uint64_t renders;
+  uint64_t radioBusyNs;
+  uint32_t callback[LATENCY_BUCKETS];
+  uint32_t wait[LATENCY_BUCKETS];
+} run_result;
+
+static uint64_t monotonicNs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t nowMs()
+{
+  return (uint32_t)(monotonicNs() / 1000000);
+}
+
+static int latencyBucket(uint64_t ns)
+{
+  if (ns < 1)
+  {
+    return 0;
+  }
+  int bucket = (int)(4 * log2((double)ns));
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// Latency below which the given fraction of samples fall, in us
+static double latencyPercentile(const uint32_t *buckets, double fraction)
+{
+  uint64_t total = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    total += buckets[i];
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)ceil(fraction * total), seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += buckets[i];
+    if (seen >= rank)
+    {
+      return pow(2.0, (i + 0.5) / 4) / 1000.0;
+    }
+  }
+  return 0;
+}
+
+static void pin(std::thread &thread, int cpu)
+{
+  if (std::thread::hardware_concurrency() < 2)
+  {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+}
+
+static bool addDriverPeer(const uint8_t *)
+{
+  return true;
+}
+
+static void removeDriverPeer(const uint8_t *)
+{
+}
+
+// The radio queue: FreeRTOS copies events in and out by value and never blocks the sender
+class RadioQueue
+{
+public:
+  // False if no more than reserve slots are free; front queues ahead of everything waiting
+  bool push(const radio_event &event, bool front, uint32_t reserve)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (RADIO_QUEUE_DEPTH - count <= reserve)
+    {
+      return false;
+    }
+    if (front)
+    {
+      head = (head + RADIO_QUEUE_DEPTH - 1) % RADIO_QUEUE_DEPTH;
+      events[head] = event;
+    }
+    else
+    {
+      events[(head + count) % RADIO_QUEUE_DEPTH] = event;
+    }
+    count++;
+    ready.notify_one();
+    return true;
+  }
+
+  // False if nothing arrived within timeoutMs
+  bool pop(radio_event *event, uint32_t timeoutMs)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]
+                        { return count > 0; }))
+    {
+      return false;
+    }
+    *event = events[head];
+    head = (head + 1) % RADIO_QUEUE_DEPTH;
+    count--;
+    return true;
+  }
+
+  uint32_t depth()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  radio_event events[RADIO_QUEUE_DEPTH];
+  uint32_t head = 0;
+  uint32_t count = 0;
+};
+
+// One sensor's reading frame, its sequence number bumped on every delivery
+typedef struct bench_sensor
+{
+  uint8_t mac[6];
+  uint8_t sensorType;
+  uint16_t len;
+  uint8_t frame[MAX_FRAME];
+} bench_sensor;
+
+static void makeMac(uint16_t id, uint8_t *mac)
+{
+  const uint8_t base[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x00};
+  memcpy(mac, base, 6);
+  mac[4] = (uint8_t)(id >> 8);
+  mac[5] = (uint8_t)id;
+}
+
+template <typename T> static void setFrame(bench_sensor &sensor, const T &message)
+{
+  memcpy(sensor.frame, &message, sizeof(message));
+  sensor.len = sizeof(message);
+}
+
+static void makeFrame(bench_sensor &sensor, uint16_t id)
+{
+  switch (sensor.sensorType)
+  {
+  case SENSOR_SOUND:
+  {
+    struct_message_sound m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.soundLevel = 40 + id % 20;
+    strcpy(m.soundStatus, "Quiet");
+    setFrame(sensor, m);
+    break;
+  }
+  case SENSOR_MOTION:
+  {
+    struct_message_motion m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.motionValue = 0;
+    strcpy(m.motionStatus, "No Motion");
+    setFrame(sensor, m);
+    break;
+  }
+  case SENSOR_SMOKE:
+  {
+    struct_message_smoke m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.smokePercentage = 3;
+    strcpy(m.smokeStatus, "Clear");
+    setFrame(sensor, m);
+    break;
+  }
+  default:
+  {
+    struct_message_light m = {};
+    frameStamp(&m.header, FRAME_READING, 1000, 1200);
+    m.lightLevel = 300 + id;
+    strcpy(m.brightnessPercentage, "45%");
+    setFrame(sensor, m);
+    break;
+  }
+  }
+}
+
+// The Server's state and threads for one run
+class PipelineServer
+{
+public:
+  PipelineServer(const bench_options &options, bool queued, double rate)
+      : options(options), queued(queued), rate(rate)
+  {
+    memset(&result, 0, sizeof(result));
+    history.begin(HISTORY_RAM_BUDGET);
+    static const uint8_t types[] = {SENSOR_SOUND, SENSOR_MOTION, SENSOR_SMOKE, SENSOR_LIGHT};
+    sensors.resize(options.sensors);
+    for (uint16_t id = 0; id < options.sensors; id++)
+    {
+      bench_sensor &sensor = sensors[id];
+      makeMac(id, sensor.mac);
+      sensor.sensorType = types[id % 4];
+      bool changed;
+      peers.admit(sensor.mac, sensor.sensorType, SENSOR_CAP_REPORTS | SENSOR_CAP_ACCEPTS_COMMANDS,
+                  id % VIEW_ZONE_COUNT, &changed);
+      makeFrame(sensor, id);
+    }
+  }
+
+  run_result run()
+  {
+    std::thread receiver(&PipelineServer::receiveMain, this);
+    pin(receiver, 0);
+    std::thread radio;
+    if (queued)
+    {
+      radio = std::thread(&PipelineServer::radioMain, this);
+      pin(radio, 1);
+    }
+    std::vector<std::thread> web;
+    for (unsigned i = 0; i < options.web; i++)
+    {
+      web.emplace_back(&PipelineServer::webMain, this);
+      pin(web.back(), 0);
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    running = false;
+    receiver.join();
+    if (queued)
+    {
+      radio.join();
+    }
+    for (std::thread &t : web)
+    {
+      t.join();
+    }
+    result.renders = renders.load();
+    return result;
+  }
+
+private:
+  // Stand-in for the Wi-Fi task: deliver frames on schedule, and the completions of sends made since
+  void receiveMain()
+  {
+    uint64_t intervalNs = rate > 0 ? (uint64_t)(1e9 / rate) : 0;
+    uint64_t dueNs = monotonicNs();
+    uint32_t next = 0;
+    uint32_t motionFrames = 0;
+    while (running)
+    {
+      deliverCompletions();
+
+      if (intervalNs > 0)
+      {
+        uint64_t now = monotonicNs();
+        if (now < dueNs)
+        {
+          // Sleep rather than spin, so a shared CPU goes to the other threads
+          timespec ts = {(time_t)(dueNs / 1000000000), (long)(dueNs % 1000000000)};
+          clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+          continue;
+        }
+        // The driver holds only so many frames for a callback that is late
+        uint64_t late = (now - dueNs) / intervalNs;
+        if (late > RADIO_QUEUE_DEPTH)
+        {
+          result.offered += late - RADIO_QUEUE_DEPTH;
+          result.dropped += late - RADIO_QUEUE_DEPTH;
+          dueNs += (late - RADIO_QUEUE_DEPTH) * intervalNs;
+        }
+        dueNs += intervalNs;
+      }
+
+      bench_sensor &sensor = sensors[next];
+      next = (next + 1) % sensors.size();
+      frame_header header;
+      memcpy(&header, sensor.frame, sizeof(header));
+      header.seq++;
+      memcpy(sensor.frame, &header, sizeof(header));
+      if (sensor.sensorType == SENSOR_MOTION)
+      {
+        // Motion on and off in turn, every commandEvery frames
+        struct_message_motion *m = (struct_message_motion *)sensor.frame;
+        motionFrames++;
+        m->motionValue = 0;
+        if (options.commandEvery > 0 && motionFrames % (options.commandEvery / 4 + 1) == 0)
+        {
+          m->motionValue = (motionFrames / (options.commandEvery / 4 + 1)) % 2 ? 1 : 2;
+        }
+      }
+      result.offered++;
+
+      uint64_t startNs = monotonicNs();
+      if (queued)
+      {
+        onDataRecv(sensor, startNs);
+      }
+      else
+      {
+        radio_event event;
+        fillEvent(&event, sensor, startNs);
+        handleFrame(event);
+        result.handled++;
+      }
+      result.callback[latencyBucket(monotonicNs() - startNs)]++;
+    }
+  }
+
+  void fillEvent(radio_event *event, const bench_sensor &sensor, uint64_t timeNs)
+  {
+    event->timeNs = timeNs;
+    event->kind = EVENT_RECEIVED;
+    memcpy(event->mac, sensor.mac, 6);
+    event->rssi = -60;
+    event->rate = 0;
+    event->delivered = false;
+    event->len = sensor.len;
+    memcpy(event->data, sensor.frame, sensor.len);
+  }
+
+  // OnDataRecv(): copy, classify and queue
+  void onDataRecv(const bench_sensor &sensor, uint64_t timeNs)
+  {
+    radio_event event;
+    fillEvent(&event, sensor, timeNs);
+    bool alarm = dispatchPriority(event.data, event.len) == DISPATCH_PRIORITY_ALARM;
+    event.kind = alarm ? EVENT_ALARM : EVENT_RECEIVED;
+    if (!queue.push(event, alarm, alarm ? RADIO_SEND_RESERVE : RADIO_SEND_RESERVE + RADIO_ALARM_RESERVE))
+    {
+      result.dropped++;
+      metrics.onRadioDropped();
+      return;
+    }
+    metrics.onRadioQueued(queue.depth());
+  }
+
+  // OnDataSent() for every send made since the last look
+  void deliverCompletions()
+  {
+    std::vector<uint16_t> done;
+    {
+      std::lock_guard<std::mutex> lock(sentMutex);
+      done.swap(sent);
+    }
+    for (uint16_t id : done)
+    {
+      radio_event event;
+      event.timeNs = monotonicNs();
+      event.kind = EVENT_SENT;
+      memcpy(event.mac, sensors[id].mac, 6);
+      event.delivered = true;
+      event.len = 0;
+      if (!queued)
+      {
+        handleSendCompleted(event);
+        resumeQueuedSends();
+      }
+      else if (!queue.push(event, false, 0))
+      {
+        result.completionsDropped++;
+        metrics.onRadioDropped();
+        std::lock_guard<std::mutex> lock(lostMutex);
+        lost.push_back(id);
+      }
+      else
+      {
+        metrics.onRadioQueued(queue.depth());
+      }
+    }
+  }
+
+  void radioMain()
+  {
+    radio_event event;
+    while (running)
+    {
+      bool received = queue.pop(&event, 100);
+      releaseLostSends();
+      if (!received)
+      {
+        continue;
+      }
+      uint64_t startNs = monotonicNs();
+      result.wait[latencyBucket(startNs - event.timeNs)]++;
+      metrics.onRadioDequeued((uint32_t)((startNs - event.timeNs) / 1000));
+      if (event.kind != EVENT_SENT)
+      {
+        handleFrame(event);
+        result.handled++;
+      }
+      else
+      {
+        handleSendCompleted(event);
+        resumeQueuedSends();
+      }
+      result.radioBusyNs += monotonicNs() - startNs;
+    }
+  }
+
+  // releaseLostSends(): unpin the peers whose completions the queue refused, and count them
+  void releaseLostSends()
+  {
+    std::vector<uint16_t> ids;
+    {
+      std::lock_guard<std::mutex> lock(lostMutex);
+      ids.swap(lost);
+    }
+    for (uint16_t id : ids)
+    {
+      cache.release(sensors[id].mac);
+      metrics.onSendCompleted(id, true);
+    }
+    resumeQueuedSends();
+  }
+
+  // handleFrame() less logging, tracing, clock sync and pairing
+  void handleFrame(const radio_event &event)
+  {
+    int id = peers.find(event.mac);
+    if (id < 0)
+    {
+      metrics.onUnknownFrame();
+      return;
+    }
+    uint8_t sensorType = peers.at(id).sensorType;
+    uint32_t ms = nowMs();
+    liveness.onFrame(id, ms);
+
+    frame_header header;
+    bool hasSeq = frameParseHeader(event.data, event.len, &header);
+    metrics.onFrame(id, sensorType, event.len, hasSeq, hasSeq ? header.seq : 0, event.rssi, ms);
+
+    sensor_reading reading;
+    if (dispatchDecode(sensorType, event.data, event.len, &reading))
+    {
+      store.update(id, sensorType, peers.at(id).zone, reading.value, reading.status, reading.flags, ms);
+      history.append(id, ms, reading.value);
+      stats.add(id, sensorType, ms, reading.value);
+      health.observe(id, sensorType, ms, reading.value);
+      rule_command command;
+      if (dispatchRule(&reading, &command))
+      {
+        sendCommand(command.command, command.typeMask);
+      }
+    }
+    metrics.onDispatched(id, (uint32_t)((monotonicNs() - event.timeNs) / 1000));
+  }
+
+  // sendCommand(): each send holds its driver slot until its completion is
+  // handled, and targets past the free slots wait in the send queue
+  void sendCommand(const char *command, uint32_t typeMask)
+  {
+    uint16_t targets[PEER_TABLE_MAX];
+    size_t targetCount = dispatchTargets(peers, typeMask, targets, PEER_TABLE_MAX);
+    for (size_t i = 0; i < targetCount; i++)
+    {
+      queued_send send = {targets[i], (uint8_t)(strlen(command) + 1), (const uint8_t *)command, 0};
+      if (sendQueue.size() == 0 && cache.acquire(targets[i], peers.at(targets[i]).mac))
+      {
+        sendToPeer(targets[i]);
+      }
+      else if (sendQueue.push(send, false))
+      {
+        result.queued++;
+      }
+      else
+      {
+        result.refused++;
+      }
+    }
+  }
+
+  // sendToPeer(): the send callback will come from the receive thread
+  void sendToPeer(uint16_t id)
+  {
+    result.sends++;
+    metrics.onSendQueued();
+    std::lock_guard<std::mutex> lock(sentMutex);
+    sent.push_back(id);
+  }
+
+  // resumeQueuedSends(): send what waits while driver slots are free
+  void resumeQueuedSends()
+  {
+    queued_send send;
+    while (sendQueue.peek(&send) && cache.acquire(send.peerId, peers.at(send.peerId).mac))
+    {
+      sendQueue.pop();
+      sendToPeer(send.peerId);
+    }
+  }
+
+  void handleSendCompleted(const radio_event &event)
+  {
+    cache.release(event.mac);
+    metrics.onSendCompleted(peers.find(event.mac), event.delivered);
+  }
+
+  // A web handler serving /status/sensors, chunk by chunk
+  void webMain()
+  {
+    char chunk[WEB_CHUNK];
+    while (running)
+    {
+      view_cursor cursor;
+      memset(&cursor, 0, sizeof(cursor));
+      uint32_t ms = nowMs();
+      while (viewSensors(chunk, sizeof(chunk), &cursor, store, health, liveness, ms, nullptr) > 0)
+      {
+      }
+      renders++;
+    }
+  }
+
+  const bench_options &options;
+  bool queued;
+  double rate;
+  std::atomic<bool> running{true};
+  run_result result;
+  std::atomic<uint64_t> renders{0};
+  std::vector<bench_sensor> sensors;
+  RadioQueue queue;
+  std::mutex sentMutex;
+  std::vector<uint16_t> sent; // Sends awaiting their callback
+  std::mutex lostMutex;
+  std::vector<uint16_t> lost; // Completions the queue refused
+
+  PeerTable peers;
+  PeerCache cache{addDriverPeer, removeDriverPeer};
+  SendQueue sendQueue;
+  SensorStore store;
+  History history;
+  WindowStats stats;
+  SensorHealth health;
+  SensorLiveness liveness;
+  Metrics metrics;
+};
+
+static bool parseList(const char *value, std::vector<double> &out)
+{
+  out.clear();
+  char *end;
+  while (*value != '\0')
+  {
+    out.push_back(strtod(value, &end));
+    if (end == value || (*end != ',' && *end != '\0') || out.back() < 0)
+    {
+      return false;
+    }
+    value = *end == ',' ? end + 1 : end;
+  }
+  return !out.empty();
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: pipeline_bench [--sensors 64] [--rates 5000,20000,100000,0] [--seconds 3]\n"
+                  "                      [--web 1] [--layout queued|inline|both] [--command-every 256]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  bench_options options;
+  options.sensors = 64;
+  options.rates = {5000, 20000, 100000, 0};
+  options.seconds = 3;
+  options.web = 1;
+  options.layout = "both";
+  options.commandEvery = 256;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    const char *name = argv[i - 1];
+    if (strcmp(name, "--sensors") == 0)
+    {
+      options.sensors = (unsigned)atoi(value);
+    }
+    else if (strcmp(name, "--rates") == 0)
+    {
+      if (!parseList(value, options.rates))
+      {
+        usage();
+      }
+    }
+    else if (strcmp(name, "--seconds") == 0)
+    {
+      options.seconds = atof(value);
+    }
+    else if (strcmp(name, "--web") == 0)
+    {
+      options.web = (unsigned)atoi(value);
+    }
+    else if (strcmp(name, "--layout") == 0)
+    {
+      options.layout = value;
+    }
+    else if (strcmp(name, "--command-every") == 0)
+    {
+      options.commandEvery = (unsigned)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (options.sensors < 4 || options.sensors > PEER_TABLE_MAX || options.seconds <= 0 || options.web > MAX_WEB ||
+      (options.layout != "queued" && options.layout != "inline" && options.layout != "both"))
+  {
+    usage();
+  }
+
+  printf("%u sensors, %u web threads, a command every %u frames, %.1f s per run%s\n", options.sensors, options.web,
+         options.commandEvery, options.seconds,
+         std::thread::hardware_concurrency() < 2 ? ", one CPU: threads not pinned" : "");
+  printf("layout  offered/s  handled/s  drop%%  cdrop  sends  queued  refused  cb p50  cb p99  wait p50  wait p99  radio%%  "
+         "renders/s\n");
+  for (bool queued : {false, true})
+  {
+    if (options.layout != "both" && (options.layout == "queued") != queued)
+    {
+      continue;
+    }
+    for (double rate : options.rates)
+    {
+      PipelineServer *server = new PipelineServer(options, queued, rate);
+      run_result r = server->run();
+      delete server;
+      double s = options.seconds;
+      printf("%-7s %9.0f %10.0f %6.2f %6llu %6llu %7llu %8llu %7.2f %7.2f %9.1f %9.1f %7.1f %10.0f\n",
+             queued ? "queued" : "inline", r.offered / s, r.handled / s, r.offered ? r.dropped * 100.0 / r.offered : 0,
+             (unsigned long long)r.completionsDropped, (unsigned long long)r.sends, (unsigned long long)r.queued,
+             (unsigned long long)r.refused,
+             latencyPercentile(r.callback, 0.5), latencyPercentile(r.callback, 0.99), latencyPercentile(r.wait, 0.5),
+             latencyPercentile(r.wait, 0.99), queued ? r.radioBusyNs / (s * 1e7) : 0.0, r.renders / s);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,297 @@
+// Host stress test of the seqlock that guards the Server's sensor slots
+// (see Server/lib/SensorStore/SensorStore.h): one writer thread updates a
+// few slots as fast as it can, as the radio task does, while reader
+// threads copy them with snapshot(), as the web handlers do.
+//
+//   seqlock_stress [--table store|peers] [--readers 3] [--slots 4] [--seconds 5]
+//
+// Every update writes one number n into all of a slot's fields: the value
+// and last-seen time are n, the zone and flags are bits 0-3 and 4-11, the
+// status is n printed in full width, and the frame count is n + 1 because
+// each slot's numbers start at 0. A snapshot whose fields do not agree is
+// a torn record. The test fails if any snapshot() is torn.
+//
+// One more reader copies the public columns straight, without the
+// version check, and counts its torn records. That run is expected to
+// find some, which shows the test can see tearing; on a host too slow to
+// ever interleave, it finds none and says so.
+//
+// With --table peers the writer removes and re-admits PeerTable entries
+// instead (see Shared/Pairing/PeerTable.h), each time with a MAC of six
+// equal bytes n and a type, capabilities and zone derived from n; it
+// takes up to 254 slots, so the MACs in the table stay distinct.
+//
+// It prints updates and snapshots per second, and the torn records of
+// each kind of reader. Build it with -fsanitize=thread to have the race
+// detector watch the checked readers too; it will also report the
+// unchecked reader, which races by design.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -pthread -I../../Server/lib/SensorStore -I../../Shared/Pairing seqlock_stress.cpp
+//     ../../Server/lib/SensorStore/SensorStore.cpp ../../Shared/Pairing/PeerTable.cpp -o seqlock_stress
+
+#include <PeerTable.h>
+#include <SensorStore.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define STRESS_TYPE 4 // SENSOR_LIGHT; any non-zero type
+
+typedef struct reader_result
+{
+  uint64_t reads;
+  uint64_t torn;
+} reader_result;
+
+static SensorStore store;
+static PeerTable peers;
+static std::atomic<bool> stop(false);
+
+static void formatStatus(uint32_t n, char *out)
+{
+  snprintf(out, SENSOR_STATUS_LEN, "%019u", (unsigned)n);
+}
+
+// Whether the fields all come from the same update
+static bool consistent(const sensor_snapshot &s)
+{
+  char expected[SENSOR_STATUS_LEN];
+  uint32_t n = (uint32_t)s.value;
+  formatStatus(n, expected);
+  return s.type == STRESS_TYPE && s.lastSeenMs == n && s.zone == (uint8_t)(n & 0x0f) &&
+         s.flags == (uint8_t)(n >> 4) && s.frames == n + 1 && memcmp(s.status, expected, SENSOR_STATUS_LEN) == 0;
+}
+
+static uint64_t writer(uint16_t slots)
+{
+  uint64_t updates = 0;
+  uint32_t n = 1; // Update 0 is written before the threads start
+  char status[SENSOR_STATUS_LEN];
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    formatStatus(n, status);
+    for (uint16_t id = 0; id < slots; id++)
+    {
+      store.update(id, STRESS_TYPE, (uint8_t)(n & 0x0f), (int32_t)n, status, (uint8_t)(n >> 4), n);
+    }
+    updates += slots;
+    n++;
+  }
+  return updates;
+}
+
+static void checkedReader(uint16_t slots, reader_result *result)
+{
+  uint16_t id = 0;
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    sensor_snapshot s;
+    if (store.snapshot(id, &s))
+    {
+      result->reads++;
+      result->torn += !consistent(s);
+    }
+    id = (id + 1) % slots;
+  }
+}
+
+// The same copy as snapshot(), minus the version check
+static void uncheckedReader(uint16_t slots, reader_result *result)
+{
+  uint16_t id = 0;
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    sensor_snapshot s;
+    s.type = ((volatile uint8_t *)store.type)[id];
+    s.zone = ((volatile uint8_t *)store.zone)[id];
+    s.flags = ((volatile uint8_t *)store.flags)[id];
+    s.value = ((volatile int32_t *)store.value)[id];
+    s.lastSeenMs = ((volatile uint32_t *)store.lastSeenMs)[id];
+    s.frames = ((volatile uint32_t *)store.frames)[id];
+    for (size_t i = 0; i < SENSOR_STATUS_LEN; i++)
+    {
+      s.status[i] = ((volatile char *)store.status[id])[i];
+    }
+    result->reads++;
+    result->torn += !consistent(s);
+    id = (id + 1) % slots;
+  }
+}
+
+// Entry written for number n; n is never 0, which would make the MAC empty
+static void makePeer(uint8_t n, peer_entry *peer)
+{
+  memset(peer->mac, n, 6);
+  peer->sensorType = n;
+  peer->capabilities = (uint8_t)~n;
+  peer->zone = (uint8_t)(n + 1);
+}
+
+static bool peerConsistent(const peer_entry &p)
+{
+  peer_entry expected;
+  makePeer(p.mac[0], &expected);
+  return memcmp(&p, &expected, sizeof(p)) == 0;
+}
+
+static uint64_t peerWriter(uint16_t slots)
+{
+  uint64_t updates = 0;
+  uint32_t n = slots; // Numbers below slots are admitted before the threads start
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    for (uint16_t id = 0; id < slots; id++)
+    {
+      // The only empty entry is the one just removed, so admit() refills it
+      peer_entry peer;
+      makePeer((uint8_t)(n % 255 + 1), &peer);
+      bool changed;
+      peers.remove(id);
+      peers.admit(peer.mac, peer.sensorType, peer.capabilities, peer.zone, &changed);
+      n++;
+    }
+    updates += slots;
+  }
+  return updates;
+}
+
+static void peerCheckedReader(uint16_t slots, reader_result *result)
+{
+  uint16_t id = 0;
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    peer_entry p;
+    if (peers.snapshot(id, &p))
+    {
+      result->reads++;
+      result->torn += !peerConsistent(p);
+    }
+    id = (id + 1) % slots;
+  }
+}
+
+// The same copy as snapshot(), minus the version check
+static void peerUncheckedReader(uint16_t slots, reader_result *result)
+{
+  uint16_t id = 0;
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    peer_entry p;
+    const volatile uint8_t *entry = (const volatile uint8_t *)&peers.at(id);
+    for (size_t i = 0; i < sizeof(p); i++)
+    {
+      ((uint8_t *)&p)[i] = entry[i];
+    }
+    if (p.mac[0] != 0)
+    {
+      result->reads++;
+      result->torn += !peerConsistent(p);
+    }
+    id = (id + 1) % slots;
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: seqlock_stress [--table store|peers] [--readers 3] [--slots 4] [--seconds 5]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  bool peerTable = false;
+  unsigned readers = 3;
+  unsigned slots = 4;
+  double seconds = 5;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--table") == 0 && (strcmp(value, "store") == 0 || strcmp(value, "peers") == 0))
+    {
+      peerTable = strcmp(value, "peers") == 0;
+    }
+    else if (strcmp(argv[i - 1], "--readers") == 0)
+    {
+      readers = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--slots") == 0)
+    {
+      slots = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--seconds") == 0)
+    {
+      seconds = atof(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (readers == 0 || readers > 64 || slots == 0 || slots > SENSOR_STORE_MAX || seconds <= 0 ||
+      (peerTable && slots > 254))
+  {
+    usage();
+  }
+
+  // Every slot holds update 0 before the readers start
+  char status[SENSOR_STATUS_LEN];
+  formatStatus(0, status);
+  for (uint16_t id = 0; id < slots; id++)
+  {
+    store.update(id, STRESS_TYPE, 0, 0, status, 0, 0);
+    peer_entry peer;
+    bool changed;
+    makePeer((uint8_t)(id % 255 + 1), &peer);
+    peers.admit(peer.mac, peer.sensorType, peer.capabilities, peer.zone, &changed);
+  }
+
+  std::vector<reader_result> results(readers + 1, reader_result{0, 0});
+  std::vector<std::thread> threads;
+  for (unsigned r = 0; r < readers; r++)
+  {
+    threads.emplace_back(peerTable ? peerCheckedReader : checkedReader, (uint16_t)slots, &results[r]);
+  }
+  threads.emplace_back(peerTable ? peerUncheckedReader : uncheckedReader, (uint16_t)slots, &results[readers]);
+
+  uint64_t updates = 0;
+  std::thread writing([&]
+                      { updates = peerTable ? peerWriter((uint16_t)slots) : writer((uint16_t)slots); });
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop.store(true);
+  writing.join();
+  for (std::thread &t : threads)
+  {
+    t.join();
+  }
+
+  uint64_t reads = 0, torn = 0;
+  for (unsigned r = 0; r < readers; r++)
+  {
+    reads += results[r].reads;
+    torn += results[r].torn;
+  }
+  const reader_result &unchecked = results[readers];
+  printf("%s, %u slots, 1 writer, %u readers, %.1f s\n", peerTable ? "PeerTable" : "SensorStore", slots, readers, seconds);
+  printf("updates/s      %12.0f\n", updates / seconds);
+  printf("snapshots/s    %12.0f  torn %llu\n", reads / seconds, (unsigned long long)torn);
+  printf("unchecked/s    %12.0f  torn %llu%s\n", unchecked.reads / seconds, (unsigned long long)unchecked.torn,
+         unchecked.torn == 0 ? " (no interleaving seen; the test proved nothing)" : "");
+  if (torn > 0)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
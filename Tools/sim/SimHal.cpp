@@ -0,0 +1,1298 @@
+// Simulated ESP32 HAL: the Arduino core, Wi-Fi, ESP-NOW, NVS, SPIFFS,
+// FreeRTOS and ESPAsyncWebServer calls the firmwares make, applied to the
+// node whose thread is running.
+
+#include "SimWorld.h"
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <Preferences.h>
+#include <LinkQuality.h>
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <ctype.h>
+
+#define SIM_SCAN_US 1800000        // Blocking scan of all 13 channels
+#define SIM_STA_CONNECT_US 2500000 // Association and DHCP with the router
+#define SIM_ROUTER_RSSI -60
+#define SIM_SPIFFS_BYTES 1441792 // SPIFFS partition of the default esp32dev layout
+#define SIM_ADC_MAX 4095
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+SPIFFSFS SPIFFS;
+
+// The node whose code is calling; HAL calls from anywhere else are a bug in the simulator
+static SimNode *node()
+{
+  SimNode *current = simWorld().currentNode();
+  if (current == nullptr)
+  {
+    fprintf(stderr, "sim: HAL call outside a node task\n");
+    abort();
+  }
+  return current;
+}
+
+// Time
+
+unsigned long millis()
+{
+  simWorld().countClockRead();
+  return (unsigned long)(node()->localUs() / 1000);
+}
+
+unsigned long micros()
+{
+  simWorld().countClockRead();
+  return (unsigned long)(uint32_t)node()->localUs();
+}
+
+int64_t esp_timer_get_time()
+{
+  simWorld().countClockRead();
+  return (int64_t)node()->localUs();
+}
+
+void delay(uint32_t ms)
+{
+  simWorld().sleepUs((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  simWorld().sleepUs(us);
+}
+
+void yield()
+{
+  simWorld().sleepUs(0);
+}
+
+uint32_t esp_random()
+{
+  return (uint32_t)simWorld().random();
+}
+
+void esp_deep_sleep_start()
+{
+  simWorld().halt(node(), "deep sleep");
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(int)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t)
+{
+  return ESP_OK;
+}
+
+void EspClass::restart()
+{
+  simWorld().halt(node(), "restart");
+}
+
+// GPIO, ADC and LEDC
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin < SIM_PINS)
+  {
+    node()->pinModes[pin] = mode;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin >= SIM_PINS)
+  {
+    return LOW;
+  }
+  SimNode *n = node();
+  if (n->pinModes[pin] == OUTPUT)
+  {
+    return n->pinOut[pin] ? HIGH : LOW;
+  }
+  if (n->pinIn[pin] >= 0)
+  {
+    return n->pinIn[pin] ? HIGH : LOW;
+  }
+  return n->pinModes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin < SIM_PINS)
+  {
+    simWorld().output(node(), SIM_OUTPUT_GPIO, pin, value ? HIGH : LOW);
+  }
+}
+
+uint16_t analogRead(uint8_t pin)
+{
+  if (pin >= SIM_PINS)
+  {
+    return 0;
+  }
+  return std::min<uint16_t>(node()->analogIn[pin], SIM_ADC_MAX);
+}
+
+double ledcSetup(uint8_t, double freq, uint8_t)
+{
+  return freq;
+}
+
+void ledcAttachPin(uint8_t, uint8_t)
+{
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty)
+{
+  if (channel < SIM_LEDC_CHANNELS)
+  {
+    simWorld().output(node(), SIM_OUTPUT_LEDC, channel, duty);
+  }
+}
+
+// String
+
+static std::string formatInteger(unsigned long long value, bool negative, unsigned char base)
+{
+  char digits[72];
+  size_t n = 0;
+  do
+  {
+    unsigned digit = (unsigned)(value % base);
+    digits[n++] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+    value /= base;
+  } while (value > 0);
+  std::string s(negative ? "-" : "");
+  while (n > 0)
+  {
+    s.push_back(digits[--n]);
+  }
+  return s;
+}
+
+static std::string formatSigned(long long value, unsigned char base)
+{
+  if (value < 0 && base == DEC)
+  {
+    return formatInteger(0ULL - (unsigned long long)value, true, base);
+  }
+  return formatInteger((unsigned long long)value, false, base);
+}
+
+String::String(const char *str) : s(str != nullptr ? str : "") {}
+String::String(const std::string &str) : s(str) {}
+String::String(char c) : s(1, c) {}
+String::String(int value, unsigned char base) : s(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : s(formatInteger(value, false, base)) {}
+String::String(long value, unsigned char base) : s(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : s(formatInteger(value, false, base)) {}
+String::String(long long value, unsigned char base) : s(formatSigned(value, base)) {}
+String::String(unsigned long long value, unsigned char base) : s(formatInteger(value, false, base)) {}
+
+String::String(double value, unsigned int decimals)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimals, value);
+  s = buf;
+}
+
+bool String::reserve(unsigned int size)
+{
+  s.reserve(size);
+  return true;
+}
+
+char String::charAt(unsigned int index) const
+{
+  return index < s.size() ? s[index] : '\0';
+}
+
+String &String::operator+=(const String &other)
+{
+  s += other.s;
+  return *this;
+}
+
+String &String::operator+=(const char *other)
+{
+  s += other != nullptr ? other : "";
+  return *this;
+}
+
+String &String::operator+=(char c)
+{
+  s.push_back(c);
+  return *this;
+}
+
+bool String::concat(const String &other)
+{
+  s += other.s;
+  return true;
+}
+
+bool String::startsWith(const String &prefix) const
+{
+  return s.compare(0, prefix.s.size(), prefix.s) == 0;
+}
+
+bool String::endsWith(const String &suffix) const
+{
+  return s.size() >= suffix.s.size() && s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  size_t pos = s.find(c, from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String &str, unsigned int from) const
+{
+  size_t pos = s.find(str.s, from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int from) const
+{
+  return from < s.size() ? String(s.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  if (from > to)
+  {
+    std::swap(from, to);
+  }
+  if (from >= s.size())
+  {
+    return String();
+  }
+  return String(s.substr(from, std::min<size_t>(to, s.size()) - from));
+}
+
+void String::replace(const String &find, const String &with)
+{
+  if (find.s.empty())
+  {
+    return;
+  }
+  size_t pos = 0;
+  while ((pos = s.find(find.s, pos)) != std::string::npos)
+  {
+    s.replace(pos, find.s.size(), with.s);
+    pos += with.s.size();
+  }
+}
+
+void String::trim()
+{
+  size_t begin = 0;
+  while (begin < s.size() && isspace((unsigned char)s[begin]))
+  {
+    begin++;
+  }
+  size_t end = s.size();
+  while (end > begin && isspace((unsigned char)s[end - 1]))
+  {
+    end--;
+  }
+  s = s.substr(begin, end - begin);
+}
+
+void String::toLowerCase()
+{
+  for (char &c : s)
+  {
+    c = (char)tolower((unsigned char)c);
+  }
+}
+
+long String::toInt() const
+{
+  return strtol(s.c_str(), nullptr, 10);
+}
+
+double String::toFloat() const
+{
+  return strtod(s.c_str(), nullptr);
+}
+
+String operator+(const String &a, const String &b)
+{
+  String result(a);
+  result += b;
+  return result;
+}
+
+String operator+(const String &a, const char *b)
+{
+  String result(a);
+  result += b;
+  return result;
+}
+
+String operator+(const char *a, const String &b)
+{
+  String result(a);
+  result += b;
+  return result;
+}
+
+// IPAddress
+
+IPAddress::IPAddress()
+{
+  memset(bytes, 0, sizeof(bytes));
+}
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+  bytes[0] = a;
+  bytes[1] = b;
+  bytes[2] = c;
+  bytes[3] = d;
+}
+
+String IPAddress::toString() const
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+  return String(buf);
+}
+
+// Print and Serial
+
+size_t Print::write(const uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    write(buf[i]);
+  }
+  return len;
+}
+
+size_t Print::print(long value, int base)
+{
+  return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(double value, int digits)
+{
+  return print(String(value, (unsigned int)digits));
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char small[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(small, sizeof(small), format, args);
+  va_end(args);
+  if (n < 0)
+  {
+    return 0;
+  }
+  if ((size_t)n < sizeof(small))
+  {
+    return write((const uint8_t *)small, n);
+  }
+
+  std::string big(n + 1, '\0');
+  va_start(args, format);
+  vsnprintf(&big[0], big.size(), format, args);
+  va_end(args);
+  return write((const uint8_t *)big.data(), n);
+}
+
+void HardwareSerial::begin(unsigned long)
+{
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len)
+{
+  simWorld().serialWrite(node(), buf, len);
+  return len;
+}
+
+// Wi-Fi
+
+bool WiFiClass::mode(wifi_mode_t)
+{
+  return true;
+}
+
+bool WiFiClass::setSleep(wifi_ps_type_t)
+{
+  return true;
+}
+
+bool WiFiClass::softAP(const char *ssid, const char *, int, int, int)
+{
+  SimNode *n = node();
+  n->apUp = true;
+  n->apSsid = ssid;
+  return true;
+}
+
+bool WiFiClass::softAPConfig(IPAddress localIp, IPAddress, IPAddress)
+{
+  SimNode *n = node();
+  for (int i = 0; i < 4; i++)
+  {
+    n->apIp[i] = localIp[i];
+  }
+  return true;
+}
+
+IPAddress WiFiClass::softAPIP()
+{
+  SimNode *n = node();
+  return IPAddress(n->apIp[0], n->apIp[1], n->apIp[2], n->apIp[3]);
+}
+
+// Joining the router moves the radio, and with it the soft AP, to the router's channel
+wl_status_t WiFiClass::begin(const char *ssid, const char *)
+{
+  SimNode *n = node();
+  SimWorld &world = simWorld();
+  n->staSsid = ssid;
+  n->staConnected = false;
+  if (n->staSsid == world.options().routerSsid)
+  {
+    uint8_t channel = world.options().routerChannel;
+    world.at(world.nowUs() + SIM_STA_CONNECT_US, [n, channel]
+             {
+      n->staConnected = true;
+      n->channel = channel; });
+  }
+  return WL_DISCONNECTED;
+}
+
+wl_status_t WiFiClass::status()
+{
+  return node()->staConnected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  SimNode *n = node();
+  if (!n->staConnected)
+  {
+    return IPAddress();
+  }
+  const std::vector<SimNode *> &nodes = simWorld().nodes();
+  size_t index = std::find(nodes.begin(), nodes.end(), n) - nodes.begin();
+  return IPAddress(192, 168, 0, (uint8_t)(10 + index));
+}
+
+int16_t WiFiClass::scanNetworks()
+{
+  SimWorld &world = simWorld();
+  world.sleepUs(SIM_SCAN_US);
+
+  SimNode *n = node();
+  n->scan.clear();
+  n->scan.push_back({world.options().routerSsid, world.options().routerChannel, SIM_ROUTER_RSSI});
+  for (SimNode *other : world.nodes())
+  {
+    if (other != n && other->apUp && !other->halted())
+    {
+      n->scan.push_back({other->apSsid, other->channel, world.linkRssi(n, other)});
+    }
+  }
+  return (int16_t)n->scan.size();
+}
+
+String WiFiClass::SSID(uint8_t index)
+{
+  SimNode *n = node();
+  return index < n->scan.size() ? String(n->scan[index].ssid) : String();
+}
+
+int32_t WiFiClass::RSSI(uint8_t index)
+{
+  SimNode *n = node();
+  return index < n->scan.size() ? n->scan[index].rssi : 0;
+}
+
+int32_t WiFiClass::channel(uint8_t index)
+{
+  SimNode *n = node();
+  return index < n->scan.size() ? n->scan[index].channel : 0;
+}
+
+int32_t WiFiClass::channel()
+{
+  return node()->channel;
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+  memcpy(mac, node()->mac(), 6);
+  return mac;
+}
+
+String WiFiClass::macAddress()
+{
+  const uint8_t *mac = node()->mac();
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(buf);
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t)
+{
+  if (primary < 1 || primary > 13)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  node()->channel = primary;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_config_espnow_rate(wifi_interface_t, wifi_phy_rate_t rate)
+{
+  // Only the rates LinkQuality picks from are modelled
+  for (uint8_t i = 0; i < LINK_RATE_COUNT; i++)
+  {
+    if (linkPhyRate(i) == rate)
+    {
+      node()->txRate = i;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_wifi_set_promiscuous(bool enable)
+{
+  node()->promiscuous = enable;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t *filter)
+{
+  node()->promiscuousFilter = filter != nullptr ? filter->filter_mask : WIFI_PROMIS_FILTER_MASK_ALL;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb)
+{
+  node()->promiscuousCb = cb;
+  return ESP_OK;
+}
+
+// ESP-NOW
+
+static std::vector<sim_mac>::iterator findPeer(SimNode *n, const uint8_t *mac)
+{
+  return std::find_if(n->peers.begin(), n->peers.end(),
+                      [mac](const sim_mac &peer) { return memcmp(peer.data(), mac, 6) == 0; });
+}
+
+esp_err_t esp_now_init()
+{
+  node()->espnowReady = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_deinit()
+{
+  SimNode *n = node();
+  n->espnowReady = false;
+  n->peers.clear();
+  n->recvCb = nullptr;
+  n->sendCb = nullptr;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+  SimNode *n = node();
+  if (!n->espnowReady)
+  {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  n->recvCb = cb;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+  SimNode *n = node();
+  if (!n->espnowReady)
+  {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  n->sendCb = cb;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+  SimNode *n = node();
+  if (!n->espnowReady)
+  {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  if (peer == nullptr)
+  {
+    return ESP_ERR_ESPNOW_ARG;
+  }
+  if (findPeer(n, peer->peer_addr) != n->peers.end())
+  {
+    return ESP_ERR_ESPNOW_EXIST;
+  }
+  if (n->peers.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM)
+  {
+    return ESP_ERR_ESPNOW_FULL;
+  }
+  sim_mac mac;
+  memcpy(mac.data(), peer->peer_addr, 6);
+  n->peers.push_back(mac);
+  return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *mac)
+{
+  SimNode *n = node();
+  if (!n->espnowReady)
+  {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  std::vector<sim_mac>::iterator it = findPeer(n, mac);
+  if (it == n->peers.end())
+  {
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+  }
+  n->peers.erase(it);
+  return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *mac)
+{
+  SimNode *n = node();
+  return findPeer(n, mac) != n->peers.end();
+}
+
+esp_err_t esp_now_get_peer_num(esp_now_peer_num_t *num)
+{
+  num->total_num = (int)node()->peers.size();
+  num->encrypt_num = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *mac, const uint8_t *data, size_t len)
+{
+  SimNode *n = node();
+  esp_err_t result = simWorld().radioSend(n, mac, data, len);
+  if (result != ESP_OK)
+  {
+    n->sendErrors++;
+  }
+  return result;
+}
+
+// Preferences
+
+Preferences::Preferences() : started(false), readOnly(false)
+{
+}
+
+Preferences::~Preferences()
+{
+  end();
+}
+
+std::string Preferences::path(const char *key) const
+{
+  return ns + "/" + key;
+}
+
+bool Preferences::begin(const char *name, bool readOnlyMode, const char *)
+{
+  ns = name;
+  started = true;
+  readOnly = readOnlyMode;
+  return true;
+}
+
+void Preferences::end()
+{
+  started = false;
+}
+
+bool Preferences::clear()
+{
+  if (!started || readOnly)
+  {
+    return false;
+  }
+  std::map<std::string, std::vector<uint8_t>> &nvs = node()->nvs;
+  std::string prefix = ns + "/";
+  for (auto it = nvs.begin(); it != nvs.end();)
+  {
+    it = it->first.compare(0, prefix.size(), prefix) == 0 ? nvs.erase(it) : std::next(it);
+  }
+  return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+  if (!started || readOnly)
+  {
+    return false;
+  }
+  return node()->nvs.erase(path(key)) > 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  return started && node()->nvs.count(path(key)) > 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+  if (!started || readOnly || key == nullptr || value == nullptr || len == 0)
+  {
+    return 0;
+  }
+  const uint8_t *bytes = (const uint8_t *)value;
+  node()->nvs[path(key)] = std::vector<uint8_t>(bytes, bytes + len);
+  return len;
+}
+
+// Like the real one: nothing is copied if the value does not fit
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+  if (!started)
+  {
+    return 0;
+  }
+  std::map<std::string, std::vector<uint8_t>> &nvs = node()->nvs;
+  auto it = nvs.find(path(key));
+  if (it == nvs.end() || it->second.size() > maxLen)
+  {
+    return 0;
+  }
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  if (!started)
+  {
+    return 0;
+  }
+  std::map<std::string, std::vector<uint8_t>> &nvs = node()->nvs;
+  auto it = nvs.find(path(key));
+  return it != nvs.end() ? it->second.size() : 0;
+}
+
+template <typename T> static T getValue(Preferences &prefs, const char *key, T defaultValue)
+{
+  T value;
+  return prefs.getBytesLength(key) == sizeof(T) && prefs.getBytes(key, &value, sizeof(T)) == sizeof(T) ? value
+                                                                                                       : defaultValue;
+}
+
+size_t Preferences::putChar(const char *key, int8_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+int8_t Preferences::getChar(const char *key, int8_t defaultValue)
+{
+  return getValue(*this, key, defaultValue);
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue)
+{
+  return getValue(*this, key, defaultValue);
+}
+
+size_t Preferences::putUShort(const char *key, uint16_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+uint16_t Preferences::getUShort(const char *key, uint16_t defaultValue)
+{
+  return getValue(*this, key, defaultValue);
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue)
+{
+  return getValue(*this, key, defaultValue);
+}
+
+size_t Preferences::putString(const char *key, const String &value)
+{
+  return putBytes(key, value.c_str(), value.length() + 1);
+}
+
+String Preferences::getString(const char *key, const String &defaultValue)
+{
+  size_t len = getBytesLength(key);
+  if (len == 0)
+  {
+    return defaultValue;
+  }
+  std::string value(len, '\0');
+  getBytes(key, &value[0], len);
+  return String(value.c_str());
+}
+
+// SPIFFS
+
+size_t fs::File::write(const uint8_t *buf, size_t len)
+{
+  if (!data || !writable)
+  {
+    return 0;
+  }
+  data->insert(data->end(), buf, buf + len);
+  return len;
+}
+
+size_t fs::File::read(uint8_t *buf, size_t len)
+{
+  if (!data)
+  {
+    return 0;
+  }
+  size_t n = std::min(len, data->size() - pos);
+  memcpy(buf, data->data() + pos, n);
+  pos += n;
+  return n;
+}
+
+int fs::File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+fs::File fs::FS::open(const char *path, const char *mode)
+{
+  std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> &files = node()->files;
+  auto it = files.find(path);
+  if (mode[0] == 'w' || (mode[0] == 'a' && it == files.end()))
+  {
+    std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
+    files[path] = data;
+    return File(data, true);
+  }
+  if (it == files.end())
+  {
+    return File();
+  }
+  return File(it->second, mode[0] == 'a');
+}
+
+bool fs::FS::exists(const char *path)
+{
+  return node()->files.count(path) > 0;
+}
+
+bool fs::FS::remove(const char *path)
+{
+  return node()->files.erase(path) > 0;
+}
+
+bool SPIFFSFS::begin(bool, const char *, uint8_t, const char *)
+{
+  return true;
+}
+
+size_t SPIFFSFS::totalBytes()
+{
+  return SIM_SPIFFS_BYTES;
+}
+
+size_t SPIFFSFS::usedBytes()
+{
+  size_t used = 0;
+  for (const auto &file : node()->files)
+  {
+    used += file.second->size();
+  }
+  return used;
+}
+
+// ESPAsyncWebServer
+
+AsyncWebServerResponse::AsyncWebServerResponse(int code, const String &contentType) : status(code), type(contentType)
+{
+}
+
+void AsyncWebServerResponse::addHeader(const String &name, const String &value)
+{
+  headers.push_back(std::make_pair(name, value));
+}
+
+class SimBasicResponse : public AsyncWebServerResponse
+{
+public:
+  SimBasicResponse(int code, const String &contentType, std::string body)
+      : AsyncWebServerResponse(code, contentType), body(std::move(body)), sent(0) {}
+
+  size_t fill(uint8_t *buffer, size_t maxLen) override
+  {
+    size_t n = std::min(maxLen, body.size() - sent);
+    memcpy(buffer, body.data() + sent, n);
+    sent += n;
+    return n;
+  }
+
+private:
+  std::string body;
+  size_t sent;
+};
+
+class SimChunkedResponse : public AsyncWebServerResponse
+{
+public:
+  SimChunkedResponse(const String &contentType, AwsResponseFiller filler)
+      : AsyncWebServerResponse(200, contentType), filler(filler), index(0) {}
+
+  size_t fill(uint8_t *buffer, size_t maxLen) override
+  {
+    size_t n = filler(buffer, maxLen, index);
+    index += n;
+    return n;
+  }
+
+private:
+  AwsResponseFiller filler;
+  size_t index;
+};
+
+AsyncWebServerRequest::AsyncWebServerRequest(WebRequestMethodComposite method, const char *url)
+    : verb(method), sent(nullptr)
+{
+  String target(url);
+  int mark = target.indexOf('?');
+  path = mark < 0 ? target : target.substring(0, mark);
+  if (mark < 0)
+  {
+    return;
+  }
+
+  String rest = target.substring(mark + 1);
+  while (rest.length() > 0)
+  {
+    int amp = rest.indexOf('&');
+    String pair = amp < 0 ? rest : rest.substring(0, amp);
+    rest = amp < 0 ? String() : rest.substring(amp + 1);
+    int eq = pair.indexOf('=');
+    query.push_back(eq < 0 ? AsyncWebParameter(pair, String())
+                           : AsyncWebParameter(pair.substring(0, eq), pair.substring(eq + 1)));
+  }
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest()
+{
+  delete sent;
+}
+
+bool AsyncWebServerRequest::hasParam(const String &name, bool, bool) const
+{
+  return getParam(name) != nullptr;
+}
+
+const AsyncWebParameter *AsyncWebServerRequest::getParam(const String &name, bool, bool) const
+{
+  for (const AsyncWebParameter &param : query)
+  {
+    if (param.name() == name)
+    {
+      return &param;
+    }
+  }
+  return nullptr;
+}
+
+void AsyncWebServerRequest::send(int code, const String &contentType, const String &content)
+{
+  send(beginResponse(code, contentType, content));
+}
+
+void AsyncWebServerRequest::send(fs::FS &fs, const String &path, const String &contentType, bool download)
+{
+  File file = fs.open(path, "r");
+  if (!file)
+  {
+    send(404);
+    return;
+  }
+  std::string body(file.size(), '\0');
+  file.read((uint8_t *)&body[0], body.size());
+  AsyncWebServerResponse *response =
+      new SimBasicResponse(200, contentType.isEmpty() ? String("application/octet-stream") : contentType, body);
+  if (download)
+  {
+    response->addHeader("Content-Disposition", "attachment");
+  }
+  send(response);
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse *response)
+{
+  delete sent;
+  sent = response;
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(int code, const String &contentType,
+                                                             const String &content)
+{
+  return new SimBasicResponse(code, contentType, content.c_str());
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginChunkedResponse(const String &contentType,
+                                                                    AwsResponseFiller filler)
+{
+  return new SimChunkedResponse(contentType, filler);
+}
+
+bool AsyncWebHandler::canHandle(const AsyncWebServerRequest *request) const
+{
+  if (!(method & request->method()))
+  {
+    return false;
+  }
+  return request->url() == uri || request->url().startsWith(uri + "/");
+}
+
+AsyncWebServer::AsyncWebServer(uint16_t port) : port(port)
+{
+}
+
+AsyncWebHandler &AsyncWebServer::on(const char *uri, WebRequestMethodComposite method,
+                                    ArRequestHandlerFunction handler)
+{
+  handlers.push_back(std::unique_ptr<AsyncWebHandler>(new AsyncWebHandler(uri, method, handler)));
+  return *handlers.back();
+}
+
+void AsyncWebServer::onNotFound(ArRequestHandlerFunction handler)
+{
+  notFound = handler;
+}
+
+void AsyncWebServer::begin()
+{
+  node()->webServer = this;
+}
+
+void AsyncWebServer::handle(AsyncWebServerRequest *request)
+{
+  for (const std::unique_ptr<AsyncWebHandler> &handler : handlers)
+  {
+    if (handler->canHandle(request))
+    {
+      handler->handle(request);
+      return;
+    }
+  }
+  if (notFound)
+  {
+    notFound(request);
+    return;
+  }
+  request->send(404, "text/plain", "Not found");
+}
+
+// FreeRTOS
+
+struct SimQueue
+{
+  size_t itemSize;
+  size_t length;
+  std::deque<std::vector<uint8_t>> items;
+  std::vector<SimThread *> receivers; // Blocked in xQueueReceive
+  std::vector<SimThread *> senders;   // Blocked in xQueueSend
+};
+
+static void wakeAll(std::vector<SimThread *> &waiters)
+{
+  for (SimThread *thread : waiters)
+  {
+    simWorld().wake(thread);
+  }
+}
+
+// Block until ready() or ticks run out; false on timeout
+template <typename Ready> static bool waitFor(std::vector<SimThread *> &waiters, TickType_t ticks, Ready ready)
+{
+  SimWorld &world = simWorld();
+  uint64_t deadline = world.nowUs() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+  while (!ready())
+  {
+    if (ticks == 0 || (ticks != portMAX_DELAY && world.nowUs() >= deadline))
+    {
+      return false;
+    }
+    SimThread *thread = world.currentThread();
+    waiters.push_back(thread);
+    if (ticks != portMAX_DELAY)
+    {
+      world.wakeAt(thread, deadline);
+    }
+    world.block();
+    waiters.erase(std::find(waiters.begin(), waiters.end(), thread));
+  }
+  return true;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  SimQueue *queue = new SimQueue();
+  queue->itemSize = itemSize;
+  queue->length = length;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void *item, TickType_t ticks, bool front)
+{
+  if (!waitFor(queue->senders, ticks, [queue] { return queue->items.size() < queue->length; }))
+  {
+    return errQUEUE_FULL;
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  std::vector<uint8_t> copy(bytes, bytes + queue->itemSize);
+  if (front)
+  {
+    queue->items.push_front(std::move(copy));
+  }
+  else
+  {
+    queue->items.push_back(std::move(copy));
+  }
+  wakeAll(queue->receivers);
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  return queueSend(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  if (!waitFor(queue->receivers, ticks, [queue] { return !queue->items.empty(); }))
+  {
+    return errQUEUE_EMPTY;
+  }
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  wakeAll(queue->senders);
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  return (UBaseType_t)queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+  return (UBaseType_t)(queue->length - queue->items.size());
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *arg,
+                                   UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+  SimThread *thread = simWorld().spawn(node(), name, [code, arg] { code(arg); }, stackDepth);
+  if (handle != nullptr)
+  {
+    *handle = thread;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle)
+{
+  return xTaskCreatePinnedToCore(code, name, stackDepth, arg, priority, handle, 0);
+}
+
+// Only a task deleting itself is supported
+void vTaskDelete(TaskHandle_t task)
+{
+  SimWorld &world = simWorld();
+  if (task == nullptr || task == world.currentThread())
+  {
+    world.exitThread();
+  }
+  fprintf(stderr, "sim: vTaskDelete of another task is not simulated\n");
+  abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  simWorld().sleepUs((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return (TickType_t)(millis() / portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  SimThread *thread = task != nullptr ? task : simWorld().currentThread();
+  return thread->stackDepth;
+}
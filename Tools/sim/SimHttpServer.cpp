@@ -0,0 +1,454 @@
+#include "SimHttpServer.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HTTP_LISTEN_ID 0
+#define HTTP_WAKE_ID 1
+#define HTTP_MAX_HEADER 8192 // Longer request heads are refused
+#define HTTP_READ_CHUNK 4096
+#define HTTP_MAX_EVENTS 64
+
+static const char *reasonPhrase(int code)
+{
+  switch (code)
+  {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 409:
+    return "Conflict";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return code < 400 ? "OK" : "Error";
+  }
+}
+
+static std::string formatResponse(int code, const std::string &contentType,
+                                  const std::vector<std::pair<std::string, std::string>> &headers,
+                                  const std::string &body, bool keepAlive)
+{
+  char head[256];
+  snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nConnection: %s\r\n", code,
+           reasonPhrase(code), body.size(), keepAlive ? "keep-alive" : "close");
+  std::string response(head);
+  if (!contentType.empty())
+  {
+    response += "Content-Type: " + contentType + "\r\n";
+  }
+  for (const std::pair<std::string, std::string> &header : headers)
+  {
+    response += header.first + ": " + header.second + "\r\n";
+  }
+  response += "\r\n";
+  response += body;
+  return response;
+}
+
+static bool headerIs(const std::string &line, const char *name)
+{
+  size_t n = strlen(name);
+  return line.size() > n && line[n] == ':' && strncasecmp(line.c_str(), name, n) == 0;
+}
+
+static std::string headerValue(const std::string &line)
+{
+  size_t start = line.find(':') + 1;
+  while (start < line.size() && isspace((unsigned char)line[start]))
+  {
+    start++;
+  }
+  return line.substr(start);
+}
+
+static long residentKb()
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f == nullptr)
+  {
+    return -1;
+  }
+  char line[128];
+  long kb = -1;
+  while (fgets(line, sizeof(line), f) != nullptr)
+  {
+    if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+    {
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+SimHttpServer::SimHttpServer(SimWorld &world, SimNode *node)
+    : world(world), node(node), listenFd(-1), epollFd(-1), wakeFd(-1), stopping(false), nextId(2), requests(0)
+{
+}
+
+SimHttpServer::~SimHttpServer()
+{
+  stop();
+}
+
+bool SimHttpServer::start(uint16_t port)
+{
+  listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+  {
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = HTTP_LISTEN_ID;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+  ev.data.u64 = HTTP_WAKE_ID;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+  io = std::thread(&SimHttpServer::ioMain, this);
+  return true;
+}
+
+void SimHttpServer::stop()
+{
+  if (!io.joinable())
+  {
+    return;
+  }
+  stopping = true;
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) < 0)
+  {
+    perror("sim: eventfd");
+  }
+  io.join();
+  for (const auto &entry : connections)
+  {
+    ::close(entry.second->fd);
+    delete entry.second;
+  }
+  connections.clear();
+  ::close(listenFd);
+  ::close(epollFd);
+  ::close(wakeFd);
+}
+
+void SimHttpServer::ioMain()
+{
+  epoll_event events[HTTP_MAX_EVENTS];
+  while (!stopping)
+  {
+    int n = epoll_wait(epollFd, events, HTTP_MAX_EVENTS, -1);
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t id = events[i].data.u64;
+      if (id == HTTP_LISTEN_ID)
+      {
+        acceptAll();
+        continue;
+      }
+      if (id == HTTP_WAKE_ID)
+      {
+        uint64_t count;
+        if (read(wakeFd, &count, sizeof(count)) > 0)
+        {
+          finishAll();
+        }
+        continue;
+      }
+
+      auto it = connections.find(id);
+      if (it == connections.end())
+      {
+        continue;
+      }
+      connection *conn = it->second;
+      if (events[i].events & (EPOLLHUP | EPOLLERR))
+      {
+        close(conn);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT)
+      {
+        writeTo(conn);
+      }
+      if ((events[i].events & EPOLLIN) && connections.count(id) > 0)
+      {
+        readFrom(conn);
+      }
+    }
+  }
+}
+
+void SimHttpServer::acceptAll()
+{
+  while (true)
+  {
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    connection *conn = new connection();
+    conn->id = nextId++;
+    conn->fd = fd;
+    conn->outPos = 0;
+    conn->busy = false;
+    conn->closeAfter = false;
+    conn->writable = false;
+    connections[conn->id] = conn;
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = conn->id;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+void SimHttpServer::readFrom(connection *conn)
+{
+  char buf[HTTP_READ_CHUNK];
+  while (true)
+  {
+    ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+    if (n > 0)
+    {
+      conn->in.append(buf, n);
+      continue;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+      // The client is gone; a response still with the node is dropped when it arrives
+      close(conn);
+      return;
+    }
+    break;
+  }
+  parseRequests(conn);
+}
+
+// Handle the buffered requests in order, one at a time
+void SimHttpServer::parseRequests(connection *conn)
+{
+  while (!conn->busy && !conn->closeAfter)
+  {
+    size_t end = conn->in.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+      if (conn->in.size() > HTTP_MAX_HEADER)
+      {
+        respond(conn, 431, "text/plain", "Request head too large", false);
+      }
+      return;
+    }
+
+    // Request line, then headers
+    std::string head = conn->in.substr(0, end);
+    std::vector<std::string> lines;
+    for (size_t start = 0; start <= head.size();)
+    {
+      size_t eol = head.find("\r\n", start);
+      lines.push_back(head.substr(start, eol == std::string::npos ? std::string::npos : eol - start));
+      start = eol == std::string::npos ? head.size() + 1 : eol + 2;
+    }
+    char method[16], target[HTTP_MAX_HEADER], version[16];
+    if (sscanf(lines[0].c_str(), "%15s %8191s %15s", method, target, version) != 3)
+    {
+      respond(conn, 400, "text/plain", "Bad request line", false);
+      return;
+    }
+    bool keepAlive = strcmp(version, "HTTP/1.1") == 0;
+    size_t bodyLen = 0;
+    for (size_t i = 1; i < lines.size(); i++)
+    {
+      if (headerIs(lines[i], "Connection"))
+      {
+        std::string value = headerValue(lines[i]);
+        keepAlive = strncasecmp(value.c_str(), "close", 5) != 0 &&
+                    (keepAlive || strncasecmp(value.c_str(), "keep-alive", 10) == 0);
+      }
+      else if (headerIs(lines[i], "Content-Length"))
+      {
+        bodyLen = strtoul(headerValue(lines[i]).c_str(), nullptr, 10);
+      }
+    }
+    if (conn->in.size() < end + 4 + bodyLen)
+    {
+      return; // Body still on its way; it is skipped, the routes take none
+    }
+    conn->in.erase(0, end + 4 + bodyLen);
+    requests++;
+
+    if (strcmp(method, "GET") != 0)
+    {
+      if (!respond(conn, 405, "text/plain", "GET only", keepAlive))
+      {
+        return;
+      }
+      continue;
+    }
+    if (strcmp(target, "/_sim/stats") == 0)
+    {
+      if (!respond(conn, 200, "application/json", statsJson(), keepAlive))
+      {
+        return;
+      }
+      continue;
+    }
+
+    conn->busy = true;
+    uint64_t id = conn->id;
+    std::string url(target);
+    world.inject([this, id, url, keepAlive]
+                 {
+      world.httpGet(node, url.c_str(), [this, id, keepAlive](const sim_http_response &response)
+                    {
+        // On the node's HTTP task; the I/O thread writes it out
+        completion result;
+        result.id = id;
+        result.keepAlive = keepAlive;
+        result.response = response.code == 0
+                              ? formatResponse(503, "text/plain", {}, "Web server not started", keepAlive)
+                              : formatResponse(response.code, response.contentType, response.headers, response.body,
+                                               keepAlive);
+        std::lock_guard<std::mutex> guard(doneLock);
+        done.push_back(std::move(result));
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0)
+        {
+          perror("sim: eventfd");
+        } }); });
+  }
+}
+
+bool SimHttpServer::respond(connection *conn, int code, const char *contentType, const std::string &body,
+                            bool keepAlive)
+{
+  uint64_t id = conn->id;
+  conn->out += formatResponse(code, contentType, {}, body, keepAlive);
+  conn->closeAfter = !keepAlive;
+  writeTo(conn);
+  return connections.count(id) > 0;
+}
+
+void SimHttpServer::finishAll()
+{
+  std::vector<completion> ready;
+  {
+    std::lock_guard<std::mutex> guard(doneLock);
+    ready.swap(done);
+  }
+  for (completion &result : ready)
+  {
+    auto it = connections.find(result.id);
+    if (it == connections.end())
+    {
+      continue;
+    }
+    connection *conn = it->second;
+    conn->busy = false;
+    conn->out += result.response;
+    conn->closeAfter = !result.keepAlive;
+    writeTo(conn);
+    if (connections.count(result.id) > 0)
+    {
+      parseRequests(conn);
+    }
+  }
+}
+
+void SimHttpServer::writeTo(connection *conn)
+{
+  while (conn->outPos < conn->out.size())
+  {
+    ssize_t n = send(conn->fd, conn->out.data() + conn->outPos, conn->out.size() - conn->outPos, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      conn->outPos += n;
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      if (!conn->writable)
+      {
+        conn->writable = true;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        ev.data.u64 = conn->id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+      }
+      return;
+    }
+    close(conn);
+    return;
+  }
+
+  conn->out.clear();
+  conn->outPos = 0;
+  if (conn->closeAfter)
+  {
+    close(conn);
+    return;
+  }
+  if (conn->writable)
+  {
+    conn->writable = false;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = conn->id;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+void SimHttpServer::close(connection *conn)
+{
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+  ::close(conn->fd);
+  connections.erase(conn->id);
+  delete conn;
+}
+
+std::string SimHttpServer::statsJson() const
+{
+  size_t bytes = 0;
+  for (const auto &entry : connections)
+  {
+    bytes += sizeof(connection) + entry.second->in.capacity() + entry.second->out.capacity();
+  }
+  char json[160];
+  snprintf(json, sizeof(json), "{\"connections\": %zu, \"requests\": %llu, \"connectionBytes\": %zu, \"rssKb\": %ld}",
+           connections.size(), (unsigned long long)requests, bytes, residentKb());
+  return json;
+}
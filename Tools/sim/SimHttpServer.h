@@ -0,0 +1,84 @@
+#ifndef SIM_HTTP_SERVER_H
+#define SIM_HTTP_SERVER_H
+
+#include "SimWorld.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// HTTP/1.1 on a host TCP port in front of a node's AsyncWebServer, so the
+// Server's routes can be loaded with ordinary HTTP tools. A host thread
+// accepts connections and parses requests (epoll, non-blocking sockets);
+// each request goes to the node's HTTP task through SimWorld::inject() and
+// the response comes back with a Content-Length. Connections are kept open
+// unless the client asks otherwise, and pipelined requests are answered in
+// order. GET only.
+//
+// /_sim/stats is answered by the front end itself: open connections,
+// requests served, bytes held per connection and the process RSS.
+
+class SimHttpServer
+{
+public:
+  SimHttpServer(SimWorld &world, SimNode *node);
+  ~SimHttpServer();
+
+  // Listen on 127.0.0.1:port; false if the port cannot be bound
+  bool start(uint16_t port);
+  void stop();
+
+private:
+  struct connection
+  {
+    uint64_t id;
+    int fd;
+    std::string in;
+    std::string out;
+    size_t outPos;
+    bool busy;       // A request is with the node
+    bool closeAfter; // Close once out is written
+    bool writable;   // Waiting for EPOLLOUT
+  };
+
+  typedef struct completion
+  {
+    uint64_t id;
+    std::string response;
+    bool keepAlive;
+  } completion;
+
+  void ioMain();
+  void acceptAll();
+  void readFrom(connection *conn);
+  void writeTo(connection *conn);
+  void parseRequests(connection *conn);
+  // Queue a response written by the front end; false if that closed the connection
+  bool respond(connection *conn, int code, const char *contentType, const std::string &body, bool keepAlive);
+  void finishAll();
+  void close(connection *conn);
+  std::string statsJson() const;
+
+  SimWorld &world;
+  SimNode *node;
+  int listenFd;
+  int epollFd;
+  int wakeFd;
+  std::thread io;
+  std::atomic<bool> stopping;
+
+  // I/O thread only
+  std::map<uint64_t, connection *> connections;
+  uint64_t nextId;
+  uint64_t requests;
+
+  // Responses from the node's HTTP task, picked up by the I/O thread
+  std::mutex doneLock;
+  std::vector<completion> done;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SIM_PRELUDE_H
+#define SIM_PRELUDE_H
+
+// Everything a firmware source can include, pulled in at global scope before
+// the source is wrapped in its node's namespace (see sim_unit.cpp). The
+// source's own includes of these then find their guards set and add nothing
+// to the namespace; its project headers do, so every node gets its own copy
+// of the shared libraries and their state.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#endif
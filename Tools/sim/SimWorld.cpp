@@ -0,0 +1,772 @@
+#include "SimWorld.h"
+
+#include <ESPAsyncWebServer.h>
+#include <LinkQuality.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+#define SIM_SPIN_LIMIT 4000          // Baton polls before sleeping, with more than one CPU
+#define SIM_CLOCK_READ_LIMIT 1000000 // Clock reads without blocking before time is moved on 1 ms
+#define SIM_ACK_TIMEOUT_US 200
+#define SIM_RSSI_JITTER 3 // dB either side of the link's RSSI
+#define SIM_TASK_STACK 8192
+#define SIM_REALTIME_IDLE_US 100000 // Longest sleep of runRealtime() with nothing due
+
+static SimWorld *current = nullptr;
+static thread_local SimThread *self = nullptr;
+
+// Thrown into parked threads to unwind them when the world is destroyed
+struct sim_stop
+{
+};
+
+static const sim_mac broadcastMAC = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+static uint64_t splitmix64(uint64_t &state)
+{
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+SimWorld &simWorld()
+{
+  return *current;
+}
+
+SimBaton::SimBaton() : ready(false), sleeping(false)
+{
+}
+
+void SimBaton::post()
+{
+  ready.store(true, std::memory_order_release);
+  std::lock_guard<std::mutex> guard(lock);
+  if (sleeping)
+  {
+    cv.notify_one();
+  }
+}
+
+void SimBaton::wait()
+{
+  // Spinning only helps when the other side runs on another CPU
+  static const int spinLimit = std::thread::hardware_concurrency() > 1 ? SIM_SPIN_LIMIT : 0;
+  for (int i = 0; i < spinLimit; i++)
+  {
+    if (ready.load(std::memory_order_acquire))
+    {
+      ready.store(false, std::memory_order_relaxed);
+      return;
+    }
+    cpuRelax();
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+  sleeping = true;
+  cv.wait(guard, [this] { return ready.load(std::memory_order_acquire); });
+  sleeping = false;
+  ready.store(false, std::memory_order_relaxed);
+}
+
+SimThread::SimThread(SimNode *node, const char *name, std::function<void()> body, uint32_t stackDepth)
+    : node(node), name(name), stackDepth(stackDepth), body(body), generation(0), finished(false), clockReads(0),
+      waitingForJob(false)
+{
+}
+
+SimNode::SimNode(SimWorld *world, const char *name, const uint8_t *mac, void (*setup)(), void (*loop)())
+    : framesSent(0), framesReceived(0), sendErrors(0), world(world), label(name), setupFn(setup), loopFn(loop),
+      bootTime(0), driftPpb(0), stopped(false), wifiTask(nullptr), httpTask(nullptr), channel(1), apUp(false),
+      staConnected(false), espnowReady(false), recvCb(nullptr), sendCb(nullptr), promiscuous(false),
+      promiscuousFilter(0), promiscuousCb(nullptr), txFreeUs(0), txRate(LINK_RATE_1M), airtimeUs(0),
+      webServer(nullptr)
+{
+  memcpy(address.data(), mac, 6);
+  memset(pinModes, 0, sizeof(pinModes));
+  for (int i = 0; i < SIM_PINS; i++)
+  {
+    pinIn[i] = -1;
+  }
+  memset(analogIn, 0, sizeof(analogIn));
+  memset(pinOut, 0, sizeof(pinOut));
+  memset(ledcDuty, 0, sizeof(ledcDuty));
+  static const uint8_t defaultApIp[4] = {192, 168, 4, 1};
+  memcpy(apIp, defaultApIp, 4);
+}
+
+uint64_t SimNode::localUs() const
+{
+  uint64_t nowUs = world->nowUs();
+  if (nowUs < bootTime)
+  {
+    return 0;
+  }
+  int64_t elapsed = (int64_t)(nowUs - bootTime);
+  return (uint64_t)(elapsed + elapsed * driftPpb / 1000000000);
+}
+
+void SimNode::setAnalog(uint8_t pin, uint16_t value)
+{
+  if (pin < SIM_PINS)
+  {
+    analogIn[pin] = value;
+  }
+}
+
+void SimNode::setDigital(uint8_t pin, int value)
+{
+  if (pin < SIM_PINS)
+  {
+    pinIn[pin] = value;
+  }
+}
+
+SimWorld::SimWorld(const sim_options &options)
+    : config(options), now(0), nextSeq(0), nextFrameId(1), stopRequested(false), stopping(false), running(nullptr)
+{
+  uint64_t state = options.seed;
+  for (int i = 0; i < 4; i++)
+  {
+    rng[i] = splitmix64(state);
+  }
+  current = this;
+}
+
+SimWorld::~SimWorld()
+{
+  // Unwind every thread still parked in firmware code, then join them
+  stopping = true;
+  for (SimThread *thread : threads)
+  {
+    if (!thread->finished)
+    {
+      running = thread;
+      thread->baton.post();
+      schedulerBaton.wait();
+      running = nullptr;
+    }
+    thread->thread.join();
+    delete thread;
+  }
+  for (SimNode *node : all)
+  {
+    delete node;
+  }
+  current = nullptr;
+}
+
+// xoshiro256**
+uint64_t SimWorld::random()
+{
+  uint64_t result = rng[1] * 5;
+  result = ((result << 7) | (result >> 57)) * 9;
+  uint64_t t = rng[1] << 17;
+  rng[2] ^= rng[0];
+  rng[3] ^= rng[1];
+  rng[1] ^= rng[2];
+  rng[0] ^= rng[3];
+  rng[2] ^= t;
+  rng[3] = (rng[3] << 45) | (rng[3] >> 19);
+  return result;
+}
+
+double SimWorld::uniform()
+{
+  return (double)(random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+SimNode *SimWorld::addNode(const char *name, const uint8_t *mac, void (*setup)(), void (*loop)(), uint64_t bootUs)
+{
+  SimNode *node = new SimNode(this, name, mac, setup, loop);
+  node->bootTime = bootUs;
+  if (config.driftPpm > 0)
+  {
+    int64_t span = 2 * (int64_t)config.driftPpm * 1000 + 1;
+    node->driftPpb = (int64_t)(random() % (uint64_t)span) - (int64_t)config.driftPpm * 1000;
+  }
+  all.push_back(node);
+  at(bootUs, [this, node] { boot(node); });
+  return node;
+}
+
+SimNode *SimWorld::findNode(const uint8_t *mac) const
+{
+  for (SimNode *node : all)
+  {
+    if (memcmp(node->mac(), mac, 6) == 0)
+    {
+      return node;
+    }
+  }
+  return nullptr;
+}
+
+SimNode *SimWorld::findNode(const char *name) const
+{
+  for (SimNode *node : all)
+  {
+    if (node->label == name)
+    {
+      return node;
+    }
+  }
+  return nullptr;
+}
+
+void SimWorld::at(uint64_t timeUs, sim_action action)
+{
+  events.push({timeUs < now ? now : timeUs, nextSeq++, std::move(action)});
+}
+
+void SimWorld::run(uint64_t untilUs)
+{
+  stopRequested = false;
+  while (!stopRequested && !events.empty() && events.top().timeUs <= untilUs)
+  {
+    sim_event event = std::move(const_cast<sim_event &>(events.top()));
+    events.pop();
+    now = event.timeUs;
+    event.action();
+  }
+  if (!stopRequested && now < untilUs)
+  {
+    now = untilUs;
+  }
+}
+
+static uint64_t wallClockUs(std::chrono::steady_clock::time_point start)
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void SimWorld::runRealtime(uint64_t untilUs)
+{
+  stopRequested = false;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() - std::chrono::microseconds(now);
+  while (!stopRequested && now < untilUs)
+  {
+    // Sleep until the next event is due or another thread injects something
+    std::vector<sim_action> actions;
+    {
+      uint64_t nextUs = std::min(events.empty() ? untilUs : events.top().timeUs, untilUs);
+      nextUs = std::min(nextUs, wallClockUs(start) + SIM_REALTIME_IDLE_US);
+      std::unique_lock<std::mutex> guard(injectLock);
+      injectCv.wait_until(guard, start + std::chrono::microseconds(nextUs), [this] { return !injected.empty(); });
+      actions.swap(injected);
+    }
+
+    uint64_t wallUs = wallClockUs(start);
+    if (!actions.empty())
+    {
+      // Injected work happens now, but never ahead of an event that is already due
+      uint64_t dueUs = events.empty() ? wallUs : std::min(wallUs, events.top().timeUs);
+      now = std::max(now, std::min(dueUs, untilUs));
+      for (sim_action &action : actions)
+      {
+        at(now, std::move(action));
+      }
+    }
+    while (!stopRequested && !events.empty() && events.top().timeUs <= std::min(wallUs, untilUs))
+    {
+      sim_event event = std::move(const_cast<sim_event &>(events.top()));
+      events.pop();
+      now = event.timeUs;
+      event.action();
+    }
+    if (events.empty() || events.top().timeUs > untilUs)
+    {
+      now = std::max(now, std::min(wallUs, untilUs));
+    }
+  }
+}
+
+void SimWorld::inject(sim_action action)
+{
+  std::lock_guard<std::mutex> guard(injectLock);
+  injected.push_back(std::move(action));
+  injectCv.notify_one();
+}
+
+// Arduino's loopTask: setup() once, then loop() forever
+void SimWorld::boot(SimNode *node)
+{
+  spawn(node, "loopTask", [this, node]
+        {
+    node->setupFn();
+    while (true)
+    {
+      node->loopFn();
+      sleepUs(config.loopTickUs);
+    } }, SIM_TASK_STACK);
+}
+
+SimThread *SimWorld::currentThread() const
+{
+  return self;
+}
+
+SimNode *SimWorld::currentNode() const
+{
+  return self != nullptr ? self->node : nullptr;
+}
+
+SimThread *SimWorld::spawn(SimNode *node, const char *name, std::function<void()> body, uint32_t stackDepth)
+{
+  SimThread *thread = new SimThread(node, name, body, stackDepth);
+  threads.push_back(thread);
+  node->threads.push_back(thread);
+  thread->thread = std::thread(&SimWorld::threadMain, this, thread);
+  wake(thread);
+  return thread;
+}
+
+void SimWorld::threadMain(SimThread *thread)
+{
+  self = thread;
+  thread->baton.wait();
+  if (!stopping)
+  {
+    try
+    {
+      thread->body();
+    }
+    catch (const sim_stop &)
+    {
+    }
+  }
+  thread->finished = true;
+  schedulerBaton.post();
+}
+
+// Give the baton to thread and wait until it blocks again
+void SimWorld::resume(SimThread *thread)
+{
+  if (thread->finished || thread->node->stopped)
+  {
+    return;
+  }
+  thread->generation++;
+  running = thread;
+  thread->baton.post();
+  schedulerBaton.wait();
+  running = nullptr;
+}
+
+// Give the baton back to the scheduler; returns when this thread is resumed
+void SimWorld::park()
+{
+  SimThread *thread = self;
+  thread->clockReads = 0;
+  schedulerBaton.post();
+  thread->baton.wait();
+  if (stopping)
+  {
+    throw sim_stop();
+  }
+}
+
+void SimWorld::wakeAt(SimThread *thread, uint64_t timeUs)
+{
+  uint64_t generation = thread->generation;
+  at(timeUs, [this, thread, generation]
+     {
+    if (thread->generation == generation)
+    {
+      resume(thread);
+    } });
+}
+
+void SimWorld::wake(SimThread *thread)
+{
+  wakeAt(thread, now);
+}
+
+void SimWorld::block()
+{
+  park();
+}
+
+// Node clocks drift, so a local duration maps to a slightly different world duration
+uint64_t SimWorld::worldDuration(const SimNode *node, uint64_t localUs) const
+{
+  int64_t local = (int64_t)localUs;
+  return (uint64_t)(local - local * node->driftPpb / (1000000000 + node->driftPpb));
+}
+
+void SimWorld::sleepUs(uint64_t localUs)
+{
+  wakeAt(self, now + worldDuration(self->node, localUs));
+  park();
+}
+
+void SimWorld::exitThread()
+{
+  throw sim_stop();
+}
+
+void SimWorld::halt(SimNode *node, const char *reason)
+{
+  node->stopped = true;
+  if (onHalt)
+  {
+    onHalt(node, reason);
+  }
+  // A halted node's threads are never resumed
+  if (self != nullptr && self->node == node)
+  {
+    park();
+  }
+}
+
+// A busy-wait on millis() would never let time move on
+void SimWorld::countClockRead()
+{
+  if (self != nullptr && ++self->clockReads > SIM_CLOCK_READ_LIMIT)
+  {
+    sleepUs(1000);
+  }
+}
+
+void SimWorld::serialWrite(SimNode *node, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    uint8_t fed = node->serialDecoder.feed(data[i]);
+    if (fed == BINLOG_FEED_FRAME)
+    {
+      // A decoded record is a line of its own
+      char line[256];
+      binlogFormatRecord(line, sizeof(line), node->serialDecoder.record());
+      if (onSerial)
+      {
+        onSerial(node, line);
+      }
+      continue;
+    }
+    if (fed != BINLOG_FEED_TEXT)
+    {
+      continue;
+    }
+    if (data[i] != '\n')
+    {
+      node->serialLine.push_back((char)data[i]);
+      continue;
+    }
+    if (!node->serialLine.empty() && node->serialLine.back() == '\r')
+    {
+      node->serialLine.pop_back();
+    }
+    if (onSerial)
+    {
+      onSerial(node, node->serialLine.c_str());
+    }
+    node->serialLine.clear();
+  }
+}
+
+void SimWorld::output(SimNode *node, sim_output kind, uint8_t index, uint32_t value)
+{
+  uint32_t *slot = kind == SIM_OUTPUT_GPIO ? &node->pinOut[index] : &node->ledcDuty[index];
+  if (*slot == value)
+  {
+    return;
+  }
+  *slot = value;
+  if (onOutput)
+  {
+    onOutput(node, kind, index, value);
+  }
+}
+
+void SimWorld::serviceLoop()
+{
+  SimThread *thread = self;
+  while (true)
+  {
+    while (thread->jobs.empty())
+    {
+      thread->waitingForJob = true;
+      park();
+    }
+    sim_action job = std::move(thread->jobs.front());
+    thread->jobs.pop_front();
+    job();
+  }
+}
+
+void SimWorld::post(SimThread *task, sim_action job)
+{
+  task->jobs.push_back(std::move(job));
+  if (task->waitingForJob)
+  {
+    task->waitingForJob = false;
+    wake(task);
+  }
+}
+
+// The Wi-Fi task runs the ESP-NOW and promiscuous callbacks in arrival order
+SimThread *SimWorld::wifiTask(SimNode *node)
+{
+  if (node->wifiTask == nullptr)
+  {
+    node->wifiTask = spawn(node, "wifi", [this] { serviceLoop(); }, SIM_TASK_STACK);
+  }
+  return node->wifiTask;
+}
+
+void SimWorld::httpGet(SimNode *node, const char *url, std::function<void(const sim_http_response &response)> done)
+{
+  if (node->webServer == nullptr || node->stopped)
+  {
+    at(now, [done] { done(sim_http_response{0, std::string(), {}, std::string()}); });
+    return;
+  }
+  if (node->httpTask == nullptr)
+  {
+    node->httpTask = spawn(node, "async_tcp", [this] { serviceLoop(); }, SIM_TASK_STACK);
+  }
+
+  std::string path(url);
+  post(node->httpTask, [node, path, done]
+       {
+    AsyncWebServerRequest request(HTTP_GET, path.c_str());
+    node->webServer->handle(&request);
+
+    sim_http_response result;
+    result.code = 0;
+    AsyncWebServerResponse *response = request.response();
+    if (response != nullptr)
+    {
+      result.code = response->code();
+      result.contentType = response->contentType().c_str();
+      for (const std::pair<String, String> &header : response->extraHeaders())
+      {
+        result.headers.push_back(std::make_pair(header.first.c_str(), header.second.c_str()));
+      }
+      uint8_t chunk[SIM_HTTP_CHUNK];
+      size_t n;
+      while ((n = response->fill(chunk, sizeof(chunk))) > 0)
+      {
+        result.body.append((const char *)chunk, n);
+      }
+    }
+    done(result); });
+}
+
+// Fixed per pair of nodes, from the seed, so the same run sees the same links
+int8_t SimWorld::linkRssi(const SimNode *a, const SimNode *b) const
+{
+  const uint8_t *lo = memcmp(a->mac(), b->mac(), 6) < 0 ? a->mac() : b->mac();
+  const uint8_t *hi = lo == a->mac() ? b->mac() : a->mac();
+  uint64_t state = config.seed;
+  for (int i = 0; i < 6; i++)
+  {
+    state ^= (uint64_t)lo[i] << (8 * i);
+    state ^= (uint64_t)hi[i] << (8 * i + 16);
+  }
+  return (int8_t)(-35 - (int)(splitmix64(state) % 45));
+}
+
+esp_err_t SimWorld::radioSend(SimNode *node, const uint8_t *mac, const uint8_t *data, size_t len)
+{
+  if (!node->espnowReady)
+  {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  if (mac == nullptr || data == nullptr || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+  {
+    return ESP_ERR_ESPNOW_ARG;
+  }
+  sim_mac dest;
+  memcpy(dest.data(), mac, 6);
+  if (std::find(node->peers.begin(), node->peers.end(), dest) == node->peers.end())
+  {
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+  }
+
+  sim_frame frame;
+  frame.id = nextFrameId++;
+  frame.from = node;
+  frame.to = dest;
+  frame.broadcast = dest == broadcastMAC;
+  frame.rate = frame.broadcast ? (uint8_t)LINK_RATE_1M : node->txRate;
+  frame.sentUs = now;
+  frame.len = (uint8_t)len;
+  memcpy(frame.data, data, len);
+  node->framesSent++;
+
+  // Frames from one node go out one after another
+  uint64_t startUs = std::max(now, node->txFreeUs);
+
+  if (frame.broadcast)
+  {
+    // Each receiver hears the single transmission or not; nobody acknowledges it.
+    // Broadcasts always go at the lowest rate.
+    uint64_t endUs = startUs + linkAirtimeUs(LINK_RATE_1M, len, true);
+    node->airtimeUs += endUs - startUs;
+    node->txFreeUs = endUs;
+    for (SimNode *to : all)
+    {
+      if (to == node)
+      {
+        continue;
+      }
+      bool reachable = !to->stopped && to->espnowReady && to->channel == node->channel;
+      sim_fate fate = !reachable ? SIM_UNREACHABLE : (uniform() < config.loss ? SIM_LOST : SIM_DELIVERED);
+      if (onTransmit)
+      {
+        onTransmit(frame, to, fate);
+      }
+      if (fate == SIM_DELIVERED)
+      {
+        uint64_t delay = config.latencyUs + (config.jitterUs > 0 ? random() % (config.jitterUs + 1) : 0);
+        at(endUs + delay, [this, to, frame] { deliver(to, frame); });
+      }
+    }
+    at(endUs, [this, node, dest]
+       {
+      if (node->sendCb != nullptr)
+      {
+        esp_now_send_cb_t cb = node->sendCb;
+        post(wifiTask(node), [cb, dest] { cb(dest.data(), ESP_NOW_SEND_SUCCESS); });
+      } });
+    return ESP_OK;
+  }
+
+  // Unicast: retransmitted until acknowledged or out of retries
+  SimNode *to = findNode(mac);
+  bool reachable = to != nullptr && to != node && !to->stopped && to->espnowReady && to->channel == node->channel;
+  uint64_t air = linkAirtimeUs(node->txRate, len);
+  // Faster rates need a stronger signal: below a rate's sensitivity most attempts are lost
+  double loss = config.loss;
+  if (reachable)
+  {
+    loss = config.loss + (1.0 - config.loss) * linkModelLoss(node->txRate, linkRssi(node, to));
+  }
+  uint64_t endUs = startUs;
+  bool delivered = false;
+  for (uint32_t attempt = 0; attempt <= config.retries && !delivered; attempt++)
+  {
+    endUs += air;
+    node->airtimeUs += air;
+    if (reachable && uniform() >= loss)
+    {
+      delivered = true;
+    }
+    else
+    {
+      endUs += SIM_ACK_TIMEOUT_US;
+    }
+  }
+  node->txFreeUs = endUs;
+
+  // Sniffers on the channel hear the last attempt, as often as loss allows
+  for (SimNode *other : all)
+  {
+    if (other != node && other != to && other->promiscuous && uniform() >= config.loss)
+    {
+      at(endUs + config.latencyUs, [this, other, frame] { overhear(other, frame); });
+    }
+  }
+
+  sim_fate fate = !reachable ? SIM_UNREACHABLE : (delivered ? SIM_DELIVERED : SIM_LOST);
+  if (onTransmit)
+  {
+    onTransmit(frame, to, fate);
+  }
+  if (delivered)
+  {
+    uint64_t delay = config.latencyUs + (config.jitterUs > 0 ? random() % (config.jitterUs + 1) : 0);
+    at(endUs + delay, [this, to, frame] { deliver(to, frame); });
+  }
+  at(endUs, [this, node, dest, delivered]
+     {
+    if (node->sendCb != nullptr)
+    {
+      esp_now_send_cb_t cb = node->sendCb;
+      esp_now_send_status_t status = delivered ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL;
+      post(wifiTask(node), [cb, dest, status] { cb(dest.data(), status); });
+    } });
+  return ESP_OK;
+}
+
+// ESP-NOW frames are vendor-specific action frames; rebuild one for sniffers
+void SimWorld::sniff(SimNode *to, const sim_frame &frame, int rssi)
+{
+  if (!to->promiscuous || to->promiscuousCb == nullptr || !(to->promiscuousFilter & WIFI_PROMIS_FILTER_MASK_MGMT))
+  {
+    return;
+  }
+  static const uint8_t oui[3] = {0x18, 0xfe, 0x34};
+  uint8_t buf[sizeof(wifi_promiscuous_pkt_t) + 39 + ESP_NOW_MAX_DATA_LEN + 4];
+  memset(buf, 0, sizeof(buf));
+  wifi_promiscuous_pkt_t *pkt = (wifi_promiscuous_pkt_t *)buf;
+  uint8_t *f = pkt->payload;
+  f[0] = 0xd0;
+  memcpy(f + 4, frame.to.data(), 6);
+  memcpy(f + 10, frame.from->mac(), 6);
+  memcpy(f + 16, broadcastMAC.data(), 6);
+  f[24] = 127;
+  memcpy(f + 25, oui, 3);
+  f[32] = 0xdd;
+  f[33] = (uint8_t)(frame.len + 5);
+  memcpy(f + 34, oui, 3);
+  f[37] = 4;
+  f[38] = 1;
+  memcpy(f + 39, frame.data, frame.len);
+  pkt->rx_ctrl.rssi = rssi;
+  pkt->rx_ctrl.rate = linkPhyRate(frame.rate);
+  pkt->rx_ctrl.channel = to->channel;
+  pkt->rx_ctrl.sig_len = 39 + frame.len + 4;
+  to->promiscuousCb(buf, WIFI_PKT_MGMT);
+}
+
+// A unicast frame for another node, which only a sniffer on the channel takes in
+void SimWorld::overhear(SimNode *to, const sim_frame &frame)
+{
+  if (to->stopped || !to->promiscuous || to->channel != frame.from->channel)
+  {
+    return;
+  }
+  int rssi = linkRssi(frame.from, to) + (int)(random() % (2 * SIM_RSSI_JITTER + 1)) - SIM_RSSI_JITTER;
+  post(wifiTask(to), [this, to, frame, rssi] { sniff(to, frame, rssi); });
+}
+
+void SimWorld::deliver(SimNode *to, const sim_frame &frame)
+{
+  // The receiver may have gone to sleep or changed channel since the frame was sent
+  if (to->stopped || !to->espnowReady || to->channel != frame.from->channel)
+  {
+    return;
+  }
+  to->framesReceived++;
+
+  int rssi = linkRssi(frame.from, to) + (int)(random() % (2 * SIM_RSSI_JITTER + 1)) - SIM_RSSI_JITTER;
+  post(wifiTask(to), [this, to, frame, rssi]
+       {
+    if (onReceive)
+    {
+      onReceive(frame, to);
+    }
+
+    sniff(to, frame, rssi);
+
+    if (to->recvCb != nullptr)
+    {
+      to->recvCb(frame.from->mac(), frame.data, frame.len);
+    } });
+}
@@ -0,0 +1,319 @@
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <BinLog.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Discrete-event simulation of the sensor network. Every task of every
+// node (setup()/loop(), FreeRTOS tasks, the Wi-Fi task running the ESP-NOW
+// callbacks, the HTTP task) is a host thread, but only one of them runs at
+// a time: the scheduler hands it the baton and waits for it to block in
+// delay(), a queue or a driver wait. Virtual time only moves between
+// events, which are ordered by time and then by the order they were
+// scheduled, so a run depends on nothing but the options and the seed.
+
+#define SIM_PINS 40
+#define SIM_LEDC_CHANNELS 16
+#define SIM_HTTP_CHUNK 1436 // Bytes per response fill, one TCP segment
+
+class AsyncWebServer;
+class SimNode;
+class SimWorld;
+
+typedef std::function<void()> sim_action;
+typedef std::array<uint8_t, 6> sim_mac;
+
+typedef struct sim_options
+{
+  uint64_t seed;
+  double loss;           // Probability that one transmission of a frame is lost
+  uint32_t latencyUs;    // Delivery delay on top of airtime
+  uint32_t jitterUs;     // Extra delivery delay, uniform in [0, jitterUs]
+  uint32_t retries;      // Retransmissions of an unacknowledged unicast frame
+  uint32_t loopTickUs;   // Virtual time one pass of loop() takes
+  uint32_t driftPpm;     // Node clocks run fast or slow by up to this much
+  uint8_t routerChannel; // Channel of the Wi-Fi network the servers join
+  const char *routerSsid;
+} sim_options;
+
+// An ESP-NOW frame on the air
+typedef struct sim_frame
+{
+  uint64_t id;
+  SimNode *from;
+  sim_mac to;
+  bool broadcast;
+  uint8_t rate;    // link_rate it went out at
+  uint64_t sentUs; // When esp_now_send() was called
+  uint8_t len;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} sim_frame;
+
+// What happened to a frame on its way to one receiver
+enum sim_fate
+{
+  SIM_DELIVERED,   // Will reach the receive callback
+  SIM_LOST,        // Every transmission was lost
+  SIM_UNREACHABLE, // No such node, asleep, ESP-NOW not started or on another channel
+};
+
+enum sim_output
+{
+  SIM_OUTPUT_GPIO,
+  SIM_OUTPUT_LEDC
+};
+
+// Handed between the scheduler and the threads; spins briefly before sleeping
+// because the other side usually answers within microseconds
+class SimBaton
+{
+public:
+  SimBaton();
+  void post();
+  void wait();
+
+private:
+  std::atomic<bool> ready;
+  std::mutex lock;
+  std::condition_variable cv;
+  bool sleeping;
+};
+
+class SimThread
+{
+public:
+  SimThread(SimNode *node, const char *name, std::function<void()> body, uint32_t stackDepth);
+
+  SimNode *const node;
+  const std::string name;
+  const uint32_t stackDepth;
+
+private:
+  friend class SimWorld;
+
+  std::function<void()> body;
+  std::thread thread;
+  SimBaton baton;
+  uint64_t generation;  // Bumped on every resume; stale wake-ups carry an old one
+  bool finished;
+  uint32_t clockReads;  // Clock reads since the thread last blocked
+  std::deque<sim_action> jobs; // Driver tasks only
+  bool waitingForJob;
+};
+
+typedef struct sim_http_response
+{
+  int code; // 0 if the node serves nothing
+  std::string contentType;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+} sim_http_response;
+
+typedef struct sim_scan_result
+{
+  std::string ssid;
+  int32_t channel;
+  int32_t rssi;
+} sim_scan_result;
+
+class SimNode
+{
+public:
+  SimNode(SimWorld *world, const char *name, const uint8_t *mac, void (*setup)(), void (*loop)());
+
+  const char *name() const { return label.c_str(); }
+  const uint8_t *mac() const { return address.data(); }
+  bool halted() const { return stopped; }
+  uint64_t bootUs() const { return bootTime; }
+
+  // Microseconds since boot on the node's own clock
+  uint64_t localUs() const;
+
+  // Inputs, set by scenarios at any time
+  void setAnalog(uint8_t pin, uint16_t value);
+  void setDigital(uint8_t pin, int value); // -1 leaves the pin floating
+
+  // Outputs as last written
+  uint32_t gpio(uint8_t pin) const { return pin < SIM_PINS ? pinOut[pin] : 0; }
+  uint32_t ledc(uint8_t channel) const { return channel < SIM_LEDC_CHANNELS ? ledcDuty[channel] : 0; }
+
+  uint64_t framesSent;
+  uint64_t framesReceived;
+  uint64_t sendErrors; // esp_now_send() calls that returned an error
+
+  // State the HAL and the world work on
+  SimWorld *world;
+  std::string label;
+  sim_mac address;
+  void (*setupFn)();
+  void (*loopFn)();
+  uint64_t bootTime;
+  int64_t driftPpb;
+  bool stopped;
+  std::vector<SimThread *> threads;
+  SimThread *wifiTask;
+  SimThread *httpTask;
+
+  // GPIO, ADC and LEDC
+  uint8_t pinModes[SIM_PINS];
+  int pinIn[SIM_PINS]; // -1 while floating
+  uint16_t analogIn[SIM_PINS];
+  uint32_t pinOut[SIM_PINS];
+  uint32_t ledcDuty[SIM_LEDC_CHANNELS];
+  std::string serialLine;
+  BinLogDecoder serialDecoder; // Binary log frames among the text
+
+  // Wi-Fi
+  int channel;
+  bool apUp;
+  std::string apSsid;
+  uint8_t apIp[4];
+  std::string staSsid;
+  bool staConnected;
+  std::vector<sim_scan_result> scan;
+
+  // ESP-NOW
+  bool espnowReady;
+  esp_now_recv_cb_t recvCb;
+  esp_now_send_cb_t sendCb;
+  std::vector<sim_mac> peers;
+  bool promiscuous;
+  uint32_t promiscuousFilter;
+  wifi_promiscuous_cb_t promiscuousCb;
+  uint64_t txFreeUs; // World time the radio finishes its queued transmissions
+  uint8_t txRate;    // link_rate of unicast frames, from esp_wifi_config_espnow_rate()
+  uint64_t airtimeUs; // Time spent transmitting, retries included
+
+  // NVS and flash, by path
+  std::map<std::string, std::vector<uint8_t>> nvs;
+  std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+
+  AsyncWebServer *webServer;
+};
+
+class SimWorld
+{
+public:
+  explicit SimWorld(const sim_options &options);
+  ~SimWorld();
+
+  const sim_options &options() const { return config; }
+  uint64_t nowUs() const { return now; }
+
+  // The node boots at bootUs; its clock drift is drawn from the seed
+  SimNode *addNode(const char *name, const uint8_t *mac, void (*setup)(), void (*loop)(), uint64_t bootUs);
+  const std::vector<SimNode *> &nodes() const { return all; }
+  SimNode *findNode(const uint8_t *mac) const;
+  SimNode *findNode(const char *name) const;
+
+  // Run action in the scheduler at timeUs; it must not block
+  void at(uint64_t timeUs, sim_action action);
+
+  // Process events up to untilUs; returns early once stop() is called
+  void run(uint64_t untilUs);
+  void stop() { stopRequested = true; }
+
+  // Like run(), but virtual time keeps pace with the host clock so other
+  // host threads can interact with the nodes through inject(). Not
+  // deterministic.
+  void runRealtime(uint64_t untilUs);
+
+  // Run action in the scheduler as soon as possible; callable from any host thread
+  void inject(sim_action action);
+
+  // Fetch url from the node's web server on its HTTP task
+  void httpGet(SimNode *node, const char *url, std::function<void(const sim_http_response &response)> done);
+
+  // Deterministic random numbers from the seed
+  uint64_t random();
+  double uniform(); // [0, 1)
+
+  // Observers, called in the scheduler or in the thread that caused the event
+  std::function<void(SimNode *node, const char *line)> onSerial;
+  std::function<void(const sim_frame &frame, SimNode *to, sim_fate fate)> onTransmit; // When sent
+  std::function<void(const sim_frame &frame, SimNode *to)> onReceive;                 // Before the callback
+  std::function<void(SimNode *node, sim_output kind, uint8_t index, uint32_t value)> onOutput;
+  std::function<void(SimNode *node, const char *reason)> onHalt;
+
+  // Used by the HAL, from firmware threads
+  SimThread *currentThread() const;
+  SimNode *currentNode() const;
+  SimThread *spawn(SimNode *node, const char *name, std::function<void()> body, uint32_t stackDepth);
+  void sleepUs(uint64_t localUs); // Node-clock microseconds
+  void block();                   // Until a wake() for this thread fires
+  void wake(SimThread *thread);
+  void wakeAt(SimThread *thread, uint64_t timeUs);
+  void exitThread();
+  void halt(SimNode *node, const char *reason);
+  void countClockRead();
+  void serialWrite(SimNode *node, const uint8_t *data, size_t len);
+  void output(SimNode *node, sim_output kind, uint8_t index, uint32_t value);
+  esp_err_t radioSend(SimNode *node, const uint8_t *mac, const uint8_t *data, size_t len);
+  SimThread *wifiTask(SimNode *node);
+  int8_t linkRssi(const SimNode *a, const SimNode *b) const;
+
+private:
+  typedef struct sim_event
+  {
+    uint64_t timeUs;
+    uint64_t seq;
+    sim_action action;
+  } sim_event;
+
+  struct later
+  {
+    bool operator()(const sim_event &a, const sim_event &b) const
+    {
+      return a.timeUs != b.timeUs ? a.timeUs > b.timeUs : a.seq > b.seq;
+    }
+  };
+
+  void boot(SimNode *node);
+  void resume(SimThread *thread);
+  void park();
+  void threadMain(SimThread *thread);
+  void serviceLoop();
+  void post(SimThread *task, sim_action job);
+  void deliver(SimNode *to, const sim_frame &frame);
+  void overhear(SimNode *to, const sim_frame &frame);
+  void sniff(SimNode *to, const sim_frame &frame, int rssi);
+  uint64_t worldDuration(const SimNode *node, uint64_t localUs) const;
+
+  sim_options config;
+  uint64_t now;
+  uint64_t nextSeq;
+  uint64_t nextFrameId;
+  uint64_t rng[4];
+  bool stopRequested;
+  bool stopping; // Threads unwind when they next block
+  std::priority_queue<sim_event, std::vector<sim_event>, later> events;
+  std::vector<SimNode *> all;
+  std::vector<SimThread *> threads;
+  SimThread *running;
+  SimBaton schedulerBaton;
+
+  // Actions from other host threads, for runRealtime()
+  std::mutex injectLock;
+  std::condition_variable injectCv;
+  std::vector<sim_action> injected;
+};
+
+// The world the HAL of the current run talks to
+SimWorld &simWorld();
+
+#endif
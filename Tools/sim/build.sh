@@ -0,0 +1,62 @@
+#!/bin/sh
+# Builds ./build/sim: every firmware source is compiled on its own against
+# the simulated HAL, inside a namespace named after its node (see
+# sim_unit.cpp), then linked with the simulator. Run from this directory.
+set -e
+
+ROOT=../..
+OUT=build
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+FLAGS="-std=gnu++17 -pthread -DARDUINO=10819 -DESP32 -Ihal -I."
+for dir in $ROOT/Shared/*/ $ROOT/Server/lib/*/; do
+  FLAGS="$FLAGS -I${dir%/}"
+done
+
+SENSOR_LIBS="Shared/BinLog/BinLog.cpp Shared/BootProfiler/BootProfiler.cpp Shared/Pairing/Pairing.cpp Shared/Pairing/PairingClient.cpp
+  Shared/ClockSync/ClockSync.cpp Shared/ClockSync/ClockSyncClient.cpp Shared/LinkQuality/LinkQuality.cpp
+  Shared/ReportControl/ReportControl.cpp Shared/ReportControl/ReportControlClient.cpp Shared/SensorFrame/SensorFrame.cpp
+  Shared/SensorFrame/HeartbeatClient.cpp Shared/Backlog/Backlog.cpp Shared/Backlog/BacklogClient.cpp"
+
+# Lines of "<namespace> <source>"
+units() {
+  for src in Server/src/main.cpp Server/lib/Capture/Capture.cpp Server/lib/Capture/CaptureSink.cpp \
+    Server/lib/Dispatch/Dispatch.cpp Server/lib/Export/Export.cpp Server/lib/Health/Health.cpp Server/lib/History/History.cpp Server/lib/Liveness/Liveness.cpp Server/lib/Metrics/Metrics.cpp Server/lib/SensorStore/SensorStore.cpp Server/lib/Stats/Stats.cpp \
+    Server/lib/Tracer/Tracer.cpp Server/lib/Views/Views.cpp Shared/BinLog/BinLog.cpp Shared/BootProfiler/BootProfiler.cpp \
+    Shared/ClockSync/ClockSync.cpp Shared/LinkQuality/LinkQuality.cpp Shared/Pairing/Pairing.cpp Shared/Pairing/PeerTable.cpp \
+    Shared/Pairing/PeerCache.cpp Shared/Pairing/SendQueue.cpp Shared/ReportControl/ReportControl.cpp Shared/SensorFrame/SensorFrame.cpp Shared/Backlog/Backlog.cpp; do
+    echo "server_fw $src"
+  done
+  for src in Master-Server/src/main.cpp Server/lib/Dispatch/Dispatch.cpp Shared/BinLog/BinLog.cpp Shared/BootProfiler/BootProfiler.cpp \
+    Shared/Pairing/Pairing.cpp Shared/Pairing/PeerTable.cpp Shared/SensorFrame/SensorFrame.cpp; do
+    echo "master_fw $src"
+  done
+  for node in sound motion smoke light; do
+    case $node in
+    sound) dir=Sound-Sensor ;;
+    motion) dir=Motion-Sensor ;;
+    smoke) dir=Smoke-Sensor ;;
+    light) dir=Light-Sensor ;;
+    esac
+    for src in $dir/src/main.cpp $SENSOR_LIBS; do
+      echo "${node}_fw $src"
+    done
+  done
+}
+
+mkdir -p $OUT
+units | while read ns src; do
+  obj=$OUT/${ns}_$(echo "$src" | tr '/' '_' | sed 's/\.cpp$/.o/')
+  echo "$CXX $FLAGS $CXXFLAGS -DSIM_NODE=$ns -DSIM_SOURCE='\"$ROOT/$src\"' -c sim_unit.cpp -o $obj"
+done >$OUT/units.txt
+for src in SimWorld.cpp SimHal.cpp SimHttpServer.cpp sim.cpp; do
+  echo "$CXX $FLAGS $CXXFLAGS -c $src -o $OUT/${src%.cpp}.o"
+done >>$OUT/units.txt
+# The simulator's own copies of BinLog, to decode the nodes' serial output,
+# and of LinkQuality, for the airtime and loss of each PHY rate
+echo "$CXX $FLAGS $CXXFLAGS -c $ROOT/Shared/BinLog/BinLog.cpp -o $OUT/BinLog.o" >>$OUT/units.txt
+echo "$CXX $FLAGS $CXXFLAGS -c $ROOT/Shared/LinkQuality/LinkQuality.cpp -o $OUT/LinkQuality.o" >>$OUT/units.txt
+
+tr '\n' '\0' <$OUT/units.txt | xargs -0 -P"$(nproc)" -n1 sh -c
+$CXX -pthread $OUT/*.o -o $OUT/sim
+echo "Built $OUT/sim"
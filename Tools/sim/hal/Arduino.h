@@ -0,0 +1,180 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Simulated Arduino-ESP32 core for the network simulator. Only what the
+// firmwares use is declared; time, pins and Serial go to the node whose
+// code is running (see SimWorld.h).
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#define PROGMEM
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint16_t analogRead(uint8_t pin);
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolutionBits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+uint32_t esp_random();
+
+// Deep sleep ends the node: no wake-up source is simulated
+#define ESP_SLEEP_WAKEUP_ALL 0
+void esp_deep_sleep_start();
+esp_err_t esp_sleep_disable_wakeup_source(int source);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us);
+
+class String
+{
+public:
+  String(const char *s = "");
+  String(const std::string &s);
+  String(char c);
+  String(int value, unsigned char base = DEC);
+  String(unsigned int value, unsigned char base = DEC);
+  String(long value, unsigned char base = DEC);
+  String(unsigned long value, unsigned char base = DEC);
+  String(long long value, unsigned char base = DEC);
+  String(unsigned long long value, unsigned char base = DEC);
+  String(double value, unsigned int decimals = 2);
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return (unsigned int)s.size(); }
+  bool isEmpty() const { return s.empty(); }
+  bool reserve(unsigned int size);
+  char charAt(unsigned int index) const;
+  char operator[](unsigned int index) const { return charAt(index); }
+
+  String &operator+=(const String &other);
+  String &operator+=(const char *other);
+  String &operator+=(char c);
+  bool concat(const String &other);
+
+  bool equals(const String &other) const { return s == other.s; }
+  bool operator==(const String &other) const { return s == other.s; }
+  bool operator==(const char *other) const { return s == (other != nullptr ? other : ""); }
+  bool operator!=(const String &other) const { return s != other.s; }
+  bool operator!=(const char *other) const { return !(*this == other); }
+  bool operator<(const String &other) const { return s < other.s; }
+
+  bool startsWith(const String &prefix) const;
+  bool endsWith(const String &suffix) const;
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String &str, unsigned int from = 0) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  void replace(const String &find, const String &with);
+  void trim();
+  void toLowerCase();
+  long toInt() const;
+  double toFloat() const;
+
+private:
+  std::string s;
+};
+
+String operator+(const String &a, const String &b);
+String operator+(const String &a, const char *b);
+String operator+(const char *a, const String &b);
+
+class IPAddress
+{
+public:
+  IPAddress();
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+  uint8_t operator[](int index) const { return bytes[index]; }
+  String toString() const;
+
+private:
+  uint8_t bytes[4];
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len);
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t print(const IPAddress &ip) { return print(ip.toString()); }
+
+  size_t println() { return write("\r\n"); }
+  size_t println(const char *str) { return print(str) + println(); }
+  template <typename T> size_t println(const T &value) { return print(value) + println(); }
+  template <typename T> size_t println(const T &value, int format) { return print(value, format) + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class HardwareSerial : public Print
+{
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  void flush() {}
+  using Print::write;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+  // The heap is not simulated; these are typical values of an idle board
+  uint32_t getHeapSize() { return 327680; }
+  uint32_t getFreeHeap() { return 229376; }
+  uint32_t getMinFreeHeap() { return 212992; }
+  uint32_t getMaxAllocHeap() { return 110580; }
+  void restart();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SIM_ESP_ASYNC_WEB_SERVER_H
+#define SIM_ESP_ASYNC_WEB_SERVER_H
+
+#include "Arduino.h"
+#include "SPIFFS.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// The parts of ESPAsyncWebServer the Server uses. Routes are kept per
+// server and requests are dispatched in-process: the simulator calls
+// AsyncWebServer::handle() on the node's HTTP task and reads the body
+// back through AsyncWebServerResponse::fill(), a piece at a time like the
+// real server's TCP send loop. SimHttpServer puts a socket in front of it.
+
+typedef enum
+{
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_ANY = 0b01111111
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+typedef std::function<size_t(uint8_t *buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebServerResponse
+{
+public:
+  AsyncWebServerResponse(int code, const String &contentType);
+  virtual ~AsyncWebServerResponse() {}
+
+  void addHeader(const String &name, const String &value);
+  int code() const { return status; }
+  const String &contentType() const { return type; }
+  const std::vector<std::pair<String, String>> &extraHeaders() const { return headers; }
+
+  // Next piece of the body, at most maxLen bytes; 0 once it is complete
+  virtual size_t fill(uint8_t *buffer, size_t maxLen) = 0;
+
+private:
+  int status;
+  String type;
+  std::vector<std::pair<String, String>> headers;
+};
+
+class AsyncWebParameter
+{
+public:
+  AsyncWebParameter(const String &name, const String &value) : key(name), val(value) {}
+  const String &name() const { return key; }
+  const String &value() const { return val; }
+
+private:
+  String key;
+  String val;
+};
+
+class AsyncWebServerRequest
+{
+public:
+  // url may carry a query string; its parameters are parsed
+  AsyncWebServerRequest(WebRequestMethodComposite method, const char *url);
+  ~AsyncWebServerRequest();
+
+  WebRequestMethodComposite method() const { return verb; }
+  const String &url() const { return path; }
+
+  bool hasParam(const String &name, bool post = false, bool file = false) const;
+  const AsyncWebParameter *getParam(const String &name, bool post = false, bool file = false) const;
+  size_t params() const { return query.size(); }
+
+  void send(int code, const String &contentType = String(), const String &content = String());
+  void send(fs::FS &fs, const String &path, const String &contentType = String(), bool download = false);
+  void send(AsyncWebServerResponse *response);
+  AsyncWebServerResponse *beginResponse(int code, const String &contentType = String(),
+                                        const String &content = String());
+  AsyncWebServerResponse *beginChunkedResponse(const String &contentType, AwsResponseFiller filler);
+
+  // The response the handler sent, owned by the request
+  AsyncWebServerResponse *response() const { return sent; }
+
+private:
+  WebRequestMethodComposite verb;
+  String path;
+  std::vector<AsyncWebParameter> query;
+  AsyncWebServerResponse *sent;
+};
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+
+class AsyncWebHandler
+{
+public:
+  AsyncWebHandler(const String &uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler)
+      : uri(uri), method(method), handler(handler) {}
+
+  bool canHandle(const AsyncWebServerRequest *request) const;
+  void handle(AsyncWebServerRequest *request) const { handler(request); }
+
+private:
+  String uri;
+  WebRequestMethodComposite method;
+  ArRequestHandlerFunction handler;
+};
+
+class AsyncWebServer
+{
+public:
+  AsyncWebServer(uint16_t port);
+
+  AsyncWebHandler &on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler);
+  void onNotFound(ArRequestHandlerFunction handler);
+  void begin();
+
+  // Run the first matching handler; sends 404 if there is none
+  void handle(AsyncWebServerRequest *request);
+
+private:
+  uint16_t port;
+  std::vector<std::unique_ptr<AsyncWebHandler>> handlers;
+  ArRequestHandlerFunction notFound;
+};
+
+#endif
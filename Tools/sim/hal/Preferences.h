@@ -0,0 +1,42 @@
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include "Arduino.h"
+
+// NVS of the node, kept in memory for the length of the run
+class Preferences
+{
+public:
+  Preferences();
+  ~Preferences();
+
+  bool begin(const char *name, bool readOnly = false, const char *partition = nullptr);
+  void end();
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+
+  size_t putBytes(const char *key, const void *value, size_t len);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+  size_t getBytesLength(const char *key);
+
+  size_t putChar(const char *key, int8_t value);
+  int8_t getChar(const char *key, int8_t defaultValue = 0);
+  size_t putUChar(const char *key, uint8_t value);
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+  size_t putUShort(const char *key, uint16_t value);
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0);
+  size_t putUInt(const char *key, uint32_t value);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  size_t putString(const char *key, const String &value);
+  String getString(const char *key, const String &defaultValue = String());
+
+private:
+  std::string path(const char *key) const;
+
+  std::string ns;
+  bool started;
+  bool readOnly;
+};
+
+#endif
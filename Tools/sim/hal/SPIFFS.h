@@ -0,0 +1,61 @@
+#ifndef SIM_SPIFFS_H
+#define SIM_SPIFFS_H
+
+#include "Arduino.h"
+
+#include <memory>
+#include <vector>
+
+// Flash file system of the node, kept in memory for the length of the run
+namespace fs
+{
+
+class File
+{
+public:
+  File() : pos(0), writable(false) {}
+  File(std::shared_ptr<std::vector<uint8_t>> data, bool writable) : data(data), pos(0), writable(writable) {}
+
+  size_t write(const uint8_t *buf, size_t len);
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t read(uint8_t *buf, size_t len);
+  int read();
+  int available() const { return data ? (int)(data->size() - pos) : 0; }
+  size_t size() const { return data ? data->size() : 0; }
+  void flush() {}
+  void close() { data.reset(); }
+  operator bool() const { return (bool)data; }
+
+private:
+  std::shared_ptr<std::vector<uint8_t>> data;
+  size_t pos;
+  bool writable;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = "r");
+  File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path);
+};
+
+} // namespace fs
+
+using fs::File;
+
+class SPIFFSFS : public fs::FS
+{
+public:
+  bool begin(bool formatOnFail = false, const char *basePath = "/spiffs", uint8_t maxOpenFiles = 10,
+             const char *partitionLabel = nullptr);
+  void end() {}
+  size_t totalBytes();
+  size_t usedBytes();
+};
+
+extern SPIFFSFS SPIFFS;
+
+#endif
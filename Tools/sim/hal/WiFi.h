@@ -0,0 +1,57 @@
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+typedef enum
+{
+  WIFI_PS_NONE = 0,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+// Station and soft AP of the node. Scans see the soft APs of the other
+// nodes and the simulated router; an AP is on the node's current channel.
+class WiFiClass
+{
+public:
+  bool mode(wifi_mode_t mode);
+  bool setSleep(wifi_ps_type_t sleep);
+
+  bool softAP(const char *ssid, const char *password = nullptr, int channel = 1, int hidden = 0, int maxConnections = 4);
+  bool softAPConfig(IPAddress localIp, IPAddress gateway, IPAddress subnet);
+  IPAddress softAPIP();
+
+  wl_status_t begin(const char *ssid, const char *password = nullptr);
+  wl_status_t status();
+  IPAddress localIP();
+
+  int16_t scanNetworks();
+  String SSID(uint8_t index);
+  int32_t RSSI(uint8_t index);
+  int32_t channel(uint8_t index);
+  int32_t channel();
+
+  uint8_t *macAddress(uint8_t *mac);
+  String macAddress();
+};
+
+extern WiFiClass WiFi;
+
+#endif
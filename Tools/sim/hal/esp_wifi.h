@@ -0,0 +1,100 @@
+#ifndef SIM_ESP_WIFI_H
+#define SIM_ESP_WIFI_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
+
+typedef enum
+{
+  WIFI_SECOND_CHAN_NONE = 0,
+  WIFI_SECOND_CHAN_ABOVE,
+  WIFI_SECOND_CHAN_BELOW
+} wifi_second_chan_t;
+
+typedef enum
+{
+  WIFI_PKT_MGMT,
+  WIFI_PKT_CTRL,
+  WIFI_PKT_DATA,
+  WIFI_PKT_MISC
+} wifi_promiscuous_pkt_type_t;
+
+#define WIFI_PROMIS_FILTER_MASK_ALL 0xFFFFFFFF
+#define WIFI_PROMIS_FILTER_MASK_MGMT (1 << 0)
+#define WIFI_PROMIS_FILTER_MASK_CTRL (1 << 1)
+#define WIFI_PROMIS_FILTER_MASK_DATA (1 << 2)
+
+typedef struct wifi_promiscuous_filter
+{
+  uint32_t filter_mask;
+} wifi_promiscuous_filter_t;
+
+// Same layout as ESP-IDF 4.4; the simulator fills rssi, channel and sig_len
+typedef struct
+{
+  signed rssi : 8;
+  unsigned rate : 5;
+  unsigned : 1;
+  unsigned sig_mode : 2;
+  unsigned : 16;
+  unsigned mcs : 7;
+  unsigned cwb : 1;
+  unsigned : 16;
+  unsigned smoothing : 1;
+  unsigned not_sounding : 1;
+  unsigned : 1;
+  unsigned aggregation : 1;
+  unsigned stbc : 2;
+  unsigned fec_coding : 1;
+  unsigned sgi : 1;
+  signed noise_floor : 8;
+  unsigned ampdu_cnt : 8;
+  unsigned channel : 4;
+  unsigned secondary_channel : 4;
+  unsigned : 8;
+  unsigned timestamp : 32;
+  unsigned : 32;
+  unsigned : 31;
+  unsigned ant : 1;
+  unsigned sig_len : 12;
+  unsigned : 12;
+  unsigned rx_state : 8;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct
+{
+  wifi_pkt_rx_ctrl_t rx_ctrl;
+  uint8_t payload[0];
+} wifi_promiscuous_pkt_t;
+
+// Same values as ESP-IDF 4.4
+typedef enum
+{
+  WIFI_PHY_RATE_1M_L = 0x00,
+  WIFI_PHY_RATE_2M_L = 0x01,
+  WIFI_PHY_RATE_5M_L = 0x02,
+  WIFI_PHY_RATE_11M_L = 0x03,
+  WIFI_PHY_RATE_2M_S = 0x05,
+  WIFI_PHY_RATE_5M_S = 0x06,
+  WIFI_PHY_RATE_11M_S = 0x07,
+  WIFI_PHY_RATE_48M = 0x08,
+  WIFI_PHY_RATE_24M = 0x09,
+  WIFI_PHY_RATE_12M = 0x0A,
+  WIFI_PHY_RATE_6M = 0x0B,
+  WIFI_PHY_RATE_54M = 0x0C,
+  WIFI_PHY_RATE_36M = 0x0D,
+  WIFI_PHY_RATE_18M = 0x0E,
+  WIFI_PHY_RATE_9M = 0x0F,
+} wifi_phy_rate_t;
+
+typedef void (*wifi_promiscuous_cb_t)(void *buf, wifi_promiscuous_pkt_type_t type);
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second);
+esp_err_t esp_wifi_set_promiscuous(bool enable);
+esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t *filter);
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb);
+esp_err_t esp_wifi_config_espnow_rate(wifi_interface_t ifx, wifi_phy_rate_t rate);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stdint.h>
+
+// Tasks of a node run one at a time and are never preempted: a task keeps
+// the CPU until it delays, blocks on a queue or returns from loop(), which
+// is enough for the firmwares' queue handoffs. Critical sections are no-ops.
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct SimQueue *QueueHandle_t;
+typedef class SimThread *TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL 0
+#define errQUEUE_EMPTY 0
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_ISR(mux) (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux) (void)(mux)
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_FREERTOS_QUEUE_H
+#define SIM_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SIM_FREERTOS_TASK_H
+#define SIM_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *arg);
+
+// Priority and core are recorded but do not affect scheduling
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+// Stack use is not simulated: reports the unused part as the whole stack
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif
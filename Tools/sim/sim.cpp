@@ -0,0 +1,795 @@
+// Discrete-event simulator of the whole network: the Server, the legacy
+// Master-Server and the four sensors run their own firmware, compiled
+// against a simulated HAL, in one process on a virtual clock. Radio loss,
+// latency and retries, ADC and GPIO inputs and boot times come from the
+// options and the seed, so a run is repeatable: the same command line
+// prints the same report, byte for byte, however loaded the host is.
+//
+//   sim [--scenario boot|motion-light|smoke] [--seed n] [--duration s]
+//       [--loss p] [--latency us] [--jitter us] [--retries n] [--drift ppm]
+//       [--channel n] [--loop-us us] [--nodes server,master,sound,motion,smoke,light]
+//       [--trace] [--radio-trace] [--serve port]
+//
+// Scenarios, all starting from a cold boot of every node:
+//   boot          nothing but the boot; reports when each sensor joined the
+//                 Server and got its first clock sync
+//   motion-light  motion pulses and button holds on the motion sensor (a
+//                 fixed opening sequence, then random ones from the seed);
+//                 reports how long the light took to come on after each
+//                 pulse and how many "turn on" commands it ignored. The
+//                 opening sequence hits the light's 10 s "turn on" gate:
+//                 motion at 30 s, disable by button at 36.7 s, motion again
+//                 at 38 s is ignored
+//   smoke         the smoke reading jumps over the alarm level at 30 s;
+//                 reports how long until the Server sent "disable1", the
+//                 sensors went to sleep and /status/smoke said so
+//
+// In every scenario a dashboard polls /status/sensors each second, and the
+// report shows the Server's per-stage reading latency from /trace, taken
+// just before the end. It ends with the ESP-NOW frames sent between each
+// pair of nodes by kind, and what happened to them. --trace prints every Serial
+// line with its virtual time, --radio-trace every transmission. Host time
+// taken goes to stderr.
+//
+// --serve runs the world in step with the host clock instead and serves
+// the Server's web routes on 127.0.0.1:port through SimHttpServer, for
+// browsers and HTTP load tools (Tools/http). It runs until killed unless
+// --duration is given, and is not deterministic.
+//
+// Each loop() pass takes --loop-us of virtual time (1000 by default), on
+// top of any delay() in it. Tasks are not preempted, stacks and the heap
+// are not simulated, broadcasts do not collide, and deep sleep is final.
+//
+// Build from this directory:
+//   ./build.sh
+// which compiles each firmware source on its own (see sim_unit.cpp) into
+// build/ and links build/sim.
+
+#include "SimHttpServer.h"
+#include "SimWorld.h"
+
+#include <Arduino.h>
+
+#include <ClockSync.h>
+#include <Pairing.h>
+#include <ReportControl.h>
+#include <SensorFrame.h>
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define SIM_SENSOR_BOOT_US 8000000   // Sensors are powered on once the servers are up
+#define SIM_SENSOR_STAGGER_US 2000000 // Spread of the sensor boot times
+#define SIM_EVENT_US 30000000         // When the scenario's main event happens
+#define SIM_POLL_US 250000            // Smoke status polling interval
+#define SIM_DASHBOARD_US 1000000      // Sensor table polling interval
+#define SIM_TRACE_LEAD_US 100000      // /trace is fetched this long before the end
+#define SIM_LIGHT_WINDOW_US 5000000   // Longest wait for the light after a motion pulse
+
+// Inputs wired to the sensors, as in the firmware
+#define MOTION_INPUT_PIN 4
+#define MOTION_BUTTON_PIN 5
+#define SENSOR_ADC_PIN 34
+#define LIGHT_LED_CHANNEL 0
+
+namespace server_fw
+{
+void setup();
+void loop();
+}
+namespace master_fw
+{
+void setup();
+void loop();
+}
+namespace sound_fw
+{
+void setup();
+void loop();
+}
+namespace motion_fw
+{
+void setup();
+void loop();
+}
+namespace smoke_fw
+{
+void setup();
+void loop();
+}
+namespace light_fw
+{
+void setup();
+void loop();
+}
+
+typedef struct node_spec
+{
+  const char *name;
+  uint8_t mac[6];
+  void (*setup)();
+  void (*loop)();
+  bool sensor;
+} node_spec;
+
+// Fixed MACs, so the logs of runs with the same seed compare line by line
+static const node_spec nodeSpecs[] = {
+    {"server", {0x24, 0x6f, 0x28, 0xaa, 0xbb, 0x01}, server_fw::setup, server_fw::loop, false},
+    {"master", {0x24, 0x6f, 0x28, 0xaa, 0xbb, 0x02}, master_fw::setup, master_fw::loop, false},
+    {"sound", {0xd8, 0xbc, 0x38, 0xfb, 0xa5, 0x7c}, sound_fw::setup, sound_fw::loop, true},
+    {"motion", {0xc0, 0x5d, 0x89, 0xb1, 0x93, 0xa0}, motion_fw::setup, motion_fw::loop, true},
+    {"smoke", {0xfc, 0xe8, 0xc0, 0x74, 0x50, 0x14}, smoke_fw::setup, smoke_fw::loop, true},
+    {"light", {0xa8, 0x42, 0xe3, 0xc8, 0x36, 0x88}, light_fw::setup, light_fw::loop, true},
+};
+
+typedef struct run_options
+{
+  sim_options sim;
+  std::string scenario;
+  uint64_t durationUs;
+  bool durationSet;
+  uint16_t servePort; // 0 for a simulated-time run
+  std::vector<std::string> nodes;
+  bool trace;
+  bool radioTrace;
+} run_options;
+
+typedef struct link_counts
+{
+  uint64_t sent;
+  uint64_t delivered;
+  uint64_t lost;
+  uint64_t unreachable;
+} link_counts;
+
+typedef struct node_times
+{
+  uint64_t joinedUs; // 0 until it happens
+  uint64_t syncedUs;
+  uint64_t haltedUs;
+  std::string haltReason;
+} node_times;
+
+// What the hooks saw during the run
+typedef struct run_state
+{
+  std::map<std::string, link_counts> links; // "from to kind"
+  uint64_t lastFrameId;
+  std::map<const SimNode *, node_times> times;
+
+  // motion-light
+  std::vector<uint64_t> motionEdges;
+  std::vector<uint64_t> lightOnLatencies;
+  std::vector<uint64_t> missedEdges;
+  uint64_t alreadyOn;
+  uint64_t pendingEdgeUs; // Motion edge waiting for the light, 0 if none
+  uint64_t turnOnDelivered;
+  uint64_t turnOnAccepted;
+
+  // smoke
+  uint64_t smokeCommandUs;
+  uint64_t smokeShownUs;
+  int smokeLastCode;
+
+  // Every scenario
+  uint64_t dashboardPolls;
+  std::string traceReport; // Empty until /trace answered
+} run_state;
+
+static double seconds(uint64_t us)
+{
+  return us / 1e6;
+}
+
+static double millisOf(uint64_t us)
+{
+  return us / 1e3;
+}
+
+static std::string frameKind(const uint8_t *data, int len)
+{
+  if (len >= 2 && data[0] == PAIRING_MAGIC)
+  {
+    return data[1] == PAIRING_JOIN_REQUEST ? "join-request" : "join-accept";
+  }
+  if (len >= 2 && data[0] == CLOCK_SYNC_MAGIC)
+  {
+    switch (data[1])
+    {
+    case CLOCK_SYNC_BEACON:
+      return "clock-beacon";
+    case CLOCK_SYNC_REQUEST:
+      return "clock-request";
+    default:
+      return "clock-response";
+    }
+  }
+  if (len >= 2 && data[0] == FRAME_MAGIC)
+  {
+    return data[1] == FRAME_HEARTBEAT ? "heartbeat" : data[1] == FRAME_BACKLOG ? "backlog" : "reading";
+  }
+  if (len >= 1 && data[0] == REPORT_CONTROL_MAGIC)
+  {
+    return "report-control";
+  }
+
+  // Commands are NUL-terminated text
+  if (len >= 2 && data[len - 1] == '\0')
+  {
+    bool text = true;
+    for (int i = 0; i < len - 1 && text; i++)
+    {
+      text = isprint(data[i]);
+    }
+    if (text)
+    {
+      return std::string("\"") + (const char *)data + "\"";
+    }
+  }
+  return "other";
+}
+
+static void printLatencies(const char *label, std::vector<uint64_t> values)
+{
+  if (values.empty())
+  {
+    printf("  %-22s    0\n", label);
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  printf("  %-22s %4zu  min %8.1f  p50 %8.1f  p99 %8.1f  max %8.1f ms\n", label, n, millisOf(values[0]),
+         millisOf(values[(n - 1) / 2]), millisOf(values[(n - 1) * 99 / 100]), millisOf(values[n - 1]));
+}
+
+// Motion input, driven by the scenario
+static void setMotion(SimWorld &world, SimNode *motion, uint64_t atUs, int level, run_state *state)
+{
+  world.at(atUs, [&world, motion, level, state]
+           {
+    if (level == HIGH && motion->pinIn[MOTION_INPUT_PIN] != HIGH)
+    {
+      SimNode *light = world.findNode("light");
+      state->motionEdges.push_back(world.nowUs());
+      if (state->pendingEdgeUs != 0)
+      {
+        state->missedEdges.push_back(state->pendingEdgeUs);
+        state->pendingEdgeUs = 0;
+      }
+      if (light != nullptr && light->ledc(LIGHT_LED_CHANNEL) > 0)
+      {
+        state->alreadyOn++;
+      }
+      else
+      {
+        uint64_t edgeUs = world.nowUs();
+        state->pendingEdgeUs = edgeUs;
+        world.at(edgeUs + SIM_LIGHT_WINDOW_US, [state, edgeUs]
+                 {
+          if (state->pendingEdgeUs == edgeUs)
+          {
+            state->missedEdges.push_back(edgeUs);
+            state->pendingEdgeUs = 0;
+          } });
+      }
+    }
+    motion->setDigital(MOTION_INPUT_PIN, level); });
+}
+
+static void holdButton(SimWorld &world, SimNode *motion, uint64_t fromUs, uint64_t toUs)
+{
+  world.at(fromUs, [motion] { motion->setDigital(MOTION_BUTTON_PIN, LOW); });
+  world.at(toUs, [motion] { motion->setDigital(MOTION_BUTTON_PIN, -1); });
+}
+
+static void scheduleMotionLight(SimWorld &world, const run_options &options, run_state *state)
+{
+  SimNode *motion = world.findNode("motion");
+  if (motion == nullptr)
+  {
+    return;
+  }
+
+  // The light's gate accepts a "turn on" at most every 10 s, also after a "disable"
+  uint64_t t = SIM_EVENT_US;
+  setMotion(world, motion, t, HIGH, state);
+  setMotion(world, motion, t + 1000000, LOW, state);
+  holdButton(world, motion, t + 1600000, t + 6700000);
+  setMotion(world, motion, t + 8000000, HIGH, state);
+  setMotion(world, motion, t + 9000000, LOW, state);
+
+  // Then pulses of 1-5 s with gaps of 5-35 s, and now and then a button hold once motion is gone
+  t += 15000000;
+  while (true)
+  {
+    uint64_t gapUs = 5000000 + world.random() % 30000000;
+    uint64_t pulseUs = 1000000 + world.random() % 4000000;
+    bool disable = world.uniform() < 0.3;
+    t += gapUs;
+    if (t + pulseUs + 7000000 > options.durationUs)
+    {
+      break;
+    }
+    setMotion(world, motion, t, HIGH, state);
+    setMotion(world, motion, t + pulseUs, LOW, state);
+    if (disable)
+    {
+      holdButton(world, motion, t + pulseUs + 600000, t + pulseUs + 6100000);
+      t += 6100000;
+    }
+    t += pulseUs;
+  }
+}
+
+static void pollSmokeStatus(SimWorld &world, SimNode *server, uint64_t atUs, run_state *state)
+{
+  world.at(atUs, [&world, server, state]
+           {
+    world.httpGet(server, "/status/smoke", [&world, server, state](const sim_http_response &response)
+                  {
+      state->smokeLastCode = response.code;
+      if (response.body.find("SMOKE DETECTED") != std::string::npos)
+      {
+        state->smokeShownUs = world.nowUs();
+        return;
+      }
+      pollSmokeStatus(world, server, world.nowUs() + SIM_POLL_US, state); }); });
+}
+
+static void scheduleSmoke(SimWorld &world, run_state *state)
+{
+  SimNode *smoke = world.findNode("smoke");
+  SimNode *server = world.findNode("server");
+  if (smoke == nullptr)
+  {
+    return;
+  }
+  world.at(SIM_EVENT_US, [smoke] { smoke->setAnalog(SENSOR_ADC_PIN, 2000); });
+  if (server != nullptr)
+  {
+    pollSmokeStatus(world, server, SIM_EVENT_US, state);
+  }
+}
+
+static void pollDashboard(SimWorld &world, SimNode *server, uint64_t atUs, run_state *state)
+{
+  world.at(atUs, [&world, server, atUs, state]
+           {
+    world.httpGet(server, "/status/sensors", [state](const sim_http_response &response)
+                  {
+      if (response.code == 200)
+      {
+        state->dashboardPolls++;
+      } });
+    pollDashboard(world, server, atUs + SIM_DASHBOARD_US, state); });
+}
+
+// The dashboard, and the latency breakdown it leads to at the end
+static void scheduleDashboard(SimWorld &world, uint64_t durationUs, run_state *state)
+{
+  SimNode *server = world.findNode("server");
+  if (server == nullptr || durationUs <= SIM_TRACE_LEAD_US)
+  {
+    return;
+  }
+  pollDashboard(world, server, SIM_SENSOR_BOOT_US, state);
+  world.at(durationUs - SIM_TRACE_LEAD_US, [&world, server, state]
+           { world.httpGet(server, "/trace", [state](const sim_http_response &response)
+                           {
+      if (response.code == 200)
+      {
+        state->traceReport = response.body;
+      } }); });
+}
+
+static void hookWorld(SimWorld &world, const run_options &options, run_state *state)
+{
+  world.onSerial = [&world, &options, state](SimNode *node, const char *line)
+  {
+    node_times &times = state->times[node];
+    if (times.joinedUs == 0 && strncmp(line, "Joined master", 13) == 0)
+    {
+      times.joinedUs = world.nowUs();
+    }
+    if (times.syncedUs == 0 && strncmp(line, "Clock sync:", 11) == 0)
+    {
+      times.syncedUs = world.nowUs();
+    }
+    if (strcmp(node->name(), "light") == 0 && strncmp(line, "Turn on command received", 24) == 0)
+    {
+      state->turnOnAccepted++;
+    }
+    if (options.trace)
+    {
+      printf("[%12.6f] %-6s %s\n", seconds(world.nowUs()), node->name(), line);
+    }
+  };
+
+  world.onTransmit = [&world, &options, state](const sim_frame &frame, SimNode *to, sim_fate fate)
+  {
+    std::string kind = frameKind(frame.data, frame.len);
+    std::string key = std::string(frame.from->name()) + " " + (frame.broadcast ? "*" : to != nullptr ? to->name() : "?") +
+                      " " + kind;
+    link_counts &counts = state->links[key];
+    if (frame.id != state->lastFrameId)
+    {
+      counts.sent++;
+      state->lastFrameId = frame.id;
+    }
+    if (fate == SIM_DELIVERED)
+    {
+      counts.delivered++;
+    }
+    else if (fate == SIM_LOST)
+    {
+      counts.lost++;
+    }
+    else
+    {
+      counts.unreachable++;
+    }
+
+    if (state->smokeCommandUs == 0 && strcmp(frame.from->name(), "server") == 0 && kind == "\"disable1\"")
+    {
+      state->smokeCommandUs = world.nowUs();
+    }
+    if (options.radioTrace)
+    {
+      static const char *fates[] = {"delivered", "lost", "unreachable"};
+      printf("[%12.6f] radio  %-6s -> %-6s %-16s %3u bytes  %s\n", seconds(world.nowUs()), frame.from->name(),
+             to != nullptr ? to->name() : "?", kind.c_str(), frame.len, fates[fate]);
+    }
+  };
+
+  world.onReceive = [state](const sim_frame &frame, SimNode *to)
+  {
+    if (strcmp(to->name(), "light") == 0 && frameKind(frame.data, frame.len) == "\"turn on\"")
+    {
+      state->turnOnDelivered++;
+    }
+  };
+
+  world.onOutput = [&world, state](SimNode *node, sim_output kind, uint8_t index, uint32_t value)
+  {
+    if (kind == SIM_OUTPUT_LEDC && index == LIGHT_LED_CHANNEL && value > 0 && state->pendingEdgeUs != 0 &&
+        strcmp(node->name(), "light") == 0)
+    {
+      state->lightOnLatencies.push_back(world.nowUs() - state->pendingEdgeUs);
+      state->pendingEdgeUs = 0;
+    }
+  };
+
+  world.onHalt = [&world, &options, state](SimNode *node, const char *reason)
+  {
+    node_times &times = state->times[node];
+    times.haltedUs = world.nowUs();
+    times.haltReason = reason;
+    if (options.trace)
+    {
+      printf("[%12.6f] %-6s halted: %s\n", seconds(world.nowUs()), node->name(), reason);
+    }
+  };
+}
+
+static void printTime(uint64_t us)
+{
+  if (us == 0)
+  {
+    printf("  %10s", "-");
+  }
+  else
+  {
+    printf("  %10.3f", seconds(us));
+  }
+}
+
+static void report(SimWorld &world, const run_options &options, run_state &state)
+{
+  printf("\nNodes              boot(s)   joined(s)   synced(s)   sent  received  errors  air(ms)  state\n");
+  for (SimNode *node : world.nodes())
+  {
+    node_times &times = state.times[node];
+    printf("  %-10s", node->name());
+    printf("  %10.3f", seconds(node->bootUs()));
+    printTime(times.joinedUs);
+    printTime(times.syncedUs);
+    printf("  %5llu  %8llu  %6llu  %7.1f  ", (unsigned long long)node->framesSent,
+           (unsigned long long)node->framesReceived, (unsigned long long)node->sendErrors, node->airtimeUs / 1000.0);
+    if (node->halted())
+    {
+      printf("%s at %.3f s\n", times.haltReason.c_str(), seconds(times.haltedUs));
+    }
+    else
+    {
+      printf("running\n");
+    }
+  }
+
+  if (options.scenario == "motion-light")
+  {
+    printf("\nMotion to light\n");
+    printf("  %-22s %4zu\n", "motion pulses", state.motionEdges.size());
+    printLatencies("light came on", state.lightOnLatencies);
+    printf("  %-22s %4llu\n", "light already on", (unsigned long long)state.alreadyOn);
+    printf("  %-22s %4zu", "light stayed off", state.missedEdges.size());
+    for (size_t i = 0; i < state.missedEdges.size() && i < 8; i++)
+    {
+      printf("%s%.3f s", i == 0 ? "  at " : ", ", seconds(state.missedEdges[i]));
+    }
+    printf("%s\n", state.missedEdges.size() > 8 ? ", ..." : "");
+    printf("  %-22s %4llu delivered, %llu accepted, %llu ignored\n", "\"turn on\" at light",
+           (unsigned long long)state.turnOnDelivered, (unsigned long long)state.turnOnAccepted,
+           (unsigned long long)(state.turnOnDelivered - state.turnOnAccepted));
+  }
+  else if (options.scenario == "smoke")
+  {
+    printf("\nSmoke at %.3f s\n", seconds(SIM_EVENT_US));
+    if (state.smokeCommandUs != 0)
+    {
+      printf("  %-26s %8.1f ms\n", "Server sent \"disable1\"", millisOf(state.smokeCommandUs - SIM_EVENT_US));
+    }
+    else
+    {
+      printf("  %-26s %8s\n", "Server sent \"disable1\"", "never");
+    }
+    for (SimNode *node : world.nodes())
+    {
+      node_times &times = state.times[node];
+      if (times.haltedUs >= SIM_EVENT_US)
+      {
+        std::string label = std::string(node->name()) + " " + times.haltReason;
+        printf("  %-26s %8.1f ms\n", label.c_str(), millisOf(times.haltedUs - SIM_EVENT_US));
+      }
+    }
+    if (state.smokeShownUs != 0)
+    {
+      printf("  %-26s %8.1f ms\n", "/status/smoke shows it", millisOf(state.smokeShownUs - SIM_EVENT_US));
+    }
+    else
+    {
+      printf("  %-26s %8s (last HTTP %d)\n", "/status/smoke shows it", "never", state.smokeLastCode);
+    }
+  }
+
+  if (!state.traceReport.empty())
+  {
+    // The Server's own table, indented
+    printf("\nReading latency, %llu dashboard polls\n", (unsigned long long)state.dashboardPolls);
+    size_t start = 0;
+    while (start < state.traceReport.size())
+    {
+      size_t end = state.traceReport.find('\n', start);
+      end = end == std::string::npos ? state.traceReport.size() : end;
+      std::string line = state.traceReport.substr(start, end - start);
+      printf(line.empty() ? "\n" : "  %s\n", line.c_str());
+      start = end + 1;
+    }
+  }
+
+  printf("\nFrames  from    to      kind                 sent  delivered   lost  unreachable\n");
+  for (const auto &link : state.links)
+  {
+    char from[16], to[16], kind[64];
+    if (sscanf(link.first.c_str(), "%15s %15s %63[^\n]", from, to, kind) != 3)
+    {
+      continue;
+    }
+    const link_counts &c = link.second;
+    printf("        %-7s %-7s %-18s %6llu  %9llu  %5llu  %11llu\n", from, to, kind, (unsigned long long)c.sent,
+           (unsigned long long)c.delivered, (unsigned long long)c.lost, (unsigned long long)c.unreachable);
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: sim [--scenario boot|motion-light|smoke] [--seed n] [--duration s] [--loss p]\n"
+                  "           [--latency us] [--jitter us] [--retries n] [--drift ppm] [--channel n]\n"
+                  "           [--loop-us us] [--nodes name,...] [--trace] [--radio-trace] [--serve port]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  run_options options;
+  options.sim.seed = 1;
+  options.sim.loss = 0.02;
+  options.sim.latencyUs = 500;
+  options.sim.jitterUs = 500;
+  options.sim.retries = 7;
+  options.sim.loopTickUs = 1000;
+  options.sim.driftPpm = 20;
+  options.sim.routerChannel = 6;
+  options.sim.routerSsid = "Man2";
+  options.scenario = "motion-light";
+  options.durationUs = 180000000;
+  options.durationSet = false;
+  options.servePort = 0;
+  options.trace = false;
+  options.radioTrace = false;
+  for (const node_spec &spec : nodeSpecs)
+  {
+    options.nodes.push_back(spec.name);
+  }
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--trace") == 0)
+    {
+      options.trace = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--radio-trace") == 0)
+    {
+      options.radioTrace = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--scenario") == 0)
+    {
+      options.scenario = value;
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      options.sim.seed = strtoull(value, nullptr, 0);
+    }
+    else if (strcmp(argv[i - 1], "--duration") == 0)
+    {
+      options.durationUs = (uint64_t)(atof(value) * 1e6);
+      options.durationSet = true;
+    }
+    else if (strcmp(argv[i - 1], "--loss") == 0)
+    {
+      options.sim.loss = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--latency") == 0)
+    {
+      options.sim.latencyUs = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--jitter") == 0)
+    {
+      options.sim.jitterUs = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--retries") == 0)
+    {
+      options.sim.retries = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--drift") == 0)
+    {
+      options.sim.driftPpm = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--channel") == 0)
+    {
+      options.sim.routerChannel = (uint8_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--loop-us") == 0)
+    {
+      options.sim.loopTickUs = (uint32_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--serve") == 0)
+    {
+      options.servePort = (uint16_t)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--nodes") == 0)
+    {
+      options.nodes.clear();
+      std::string list(value);
+      for (size_t start = 0; start <= list.size();)
+      {
+        size_t comma = list.find(',', start);
+        options.nodes.push_back(list.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        start = comma == std::string::npos ? list.size() + 1 : comma + 1;
+      }
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if ((options.scenario != "boot" && options.scenario != "motion-light" && options.scenario != "smoke") ||
+      options.sim.loss < 0 || options.sim.loss > 1 || options.sim.routerChannel < 1 || options.sim.routerChannel > 13 ||
+      options.durationUs == 0)
+  {
+    usage();
+  }
+
+  // Served runs go on until killed; scenario inputs still stop at the default duration
+  std::string duration = options.servePort != 0 && !options.durationSet
+                             ? std::string("-")
+                             : std::to_string((unsigned long long)seconds(options.durationUs)) + " s";
+  printf("scenario %s  seed %llu  duration %s  loss %.3f  latency %u+%u us  retries %u  drift %u ppm  "
+         "channel %u  loop %u us\n",
+         options.scenario.c_str(), (unsigned long long)options.sim.seed, duration.c_str(), options.sim.loss,
+         options.sim.latencyUs, options.sim.jitterUs, options.sim.retries, options.sim.driftPpm,
+         options.sim.routerChannel, options.sim.loopTickUs);
+
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+  run_state state;
+  state.lastFrameId = 0;
+  state.alreadyOn = 0;
+  state.pendingEdgeUs = 0;
+  state.turnOnDelivered = 0;
+  state.turnOnAccepted = 0;
+  state.smokeCommandUs = 0;
+  state.smokeShownUs = 0;
+  state.smokeLastCode = 0;
+  state.dashboardPolls = 0;
+  {
+    SimWorld world(options.sim);
+    hookWorld(world, options, &state);
+
+    // Servers first, then the sensors in a seeded order of boot times
+    for (const node_spec &spec : nodeSpecs)
+    {
+      if (std::find(options.nodes.begin(), options.nodes.end(), spec.name) == options.nodes.end())
+      {
+        continue;
+      }
+      uint64_t bootUs = spec.sensor ? SIM_SENSOR_BOOT_US + world.random() % SIM_SENSOR_STAGGER_US
+                                    : (spec.loop == master_fw::loop ? 500000 : 0);
+      SimNode *node = world.addNode(spec.name, spec.mac, spec.setup, spec.loop, bootUs);
+      state.times[node] = node_times();
+      node->setAnalog(SENSOR_ADC_PIN, strcmp(spec.name, "light") == 0   ? 500
+                                      : strcmp(spec.name, "smoke") == 0 ? 300
+                                                                        : 1000);
+    }
+    for (const std::string &name : options.nodes)
+    {
+      if (world.findNode(name.c_str()) == nullptr)
+      {
+        fprintf(stderr, "sim: no node named %s\n", name.c_str());
+        usage();
+      }
+    }
+
+    if (options.scenario == "motion-light")
+    {
+      scheduleMotionLight(world, options, &state);
+    }
+    else if (options.scenario == "smoke")
+    {
+      scheduleSmoke(world, &state);
+    }
+
+    if (options.servePort == 0)
+    {
+      scheduleDashboard(world, options.durationUs, &state);
+      world.run(options.durationUs);
+      report(world, options, state);
+    }
+    else
+    {
+      SimNode *server = world.findNode("server");
+      if (server == nullptr)
+      {
+        fprintf(stderr, "sim: --serve needs the server node\n");
+        return 1;
+      }
+      SimHttpServer http(world, server);
+      if (!http.start(options.servePort))
+      {
+        fprintf(stderr, "sim: cannot listen on port %u\n", options.servePort);
+        return 1;
+      }
+      fprintf(stderr, "serving the Server's routes on http://127.0.0.1:%u/\n", options.servePort);
+      world.runRealtime(options.durationSet ? options.durationUs : UINT64_MAX);
+      http.stop();
+      report(world, options, state);
+    }
+  }
+
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  fprintf(stderr, "simulated %.0f s in %.2f s (%.0fx real time)\n", seconds(options.durationUs), wallSeconds,
+          seconds(options.durationUs) / wallSeconds);
+  return 0;
+}
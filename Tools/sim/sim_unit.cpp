@@ -0,0 +1,9 @@
+// One firmware source compiled for the simulator. build.sh compiles this
+// once per source with -DSIM_NODE=<namespace> -DSIM_SOURCE='"<path>"'.
+
+#include "SimPrelude.h"
+
+namespace SIM_NODE
+{
+#include SIM_SOURCE
+}
@@ -0,0 +1,433 @@
+// Host check of the Server's sliding-window statistics and quantile
+// sketches (see Server/lib/Stats/Stats.h): accuracy against exact values
+// computed from every reading, and the cost of adding one.
+//
+//   stats_accuracy [--hours 2] [--seed 1] [--every 10]
+//
+// It makes --hours of one light, sound and smoke sensor reporting as the
+// firmware does: light at 10 Hz on a day curve with ADC noise, sound at
+// 2 Hz with background noise and loud bursts, smoke at 2 Hz with a few
+// percent of noise and, for a quarter of an hour in the middle, smoke
+// building up and clearing. Send times jitter by a few milliseconds.
+//
+// Every --every seconds it asks each window and the sketch for their
+// values and compares them with:
+//   - the readings the window's buckets cover: count, min and max must be
+//     exact, mean and stddev within float rounding
+//   - the readings of the last full window length, which the bucketed
+//     window only approximates; the error is printed, not checked
+//   - exact nearest-rank p50/p95/p99 of the readings the sketch covers,
+//     which must be within the sketch's bin width
+// Then it prints the time per add() and per query.
+//
+// Last it fills the slot and sketch pools with light and sound instances
+// that report first, as the 10 Hz sensors do after a boot, then adds as
+// many smoke instances as there are sketches. Every smoke instance must
+// get statistics and quantiles, and the instances left without them must
+// be counted.
+//
+// Build from this directory:
+//   g++ -std=c++17 -O2 -I../../Shared/Pairing -I../../Server/lib/Stats
+//     stats_accuracy.cpp ../../Shared/Pairing/Pairing.cpp
+//     ../../Server/lib/Stats/Stats.cpp -o stats_accuracy
+
+#include <Pairing.h>
+#include <Stats.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DAY_MS (24UL * 3600 * 1000)
+#define QUANTILE_TOLERANCE 0.06 // Half a bin is about 5%; the rest is rounding to integers
+
+typedef struct trace
+{
+  const char *name;
+  uint8_t sensorType;
+  std::vector<uint32_t> ms;
+  std::vector<int32_t> value;
+} trace;
+
+typedef struct exact_summary
+{
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  double mean;
+  double stddev;
+} exact_summary;
+
+typedef struct error_totals
+{
+  uint32_t checks;
+  uint32_t failures;
+  double trailingMean;    // Sum of |mean - mean over the trailing window| / stddev
+  double quantileWorst;   // Largest relative quantile error
+} error_totals;
+
+static double uniform(unsigned *seed)
+{
+  return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static int jitter(unsigned *seed)
+{
+  return (int)(rand_r(seed) % 7) - 3;
+}
+
+static void synthetic(std::vector<trace> &traces, double hours, unsigned seed)
+{
+  uint32_t endMs = (uint32_t)(hours * 3600 * 1000);
+
+  trace light = {"light", SENSOR_LIGHT, {}, {}};
+  for (uint32_t t = 0; t < endMs; t += 100)
+  {
+    double day = sin(2 * M_PI * t / DAY_MS);
+    light.ms.push_back(t + 3 + jitter(&seed));
+    light.value.push_back(2048 + (int32_t)(1500 * day) + (int32_t)(uniform(&seed) * 17) - 8);
+  }
+
+  trace sound = {"sound", SENSOR_SOUND, {}, {}};
+  int burst = 0;
+  for (uint32_t t = 0; t < endMs; t += 500)
+  {
+    if (burst == 0 && uniform(&seed) < 0.01)
+    {
+      burst = 2 + rand_r(&seed) % 8;
+    }
+    int32_t level = 250 + (int32_t)(uniform(&seed) * 61) - 30;
+    if (burst > 0)
+    {
+      level = 1500 + rand_r(&seed) % 1500;
+      burst--;
+    }
+    sound.ms.push_back(t + 3 + jitter(&seed));
+    sound.value.push_back(level);
+  }
+
+  trace smoke = {"smoke", SENSOR_SMOKE, {}, {}};
+  uint32_t fireMs = endMs / 2, fireEndMs = fireMs + 15 * 60 * 1000;
+  double percent = 3;
+  for (uint32_t t = 0; t < endMs; t += 500)
+  {
+    double target = t >= fireMs && t < fireEndMs ? 65 : 3;
+    percent += (target - percent) * 0.002 + (uniform(&seed) - 0.5) * 0.6;
+    percent = percent < 0 ? 0 : percent > 100 ? 100 : percent;
+    smoke.ms.push_back(t + 3 + jitter(&seed));
+    smoke.value.push_back((int32_t)lround(percent));
+  }
+
+  traces.push_back(light);
+  traces.push_back(sound);
+  traces.push_back(smoke);
+}
+
+// Readings of t timed in [fromMs, toMs]
+static exact_summary exactSummary(const trace &t, uint32_t fromMs, uint32_t toMs)
+{
+  exact_summary out = {0, 0, 0, 0, 0};
+  double sum = 0, sumSquares = 0;
+  for (size_t i = 0; i < t.ms.size() && t.ms[i] <= toMs; i++)
+  {
+    if (t.ms[i] < fromMs)
+    {
+      continue;
+    }
+    int32_t v = t.value[i];
+    out.min = out.count == 0 || v < out.min ? v : out.min;
+    out.max = out.count == 0 || v > out.max ? v : out.max;
+    out.count++;
+    sum += v;
+    sumSquares += (double)v * v;
+  }
+  if (out.count > 0)
+  {
+    out.mean = sum / out.count;
+    double variance = sumSquares / out.count - out.mean * out.mean;
+    out.stddev = variance > 0 ? sqrt(variance) : 0;
+  }
+  return out;
+}
+
+// Nearest-rank quantile in permille of the readings of t timed in [fromMs, toMs]
+static int32_t exactQuantile(const trace &t, uint32_t fromMs, uint32_t toMs, uint32_t permille)
+{
+  std::vector<int32_t> values;
+  for (size_t i = 0; i < t.ms.size() && t.ms[i] <= toMs; i++)
+  {
+    if (t.ms[i] >= fromMs)
+    {
+      values.push_back(t.value[i]);
+    }
+  }
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t rank = ((uint64_t)values.size() * permille + 999) / 1000;
+  return values[rank == 0 ? 0 : rank - 1];
+}
+
+static bool close(double a, double b)
+{
+  return fabs(a - b) <= 1e-3 * (fabs(b) > 1 ? fabs(b) : 1);
+}
+
+// Compare every window and the sketch of series id with the readings of t up to nowMs
+static void check(const WindowStats &stats, uint16_t id, const trace &t, uint32_t nowMs, error_totals *totals)
+{
+  for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+  {
+    stats_summary summary;
+    if (!stats.summary(id, w, nowMs, &summary))
+    {
+      totals[w].failures++;
+      continue;
+    }
+    uint32_t bucketMs = statsWindowMs(w) / STATS_BUCKETS;
+    uint32_t period = nowMs / bucketMs;
+    uint32_t fromMs = period >= STATS_BUCKETS - 1 ? (period - (STATS_BUCKETS - 1)) * bucketMs : 0;
+    exact_summary covered = exactSummary(t, fromMs, nowMs);
+    totals[w].checks++;
+    if (summary.count != covered.count || (covered.count > 0 && (summary.min != covered.min || summary.max != covered.max ||
+                                                                 !close(summary.mean, covered.mean) ||
+                                                                 !close(summary.stddev, covered.stddev))))
+    {
+      totals[w].failures++;
+      fprintf(stderr, "%s window %lu ms at %lu: count %lu/%lu min %ld/%ld max %ld/%ld mean %.3f/%.3f stddev %.3f/%.3f\n",
+              t.name, (unsigned long)summary.windowMs, (unsigned long)nowMs, (unsigned long)summary.count,
+              (unsigned long)covered.count, (long)summary.min, (long)covered.min, (long)summary.max, (long)covered.max,
+              summary.mean, covered.mean, summary.stddev, covered.stddev);
+    }
+
+    uint32_t trailingFromMs = nowMs >= statsWindowMs(w) ? nowMs - statsWindowMs(w) + 1 : 0;
+    exact_summary trailing = exactSummary(t, trailingFromMs, nowMs);
+    totals[w].trailingMean += fabs(summary.mean - trailing.mean) / (trailing.stddev > 1 ? trailing.stddev : 1);
+  }
+
+  stats_quantiles quantiles;
+  if (!stats.quantiles(id, nowMs, &quantiles))
+  {
+    return;
+  }
+  uint32_t period = nowMs / STATS_SKETCH_MS;
+  uint32_t fromMs = period > 0 ? (period - 1) * STATS_SKETCH_MS : 0;
+  static const uint32_t permille[3] = {500, 950, 990};
+  int32_t estimates[3] = {quantiles.p50, quantiles.p95, quantiles.p99};
+  error_totals &q = totals[STATS_WINDOWS];
+  for (size_t i = 0; i < 3; i++)
+  {
+    int32_t exact = exactQuantile(t, fromMs, nowMs, permille[i]);
+    double error = fabs((double)estimates[i] - exact) / (exact > 1 ? exact : 1);
+    q.checks++;
+    q.quantileWorst = error > q.quantileWorst ? error : q.quantileWorst;
+    if (error > QUANTILE_TOLERANCE && abs(estimates[i] - exact) > 1)
+    {
+      q.failures++;
+      fprintf(stderr, "%s p%.1f at %lu: %ld, exact %ld\n", t.name, permille[i] / 10.0, (unsigned long)nowMs,
+              (long)estimates[i], (long)exact);
+    }
+  }
+}
+
+static bool accuracy(const std::vector<trace> &traces, uint32_t everyMs)
+{
+  static WindowStats stats;
+  bool ok = true;
+  for (uint16_t id = 0; id < traces.size(); id++)
+  {
+    const trace &t = traces[id];
+    error_totals totals[STATS_WINDOWS + 1];
+    memset(totals, 0, sizeof(totals));
+    uint32_t nextCheckMs = everyMs;
+    for (size_t i = 0; i < t.ms.size(); i++)
+    {
+      // Check as of just before the first reading past each checkpoint
+      if (t.ms[i] >= nextCheckMs && i > 0)
+      {
+        check(stats, id, t, t.ms[i - 1], totals);
+        nextCheckMs += everyMs;
+      }
+      stats.add(id, t.sensorType, t.ms[i], t.value[i]);
+    }
+
+    for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+    {
+      printf("%-6s %7lu ms window: %5lu checks, %lu wrong, mean off the trailing window by %.3f stddev on average\n",
+             t.name, (unsigned long)statsWindowMs(w), (unsigned long)totals[w].checks, (unsigned long)totals[w].failures,
+             totals[w].checks > 0 ? totals[w].trailingMean / totals[w].checks : 0);
+      ok = ok && totals[w].failures == 0;
+    }
+    const error_totals &q = totals[STATS_WINDOWS];
+    if (q.checks > 0)
+    {
+      printf("%-6s quantiles:        %5lu checks, %lu out of tolerance, worst error %.1f%%\n", t.name,
+             (unsigned long)q.checks, (unsigned long)q.failures, q.quantileWorst * 100);
+      ok = ok && q.failures == 0;
+    }
+  }
+  return ok;
+}
+
+static void cost(const std::vector<trace> &traces)
+{
+  static WindowStats stats;
+  for (uint16_t id = 0; id < traces.size(); id++)
+  {
+    const trace &t = traces[id];
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < t.ms.size(); i++)
+    {
+      stats.add(id, t.sensorType, t.ms[i], t.value[i]);
+    }
+    double addNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                   t.ms.size();
+
+    uint32_t nowMs = t.ms.back();
+    const int queries = 20000;
+    volatile int64_t sink = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++)
+    {
+      stats_summary summary;
+      stats.summary(id, (uint8_t)(i % STATS_WINDOWS), nowMs, &summary);
+      sink = sink + summary.count;
+    }
+    double summaryNs =
+        std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++)
+    {
+      stats_quantiles quantiles;
+      stats.quantiles(id, nowMs, &quantiles);
+      sink = sink + quantiles.p99;
+    }
+    double quantileNs =
+        std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries;
+    printf("%-6s %8zu readings: add %.1f ns, summary %.1f ns, quantiles %.1f ns\n", t.name, t.ms.size(), addNs,
+           summaryNs, quantileNs);
+  }
+  printf("%d series of %zu bytes and %d sketches of %zu bytes (%zu KB)\n", STATS_MAX_SERIES, sizeof(stats_series),
+         STATS_MAX_SKETCHES, sizeof(stats_sketch), sizeof(WindowStats) / 1024);
+}
+
+// Smoke instances that join a fleet whose light and sound sensors took every slot
+static bool pools()
+{
+  static WindowStats stats;
+  const uint16_t others = STATS_MAX_SERIES + STATS_MAX_SKETCHES;
+  const uint16_t smokes = STATS_MAX_SKETCHES;
+  uint32_t nowMs = 1000;
+  for (uint16_t id = 0; id < others; id++)
+  {
+    stats.add(id, id % 2 ? SENSOR_SOUND : SENSOR_LIGHT, nowMs++, 100);
+  }
+  for (uint16_t id = others; id < others + smokes; id++)
+  {
+    stats.add(id, SENSOR_SMOKE, nowMs++, 5);
+  }
+  // Everyone reports again, the evicted instances included
+  for (uint16_t id = 0; id < others + smokes; id++)
+  {
+    stats.add(id, id < others ? (id % 2 ? SENSOR_SOUND : SENSOR_LIGHT) : SENSOR_SMOKE, nowMs++, 5);
+  }
+
+  bool ok = true;
+  for (uint16_t id = others; id < others + smokes; id++)
+  {
+    stats_summary summary;
+    stats_quantiles quantiles;
+    if (!stats.summary(id, 0, nowMs, &summary) || summary.count != 2 || !stats.quantiles(id, nowMs, &quantiles) ||
+        stats.missing(id) != 0)
+    {
+      fprintf(stderr, "smoke instance %u has no statistics or quantiles\n", (unsigned)id);
+      ok = false;
+    }
+  }
+  uint16_t withoutSeries = 0, withoutSketch = 0;
+  for (uint16_t id = 0; id < others; id++)
+  {
+    stats_summary summary;
+    stats_quantiles quantiles;
+    bool hasSeries = stats.summary(id, 0, nowMs, &summary);
+    bool lacksSketch = hasSeries && id % 2 && !stats.quantiles(id, nowMs, &quantiles);
+    withoutSeries += !hasSeries;
+    withoutSketch += lacksSketch;
+    uint8_t expected = (hasSeries ? 0 : STATS_MISSING_SERIES) | (lacksSketch ? STATS_MISSING_SKETCH : 0);
+    if (stats.missing(id) != expected)
+    {
+      fprintf(stderr, "instance %u: missing() does not match its slot and sketch\n", (unsigned)id);
+      ok = false;
+    }
+  }
+  printf("pools: %u smoke instances joined %u others; %u left without statistics, %u without quantiles\n",
+         (unsigned)smokes, (unsigned)others, (unsigned)stats.withoutSeries(), (unsigned)stats.withoutSketch());
+  if (withoutSeries != stats.withoutSeries() || withoutSketch != stats.withoutSketch())
+  {
+    fprintf(stderr, "counted %u without statistics and %u without quantiles, expected %u and %u\n",
+            (unsigned)stats.withoutSeries(), (unsigned)stats.withoutSketch(), (unsigned)withoutSeries,
+            (unsigned)withoutSketch);
+    ok = false;
+  }
+  return ok;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: stats_accuracy [--hours 2] [--seed 1] [--every 10]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  double hours = 2;
+  unsigned seed = 1;
+  uint32_t everySeconds = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--hours") == 0)
+    {
+      hours = atof(value);
+    }
+    else if (strcmp(argv[i - 1], "--seed") == 0)
+    {
+      seed = (unsigned)atoi(value);
+    }
+    else if (strcmp(argv[i - 1], "--every") == 0)
+    {
+      everySeconds = (uint32_t)atoi(value);
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (hours <= 0 || hours > 24 * 40 || everySeconds == 0)
+  {
+    usage();
+  }
+
+  std::vector<trace> traces;
+  synthetic(traces, hours, seed);
+  bool ok = accuracy(traces, everySeconds * 1000);
+  cost(traces);
+  ok = pools() && ok;
+  if (!ok)
+  {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}